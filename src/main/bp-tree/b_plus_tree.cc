@@ -3,6 +3,10 @@
 #include <algorithm>
 #include <fstream>
 #include <functional>
+#include <numeric>
+#include <utility>
+
+#include "record_parser.h"
 
 namespace s21 {
 
@@ -25,16 +29,33 @@ void Append(std::vector<Type>& left, std::vector<Type>& right) {
   left.insert(left.end(), right.begin(), right.end());
 }
 
+// Positions of the keys in ascending order, equal keys keep their order.
+template <class GetKey>
+std::vector<size_t> SortedOrder(size_t size, GetKey const& get_key) {
+  std::vector<size_t> order(size);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right) {
+    return get_key(left) < get_key(right);
+  });
+  return order;
+}
+
 }  // namespace Utils
 
 //============================ Leaf =============================
-bool BPlusTree::Leaf::Insert(K const& key, const V& value) {
-  if (IsKeyExist(key)) return false;
+// Returns the position of the new key or nothing if it already exists.
+std::optional<size_t> BPlusTree::Leaf::Insert(K&& key, V&& value) {
+  if (IsKeyExist(key)) return std::nullopt;
+  return Insert(std::move(key), std::make_shared<V>(std::move(value)));
+}
+
+std::optional<size_t> BPlusTree::Leaf::Insert(K&& key, DataPtr value) {
+  if (IsKeyExist(key)) return std::nullopt;
   auto distance =
       Utils::GetDistanceTo(keys, [&](auto const& i) { return key < i; });
-  keys.emplace(keys.begin() + distance, key);
-  data.emplace(data.begin() + distance, std::make_shared<V>(value));
-  return true;
+  keys.emplace(keys.begin() + distance, std::move(key));
+  data.emplace(data.begin() + distance, std::move(value));
+  return distance;
 }
 
 BPlusTree::NodePtr BPlusTree::Leaf::Split() {
@@ -103,7 +124,7 @@ void BPlusTree::Leaf::Share(NodePtr node_from, NodePtr left_node) {
   LeafPtr l_left = (from == left) ? from : shared_from_this();
   LeafPtr l_right = (from == left) ? shared_from_this() : from;
 
-  Insert(key, from->GetValue(key));
+  Insert(K(key), std::move(from->GetValue(key)));
   from->Delete(key);
   auto distance = Utils::GetDistanceTo(
       w_parent->children, [&](auto const& i) { return i == l_left; });
@@ -187,50 +208,57 @@ void BPlusTree::Internal::Share(NodePtr node_from, NodePtr node_left) {
 
 // ============================= BPlusTree ===============================
 bool BPlusTree::Set(K const& key, const V& value, int lifetime) {
+  return Set(K(key), V(value), lifetime);
+}
+
+bool BPlusTree::Set(K&& key, V&& value, int lifetime) {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
   auto leaf = GetLeaf(root_, key);
-  if (!leaf->Insert(key, value)) return false;
+  auto position = leaf->Insert(std::move(key), std::move(value));
+  if (!position) return false;
+
+  K const& stored = leaf->keys[*position];
+  observers_.OnInsert(stored, *leaf->data[*position]);
+
+  if (lifetime > -1) ScheduleExpiration(stored, lifetime);
 
   if (leaf->Size() > bucket_size_) {
     auto new_leaf = leaf->Split();
     ShiftLevel(leaf, new_leaf, new_leaf->keys.front());
   }
 
-  if (lifetime > -1) {
-    size_t ID = pool_.DelayTask(std::chrono::seconds(lifetime),
-                                [&, key] { Delete(key); });
-    delay_deletions_.emplace(key, ID);
-  }
-
   ++size_;
   return true;
 }
 
 BPlusTree::V BPlusTree::Get(K const& key) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
-  auto leaf = GetLeaf(root_, key);
-  if (leaf->IsKeyExist(key)) return leaf->GetValue(key);
+  const V* value = Lookup(key);
+  if (value) return *value;
   return {};
 }
 
 bool BPlusTree::Exists(K const& key) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
-  auto leaf = GetLeaf(root_, key);
-  return leaf->IsKeyExist(key);
+  return Lookup(key) != nullptr;
 }
 
 bool BPlusTree::Delete(K const& key) {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
-  auto itr = delay_deletions_.find(key);
-  if (itr != delay_deletions_.end()) {
-    pool_.StopTask(itr->second);
-    delay_deletions_.erase(itr);
-  }
+  return Erase(key, false);
+}
+
+bool BPlusTree::Erase(K const& key, bool expired) {
+  CancelExpiration(key);
 
   auto leaf = GetLeaf(root_, key);
   if (!leaf->IsKeyExist(key)) return false;
 
+  if (expired)
+    observers_.OnExpire(key, leaf->GetValue(key));
+  else
+    observers_.OnErase(key, leaf->GetValue(key));
   leaf->Delete(key);
   UpdateTree(leaf);
 
@@ -242,7 +270,10 @@ bool BPlusTree::Update(K const& key, V const& value) {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
   auto leaf = GetLeaf(root_, key);
   if (leaf->IsKeyExist(key)) {
-    leaf->GetValue(key) = value;
+    V& stored = leaf->GetValue(key);
+    observers_.OnBeforeUpdate(key, stored);
+    stored = value;
+    observers_.OnAfterUpdate(key, stored);
     return true;
   }
   return false;
@@ -259,22 +290,38 @@ std::vector<BPlusTree::K> BPlusTree::Keys() const {
   return res;
 }
 
+// Moves the shared value pointer to the leaf of the new key, the value
+// itself and the expiration timer are not touched.
 bool BPlusTree::Rename(K const& from, K const& to) {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
   auto leaf = GetLeaf(root_, from);
   if (!leaf->IsKeyExist(from)) return false;
   if (from == to) return true;
+  if (Lookup(to)) return false;
 
-  bool res = Set(to, leaf->GetValue(from), Ttl(from));
-  if (res) Delete(from);
-  return res;
+  auto distance = Utils::GetDistanceTo(
+      leaf->keys, [&](auto const& i) { return i == from; });
+  DataPtr data = leaf->data[distance];
+  leaf->Delete(from);
+  UpdateTree(leaf);
+
+  auto target = GetLeaf(root_, to);
+  target->Insert(K(to), std::move(data));
+  if (target->Size() > bucket_size_) {
+    auto new_leaf = target->Split();
+    ShiftLevel(target, new_leaf, new_leaf->keys.front());
+  }
+
+  RenameExpiration(from, to);
+  observers_.OnRename(from, to);
+  return true;
 }
 
 int BPlusTree::Ttl(K const& key) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
   auto itr = delay_deletions_.find(key);
   if (itr != delay_deletions_.end())
-    return pool_.GetRemainTime(itr->second).count();
+    return pool_.GetRemainTime(itr->second.task_id).count();
 
   return -1;
 }
@@ -284,9 +331,26 @@ std::vector<BPlusTree::K> BPlusTree::Find(const V& value) const {
   res.reserve(size_);
 
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  auto lookup = [&](K const& key) { return Lookup(key); };
+  if (index_.Find(value, lookup, res)) return res;
+
+  for (auto leaf = list_; leaf; leaf = leaf->next)
+    for (size_t i = 0; i < leaf->keys.size(); ++i)
+      if (*leaf->data[i] == value) res.push_back(leaf->keys[i]);
+
+  return res;
+}
+
+size_t BPlusTree::Count(const V& value) const {
+  size_t res = 0;
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  auto lookup = [&](K const& key) { return Lookup(key); };
+  if (index_.Count(value, lookup, res)) return res;
+
   for (auto leaf = list_; leaf; leaf = leaf->next)
-    std::copy_if(leaf->keys.begin(), leaf->keys.end(), std::back_inserter(res),
-                 [&](auto const& i) { return leaf->GetValue(i) == value; });
+    res += std::count_if(leaf->data.cbegin(), leaf->data.cend(),
+                         [&](auto const& i) { return *i == value; });
 
   return res;
 }
@@ -303,24 +367,109 @@ std::vector<BPlusTree::V> BPlusTree::ShowAll() const {
   return res;
 }
 
-int BPlusTree::Upload(const std::string& filename) {
-  std::ifstream file(filename);
-  if (!file.is_open()) {
-    return 0;
-  }
+GroupedStats BPlusTree::Aggregate(const V& filter, GroupBy group_by) const {
+  Aggregator aggregator(filter, group_by);
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  for (auto leaf = list_; leaf; leaf = leaf->next)
+    for (auto const& i : leaf->data) aggregator.Add(*i);
+
+  return aggregator.Result();
+}
+
+bool BPlusTree::Visit(K const& key,
+                      const std::function<void(const V&)>& visitor) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  const V* value = Lookup(key);
+  if (value) visitor(*value);
+  return value != nullptr;
+}
+
+ReadHandle BPlusTree::Read(K const& key) const {
+  std::unique_lock<std::recursive_mutex> lock(mtx_);
+  const V* value = Lookup(key);
+  return ReadHandle(std::move(lock), value);
+}
+
+void BPlusTree::ForEach(const Visitor& visitor) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  for (auto leaf = list_; leaf; leaf = leaf->next)
+    for (size_t i = 0; i < leaf->keys.size(); ++i)
+      visitor(leaf->keys[i], *leaf->data[i]);
+}
+
+CoinsStatus BPlusTree::IncrementBy(K const& key, long long delta,
+                                   long long& balance) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Coins::IncrementBy(key, Lookup(key), delta, observers_, balance);
+}
+
+CoinsStatus BPlusTree::Transfer(K const& from, K const& to, long long amount) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Coins::Transfer(from, Lookup(from), to, Lookup(to), amount,
+                         observers_);
+}
+
+int BPlusTree::MSet(const std::vector<std::pair<K, V>>& items) {
+  auto order = Utils::SortedOrder(
+      items.size(), [&](size_t i) -> K const& { return items[i].first; });
 
   int res = 0;
-  K key;
-  V value;
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
-  while (file >> key >> value) {
-    Set(key, value);
-    ++res;
-  }
+  for (size_t i : order) res += Set(items[i].first, items[i].second);
 
   return res;
 }
 
+std::vector<BPlusTree::V> BPlusTree::MGet(const std::vector<K>& keys) const {
+  auto order = Utils::SortedOrder(
+      keys.size(), [&](size_t i) -> K const& { return keys[i]; });
+  std::vector<const V*> values(keys.size(), nullptr);
+  std::vector<V> res;
+  res.reserve(keys.size());
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  LookupSorted(root_.get(), keys, order.data(), order.data() + order.size(),
+               values);
+  for (auto const* i : values) res.push_back(i ? *i : V{});
+
+  return res;
+}
+
+std::vector<bool> BPlusTree::MExists(const std::vector<K>& keys) const {
+  auto order = Utils::SortedOrder(
+      keys.size(), [&](size_t i) -> K const& { return keys[i]; });
+  std::vector<const V*> values(keys.size(), nullptr);
+  std::vector<bool> res(keys.size());
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  LookupSorted(root_.get(), keys, order.data(), order.data() + order.size(),
+               values);
+  for (size_t i = 0; i < values.size(); ++i) res[i] = values[i] != nullptr;
+
+  return res;
+}
+
+int BPlusTree::MDelete(const std::vector<K>& keys) {
+  auto order = Utils::SortedOrder(
+      keys.size(), [&](size_t i) -> K const& { return keys[i]; });
+
+  int res = 0;
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  for (size_t i : order) res += Delete(keys[i]);
+
+  return res;
+}
+
+int BPlusTree::Upload(const std::string& filename, unsigned threads) {
+  threads = ParallelLoader::Threads(threads);
+  ParallelLoader::Chunks chunks;
+  if (!ParallelLoader::Read(filename, threads, chunks)) return 0;
+
+  InsertChunks(chunks, threads);
+  return ParallelLoader::Count(chunks);
+}
+
 int BPlusTree::Export(const std::string& filename) const {
   std::ofstream file(filename);
   if (!file.is_open()) {
@@ -338,6 +487,173 @@ int BPlusTree::Export(const std::string& filename) const {
   return res;
 }
 
+int BPlusTree::ExportShards(const std::string& manifest,
+                            unsigned shards) const {
+  shards = ParallelLoader::Threads(shards);
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+
+  // Every shard takes a run of leaves, a key range.
+  std::vector<Leaf*> leaves;
+  for (auto leaf = list_; leaf; leaf = leaf->next) leaves.push_back(leaf.get());
+
+  return ExportWriter::Shards(manifest, shards, [&](size_t shard,
+                                                    ExportWriter& writer) {
+    size_t end = leaves.size() * (shard + 1) / shards;
+    for (size_t i = leaves.size() * shard / shards; i < end; ++i) {
+      for (size_t j = 0; j < leaves[i]->Size(); ++j)
+        writer.Add(leaves[i]->keys[j], *leaves[i]->data[j]);
+      writer.Spill();
+    }
+  });
+}
+
+ExportStats BPlusTree::ExportInChunks(const std::string& filename,
+                                      size_t chunk) const {
+  ExportStats stats;
+  ExportWriter writer(filename);
+  if (writer.IsOpen() == false) return stats;
+  chunk = std::max<size_t>(chunk, 1);
+
+  // Leaves split and merge between the chunks, so the next chunk starts
+  // from the key after the last one written.
+  std::optional<K> last;
+  for (bool done = false; !done; ++stats.chunks) {
+    {
+      std::scoped_lock<std::recursive_mutex> lock(mtx_);
+      Timer timer;
+      LeafPtr leaf = list_;
+      size_t i = 0;
+      if (last) {
+        leaf = GetLeaf(root_, *last);
+        i = std::upper_bound(leaf->keys.begin(), leaf->keys.end(), *last) -
+            leaf->keys.begin();
+      }
+
+      const K* tail = nullptr;
+      for (size_t taken = 0; leaf && taken < chunk;) {
+        for (; i < leaf->Size() && taken < chunk; ++i, ++taken) {
+          writer.Add(leaf->keys[i], *leaf->data[i]);
+          tail = &leaf->keys[i];
+        }
+        if (i == leaf->Size()) {
+          leaf = leaf->next;
+          i = 0;
+        }
+      }
+
+      done = leaf == nullptr;
+      if (tail) last = *tail;
+      stats.max_lock_hold = std::max(stats.max_lock_hold, timer.Finish());
+    }
+    writer.Spill();
+  }
+
+  if (writer.Finish()) stats.lines = writer.Count();
+  return stats;
+}
+
+SnapshotStatus BPlusTree::Save(const std::string& filename, int& saved,
+                               bool compress) const {
+  Snapshot::Writer writer(filename, compress);
+  if (!writer.IsOpen()) {
+    return SnapshotStatus::kNotOpen;
+  }
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Dump(writer, Deadlines());
+  saved = writer.Count();
+  return writer.Finish() ? SnapshotStatus::kOk : SnapshotStatus::kNotOpen;
+}
+
+pid_t BPlusTree::SaveInBackground(const std::string& filename,
+                                  bool compress) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  auto deadlines = Deadlines();
+
+  return Snapshot::Fork([&] {
+    Snapshot::Writer writer(filename, compress);
+    if (!writer.IsOpen()) return false;
+    Dump(writer, deadlines);
+    return writer.Finish();
+  });
+}
+
+SnapshotStatus BPlusTree::Load(const std::string& filename, int& loaded,
+                               unsigned threads,
+                               LoadTimings* timings) {
+  threads = ParallelLoader::Threads(threads);
+  ParallelLoader::Chunks chunks;
+  std::vector<Snapshot::Expiring> expiring;
+  auto status = Snapshot::Read(filename, threads, chunks, expiring, timings);
+  if (status != SnapshotStatus::kOk) {
+    return status;
+  }
+
+  Timer timer;
+  InsertChunks(chunks, threads);
+  for (auto& [key, value, lifetime] : expiring)
+    Set(std::move(key), std::move(value), lifetime);
+  if (timings) timings->insert = timer.Finish();
+
+  loaded = ParallelLoader::Count(chunks) + expiring.size();
+  return SnapshotStatus::kOk;
+}
+
+uint64_t BPlusTree::Watch(K const& key) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return watches_.Watch(key);
+}
+
+void BPlusTree::Unwatch(K const& key) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  watches_.Unwatch(key);
+}
+
+bool BPlusTree::Atomically(const WatchedKeys& watched,
+                          const std::function<void()>& body) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (!watches_.Unchanged(watched)) return false;
+
+  body();
+  return true;
+}
+
+void BPlusTree::Subscribe(StorageObserver* observer) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  observers_.Add(observer);
+}
+
+void BPlusTree::Unsubscribe(StorageObserver* observer) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  observers_.Remove(observer);
+}
+
+void BPlusTree::CreateView(GroupBy group_by) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (!views_.Contains(group_by))
+    views_.Create(group_by, Aggregate({"-", "-", "-", "-", "-"}, group_by));
+}
+
+GroupedTotals BPlusTree::ReadView(GroupBy group_by) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return views_.Read(group_by);
+}
+
+void BPlusTree::CreateIndex() {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (index_.Enabled()) return;
+
+  index_.Enable();
+  for (auto leaf = list_; leaf; leaf = leaf->next)
+    for (size_t i = 0; i < leaf->keys.size(); ++i)
+      index_.OnInsert(leaf->keys[i], *leaf->data[i]);
+}
+
+size_t BPlusTree::IndexMemoryUsage() const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return index_.Enabled() ? index_.MemoryUsage() : 0;
+}
+
 //============================ PRIVATE =============================
 
 std::tuple<BPlusTree::NodePtr, BPlusTree::NodePtr> BPlusTree::GetSiblings(
@@ -380,6 +696,49 @@ BPlusTree::LeafPtr BPlusTree::GetLeaf(NodePtr node, K const& key) const {
   return GetLeaf(children.back(), key);
 }
 
+const BPlusTree::V* BPlusTree::Lookup(K const& key) const {
+  auto leaf = GetLeaf(root_, key);
+  auto itr = std::find(leaf->keys.begin(), leaf->keys.end(), key);
+  if (itr == leaf->keys.end()) return nullptr;
+  return leaf->data[std::distance(leaf->keys.begin(), itr)].get();
+}
+
+BPlusTree::V* BPlusTree::Lookup(K const& key) {
+  return const_cast<V*>(std::as_const(*this).Lookup(key));
+}
+
+// Resolves a sorted batch of keys in one descent: every child only gets
+// the slice of keys that falls between its separators, and a leaf is
+// merged with its slice in a single pass.
+void BPlusTree::LookupSorted(Node* node, std::vector<K> const& keys,
+                             size_t* first, size_t* last,
+                             std::vector<const V*>& values) const {
+  if (node->IsLeaf()) {
+    auto leaf = static_cast<Leaf*>(node);
+    size_t j = 0;
+    for (; first != last; ++first) {
+      K const& key = keys[*first];
+      while (j < leaf->keys.size() && leaf->keys[j] < key) ++j;
+      if (j < leaf->keys.size() && leaf->keys[j] == key)
+        values[*first] = leaf->data[j].get();
+    }
+    return;
+  }
+
+  auto internal = static_cast<Internal*>(node);
+  for (size_t i = 0; first != last; ++i) {
+    size_t* bound = last;
+    if (i < internal->keys.size())
+      bound = std::partition_point(first, last, [&](size_t j) {
+        return keys[j] < internal->keys[i];
+      });
+
+    if (first != bound)
+      LookupSorted(internal->children[i].get(), keys, first, bound, values);
+    first = bound;
+  }
+}
+
 void BPlusTree::UpdateTree(NodePtr node) {
   // assert(node);
 
@@ -412,6 +771,135 @@ void BPlusTree::UpdateTree(NodePtr node) {
   }
 }
 
+// Sorted records go to an empty tree in one bottom-up pass and through
+// Set otherwise, a repeated key keeps its first value either way.
+void BPlusTree::InsertChunks(ParallelLoader::Chunks& chunks,
+                             unsigned threads) {
+  auto records = ParallelLoader::SortedUnique(chunks, threads);
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (size_) {
+    for (auto* record : records)
+      Set(std::move(record->first), std::move(record->second));
+  } else {
+    BulkLoad(records, threads);
+  }
+}
+
+// Builds an empty tree bottom-up from sorted unique records. Nodes of a
+// level are filled evenly up to bucket_size_ keys, which keeps every one
+// of them at least half full as UpdateTree expects.
+void BPlusTree::BulkLoad(std::vector<std::pair<K, V>*> const& records,
+                         unsigned threads) {
+  if (records.empty()) return;
+
+  size_t leaves = (records.size() + bucket_size_ - 1) / bucket_size_;
+  std::vector<NodePtr> level(leaves);
+  ParallelLoader::Run(leaves, threads, [&](size_t i) {
+    auto leaf = std::make_shared<Leaf>();
+    leaf->keys.reserve(bucket_size_ + 1);
+    leaf->data.reserve(bucket_size_ + 1);
+    size_t last = records.size() * (i + 1) / leaves;
+    for (size_t j = records.size() * i / leaves; j < last; ++j) {
+      leaf->keys.push_back(std::move(records[j]->first));
+      leaf->data.push_back(std::make_shared<V>(std::move(records[j]->second)));
+    }
+    level[i] = leaf;
+  });
+
+  // Smallest key under every node of the level, the separators above it.
+  std::vector<K> lows;
+  for (size_t i = 0; i < leaves; ++i) {
+    auto leaf = CastNode<Leaf>(level[i]);
+    if (i + 1 < leaves) leaf->next = CastNode<Leaf>(level[i + 1]);
+    for (size_t j = 0; j < leaf->Size(); ++j)
+      observers_.OnInsert(leaf->keys[j], *leaf->data[j]);
+    lows.push_back(leaf->keys.front());
+  }
+  list_ = CastNode<Leaf>(level.front());
+  size_ = records.size();
+
+  while (level.size() > 1) {
+    size_t count = (level.size() + bucket_size_) / (bucket_size_ + 1);
+    std::vector<NodePtr> upper;
+    std::vector<K> upper_lows;
+
+    for (size_t i = 0; i < count; ++i) {
+      auto internal = std::make_shared<Internal>();
+      size_t first = level.size() * i / count;
+      size_t last = level.size() * (i + 1) / count;
+      for (size_t j = first; j < last; ++j) {
+        if (j != first) internal->keys.push_back(std::move(lows[j]));
+        level[j]->parent = internal;
+        internal->children.push_back(level[j]);
+      }
+      upper.push_back(internal);
+      upper_lows.push_back(std::move(lows[first]));
+    }
+
+    level = std::move(upper);
+    lows = std::move(upper_lows);
+  }
+
+  root_ = level.front();
+  root_->parent.reset();
+}
+
+void BPlusTree::ScheduleExpiration(K const& key, int lifetime) {
+  auto holder = std::make_shared<K>(key);
+  size_t id = pool_.DelayTask(std::chrono::seconds(lifetime), [&, holder] {
+    std::scoped_lock<std::recursive_mutex> lock(mtx_);
+    Erase(*holder, true);
+  });
+  delay_deletions_.emplace(key, Expiration{id, holder});
+  observers_.OnExpireAt(key, Deadline(key));
+}
+
+// Unix time in milliseconds when the key expires, 0 without TTL.
+uint64_t BPlusTree::Deadline(K const& key) const {
+  auto item = delay_deletions_.find(key);
+  if (item == delay_deletions_.end()) return 0;
+  return Snapshot::ToDeadline(pool_.GetDeleteTime(item->second.task_id));
+}
+
+Snapshot::Deadlines BPlusTree::Deadlines() const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Snapshot::Deadlines result;
+  for (auto const& [key, expiration] : delay_deletions_)
+    result.emplace_hint(result.end(), key, Deadline(key));
+  return result;
+}
+
+// Writes the records without locking anything, a forked child calls it
+// too.
+void BPlusTree::Dump(Snapshot::Writer& writer,
+                     Snapshot::Deadlines const& deadlines) const {
+  for (auto leaf = list_; leaf; leaf = leaf->next) {
+    for (size_t i = 0; i < leaf->Size(); ++i) {
+      auto deadline = deadlines.find(leaf->keys[i]);
+      writer.Add(leaf->keys[i], *leaf->data[i],
+                 deadline == deadlines.end() ? 0 : deadline->second);
+    }
+  }
+}
+
+void BPlusTree::CancelExpiration(K const& key) {
+  auto item = delay_deletions_.find(key);
+  if (item == delay_deletions_.end()) return;
+
+  pool_.StopTask(item->second.task_id);
+  delay_deletions_.erase(item);
+}
+
+void BPlusTree::RenameExpiration(K const& from, K const& to) {
+  auto item = delay_deletions_.extract(from);
+  if (!item) return;
+
+  item.key() = to;
+  *item.mapped().key = to;
+  delay_deletions_.insert(std::move(item));
+}
+
 void BPlusTree::ShiftLevel(NodePtr left, NodePtr right, K const& key) {
   if (left == root_) {
     auto new_root = std::make_shared<Internal>();
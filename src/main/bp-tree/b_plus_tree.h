@@ -7,9 +7,11 @@
 
 #include <map>
 #include <memory>
+#include <optional>
 #include <tuple>
 
 #include "async_pool.h"
+#include "expiration.h"
 #include "key_value_storage.h"
 
 namespace s21 {
@@ -28,11 +30,41 @@ class BPlusTree : public KeyValueStorage {
   void operator=(BPlusTree&&) = delete;
 
   bool Set(K const& key, const V& value, int lifetime = -1) override;
+  bool Set(K&& key, V&& value, int lifetime = -1) override;
   [[nodiscard]] std::vector<K> Find(const V& value) const override;
+  [[nodiscard]] size_t Count(const V& value) const override;
   [[nodiscard]] bool Exists(K const& key) const override;
-  int Upload(const std::string& filename) override;
+  bool Visit(const K& key,
+             const std::function<void(const V&)>& visitor) const override;
+  [[nodiscard]] ReadHandle Read(const K& key) const override;
+  void ForEach(const Visitor& visitor) const override;
+  CoinsStatus IncrementBy(const K& key, long long delta,
+                          long long& balance) override;
+  CoinsStatus Transfer(const K& from, const K& to, long long amount) override;
+  int MSet(const std::vector<std::pair<K, V>>& items) override;
+  [[nodiscard]] std::vector<V> MGet(const std::vector<K>& keys) const override;
+  [[nodiscard]] std::vector<bool> MExists(
+      const std::vector<K>& keys) const override;
+  int MDelete(const std::vector<K>& keys) override;
+  int Upload(const std::string& filename, unsigned threads = 0) override;
   int Export(const std::string& filename) const override;
+  int ExportShards(const std::string& manifest,
+                   unsigned shards = 0) const override;
+  ExportStats ExportInChunks(const std::string& filename,
+                             size_t chunk = 1024) const override;
+  SnapshotStatus Save(const std::string& filename, int& saved,
+                      bool compress = false) const override;
+  SnapshotStatus Load(const std::string& filename, int& loaded,
+                      unsigned threads = 0,
+                      LoadTimings* timings = nullptr) override;
+  pid_t SaveInBackground(const std::string& filename,
+                         bool compress = false) const override;
+  [[nodiscard]] Snapshot::Deadlines Deadlines() const override;
+  void Dump(Snapshot::Writer& writer,
+            Snapshot::Deadlines const& deadlines) const override;
   [[nodiscard]] std::vector<V> ShowAll() const override;
+  [[nodiscard]] GroupedStats Aggregate(const V& filter,
+                                       GroupBy group_by) const override;
   [[nodiscard]] std::vector<K> Keys() const override;
   bool Rename(K const& from, K const& to) override;
   [[nodiscard]] int Ttl(K const& key) const override;
@@ -40,6 +72,18 @@ class BPlusTree : public KeyValueStorage {
   bool Update(K const& key, V const& value) override;
   bool Delete(K const& key) override;
 
+  uint64_t Watch(const K& key) override;
+  void Unwatch(const K& key) override;
+  bool Atomically(const WatchedKeys& watched,
+                  const std::function<void()>& body) override;
+
+  void Subscribe(StorageObserver* observer) override;
+  void Unsubscribe(StorageObserver* observer) override;
+  void CreateView(GroupBy group_by) override;
+  [[nodiscard]] GroupedTotals ReadView(GroupBy group_by) const override;
+  void CreateIndex() override;
+  [[nodiscard]] size_t IndexMemoryUsage() const override;
+
  private:
   struct Node;
   struct Internal;
@@ -52,10 +96,14 @@ class BPlusTree : public KeyValueStorage {
 
   LeafPtr list_ = std::make_shared<Leaf>();
   NodePtr root_ = std::static_pointer_cast<Node>(list_);
-  std::map<K, size_t> delay_deletions_;
+  std::map<K, Expiration> delay_deletions_;
   mutable std::recursive_mutex mtx_;
   size_t bucket_size_ = 10;
   size_t size_ = 0;
+  MaterializedViews views_;
+  BitmapIndex index_;
+  WatchTable watches_;
+  StorageObservers observers_{&views_, &index_, &watches_};
   AsyncPool pool_;
 
   template <typename Type>
@@ -65,9 +113,21 @@ class BPlusTree : public KeyValueStorage {
 
   void ShiftLevel(NodePtr left, NodePtr right, K const& key);
   LeafPtr GetLeaf(NodePtr node, K const& key) const;
+  const V* Lookup(K const& key) const;
+  V* Lookup(K const& key);
+  void LookupSorted(Node* node, std::vector<K> const& keys, size_t* first,
+                    size_t* last, std::vector<const V*>& values) const;
 
   std::tuple<BPlusTree::NodePtr, BPlusTree::NodePtr> GetSiblings(NodePtr node);
   void UpdateTree(NodePtr node);
+  void InsertChunks(ParallelLoader::Chunks& chunks, unsigned threads);
+  uint64_t Deadline(const K& key) const;
+  void BulkLoad(std::vector<std::pair<K, V>*> const& records,
+                unsigned threads);
+  bool Erase(K const& key, bool expired);
+  void ScheduleExpiration(K const& key, int lifetime);
+  void CancelExpiration(K const& key);
+  void RenameExpiration(K const& from, K const& to);
 };
 
 // ============================ BASE_NODE ==============================
@@ -103,7 +163,8 @@ struct BPlusTree::Leaf : public Node,
   virtual void Share(NodePtr from, NodePtr left) override;
   virtual bool IsLeaf() const override { return true; }
   virtual void Merge(NodePtr right) override;
-  bool Insert(K const& key, const V& value);
+  std::optional<size_t> Insert(K&& key, V&& value);
+  std::optional<size_t> Insert(K&& key, DataPtr value);
   virtual NodePtr Split() override;
   bool IsKeyExist(K const& key);
   V& GetValue(K const& key);
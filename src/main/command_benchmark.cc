@@ -0,0 +1,169 @@
+//////////////////////////////////////////
+//  parsing and dispatch microbenchmark  //
+//////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "command_table.h"
+#include "hash_table.h"
+#include "resp.h"
+#include "timer.h"
+#include "tokenizer.h"
+
+using namespace s21;
+
+namespace {
+
+constexpr int kLines = 100000;
+constexpr int kRounds = 20;
+
+// The names in the order the console used to compare them.
+const char* const kNames[] = {
+    "Q",        "QUIT",    "WATCH",   "UNWATCH", "MULTI",        "EXEC",
+    "DISCARD",  "SET",     "GET",     "EXISTS",  "DEL",          "UPDATE",
+    "MSET",     "MGET",    "MEXISTS", "MDEL",    "INCRBY",       "DECRBY",
+    "TRANSFER", "KEYS",    "RENAME",  "TTL",     "FIND",         "COUNT",
+    "INDEX",    "SHOWALL", "AGG",     "VIEW",    "UPLOAD",       "EXPORT",
+    "SAVE",     "LOAD",    "BGSAVE",  "LASTSAVE", "BGREWRITEAOF", "CHECKPOINT",
+    "ROLE",     "PING"};
+
+// A trace like the ones replayed in script mode.
+std::vector<std::string> MakeTrace() {
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> key(0, 9999);
+  std::uniform_int_distribution<int> percent(0, 99);
+  std::vector<std::string> lines;
+  for (int i = 0; i < kLines; ++i) {
+    std::string name = "key" + std::to_string(key(random));
+    int kind = percent(random);
+    if (kind < 30)
+      lines.push_back("SET " + name + " Ivanov Ivan 2000 Moscow 100");
+    else if (kind < 80)
+      lines.push_back("get " + name);
+    else if (kind < 95)
+      lines.push_back("INCRBY " + name + " 1");
+    else
+      lines.push_back("DEL " + name);
+  }
+  return lines;
+}
+
+// What every line went through before: a stream split into new strings,
+// an upper-case copy of the name, a chain of comparisons and a set of the
+// writes.
+size_t Streaming(std::vector<std::string> const& lines) {
+  static const std::set<std::string> writes = {
+      "SET", "DEL", "UPDATE", "MSET", "MDEL", "INCRBY", "DECRBY", "TRANSFER",
+      "RENAME", "UPLOAD", "LOAD", "EXEC", "BGREWRITEAOF", "CHECKPOINT"};
+  size_t sum = 0;
+  for (auto const& line : lines) {
+    std::vector<std::string> tokens;
+    tokens.reserve(10);
+    std::stringstream stream(line);
+    std::string token;
+    while (getline(stream, token, ' ')) tokens.push_back(token);
+
+    std::string command = tokens[0];
+    std::transform(command.begin(), command.end(), command.begin(),
+                   [](const char& c) { return std::toupper(c); });
+    size_t id = 0;
+    while (id < std::size(kNames) && command != kNames[id]) ++id;
+    sum += id + writes.count(command) + tokens.size();
+  }
+  return sum;
+}
+
+size_t Viewing(std::vector<std::string> const& lines) {
+  std::vector<std::string_view> views;
+  size_t sum = 0;
+  for (auto const& line : lines) {
+    Tokenizer::Split(line, views);
+    CommandId id = CommandTable::Find(views[0]);
+    sum += static_cast<size_t>(id) + CommandTable::IsWrite(id) + views.size();
+  }
+  return sum;
+}
+
+// The console then copies the views into the strings the commands take.
+size_t ViewingIntoStrings(std::vector<std::string> const& lines) {
+  std::vector<std::string_view> views;
+  std::vector<std::string> tokens;
+  size_t sum = 0;
+  for (auto const& line : lines) {
+    Tokenizer::Split(line, views);
+    CommandId id = CommandTable::Find(views[0]);
+    tokens.resize(views.size());
+    for (size_t i = 0; i < views.size(); ++i) tokens[i] = views[i];
+    sum += static_cast<size_t>(id) + CommandTable::IsWrite(id) + tokens.size();
+  }
+  return sum;
+}
+
+size_t ParsingResp(std::string const& input) {
+  std::string_view rest = input;
+  std::vector<std::string> command;
+  size_t sum = 0;
+  while (Resp::Parse(rest, command) == Resp::Status::kOk)
+    sum += static_cast<size_t>(CommandTable::Find(command[0])) +
+           command.size();
+  return sum;
+}
+
+size_t Getting(HashTable& storage, std::vector<std::string> const& keys) {
+  size_t sum = 0;
+  for (auto const& key : keys) sum += storage.Get(key).coins.size();
+  return sum;
+}
+
+// Nanoseconds per line of the fastest of the rounds.
+template <class Run>
+double Measure(Run const& run, size_t& sum) {
+  nanoseconds best = nanoseconds::max();
+  for (int round = 0; round < kRounds; ++round) {
+    Timer timer;
+    sum += run();
+    best = std::min(best, timer.Finish());
+  }
+  return static_cast<double>(best.count()) / kLines;
+}
+
+}  // namespace
+
+// Usage: command_benchmark.out
+// Times the way a line of a trace becomes a command: the tokenizer and
+// the command table against the copies and comparisons they replaced, and
+// the RESP parser of the server. A GET from the hash table, the least work
+// a command does, is the scale.
+int main() {
+  std::vector<std::string> lines = MakeTrace();
+  std::string resp;
+  std::vector<std::string> keys;
+  HashTable storage(10000);
+  for (auto const& line : lines) {
+    std::vector<std::string_view> views;
+    Tokenizer::Split(line, views);
+    Resp::Command(resp, std::vector<std::string>(views.begin(), views.end()));
+    keys.emplace_back(views[1]);
+    storage.Set(keys.back(), {"Ivanov", "Ivan", "2000", "Moscow", "100"});
+  }
+
+  size_t sum = 0;
+  std::printf("%-40s %10s\n", "per command", "ns");
+  std::printf("%-40s %10.1f\n", "stringstream, ToUpper, if chain",
+              Measure([&] { return Streaming(lines); }, sum));
+  std::printf("%-40s %10.1f\n", "Tokenizer, CommandTable",
+              Measure([&] { return Viewing(lines); }, sum));
+  std::printf("%-40s %10.1f\n", "... copied into reused strings",
+              Measure([&] { return ViewingIntoStrings(lines); }, sum));
+  std::printf("%-40s %10.1f\n", "Resp::Parse, CommandTable",
+              Measure([&] { return ParsingResp(resp); }, sum));
+  std::printf("%-40s %10.1f\n", "HashTable::Get",
+              Measure([&] { return Getting(storage, keys); }, sum));
+  return sum == 0;
+}
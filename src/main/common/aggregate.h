@@ -0,0 +1,77 @@
+#ifndef A6_SRC_MAIN_COMMON_AGGREGATE_H_
+#define A6_SRC_MAIN_COMMON_AGGREGATE_H_
+
+#include <algorithm>
+#include <charconv>
+#include <map>
+#include <string>
+
+#include "person.h"
+
+namespace s21 {
+
+enum class GroupBy { kNone, kCity, kBirthday };
+
+struct Stats {
+  size_t count = 0;
+  long long sum = 0;
+  long long min = 0;
+  long long max = 0;
+
+  void Add(long long coins) {
+    min = count ? std::min(min, coins) : coins;
+    max = count ? std::max(max, coins) : coins;
+    sum += coins;
+    ++count;
+  }
+};
+
+using GroupedStats = std::map<std::string, Stats, std::less<>>;
+
+// Accumulates COUNT/SUM/MIN/MAX of coins for the records matching the
+// filter (FIND syntax, "-" is a wildcard). Records are only read, never
+// copied, a group key is allocated once per new group.
+class Aggregator {
+ public:
+  Aggregator(const Person& filter, GroupBy group_by)
+      : filter_(filter), group_by_(group_by) {}
+
+  void Add(const Person& value) {
+    if (!(value == filter_)) return;
+
+    const std::string& group = GroupOf(value);
+    auto itr = result_.find(group);
+    if (itr == result_.end()) itr = result_.emplace(group, Stats{}).first;
+
+    itr->second.Add(ParseCoins(value.coins));
+  }
+
+  GroupedStats Result() { return std::move(result_); }
+
+  static const std::string& GroupOf(const Person& value, GroupBy group_by) {
+    static const std::string kAll;
+    if (group_by == GroupBy::kCity) return value.city;
+    if (group_by == GroupBy::kBirthday) return value.birthday;
+    return kAll;
+  }
+
+  // Coins that are not a number are accounted as 0.
+  static long long ParseCoins(const std::string& coins) {
+    long long result = 0;
+    std::from_chars(coins.data(), coins.data() + coins.size(), result);
+    return result;
+  }
+
+ private:
+  const Person& filter_;
+  GroupBy group_by_;
+  GroupedStats result_;
+
+  const std::string& GroupOf(const Person& value) const {
+    return GroupOf(value, group_by_);
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_AGGREGATE_H_
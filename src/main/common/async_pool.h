@@ -62,6 +62,13 @@ class AsyncPool {
     return 0s;
   }
 
+  // Time the task runs at, now if it is unknown.
+  Timestamp GetDeleteTime(size_t id) const {
+    std::scoped_lock<std::mutex> lock(mtx_);
+    auto itr = tasks_.find(id);
+    return itr != tasks_.end() ? itr->second.delete_time : Clock::now();
+  }
+
   void StopTask(size_t id) {
     std::scoped_lock<std::mutex> lock(mtx_);
     if (tasks_.find(id) != tasks_.end()) tasks_[id].remove = true;
@@ -0,0 +1,245 @@
+#ifndef A6_SRC_MAIN_COMMON_BITMAP_INDEX_H_
+#define A6_SRC_MAIN_COMMON_BITMAP_INDEX_H_
+
+#include <cmath>
+#include <tuple>
+#include <unordered_map>
+
+#include "roaring_bitmap.h"
+#include "storage_observer.h"
+
+namespace s21 {
+
+// Bitmap indexes over the low-cardinality fields: birthday, city and coins
+// bucketed by their number of digits. Every record gets a dense id, so a
+// FIND becomes an AND of the fields and an OR of the alternatives inside
+// a field, and only the matching ids are turned back into keys.
+class BitmapIndex : public StorageObserver {
+ public:
+  bool Enabled() const { return enabled_; }
+  void Enable() { enabled_ = true; }
+
+  // Lookup(key) must return the stored value or nullptr, it is only used
+  // when the filter constrains fields that the index doesn't answer
+  // exactly. Returns false if the index can't narrow the search.
+  template <class Lookup>
+  bool Find(const V& filter, Lookup const& lookup,
+            std::vector<K>& result) const {
+    RoaringBitmap ids;
+    if (!Query(filter, ids)) return false;
+
+    bool exact = IsExact(filter);
+    ids.ForEach([&](uint32_t id) {
+      const K& key = *keys_[id];
+      if (exact) {
+        result.push_back(key);
+      } else {
+        const V* value = lookup(key);
+        if (value && *value == filter) result.push_back(key);
+      }
+    });
+
+    return true;
+  }
+
+  template <class Lookup>
+  bool Count(const V& filter, Lookup const& lookup, size_t& result) const {
+    RoaringBitmap ids;
+    if (!Query(filter, ids)) return false;
+
+    if (IsExact(filter)) {
+      result = ids.Cardinality();
+    } else {
+      result = 0;
+      ids.ForEach([&](uint32_t id) {
+        const V* value = lookup(*keys_[id]);
+        if (value && *value == filter) ++result;
+      });
+    }
+
+    return true;
+  }
+
+  size_t MemoryUsage() const {
+    size_t node = sizeof(K) + sizeof(uint32_t) + 2 * sizeof(void*);
+    size_t result = sizeof(*this) + keys_.capacity() * sizeof(K*) +
+                    free_ids_.capacity() * sizeof(uint32_t) +
+                    ids_.size() * node;
+    for (auto const* field : {&birthdays_, &cities_, &coins_})
+      for (auto const& [value, bitmap] : *field)
+        result += value.capacity() + bitmap.MemoryUsage();
+    return result;
+  }
+
+  void OnInsert(const K& key, const V& value) override {
+    if (!enabled_) return;
+
+    uint32_t id = keys_.size();
+    if (!free_ids_.empty()) {
+      id = free_ids_.back();
+      free_ids_.pop_back();
+    } else {
+      keys_.push_back(nullptr);
+    }
+
+    keys_[id] = &ids_.emplace(key, id).first->first;
+    Add(id, value);
+  }
+
+  void OnBeforeUpdate(const K& key, const V& value) override {
+    if (enabled_) Remove(ids_.at(key), value);
+  }
+
+  void OnAfterUpdate(const K& key, const V& value) override {
+    if (enabled_) Add(ids_.at(key), value);
+  }
+
+  void OnErase(const K& key, const V& value) override {
+    if (!enabled_) return;
+
+    auto itr = ids_.find(key);
+    Remove(itr->second, value);
+    keys_[itr->second] = nullptr;
+    free_ids_.push_back(itr->second);
+    ids_.erase(itr);
+  }
+
+  void OnRename(const K& from, const K& to) override {
+    if (!enabled_) return;
+
+    auto node = ids_.extract(from);
+    node.key() = to;
+    uint32_t id = node.mapped();
+    keys_[id] = &ids_.insert(std::move(node)).position->first;
+  }
+
+ private:
+  using Field = std::unordered_map<std::string, RoaringBitmap>;
+
+  bool enabled_ = false;
+  std::unordered_map<K, uint32_t> ids_;
+  std::vector<const K*> keys_;
+  std::vector<uint32_t> free_ids_;
+  Field birthdays_;
+  Field cities_;
+  Field coins_;
+
+  // Coins are bucketed by sign and number of digits: "3" holds 100..999,
+  // "-2" holds -99..-10, "" holds the values that are not numbers.
+  static std::string Bucket(std::string_view coins) {
+    long long number = 0;
+    if (!V::ParseNumber(coins, number)) return {};
+
+    std::string digits = std::to_string(number);
+    if (number < 0) return "-" + std::to_string(digits.size() - 1);
+    return std::to_string(digits.size());
+  }
+
+  static bool Overlaps(const std::string& bucket, long long from,
+                       long long to) {
+    if (bucket.empty()) return false;
+
+    bool negative = bucket.front() == '-';
+    int digits = std::stoi(bucket.substr(negative));
+    long double low = digits > 1 ? std::pow(10.0L, digits - 1) : 0;
+    long double high = std::pow(10.0L, digits) - 1;
+    if (negative) std::tie(low, high) = std::make_pair(-high, -low);
+
+    return from <= high && low <= to;
+  }
+
+  static bool IsExact(const V& filter) {
+    return filter.last_name == "-" && filter.first_name == "-" &&
+           filter.coins == "-";
+  }
+
+  void Add(uint32_t id, const V& value) {
+    birthdays_[value.birthday].Add(id);
+    cities_[value.city].Add(id);
+    coins_[Bucket(value.coins)].Add(id);
+  }
+
+  void Remove(uint32_t id, const V& value) {
+    Remove(birthdays_, value.birthday, id);
+    Remove(cities_, value.city, id);
+    Remove(coins_, Bucket(value.coins), id);
+  }
+
+  static void Remove(Field& field, const std::string& value, uint32_t id) {
+    auto itr = field.find(value);
+    if (itr == field.end()) return;
+
+    itr->second.Remove(id);
+    if (itr->second.Empty()) field.erase(itr);
+  }
+
+  bool Query(const V& filter, RoaringBitmap& result) const {
+    if (!enabled_) return false;
+
+    bool narrowed = false;
+    auto intersect = [&](RoaringBitmap const& ids) {
+      if (narrowed) {
+        result &= ids;
+      } else {
+        result = ids;
+        narrowed = true;
+      }
+    };
+
+    if (filter.birthday != "-")
+      intersect(Select(birthdays_, filter.birthday));
+    if (filter.city != "-") intersect(Select(cities_, filter.city));
+    if (filter.coins != "-") intersect(SelectCoins(filter.coins));
+
+    return narrowed;
+  }
+
+  // OR of the bitmaps of all indexed values matching the pattern. Plain
+  // values are looked up directly, ranges walk the (few) distinct values.
+  static RoaringBitmap Select(Field const& field, std::string_view pattern) {
+    RoaringBitmap result;
+
+    if (pattern.find('|') == std::string_view::npos &&
+        pattern.find("..") == std::string_view::npos) {
+      auto itr = field.find(std::string(pattern));
+      if (itr != field.end()) result = itr->second;
+      return result;
+    }
+
+    for (auto const& [value, ids] : field)
+      if (V::Matches(value, pattern)) result |= ids;
+
+    return result;
+  }
+
+  RoaringBitmap SelectCoins(std::string_view pattern) const {
+    RoaringBitmap result;
+
+    while (!pattern.empty()) {
+      size_t bar = pattern.find('|');
+      std::string_view alternative = pattern.substr(0, bar);
+      pattern = bar == std::string_view::npos ? "" : pattern.substr(bar + 1);
+
+      size_t dots = alternative.find("..");
+      if (dots == std::string_view::npos) {
+        auto itr = coins_.find(Bucket(alternative));
+        if (itr != coins_.end()) result |= itr->second;
+        continue;
+      }
+
+      long long from = 0, to = 0;
+      if (!V::ParseNumber(alternative.substr(0, dots), from) ||
+          !V::ParseNumber(alternative.substr(dots + 2), to))
+        continue;
+
+      for (auto const& [bucket, ids] : coins_)
+        if (Overlaps(bucket, from, to)) result |= ids;
+    }
+
+    return result;
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_BITMAP_INDEX_H_
@@ -0,0 +1,268 @@
+#ifndef A6_SRC_MAIN_COMMON_CHANGE_BUS_H_
+#define A6_SRC_MAIN_COMMON_CHANGE_BUS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "snapshot.h"
+#include "storage_observer.h"
+
+namespace s21 {
+
+// A change of the storage as the subscribers of a ChangeBus see it.
+struct ChangeEvent {
+  enum Type : uint8_t {
+    kSet,      // a new key, with its value
+    kUpdate,   // with the new value
+    kDelete,   // with the last value
+    kRename,   // key to `to`
+    kExpire,   // a TTL was set, Unix time in milliseconds
+    kExpired,  // the TTL ran out, with the last value
+    kLost      // the reader fell behind, the events before it are gone
+  };
+
+  Type type = kSet;
+  std::string key;
+  std::string to;
+  Person value;
+  uint64_t deadline = 0;
+
+  static const char* Name(Type type) {
+    static const char* const names[] = {"set",    "update",  "del", "rename",
+                                        "expire", "expired", "lost"};
+    return names[type];
+  }
+};
+
+// Broadcasts the changes of the storage it observes through a lock-free
+// ring of cache-line cells. A writer claims the cells of its event with
+// one fetch_add and stamps each of them once it is written, so writers
+// never wait for each other or for readers. Every reader has its own
+// cursor. A reader that the writers lap sees a kLost event and continues
+// from the newest event, a slow reader never holds anybody up. Nothing is
+// encoded while there are no readers.
+class ChangeBus : public StorageObserver {
+ public:
+  // Every reader polls from its own thread, or from the same thread as
+  // other readers.
+  class Reader {
+   public:
+    // Starts after the events published so far.
+    explicit Reader(ChangeBus& bus) : bus_(bus) {
+      bus_.readers_.fetch_add(1, std::memory_order_seq_cst);
+      cursor_ = bus_.head_.load(std::memory_order_seq_cst);
+    }
+
+    ~Reader() { bus_.readers_.fetch_sub(1, std::memory_order_relaxed); }
+
+    Reader(const Reader&) = delete;
+    Reader(Reader&&) = delete;
+    void operator=(const Reader&) = delete;
+    void operator=(Reader&&) = delete;
+
+    // Calls the visitor with up to `max` events published since the last
+    // call, in order. Returns how many it got.
+    template <class Visitor>
+    size_t Read(Visitor const& visitor, size_t max = SIZE_MAX) {
+      size_t count = 0;
+      std::string record;
+      ChangeEvent event;
+      while (count < max) {
+        uint64_t head = bus_.head_.load(std::memory_order_acquire);
+        if (cursor_ == head) break;
+
+        Result result = head - cursor_ > bus_.capacity_
+                            ? Result::kOverwritten
+                            : bus_.Fetch(cursor_, record);
+        if (result == Result::kPending) break;
+        if (result == Result::kOverwritten) {
+          // The head is always where a record starts.
+          cursor_ = head;
+          event = ChangeEvent{};
+          event.type = ChangeEvent::kLost;
+        } else {
+          cursor_ += Cells(record.size());
+          if (!Decode(record, event)) continue;
+        }
+        visitor(static_cast<ChangeEvent const&>(event));
+        ++count;
+      }
+      return count;
+    }
+
+   private:
+    ChangeBus& bus_;
+    uint64_t cursor_ = 0;
+  };
+
+  // The capacity in cells is rounded up to a power of two. A cell holds 56
+  // bytes of an event, events larger than a quarter of the ring are not
+  // published.
+  explicit ChangeBus(size_t capacity = 1 << 16) {
+    capacity_ = 64;
+    while (capacity_ < capacity) capacity_ *= 2;
+    cells_ = std::make_unique<Cell[]>(capacity_);
+  }
+
+  ChangeBus(const ChangeBus&) = delete;
+  ChangeBus(ChangeBus&&) = delete;
+  void operator=(const ChangeBus&) = delete;
+  void operator=(ChangeBus&&) = delete;
+
+  void OnInsert(const K& key, const V& value) override {
+    if (Listened()) Publish(Encode(ChangeEvent::kSet, key, &value));
+  }
+
+  void OnAfterUpdate(const K& key, const V& value) override {
+    if (Listened()) Publish(Encode(ChangeEvent::kUpdate, key, &value));
+  }
+
+  void OnErase(const K& key, const V& value) override {
+    if (Listened()) Publish(Encode(ChangeEvent::kDelete, key, &value));
+  }
+
+  void OnExpire(const K& key, const V& value) override {
+    if (Listened()) Publish(Encode(ChangeEvent::kExpired, key, &value));
+  }
+
+  void OnRename(const K& from, const K& to) override {
+    if (!Listened()) return;
+    std::string record = Encode(ChangeEvent::kRename, from, nullptr);
+    Snapshot::PutString(record, to);
+    Publish(record);
+  }
+
+  void OnExpireAt(const K& key, uint64_t deadline) override {
+    if (!Listened()) return;
+    std::string record = Encode(ChangeEvent::kExpire, key, nullptr);
+    Snapshot::PutVarint(record, deadline);
+    Publish(record);
+  }
+
+ private:
+  static constexpr size_t kWords = 7;
+  static constexpr size_t kCellBytes = kWords * sizeof(uint64_t);
+
+  // A stamp is the position of the cell plus one, shifted left, with the
+  // low bit set on the first cell of a record, and 0 while it is written.
+  // The words are atomics so that a reader racing with a writer only
+  // reads a stale or a torn word, which the stamp then rejects.
+  struct alignas(64) Cell {
+    std::atomic<uint64_t> stamp{0};
+    std::atomic<uint64_t> words[kWords]{};
+  };
+
+  enum class Result { kOk, kPending, kOverwritten };
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t capacity_;
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) std::atomic<int> readers_{0};
+
+  static uint64_t Stamp(uint64_t position, bool first) {
+    return (position + 1) << 1 | first;
+  }
+
+  // Cells of a record, with the size in front of it.
+  static size_t Cells(size_t size) {
+    return (sizeof(uint64_t) + size + kCellBytes - 1) / kCellBytes;
+  }
+
+  bool Listened() const {
+    return readers_.load(std::memory_order_relaxed) > 0;
+  }
+
+  static std::string Encode(ChangeEvent::Type type, const K& key,
+                            const V* value) {
+    std::string record(1, type);
+    Snapshot::PutString(record, key);
+    if (value) Snapshot::PutValue(record, *value);
+    return record;
+  }
+
+  static bool Decode(std::string_view record, ChangeEvent& event) {
+    event.type = static_cast<ChangeEvent::Type>(record.front());
+    record.remove_prefix(1);
+    if (!Snapshot::GetString(record, event.key)) return false;
+    switch (event.type) {
+      case ChangeEvent::kSet:
+      case ChangeEvent::kUpdate:
+      case ChangeEvent::kDelete:
+      case ChangeEvent::kExpired:
+        return Snapshot::GetValue(record, event.value);
+      case ChangeEvent::kRename:
+        return Snapshot::GetString(record, event.to);
+      case ChangeEvent::kExpire:
+        return Snapshot::GetVarint(record, event.deadline);
+      default:
+        return false;
+    }
+  }
+
+  void Publish(std::string const& record) {
+    size_t cells = Cells(record.size());
+    if (cells > capacity_ / 4) return;
+    uint64_t first = head_.fetch_add(cells, std::memory_order_relaxed);
+
+    std::string bytes(cells * kCellBytes, '\0');
+    uint64_t size = record.size();
+    std::memcpy(bytes.data(), &size, sizeof(size));
+    std::memcpy(bytes.data() + sizeof(size), record.data(), record.size());
+    for (size_t i = 0; i < cells; ++i) {
+      Cell& cell = cells_[(first + i) & (capacity_ - 1)];
+      cell.stamp.store(0, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (size_t w = 0; w < kWords; ++w) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + i * kCellBytes + w * 8, 8);
+        cell.words[w].store(word, std::memory_order_relaxed);
+      }
+      cell.stamp.store(Stamp(first + i, i == 0), std::memory_order_release);
+    }
+  }
+
+  // Copies the cell at the position, kPending if it isn't written yet.
+  Result Copy(uint64_t position, bool first, char* output) const {
+    Cell const& cell = cells_[position & (capacity_ - 1)];
+    uint64_t stamp = cell.stamp.load(std::memory_order_acquire);
+    uint64_t words[kWords];
+    for (size_t w = 0; w < kWords; ++w)
+      words[w] = cell.words[w].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (cell.stamp.load(std::memory_order_relaxed) != stamp)
+      return Result::kOverwritten;
+
+    uint64_t expected = Stamp(position, first);
+    if (stamp == 0 || stamp < expected) return Result::kPending;
+    if (stamp != expected) return Result::kOverwritten;
+    std::memcpy(output, words, kCellBytes);
+    return Result::kOk;
+  }
+
+  // The record that starts at the position.
+  Result Fetch(uint64_t position, std::string& record) const {
+    char cell[kCellBytes];
+    Result result = Copy(position, true, cell);
+    if (result != Result::kOk) return result;
+
+    uint64_t size = 0;
+    std::memcpy(&size, cell, sizeof(size));
+    if (size == 0 || Cells(size) > capacity_ / 4) return Result::kOverwritten;
+    std::string bytes(cell, kCellBytes);
+    bytes.resize(Cells(size) * kCellBytes);
+    for (size_t i = 1; i < Cells(size); ++i) {
+      result = Copy(position + i, false, bytes.data() + i * kCellBytes);
+      if (result != Result::kOk) return result;
+    }
+    record.assign(bytes, sizeof(size), size);
+    return Result::kOk;
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_CHANGE_BUS_H_
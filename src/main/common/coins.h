@@ -0,0 +1,77 @@
+#ifndef A6_SRC_MAIN_COMMON_COINS_H_
+#define A6_SRC_MAIN_COMMON_COINS_H_
+
+#include <string>
+
+#include "storage_observer.h"
+
+namespace s21 {
+
+enum class CoinsStatus {
+  kOk,
+  kNotFound,   // one of the keys doesn't exist
+  kNotNumber,  // stored coins are not an integer
+  kOverflow,   // the new balance doesn't fit into long long
+  kOverdraft   // the balance would become negative
+};
+
+// Balance arithmetic shared by the engines. They look the values up and
+// call these under their lock, so a whole operation is atomic. Changed
+// values are reported to the observer as updates.
+class Coins {
+ public:
+  using K = std::string;
+  using V = Person;
+
+  static CoinsStatus IncrementBy(const K& key, V* value, long long delta,
+                                 StorageObserver& observer,
+                                 long long& balance) {
+    if (!value) return CoinsStatus::kNotFound;
+
+    CoinsStatus status = Add(*value, delta, balance);
+    if (status == CoinsStatus::kOk) Store(key, *value, balance, observer);
+    return status;
+  }
+
+  // Moves amount coins from source to target. Both keys are checked
+  // before anything changes, so a failed transfer leaves both untouched.
+  static CoinsStatus Transfer(const K& from, V* source, const K& to,
+                              V* target, long long amount,
+                              StorageObserver& observer) {
+    if (!source || !target) return CoinsStatus::kNotFound;
+    if (amount < 0) return CoinsStatus::kOverdraft;
+
+    long long debit = 0, credit = 0;
+    CoinsStatus status = Add(*source, -amount, debit);
+    if (status != CoinsStatus::kOk) return status;
+    if (source == target) return CoinsStatus::kOk;
+
+    status = Add(*target, amount, credit);
+    if (status != CoinsStatus::kOk) return status;
+
+    Store(from, *source, debit, observer);
+    Store(to, *target, credit, observer);
+    return CoinsStatus::kOk;
+  }
+
+  // The balance the value would have after adding delta.
+  static CoinsStatus Add(const V& value, long long delta, long long& result) {
+    long long coins = 0;
+    if (!V::ParseNumber(value.coins, coins)) return CoinsStatus::kNotNumber;
+    if (__builtin_add_overflow(coins, delta, &result))
+      return CoinsStatus::kOverflow;
+    return result < 0 ? CoinsStatus::kOverdraft : CoinsStatus::kOk;
+  }
+
+ private:
+  static void Store(const K& key, V& value, long long balance,
+                    StorageObserver& observer) {
+    observer.OnBeforeUpdate(key, value);
+    value.coins = std::to_string(balance);
+    observer.OnAfterUpdate(key, value);
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_COINS_H_
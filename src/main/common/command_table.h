@@ -0,0 +1,189 @@
+#ifndef A6_SRC_MAIN_COMMON_COMMAND_TABLE_H_
+#define A6_SRC_MAIN_COMMON_COMMAND_TABLE_H_
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace s21 {
+
+// The commands of the console and of the server mode.
+enum class CommandId : uint8_t {
+  kUnknown,
+  kQuit,
+  kSet,
+  kGet,
+  kExists,
+  kDel,
+  kUpdate,
+  kMSet,
+  kMGet,
+  kMExists,
+  kMDel,
+  kIncrBy,
+  kDecrBy,
+  kTransfer,
+  kKeys,
+  kRename,
+  kTtl,
+  kFind,
+  kCount,
+  kIndex,
+  kShowAll,
+  kAggregate,
+  kView,
+  kUpload,
+  kExport,
+  kSave,
+  kLoad,
+  kBackgroundSave,
+  kLastSave,
+  kRewriteLog,
+  kCheckpoint,
+  kRole,
+  kPing,
+  kSubscribe,
+  kUnsubscribe,
+  kWatch,
+  kUnwatch,
+  kMulti,
+  kExec,
+  kDiscard,
+  kSync,
+  kAck,
+  kShutdown
+};
+
+// Finds a command by its name in any case without copying the name. The
+// length and three letters of the name hash it to a slot of a table where
+// no two names meet, one comparison then confirms it. A new name that
+// collides stops the build, the hash needs other factors then.
+class CommandTable {
+ public:
+  static CommandId Find(std::string_view name);
+
+  // Commands that change the keys or the values.
+  static bool IsWrite(CommandId id) {
+    switch (id) {
+      case CommandId::kSet:
+      case CommandId::kDel:
+      case CommandId::kUpdate:
+      case CommandId::kMSet:
+      case CommandId::kMDel:
+      case CommandId::kIncrBy:
+      case CommandId::kDecrBy:
+      case CommandId::kTransfer:
+      case CommandId::kRename:
+      case CommandId::kUpload:
+      case CommandId::kLoad:
+      case CommandId::kExec:
+      case CommandId::kRewriteLog:
+      case CommandId::kCheckpoint:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+ private:
+  struct Entry {
+    std::string_view name;
+    CommandId id;
+  };
+
+  static constexpr size_t kSlots = 128;
+
+  // The first entry is what an empty slot points to.
+  static constexpr Entry kEntries[] = {
+      {"", CommandId::kUnknown},
+      {"Q", CommandId::kQuit},
+      {"QUIT", CommandId::kQuit},
+      {"SET", CommandId::kSet},
+      {"GET", CommandId::kGet},
+      {"EXISTS", CommandId::kExists},
+      {"DEL", CommandId::kDel},
+      {"UPDATE", CommandId::kUpdate},
+      {"MSET", CommandId::kMSet},
+      {"MGET", CommandId::kMGet},
+      {"MEXISTS", CommandId::kMExists},
+      {"MDEL", CommandId::kMDel},
+      {"INCRBY", CommandId::kIncrBy},
+      {"DECRBY", CommandId::kDecrBy},
+      {"TRANSFER", CommandId::kTransfer},
+      {"KEYS", CommandId::kKeys},
+      {"RENAME", CommandId::kRename},
+      {"TTL", CommandId::kTtl},
+      {"FIND", CommandId::kFind},
+      {"COUNT", CommandId::kCount},
+      {"INDEX", CommandId::kIndex},
+      {"SHOWALL", CommandId::kShowAll},
+      {"AGG", CommandId::kAggregate},
+      {"VIEW", CommandId::kView},
+      {"UPLOAD", CommandId::kUpload},
+      {"EXPORT", CommandId::kExport},
+      {"SAVE", CommandId::kSave},
+      {"LOAD", CommandId::kLoad},
+      {"BGSAVE", CommandId::kBackgroundSave},
+      {"LASTSAVE", CommandId::kLastSave},
+      {"BGREWRITEAOF", CommandId::kRewriteLog},
+      {"CHECKPOINT", CommandId::kCheckpoint},
+      {"ROLE", CommandId::kRole},
+      {"PING", CommandId::kPing},
+      {"SUBSCRIBE", CommandId::kSubscribe},
+      {"UNSUBSCRIBE", CommandId::kUnsubscribe},
+      {"WATCH", CommandId::kWatch},
+      {"UNWATCH", CommandId::kUnwatch},
+      {"MULTI", CommandId::kMulti},
+      {"EXEC", CommandId::kExec},
+      {"DISCARD", CommandId::kDiscard},
+      {"SYNC", CommandId::kSync},
+      {"ACK", CommandId::kAck},
+      {"SHUTDOWN", CommandId::kShutdown}};
+
+  static constexpr char Upper(char c) {
+    return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+  }
+
+  static constexpr size_t Hash(std::string_view name) {
+    size_t second = name.size() > 1 ? Upper(name[1]) : 0;
+    return (Upper(name.front()) + second + 11 * Upper(name.back()) +
+            9 * name.size()) %
+           kSlots;
+  }
+
+  // The name in any case against an upper-case one.
+  static constexpr bool Equals(std::string_view name, std::string_view upper) {
+    if (name.size() != upper.size()) return false;
+    for (size_t i = 0; i < name.size(); ++i)
+      if (Upper(name[i]) != upper[i]) return false;
+    return true;
+  }
+
+  static constexpr std::array<uint8_t, kSlots> Slots() {
+    std::array<uint8_t, kSlots> slots{};
+    for (size_t i = 1; i < std::size(kEntries); ++i)
+      slots[Hash(kEntries[i].name)] = i;
+    return slots;
+  }
+
+  static constexpr bool IsPerfect() {
+    for (size_t i = 1; i < std::size(kEntries); ++i)
+      for (size_t j = 1; j < i; ++j)
+        if (Hash(kEntries[i].name) == Hash(kEntries[j].name)) return false;
+    return true;
+  }
+};
+
+// Out of the class, where its constexpr members can run.
+inline CommandId CommandTable::Find(std::string_view name) {
+  static_assert(IsPerfect(), "two commands hash to the same slot");
+  static constexpr std::array<uint8_t, kSlots> slots = Slots();
+
+  if (name.empty()) return CommandId::kUnknown;
+  Entry const& entry = kEntries[slots[Hash(name)]];
+  return Equals(name, entry.name) ? entry.id : CommandId::kUnknown;
+}
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_COMMAND_TABLE_H_
@@ -2,21 +2,37 @@
 #define A6_SRC_MAIN_COMMON_CONSOLE_H_
 
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "tokenizer.h"
+
 namespace s21 {
 
 class Console {
  public:
+  // Without a terminal there are no prompts and no colors, and the output
+  // is only flushed when its buffer fills up. Call it before any other
+  // input or output.
+  static void UsePlainOutput() {
+    Plain() = true;
+    std::ios::sync_with_stdio(false);
+    std::cin.tie(nullptr);
+  }
+
   static void Write(const std::string& text) {
-    std::cout << "\033[0;32m" << text << "\033[0m";
+    if (Plain())
+      std::cout << text;
+    else
+      std::cout << "\033[0;32m" << text << "\033[0m";
   }
 
   static void WriteLine(const std::string& text) { Write(text + "\n"); }
 
   static void Info(const std::string& message) {
-    std::cout << "\033[0;36m" << message << "\033[0m";
+    if (!Plain()) std::cout << "\033[0;36m" << message << "\033[0m";
   }
 
   static int ReadInt(const std::string& message) {
@@ -30,7 +46,17 @@ class Console {
   }
 
   static void Error(const std::string& message) {
-    std::cout << "\033[0;31m[ERROR]\033[0m - " << message << std::endl;
+    if (Plain())
+      std::cout << "[ERROR] - " << message << '\n';
+    else
+      std::cout << "\033[0;31m[ERROR]\033[0m - " << message << std::endl;
+  }
+
+  // Goes to stderr, apart from the output of the commands, after that
+  // output.
+  static void Note(const std::string& message) {
+    std::cout.flush();
+    std::cerr << message << std::endl;
   }
 
   static std::string ReadLine(const std::string& message) {
@@ -40,22 +66,27 @@ class Console {
     return result;
   }
 
-  static std::vector<std::string> ReadTokens(const std::string& message) {
-    std::string line = ReadLine(message);
-
-    std::vector<std::string> tokens;
-    tokens.reserve(10);
-    std::stringstream stream(line);
-    std::string token;
-    while (getline(stream, token, ' ')) tokens.push_back(token);
-
-    return tokens;
+  // Reads a line of tokens into the strings, reusing their buffers. False
+  // once the input has ended.
+  static bool ReadTokens(const std::string& message,
+                         std::vector<std::string>& tokens) {
+    Info(message);
+    static Tokenizer tokenizer;
+    bool read = tokenizer.Read(std::cin);
+    tokenizer.CopyTo(tokens);
+    return read;
   }
 
   static void ClearInput() {
     std::cin.clear();
     std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
   }
+
+ private:
+  static bool& Plain() {
+    static bool plain = false;
+    return plain;
+  }
 };
 
 }  // namespace s21
@@ -0,0 +1,19 @@
+#ifndef A6_SRC_MAIN_COMMON_EXPIRATION_H_
+#define A6_SRC_MAIN_COMMON_EXPIRATION_H_
+
+#include <memory>
+#include <string>
+
+namespace s21 {
+
+// Pending TTL deletion of a key. The AsyncPool task reads the key through
+// the shared holder under the storage lock, so RENAME retargets the timer
+// by rewriting the key instead of cancelling it and scheduling a new one.
+struct Expiration {
+  size_t task_id;
+  std::shared_ptr<std::string> key;
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_EXPIRATION_H_
@@ -0,0 +1,140 @@
+#ifndef A6_SRC_MAIN_COMMON_EXPORT_WRITER_H_
+#define A6_SRC_MAIN_COMMON_EXPORT_WRITER_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parallel_loader.h"
+#include "person.h"
+#include "timer.h"
+
+namespace s21 {
+
+// Outcome of a chunked Export.
+struct ExportStats {
+  int lines = 0;
+  int chunks = 0;
+  nanoseconds max_lock_hold{0};
+};
+
+// Writes records in the Upload/Export format. Lines are formatted by hand
+// into a large buffer that goes to the file in one write call once it
+// fills up, instead of going through std::ofstream a field at a time. Add
+// never touches the file, so a caller holding a lock can leave the write
+// to Spill after releasing it.
+class ExportWriter {
+ public:
+  static constexpr size_t kBufferSize = 4 << 20;
+
+  explicit ExportWriter(const std::string& filename)
+      : fd_(::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) {
+    buffer_.reserve(kBufferSize + 4096);
+  }
+
+  ~ExportWriter() { Finish(); }
+
+  ExportWriter(const ExportWriter&) = delete;
+  ExportWriter(ExportWriter&&) = delete;
+  void operator=(const ExportWriter&) = delete;
+  void operator=(ExportWriter&&) = delete;
+
+  bool IsOpen() const { return fd_ >= 0; }
+  int Count() const { return count_; }
+
+  // Same text as `stream << key << " " << value << std::endl`.
+  void Add(const std::string& key, const Person& value) {
+    buffer_.append(key);
+    buffer_.push_back(' ');
+    Quote(value.last_name);
+    buffer_.push_back(' ');
+    Quote(value.first_name);
+    buffer_.push_back(' ');
+    buffer_.append(value.birthday);
+    buffer_.push_back(' ');
+    Quote(value.city);
+    buffer_.push_back(' ');
+    buffer_.append(value.coins);
+    buffer_.push_back('\n');
+    ++count_;
+  }
+
+  // Sharded export: task(i, writer) fills shard i, each shard on its own
+  // thread, shard i goes to "<manifest>.i" and the manifest lists them
+  // for Upload. Returns the number of records or 0 if a file can't be
+  // written.
+  template <class Task>
+  static int Shards(const std::string& manifest, size_t shards,
+                    Task const& task) {
+    std::ofstream file(manifest, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return 0;
+
+    std::string name = manifest.substr(manifest.rfind('/') + 1);
+    std::vector<int> counts(shards, -1);
+    ParallelLoader::Run(shards, shards, [&](size_t i) {
+      ExportWriter writer(manifest + "." + std::to_string(i));
+      if (!writer.IsOpen()) return;
+      task(i, writer);
+      if (writer.Finish()) counts[i] = writer.Count();
+    });
+
+    int result = 0;
+    file << ParallelLoader::kManifest;
+    for (size_t i = 0; i < shards; ++i) {
+      if (counts[i] < 0) return 0;
+      result += counts[i];
+      file << name << "." << i << "\n";
+    }
+    file.flush();
+    return file ? result : 0;
+  }
+
+  // Writes the buffer out once it is full.
+  void Spill() {
+    if (buffer_.size() >= kBufferSize) Flush();
+  }
+
+  // Writes out the buffer and closes the file, returns false if any write
+  // failed.
+  bool Finish() {
+    if (fd_ < 0) return ok_;
+    Flush();
+    ok_ = ::close(fd_) == 0 && ok_;
+    fd_ = -1;
+    return ok_;
+  }
+
+ private:
+  int fd_;
+  std::string buffer_;
+  int count_ = 0;
+  bool ok_ = true;
+
+  // std::quoted: the delimiter and the escape character get a backslash.
+  void Quote(std::string_view text) {
+    buffer_.push_back('"');
+    for (char c : text) {
+      if (c == '"' || c == '\\') buffer_.push_back('\\');
+      buffer_.push_back(c);
+    }
+    buffer_.push_back('"');
+  }
+
+  void Flush() {
+    std::string_view data = buffer_;
+    while (ok_ && !data.empty()) {
+      ssize_t written = ::write(fd_, data.data(), data.size());
+      ok_ = written >= 0;
+      if (ok_) data.remove_prefix(written);
+    }
+    buffer_.clear();
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_EXPORT_WRITER_H_
@@ -0,0 +1,379 @@
+#ifndef A6_SRC_MAIN_COMMON_IO_RING_H_
+#define A6_SRC_MAIN_COMMON_IO_RING_H_
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace s21 {
+
+// io_uring on the bare system calls: operations are queued into the
+// submission ring in shared memory and go to the kernel in one
+// io_uring_enter together with the wait for their completions. A ring
+// belongs to one thread.
+class IoRing {
+ public:
+  explicit IoRing(unsigned entries) {
+    io_uring_params params{};
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) return;
+
+    // One mapping for both rings (5.4) and waits with a timeout (5.11).
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG)) {
+      Close();
+      return;
+    }
+
+    ring_size_ =
+        std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring_ = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+      if (sqes != MAP_FAILED) ::munmap(sqes, sqes_size_);
+      Close();
+      return;
+    }
+
+    char* base = static_cast<char*>(ring_);
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+    sq_entries_ = params.sq_entries;
+    sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    tail_ = *sq_tail_;
+  }
+
+  ~IoRing() {
+    if (sqes_) ::munmap(sqes_, sqes_size_);
+    Close();
+  }
+
+  IoRing(const IoRing&) = delete;
+  IoRing(IoRing&&) = delete;
+  void operator=(const IoRing&) = delete;
+  void operator=(IoRing&&) = delete;
+
+  bool IsOpen() const { return fd_ >= 0; }
+
+  // Whether the kernel lets the process set up a ring, it may be missing
+  // or forbidden by a seccomp profile.
+  static bool Supported() {
+    static const bool supported = IoRing(2).IsOpen();
+    return supported;
+  }
+
+  // The operations queue a request, `tag` comes back with its completion.
+  // They return false only if the ring is broken.
+  bool Accept(int fd, uint64_t tag) {
+    io_uring_sqe* sqe = Prepare(IORING_OP_ACCEPT, fd, nullptr, 0, 0, tag);
+    if (sqe) sqe->accept_flags = SOCK_CLOEXEC;
+    return sqe;
+  }
+
+  bool Recv(int fd, char* buffer, size_t size, uint64_t tag) {
+    return Prepare(IORING_OP_RECV, fd, buffer, size, 0, tag);
+  }
+
+  bool Send(int fd, const char* data, size_t size, uint64_t tag) {
+    io_uring_sqe* sqe = Prepare(IORING_OP_SEND, fd, data, size, 0, tag);
+    if (sqe) sqe->msg_flags = MSG_NOSIGNAL;
+    return sqe;
+  }
+
+  bool Write(int fd, const char* data, size_t size, uint64_t offset,
+             uint64_t tag) {
+    return Prepare(IORING_OP_WRITE, fd, data, size, offset, tag);
+  }
+
+  // fdatasync, started once every request queued before it is complete.
+  bool Sync(int fd, uint64_t tag) {
+    io_uring_sqe* sqe = Prepare(IORING_OP_FSYNC, fd, nullptr, 0, 0, tag);
+    if (!sqe) return false;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->flags |= IOSQE_IO_DRAIN;
+    return true;
+  }
+
+  bool Cancel(uint64_t target, uint64_t tag) {
+    io_uring_sqe* sqe =
+        Prepare(IORING_OP_ASYNC_CANCEL, -1, nullptr, 0, 0, tag);
+    if (sqe) sqe->addr = target;
+    return sqe;
+  }
+
+  // Hands the queued requests to the kernel and waits until `wait` of
+  // them are complete or `timeout_ms` passes, -1 waits without a limit.
+  // False only on an error of the ring itself.
+  bool Submit(unsigned wait = 0, int timeout_ms = -1) {
+    if (fd_ < 0) return false;
+    unsigned submit = tail_ - *sq_tail_;
+    if (!submit && !wait) return true;
+    __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    __kernel_timespec timeout{timeout_ms / 1000,
+                              (timeout_ms % 1000) * 1000000LL};
+    io_uring_getevents_arg arg{};
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    bool timed = wait && timeout_ms >= 0;
+    if (timed) flags |= IORING_ENTER_EXT_ARG;
+
+    while (true) {
+      long result = ::syscall(__NR_io_uring_enter, fd_, submit, wait, flags,
+                              timed ? &arg : nullptr, timed ? sizeof(arg) : 0);
+      if (result >= 0 || errno == ETIME || errno == EINTR) return true;
+      if (errno != EAGAIN && errno != EBUSY) return false;
+      // The completion ring is full, the caller has to reap first.
+      if (Ready()) return true;
+    }
+  }
+
+  bool Ready() const {
+    return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  }
+
+  // Calls f(tag, result) for every completion there is, the result is
+  // what the system call would return, or -errno.
+  template <class F>
+  size_t Reap(F const& f) {
+    size_t count = 0;
+    while (Ready()) {
+      unsigned head = *cq_head_;
+      io_uring_cqe const& cqe = cqes_[head & cq_mask_];
+      uint64_t tag = cqe.user_data;
+      int result = cqe.res;
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      f(tag, result);
+      ++count;
+    }
+    return count;
+  }
+
+ private:
+  int fd_ = -1;
+  void* ring_ = MAP_FAILED;
+  size_t ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+  unsigned tail_ = 0;  // queued, published to the kernel by Submit
+
+  void Close() {
+    if (ring_ != MAP_FAILED) ::munmap(ring_, ring_size_);
+    ring_ = MAP_FAILED;
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+  }
+
+  // A cleared request in the next free slot, the queued ones go to the
+  // kernel first if the ring is full.
+  io_uring_sqe* Prepare(uint8_t op, int fd, const void* address,
+                        size_t size, uint64_t offset, uint64_t tag) {
+    if (fd_ < 0) return nullptr;
+    if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_ &&
+        (!Submit() ||
+         tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_))
+      return nullptr;
+
+    unsigned index = tail_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(address);
+    sqe->len = static_cast<uint32_t>(size);
+    sqe->off = offset;
+    sqe->user_data = tag;
+    sq_array_[index] = index;
+    ++tail_;
+    return sqe;
+  }
+};
+
+enum class IoBackend {
+  kPosix,  // epoll and write(2)
+  kUring
+};
+
+// The backend the server loop, the log and the snapshots use, chosen at
+// startup.
+inline std::atomic<IoBackend>& ChosenIoBackend() {
+  static std::atomic<IoBackend> backend = IoBackend::kPosix;
+  return backend;
+}
+
+// The chosen backend, kPosix where the kernel has no usable io_uring.
+inline IoBackend CurrentIoBackend() {
+  return ChosenIoBackend() == IoBackend::kUring && IoRing::Supported()
+             ? IoBackend::kUring
+             : IoBackend::kPosix;
+}
+
+// Sequential output to a file that it doesn't own. With write(2) every
+// Write goes out before it returns. Through a ring up to kDepth buffers
+// are in flight, so the caller fills the next one meanwhile, and a Flush
+// with a sync costs one system call.
+class FileOutput {
+ public:
+  static constexpr size_t kDepth = 4;
+
+  FileOutput(int fd, IoBackend backend) : fd_(fd) {
+    if (backend == IoBackend::kUring && fd >= 0) {
+      ring_ = std::make_unique<IoRing>(2 * kDepth);
+      if (!ring_->IsOpen()) ring_.reset();
+    }
+    off_t offset = fd >= 0 ? ::lseek(fd, 0, SEEK_CUR) : -1;
+    offset_ = offset < 0 ? 0 : offset;
+  }
+
+  ~FileOutput() { Flush(false); }
+
+  FileOutput(const FileOutput&) = delete;
+  FileOutput(FileOutput&&) = delete;
+  void operator=(const FileOutput&) = delete;
+  void operator=(FileOutput&&) = delete;
+
+  // Writes the data after everything written before. A file opened with
+  // O_APPEND must be flushed after every write, the kernel appends the
+  // writes in flight in any order.
+  void Write(std::string data) {
+    if (data.empty()) return;
+    if (!ring_) {
+      ok_ = WriteAll(data, offset_) && ok_;
+      offset_ += data.size();
+      return;
+    }
+
+    if (in_flight_.size() == kDepth) Wait(1);
+    in_flight_.push_back({std::move(data), offset_, ++writes_});
+    Buffer& buffer = in_flight_.back();
+    offset_ += buffer.data.size();
+    ok_ = ring_->Write(fd_, buffer.data.data(), buffer.data.size(),
+                       buffer.offset, buffer.tag) &&
+          ring_->Submit() && ok_;
+  }
+
+  // Waits for the writes in flight and syncs the data if asked to.
+  // Returns false if any write or the sync failed.
+  bool Flush(bool sync) {
+    if (fd_ < 0) return false;
+    if (!ring_) {
+      if (sync) ok_ = ::fdatasync(fd_) == 0 && ok_;
+      return ok_;
+    }
+
+    if (sync) {
+      ok_ = ring_->Sync(fd_, kSynced) && ok_;
+      synced_ = false;
+    }
+    Wait(0);
+    if (sync) {
+      while (!synced_ && ring_->Submit(1)) Reap();
+      ok_ = synced_ && ok_;
+    }
+    return ok_;
+  }
+
+ private:
+  static constexpr uint64_t kSynced = 0;  // writes are tagged from 1
+
+  struct Buffer {
+    std::string data;
+    uint64_t offset;
+    uint64_t tag;
+    int result = -1;
+    bool done = false;
+  };
+
+  int fd_;
+  std::unique_ptr<IoRing> ring_;
+  std::deque<Buffer> in_flight_;
+  uint64_t offset_ = 0;
+  uint64_t writes_ = 0;
+  bool ok_ = true;
+  bool synced_ = true;
+
+  bool WriteAll(std::string_view data, uint64_t offset) {
+    while (!data.empty()) {
+      ssize_t written = ::pwrite(fd_, data.data(), data.size(), offset);
+      if (written < 0 && errno == EINTR) continue;
+      if (written <= 0) return false;
+      data.remove_prefix(written);
+      offset += written;
+    }
+    return true;
+  }
+
+  // Waits until at most `left` writes are in flight. Writes complete in
+  // any order, the finished ones at the front are retired, and the rest
+  // of a short write goes out with pwrite.
+  void Wait(size_t left) {
+    while (in_flight_.size() > left) {
+      while (!in_flight_.empty() && in_flight_.front().done) {
+        Buffer& buffer = in_flight_.front();
+        size_t written = buffer.result < 0 ? 0 : buffer.result;
+        ok_ = buffer.result >= 0 &&
+              (written == buffer.data.size() ||
+               WriteAll(std::string_view(buffer.data).substr(written),
+                        buffer.offset + written)) &&
+              ok_;
+        in_flight_.pop_front();
+      }
+      if (in_flight_.size() <= left) return;
+      if (!ring_->Submit(1)) {
+        ok_ = false;
+        return;
+      }
+      Reap();
+    }
+  }
+
+  void Reap() {
+    ring_->Reap([&](uint64_t tag, int result) {
+      if (tag == kSynced) {
+        synced_ = result == 0;
+        return;
+      }
+      for (Buffer& buffer : in_flight_) {
+        if (buffer.tag != tag) continue;
+        buffer.done = true;
+        buffer.result = result;
+      }
+    });
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_IO_RING_H_
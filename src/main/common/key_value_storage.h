@@ -1,9 +1,20 @@
 #ifndef A6_SRC_MAIN_COMMON_KEY_VALUE_STORAGE_H_
 #define A6_SRC_MAIN_COMMON_KEY_VALUE_STORAGE_H_
 
+#include <functional>
+#include <utility>
 #include <vector>
 
+#include "aggregate.h"
+#include "bitmap_index.h"
+#include "coins.h"
+#include "export_writer.h"
+#include "materialized_views.h"
 #include "person.h"
+#include "read_handle.h"
+#include "snapshot.h"
+#include "storage_observer.h"
+#include "watch_table.h"
 
 namespace s21 {
 
@@ -11,10 +22,12 @@ class KeyValueStorage {
  public:
   using K = std::string;
   using V = Person;
+  using Visitor = std::function<void(const K&, const V&)>;
 
   virtual ~KeyValueStorage() = default;
 
   virtual bool Set(const K& key, const V& value, int lifetime = -1) = 0;
+  virtual bool Set(K&& key, V&& value, int lifetime = -1) = 0;
   virtual V Get(const K& key) const = 0;
   virtual bool Exists(const K& key) const = 0;
   virtual bool Delete(const K& key) = 0;
@@ -23,9 +36,79 @@ class KeyValueStorage {
   virtual bool Rename(const K& from, const K& to) = 0;
   virtual int Ttl(const K& key) const = 0;
   virtual std::vector<K> Find(const V& value) const = 0;
+  virtual size_t Count(const V& value) const = 0;
   virtual std::vector<V> ShowAll() const = 0;
-  virtual int Upload(const std::string& filename) = 0;
+  virtual GroupedStats Aggregate(const V& filter, GroupBy group_by) const = 0;
+  virtual bool Visit(const K& key,
+                     const std::function<void(const V&)>& visitor) const = 0;
+  virtual ReadHandle Read(const K& key) const = 0;
+  virtual void ForEach(const Visitor& visitor) const = 0;
+  virtual CoinsStatus IncrementBy(const K& key, long long delta,
+                                  long long& balance) = 0;
+  virtual CoinsStatus Transfer(const K& from, const K& to,
+                               long long amount) = 0;
+  virtual int MSet(const std::vector<std::pair<K, V>>& items) = 0;
+  virtual std::vector<V> MGet(const std::vector<K>& keys) const = 0;
+  virtual std::vector<bool> MExists(const std::vector<K>& keys) const = 0;
+  virtual int MDelete(const std::vector<K>& keys) = 0;
+  // Loads the records of the file, or of the shards a manifest lists, on
+  // `threads` threads, 0 means one per core. Keys that already exist keep
+  // their values, like with Set.
+  virtual int Upload(const std::string& filename, unsigned threads = 0) = 0;
   virtual int Export(const std::string& filename) const = 0;
+  // Writes the records to `shards` files at once, 0 means one per core,
+  // every thread owning a part of the storage, and a manifest that Upload
+  // takes to load the shards back in parallel.
+  virtual int ExportShards(const std::string& manifest,
+                           unsigned shards = 0) const = 0;
+  // Export that holds the lock for at most `chunk` records at a time, so
+  // writers get in between the chunks. The file is fuzzy: every key is in
+  // it at most once and the keys that live through the whole export are
+  // all there, but with whatever value they had when their chunk was read.
+  virtual ExportStats ExportInChunks(const std::string& filename,
+                                     size_t chunk = 1024) const = 0;
+
+  // Binary snapshots. Save writes every record with its TTL deadline, Load
+  // reads them like Upload does, expired records are skipped.
+  virtual SnapshotStatus Save(const std::string& filename, int& saved,
+                              bool compress = false) const = 0;
+  virtual SnapshotStatus Load(const std::string& filename, int& loaded,
+                              unsigned threads = 0,
+                              LoadTimings* timings = nullptr) = 0;
+  // Writes the snapshot from a forked child, the storage is locked only
+  // for the fork. Returns the child pid or -1, Snapshot::Poll tells how
+  // the save ended.
+  virtual pid_t SaveInBackground(const std::string& filename,
+                                 bool compress = false) const = 0;
+  // TTL deadlines of the keys that have one, see Snapshot.
+  virtual Snapshot::Deadlines Deadlines() const = 0;
+  // Adds every record to the writer without locking anything, for callers
+  // that keep the storage still: a forked child, or a sharded storage
+  // saving all of its shards into one snapshot.
+  virtual void Dump(Snapshot::Writer& writer,
+                    Snapshot::Deadlines const& deadlines) const = 0;
+
+  // Optimistic transactions: Watch returns the current version of the key,
+  // Atomically runs the body under the storage lock only if none of the
+  // watched keys changed since, and returns false otherwise.
+  virtual uint64_t Watch(const K& key) = 0;
+  virtual void Unwatch(const K& key) = 0;
+  virtual bool Atomically(const WatchedKeys& watched,
+                          const std::function<void()>& body) = 0;
+
+  virtual void Subscribe(StorageObserver* observer) = 0;
+  virtual void Unsubscribe(StorageObserver* observer) = 0;
+  virtual void CreateView(GroupBy group_by) = 0;
+  virtual GroupedTotals ReadView(GroupBy group_by) const = 0;
+  virtual void CreateIndex() = 0;
+  virtual size_t IndexMemoryUsage() const = 0;
+
+  // Builds the value from its fields right before it's moved into the
+  // storage, e.g. Emplace("key", "Ivanov", "Ivan", "1990", "Moscow", "5").
+  template <class... Args>
+  bool Emplace(K key, Args&&... fields) {
+    return Set(std::move(key), V{std::forward<Args>(fields)...});
+  }
 };
 
 }  // namespace s21
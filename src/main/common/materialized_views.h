@@ -0,0 +1,86 @@
+#ifndef A6_SRC_MAIN_COMMON_MATERIALIZED_VIEWS_H_
+#define A6_SRC_MAIN_COMMON_MATERIALIZED_VIEWS_H_
+
+#include <array>
+#include <memory>
+#include <unordered_map>
+
+#include "aggregate.h"
+#include "storage_observer.h"
+
+namespace s21 {
+
+struct Totals {
+  size_t count = 0;
+  long long sum = 0;
+};
+
+using GroupedTotals = std::map<std::string, Totals>;
+
+// Running COUNT/SUM of coins for every registered grouping. Each write
+// touches one row per registered view, so it costs O(1) regardless of the
+// storage size. MIN/MAX are not kept because a delete can't restore them
+// without a scan.
+class MaterializedViews : public StorageObserver {
+ public:
+  bool Contains(GroupBy group_by) const {
+    return views_[Index(group_by)] != nullptr;
+  }
+
+  void Create(GroupBy group_by, GroupedStats const& initial) {
+    auto view = std::make_unique<View>();
+    for (auto const& [group, stats] : initial)
+      (*view)[group] = Totals{stats.count, stats.sum};
+    views_[Index(group_by)] = std::move(view);
+  }
+
+  GroupedTotals Read(GroupBy group_by) const {
+    auto const& view = views_[Index(group_by)];
+    if (!view) return {};
+    return GroupedTotals(view->begin(), view->end());
+  }
+
+  void OnInsert(const K& key, const V& value) override { Apply(value, 1); }
+
+  void OnBeforeUpdate(const K& key, const V& value) override {
+    Apply(value, -1);
+  }
+
+  void OnAfterUpdate(const K& key, const V& value) override {
+    Apply(value, 1);
+  }
+
+  void OnErase(const K& key, const V& value) override { Apply(value, -1); }
+
+ private:
+  using View = std::unordered_map<std::string, Totals>;
+
+  std::array<std::unique_ptr<View>, 3> views_;
+
+  static size_t Index(GroupBy group_by) {
+    return static_cast<size_t>(group_by);
+  }
+
+  void Apply(const V& value, int sign) {
+    long long coins = Aggregator::ParseCoins(value.coins);
+
+    for (size_t i = 0; i < views_.size(); ++i) {
+      if (!views_[i]) continue;
+
+      View& view = *views_[i];
+      auto const& group =
+          Aggregator::GroupOf(value, static_cast<GroupBy>(i));
+
+      auto itr = view.find(group);
+      if (itr == view.end()) itr = view.emplace(group, Totals{}).first;
+
+      itr->second.count += sign;
+      itr->second.sum += sign * coins;
+      if (!itr->second.count) view.erase(itr);
+    }
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_MATERIALIZED_VIEWS_H_
@@ -0,0 +1,548 @@
+#ifndef A6_SRC_MAIN_COMMON_OP_LOG_H_
+#define A6_SRC_MAIN_COMMON_OP_LOG_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "io_ring.h"
+#include "key_value_storage.h"
+
+namespace s21 {
+
+enum class FsyncPolicy {
+  kAlways,    // Commit waits until the entries reach the disk
+  kEverySec,  // the writer syncs at most once a second
+  kNo         // the system decides when to flush
+};
+
+// Turns the storage mutations into log entries, each one an op byte and
+// its arguments, and hands them to Append. The append-only log and the
+// replication feed speak the same entries.
+class LogObserver : public StorageObserver {
+ public:
+  enum Op : char {
+    kSet,
+    kUpdate,
+    kDelete,
+    kRename,
+    kExpire,
+    kCheckpoint,
+    kHeartbeat  // only in the replication stream
+  };
+
+  // Applies entries, a Set followed by the Expire of its key is one Set
+  // with a lifetime, the only way to give a key a TTL. The shards append
+  // concurrently, so entries of other keys may come between the two; the
+  // Expire of a key already set then sets it again with the lifetime.
+  class Replayer {
+   public:
+    Replayer(KeyValueStorage* storage, std::string directory,
+             LoadTimings* timings)
+        : storage_(storage),
+          directory_(std::move(directory)),
+          timings_(timings) {}
+
+    // True once a checkpoint failed to load.
+    bool Broken() const { return broken_; }
+
+    bool Apply(std::string_view payload) {
+      char op = payload.front();
+      payload.remove_prefix(1);
+
+      K key, to;
+      V value;
+      uint64_t deadline = 0;
+      if (!Snapshot::GetString(payload, key)) return false;
+
+      if (op == kCheckpoint) {
+        Flush();
+        int loaded = 0;
+        broken_ = storage_->Load(directory_ + key, loaded, 0, timings_) !=
+                  SnapshotStatus::kOk;
+        return !broken_;
+      }
+
+      if (op == kExpire) {
+        if (!Snapshot::GetVarint(payload, deadline)) return false;
+        auto now = duration_cast<milliseconds>(
+            system_clock::now().time_since_epoch());
+        int64_t left = static_cast<int64_t>(deadline) - now.count();
+        if (set_ && set_->first == key) {
+          if (left > 0)
+            storage_->Set(std::move(set_->first), std::move(set_->second),
+                          (left + 999) / 1000);
+          set_.reset();
+        } else if (storage_->Exists(key)) {
+          V stored = storage_->Get(key);
+          storage_->Delete(key);
+          if (left > 0)
+            storage_->Set(std::move(key), std::move(stored),
+                          (left + 999) / 1000);
+        }
+        return true;
+      }
+
+      Flush();
+      if (op == kSet || op == kUpdate) {
+        if (!Snapshot::GetValue(payload, value)) return false;
+        if (op == kSet)
+          set_.emplace(std::move(key), std::move(value));
+        else
+          storage_->Update(key, value);
+      } else if (op == kDelete) {
+        storage_->Delete(key);
+      } else if (op == kRename) {
+        if (!Snapshot::GetString(payload, to)) return false;
+        storage_->Rename(key, to);
+      } else {
+        return false;
+      }
+      return true;
+    }
+
+    void Flush() {
+      if (set_) storage_->Set(std::move(set_->first), std::move(set_->second));
+      set_.reset();
+    }
+
+   private:
+    KeyValueStorage* storage_;
+    std::string directory_;
+    LoadTimings* timings_;
+    std::optional<std::pair<K, V>> set_;
+    bool broken_ = false;
+  };
+
+  // Adds the size and the checksum in front of the payload.
+  static void Frame(std::string& output, std::string const& payload) {
+    Snapshot::PutVarint(output, payload.size());
+    uint32_t crc = Snapshot::Crc32(payload);
+    for (int i = 0; i < 4; ++i) output.push_back(crc >> (8 * i));
+    output.append(payload);
+  }
+
+  // Takes the payload of the next entry, false at the end of the input or
+  // at an entry that is torn or damaged.
+  static bool NextEntry(std::string_view& input, std::string_view& payload) {
+    uint64_t size = 0;
+    if (!Snapshot::GetVarint(input, size) || !size || input.size() < size + 4)
+      return false;
+
+    uint32_t crc = 0;
+    for (int i = 0; i < 4; ++i)
+      crc |= uint32_t{static_cast<uint8_t>(input[i])} << (8 * i);
+    payload = input.substr(4, size);
+    if (Snapshot::Crc32(payload) != crc) return false;
+
+    input.remove_prefix(4 + size);
+    return true;
+  }
+
+  void OnInsert(const K& key, const V& value) override {
+    std::string entry(1, kSet);
+    Snapshot::PutString(entry, key);
+    Snapshot::PutValue(entry, value);
+    Append(entry);
+  }
+
+  void OnAfterUpdate(const K& key, const V& value) override {
+    std::string entry(1, kUpdate);
+    Snapshot::PutString(entry, key);
+    Snapshot::PutValue(entry, value);
+    Append(entry);
+  }
+
+  void OnErase(const K& key, const V& value) override {
+    std::string entry(1, kDelete);
+    Snapshot::PutString(entry, key);
+    Append(entry);
+  }
+
+  void OnRename(const K& from, const K& to) override {
+    std::string entry(1, kRename);
+    Snapshot::PutString(entry, from);
+    Snapshot::PutString(entry, to);
+    Append(entry);
+  }
+
+  void OnExpireAt(const K& key, uint64_t deadline) override {
+    std::string entry(1, kExpire);
+    Snapshot::PutString(entry, key);
+    Snapshot::PutVarint(entry, deadline);
+    Append(entry);
+  }
+
+ protected:
+  virtual void Append(std::string const& payload) = 0;
+};
+
+// Append-only log of the storage mutations:
+//   file  := "S21AOF" version:u8 entry*
+//   entry := varint(size) crc32:u32le op:u8 arguments
+// A checkpointed log starts with an entry that names a snapshot next to
+// it, the rest of the log is the tail written after the snapshot.
+// It observes the storage, so entries are appended under the storage lock
+// in the order the mutations happen, including bulk loads, coins updates
+// and expirations. Appending only copies bytes into a buffer, a writer
+// thread writes whatever piled up since its last write in one call, so
+// the writes and syncs of concurrent clients are committed as a group.
+class OpLog : public LogObserver {
+ public:
+  OpLog(const std::string& filename, FsyncPolicy policy)
+      : filename_(filename), policy_(policy) {
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) return;
+
+    size_ = ::lseek(fd_, 0, SEEK_END);
+    if (!size_) {
+      std::string header = Header();
+      WriteAll(fd_, header);
+      size_ = header.size();
+    }
+    checkpoint_ = CheckpointOf(filename);
+    base_size_ = size_;
+    writer_ = std::thread([this] { Write(); });
+  }
+
+  ~OpLog() {
+    {
+      std::scoped_lock<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    pending_cv_.notify_all();
+    if (writer_.joinable()) writer_.join();
+    if (rewriter_.joinable()) rewriter_.join();
+    if (fd_ >= 0) {
+      ::fdatasync(fd_);
+      ::close(fd_);
+    }
+  }
+
+  OpLog(const OpLog&) = delete;
+  OpLog(OpLog&&) = delete;
+  void operator=(const OpLog&) = delete;
+  void operator=(OpLog&&) = delete;
+
+  bool IsOpen() const { return fd_ >= 0; }
+  FsyncPolicy Policy() const { return policy_; }
+
+  // Applies the log to the storage, loading its checkpoint first, and cuts
+  // off a torn last entry. Returns the number of entries, or -1 if the file
+  // is not a log or its checkpoint can't be loaded.
+  static int Replay(const std::string& filename, KeyValueStorage* storage,
+                    LoadTimings* timings = nullptr) {
+    size_t valid = 0;
+    int result = 0;
+    {
+      MappedFile file(filename);
+      std::string_view text = file.Data();
+      if (text.empty()) return 0;
+
+      std::string header = Header();
+      if (text.substr(0, header.size()) != header) return -1;
+      valid = header.size();
+
+      Replayer replayer(storage, Directory(filename), timings);
+      std::string_view payload;
+      for (text.remove_prefix(valid); NextEntry(text, payload);) {
+        if (!replayer.Apply(payload)) break;
+        valid = file.Data().size() - text.size();
+        ++result;
+      }
+      if (replayer.Broken()) return -1;
+      replayer.Flush();
+
+      if (valid == file.Data().size()) return result;
+    }
+
+    if (::truncate(filename.c_str(), valid) != 0) return -1;
+    return result;
+  }
+
+  // Waits until everything appended so far is written, and synced with
+  // kAlways.
+  void Commit() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    uint64_t target = appended_;
+    pending_cv_.notify_one();
+    written_cv_.wait(lock, [&] { return written_ >= target || stop_; });
+  }
+
+  // True once the log has doubled since it was opened or rewritten.
+  bool NeedsRewrite(size_t min_size = 64 << 20) const {
+    std::scoped_lock<std::mutex> lock(mtx_);
+    return !rewriting_ && size_ >= min_size && size_ >= 2 * base_size_;
+  }
+
+  // Starts rewriting the log in the background as the shortest sequence of
+  // entries that builds the current storage. Returns false if a rewrite is
+  // already running. Entries appended meanwhile are kept aside and added
+  // to the new log before it replaces the old one.
+  bool Rewrite(KeyValueStorage* storage) {
+    return StartRewrite([this, storage] { return Dump(storage); });
+  }
+
+  // Rewrites the log in the background as a checkpoint: a snapshot of the
+  // storage written by a forked child, and a log that names it followed by
+  // the entries appended since the fork. Replay then loads the snapshot
+  // and goes through the tail only. False if a rewrite is already running.
+  bool Checkpoint(KeyValueStorage* storage) {
+    return StartRewrite([this, storage] { return Snap(storage); });
+  }
+
+  // Waits for a running rewrite or checkpoint, true if the last one
+  // replaced the log.
+  bool WaitRewrite() {
+    if (rewriter_.joinable()) rewriter_.join();
+    std::scoped_lock<std::mutex> lock(mtx_);
+    return rewritten_;
+  }
+
+ private:
+  // Base of a rewritten log and the snapshot it names, if any.
+  struct Base {
+    std::string log;
+    std::string checkpoint;
+  };
+
+  std::string filename_;
+  FsyncPolicy policy_;
+  int fd_ = -1;
+
+  // Guards the fields below, the writer and the rewriter take io_mtx_
+  // first whenever they touch the file.
+  mutable std::mutex mtx_;
+  std::mutex io_mtx_;
+  std::condition_variable pending_cv_;
+  std::condition_variable written_cv_;
+  std::string pending_;
+  std::string rewrite_buffer_;
+  uint64_t appended_ = 0;
+  uint64_t written_ = 0;
+  size_t size_ = 0;
+  size_t base_size_ = 0;
+  bool capturing_ = false;
+  bool rewriting_ = false;
+  bool rewritten_ = false;
+  bool stop_ = false;
+  std::string checkpoint_;
+
+  std::thread writer_;
+  std::thread rewriter_;
+
+  static std::string Header() { return std::string("S21AOF") + '\1'; }
+
+  static std::string Directory(const std::string& filename) {
+    return filename.substr(0, filename.rfind('/') + 1);
+  }
+
+  // Snapshot the log starts from, empty if it has none.
+  static std::string CheckpointOf(const std::string& filename) {
+    MappedFile file(filename);
+    std::string_view text = file.Data(), payload;
+    std::string header = Header(), result;
+    if (text.substr(0, header.size()) != header) return result;
+
+    text.remove_prefix(header.size());
+    if (NextEntry(text, payload) && payload.front() == kCheckpoint) {
+      payload.remove_prefix(1);
+      Snapshot::GetString(payload, result);
+    }
+    return result;
+  }
+
+  static bool WriteAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+      ssize_t written = ::write(fd, data.data(), data.size());
+      if (written < 0) return false;
+      data.remove_prefix(written);
+    }
+    return true;
+  }
+
+  void Append(std::string const& payload) override {
+    std::scoped_lock<std::mutex> lock(mtx_);
+    size_t before = pending_.size();
+    Frame(pending_, payload);
+    size_ += pending_.size() - before;
+    if (capturing_) rewrite_buffer_.append(pending_, before);
+    ++appended_;
+    pending_cv_.notify_one();
+  }
+
+  // With io_uring a batch and its sync go to the kernel in one call.
+  void Write() {
+    std::optional<FileOutput> output;
+    int output_fd = -1;
+    auto synced = Clock::now();
+    bool dirty = false;
+
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        pending_cv_.wait_for(lock, 1s,
+                             [&] { return stop_ || !pending_.empty(); });
+        if (stop_ && pending_.empty()) return;
+      }
+
+      std::scoped_lock<std::mutex> io(io_mtx_);
+      std::string batch;
+      uint64_t sequence = 0;
+      {
+        std::scoped_lock<std::mutex> lock(mtx_);
+        batch.swap(pending_);
+        sequence = appended_;
+      }
+
+      dirty = dirty || !batch.empty();
+      bool sync = dirty && (policy_ == FsyncPolicy::kAlways ||
+                            (policy_ == FsyncPolicy::kEverySec &&
+                             Clock::now() >= synced + 1s));
+      // A rewrite replaces the file.
+      if (output_fd != fd_) output.emplace(output_fd = fd_, CurrentIoBackend());
+      output->Write(std::move(batch));
+      output->Flush(sync);
+      if (sync) {
+        synced = Clock::now();
+        dirty = false;
+      }
+
+      std::scoped_lock<std::mutex> lock(mtx_);
+      written_ = std::max(written_, sequence);
+      written_cv_.notify_all();
+    }
+  }
+
+  template <class Make>
+  bool StartRewrite(Make make) {
+    {
+      std::scoped_lock<std::mutex> lock(mtx_);
+      if (rewriting_ || fd_ < 0) return false;
+      rewriting_ = true;
+    }
+
+    if (rewriter_.joinable()) rewriter_.join();
+    rewriter_ = std::thread([this, make] { Replace(make()); });
+    return true;
+  }
+
+  // Called under the storage lock, everything appended from now on goes
+  // to the new log too.
+  void StartCapturing() {
+    std::scoped_lock<std::mutex> lock(mtx_);
+    capturing_ = true;
+    rewrite_buffer_.clear();
+  }
+
+  // The shortest sequence of entries that builds the storage.
+  std::optional<Base> Dump(KeyValueStorage* storage) {
+    Base base{Header(), ""};
+    storage->Atomically({}, [&] {
+      StartCapturing();
+      auto now = duration_cast<milliseconds>(
+          system_clock::now().time_since_epoch());
+      storage->ForEach([&](const K& key, const V& value) {
+        std::string entry(1, kSet);
+        Snapshot::PutString(entry, key);
+        Snapshot::PutValue(entry, value);
+        Frame(base.log, entry);
+
+        int ttl = storage->Ttl(key);
+        if (ttl < 0) return;
+        entry.assign(1, kExpire);
+        Snapshot::PutString(entry, key);
+        Snapshot::PutVarint(entry, now.count() + ttl * 1000);
+        Frame(base.log, entry);
+      });
+    });
+    return base;
+  }
+
+  // A snapshot taken at the fork, synced, and the entry that names it.
+  // Every checkpoint gets a new file, the one the current log names stays
+  // until the new log replaces it.
+  std::optional<Base> Snap(KeyValueStorage* storage) {
+    auto now = duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch());
+    std::string name = filename_.substr(filename_.rfind('/') + 1) + "." +
+                       std::to_string(now.count()) + ".snap";
+    std::string path = Directory(filename_) + name;
+
+    pid_t pid = -1;
+    storage->Atomically({}, [&] {
+      StartCapturing();
+      pid = storage->SaveInBackground(path);
+    });
+
+    bool saved = pid > 0 && Snapshot::Poll(pid, true).value_or(false);
+    if (saved) {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      saved = fd >= 0 && ::fdatasync(fd) == 0;
+      if (fd >= 0) ::close(fd);
+    }
+    if (!saved) {
+      std::remove(path.c_str());
+      return std::nullopt;
+    }
+
+    Base base{Header(), name};
+    std::string entry(1, kCheckpoint);
+    Snapshot::PutString(entry, name);
+    Frame(base.log, entry);
+    return base;
+  }
+
+  void Replace(std::optional<Base> base) {
+    std::string temporary = filename_ + ".rewrite";
+    int fd = -1;
+    bool done = false;
+    if (base) {
+      fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                  0644);
+      done = fd >= 0 && WriteAll(fd, base->log) && ::fdatasync(fd) == 0;
+    }
+
+    std::scoped_lock<std::mutex> io(io_mtx_);
+    std::scoped_lock<std::mutex> lock(mtx_);
+
+    // Everything appended since the base was taken, including the pending
+    // entries, goes to the new log, the old one is left as it is.
+    done = done && WriteAll(fd, rewrite_buffer_) && ::fdatasync(fd) == 0 &&
+           std::rename(temporary.c_str(), filename_.c_str()) == 0;
+    if (done) {
+      ::close(fd_);
+      fd_ = fd;
+      base_size_ = size_ = base->log.size() + rewrite_buffer_.size();
+      pending_.clear();
+      written_ = appended_;
+      written_cv_.notify_all();
+
+      if (!checkpoint_.empty() && checkpoint_ != base->checkpoint)
+        std::remove((Directory(filename_) + checkpoint_).c_str());
+      checkpoint_ = base->checkpoint;
+    } else {
+      if (fd >= 0) ::close(fd);
+      std::remove(temporary.c_str());
+      if (base && !base->checkpoint.empty())
+        std::remove((Directory(filename_) + base->checkpoint).c_str());
+    }
+
+    capturing_ = false;
+    rewriting_ = false;
+    rewritten_ = done;
+    rewrite_buffer_.clear();
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_OP_LOG_H_
@@ -0,0 +1,180 @@
+#ifndef A6_SRC_MAIN_COMMON_PARALLEL_LOADER_H_
+#define A6_SRC_MAIN_COMMON_PARALLEL_LOADER_H_
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "record_parser.h"
+
+namespace s21 {
+
+// Front end of a parallel Upload. The file is cut into chunks at line
+// boundaries and every chunk is parsed on its own thread. The engines then
+// insert the records in their own way, but always so that the first
+// occurrence of a key wins, as it does with a serial Set loop.
+class ParallelLoader {
+ public:
+  using K = std::string;
+  using V = Person;
+  using Record = std::pair<K, V>;
+  using Chunks = std::vector<std::vector<Record>>;
+
+  // First line of the manifest of a sharded Export, every next line names
+  // a shard file relative to the manifest.
+  static constexpr std::string_view kManifest = "S21SHARDS\n";
+
+  // Number of threads to use, 0 means one per core.
+  static unsigned Threads(unsigned threads) {
+    if (threads) return threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Calls task(i) for every i in [0, count) on up to `threads` threads.
+  template <class Task>
+  static void Run(size_t count, unsigned threads, Task const& task) {
+    size_t workers = std::min<size_t>(count, threads);
+    if (workers < 2) {
+      for (size_t i = 0; i < count; ++i) task(i);
+      return;
+    }
+
+    std::vector<std::thread> pool;
+    for (size_t worker = 0; worker < workers; ++worker)
+      pool.emplace_back([&, worker] {
+        for (size_t i = worker; i < count; i += workers) task(i);
+      });
+    for (auto& thread : pool) thread.join();
+  }
+
+  // Records of the text, one vector per chunk in file order. If a chunk
+  // doesn't end cleanly, the text is malformed or a quoted field spans a
+  // cut, and it is parsed again in one piece to stop exactly where the
+  // serial parser stops.
+  static Chunks Parse(std::string_view text, unsigned threads) {
+    std::vector<std::string_view> parts = Split(text, threads);
+    Chunks chunks(parts.size());
+    std::vector<char> finished(parts.size());
+
+    Run(parts.size(), threads, [&](size_t i) {
+      RecordParser parser(parts[i]);
+      K key;
+      V value;
+      while (parser.Next(key, value))
+        chunks[i].emplace_back(std::move(key), std::move(value));
+      finished[i] = parser.Finished();
+    });
+
+    if (std::count(finished.begin(), finished.end(), 0) && parts.size() > 1) {
+      chunks.assign(1, {});
+      RecordParser::ParseAll(text, [&](K&& key, V&& value) {
+        chunks[0].emplace_back(std::move(key), std::move(value));
+      });
+    }
+    return chunks;
+  }
+
+  // Records of an Upload file, or of all the shards in the order the
+  // manifest lists them. False if a file can't be opened.
+  static bool Read(const std::string& filename, unsigned threads,
+                   Chunks& chunks) {
+    MappedFile file(filename);
+    if (!file.IsOpen()) return false;
+
+    std::string_view text = file.Data();
+    if (text.substr(0, kManifest.size()) != kManifest) {
+      chunks = Parse(text, threads);
+      return true;
+    }
+
+    std::string directory = filename.substr(0, filename.rfind('/') + 1);
+    std::vector<std::string> shards;
+    for (text.remove_prefix(kManifest.size()); !text.empty();) {
+      size_t end = std::min(text.find('\n'), text.size());
+      if (end) shards.push_back(directory + std::string(text.substr(0, end)));
+      text.remove_prefix(std::min(end + 1, text.size()));
+    }
+
+    // A shard is one chunk, parsed on its own thread.
+    chunks.assign(shards.size(), {});
+    std::vector<char> opened(shards.size());
+    Run(shards.size(), threads, [&](size_t i) {
+      MappedFile shard(shards[i]);
+      opened[i] = shard.IsOpen();
+      RecordParser::ParseAll(shard.Data(), [&](K&& key, V&& value) {
+        chunks[i].emplace_back(std::move(key), std::move(value));
+      });
+    });
+    return std::count(opened.begin(), opened.end(), 0) == 0;
+  }
+
+  static int Count(Chunks const& chunks) {
+    size_t result = 0;
+    for (auto const& chunk : chunks) result += chunk.size();
+    return result;
+  }
+
+  // Records ordered by key, only the first occurrence of every key is
+  // kept. Chunks are sorted in parallel and merged pairwise, the left run
+  // goes first so equal keys stay in file order.
+  static std::vector<Record*> SortedUnique(Chunks& chunks, unsigned threads) {
+    auto by_key = [](Record* left, Record* right) {
+      return left->first < right->first;
+    };
+
+    std::vector<std::vector<Record*>> runs(chunks.size());
+    Run(chunks.size(), threads, [&](size_t i) {
+      for (Record& record : chunks[i]) runs[i].push_back(&record);
+      std::stable_sort(runs[i].begin(), runs[i].end(), by_key);
+    });
+
+    while (runs.size() > 1) {
+      std::vector<std::vector<Record*>> merged((runs.size() + 1) / 2);
+      Run(merged.size(), threads, [&](size_t i) {
+        auto& left = runs[2 * i];
+        if (2 * i + 1 == runs.size()) {
+          merged[i] = std::move(left);
+          return;
+        }
+
+        auto& right = runs[2 * i + 1];
+        merged[i].resize(left.size() + right.size());
+        std::merge(left.begin(), left.end(), right.begin(), right.end(),
+                   merged[i].begin(), by_key);
+      });
+      runs = std::move(merged);
+    }
+
+    if (runs.empty()) return {};
+    auto& result = runs.front();
+    result.erase(std::unique(result.begin(), result.end(),
+                             [](Record* left, Record* right) {
+                               return left->first == right->first;
+                             }),
+                 result.end());
+    return std::move(result);
+  }
+
+ private:
+  // Up to `parts` pieces of the text, each one ends after a newline.
+  static std::vector<std::string_view> Split(std::string_view text,
+                                             size_t parts) {
+    std::vector<std::string_view> result;
+    size_t begin = 0;
+    for (size_t i = 1; i <= parts && begin < text.size(); ++i) {
+      size_t end = std::max(begin, text.size() / parts * i);
+      end = i == parts ? std::string_view::npos : text.find('\n', end);
+      end = end == std::string_view::npos ? text.size() : end + 1;
+      result.push_back(text.substr(begin, end - begin));
+      begin = end;
+    }
+    return result;
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_PARALLEL_LOADER_H_
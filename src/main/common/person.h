@@ -1,7 +1,10 @@
 #ifndef A6_SRC_MAIN_COMMON_PERSON_H_
 #define A6_SRC_MAIN_COMMON_PERSON_H_
 
+#include <charconv>
 #include <iomanip>
+#include <string_view>
+#include <utility>
 
 namespace s21 {
 
@@ -13,13 +16,44 @@ struct Person {
   std::string coins;
 
   bool operator==(const Person& other) const {
-    return (city == other.city || other.city == "-") &&
-           (last_name == other.last_name || other.last_name == "-") &&
-           (first_name == other.first_name || other.first_name == "-") &&
-           (birthday == other.birthday || other.birthday == "-") &&
-           (coins == other.coins || other.coins == "-");
+    return Matches(city, other.city) &&              //
+           Matches(last_name, other.last_name) &&    //
+           Matches(first_name, other.first_name) &&  //
+           Matches(birthday, other.birthday) &&      //
+           Matches(coins, other.coins);
   }
 
+  // "-" matches any value, "a|b" matches any of the alternatives and
+  // "lo..hi" matches the numbers from lo to hi inclusive.
+  static bool Matches(std::string_view value, std::string_view pattern) {
+    if (pattern == "-" || pattern == value) return true;
+
+    size_t bar = pattern.find('|');
+    if (bar != std::string_view::npos)
+      return Matches(value, pattern.substr(0, bar)) ||
+             Matches(value, pattern.substr(bar + 1));
+
+    long long number = 0, from = 0, to = 0;
+    size_t dots = pattern.find("..");
+    return dots != std::string_view::npos &&
+           ParseNumber(value, number) &&
+           ParseNumber(pattern.substr(0, dots), from) &&
+           ParseNumber(pattern.substr(dots + 2), to) &&  //
+           from <= number && number <= to;
+  }
+
+  static bool ParseNumber(std::string_view text, long long& number) {
+    auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), number);
+    return error == std::errc() && end == text.data() + text.size();
+  }
+
+  // The user-declared assignments below would otherwise suppress the
+  // implicit move constructor and turn every move into a copy.
+  Person() = default;
+  Person(const Person&) = default;
+  Person(Person&&) = default;
+
   Person& operator=(const Person& other) {
     city = (other.city == "-") ? city : other.city;
     last_name = (other.last_name == "-") ? last_name : other.last_name;
@@ -29,6 +63,15 @@ struct Person {
     return *this;
   }
 
+  Person& operator=(Person&& other) {
+    if (other.city != "-") city = std::move(other.city);
+    if (other.last_name != "-") last_name = std::move(other.last_name);
+    if (other.first_name != "-") first_name = std::move(other.first_name);
+    if (other.birthday != "-") birthday = std::move(other.birthday);
+    if (other.coins != "-") coins = std::move(other.coins);
+    return *this;
+  }
+
   friend std::ostream& operator<<(std::ostream& stream, const Person& data) {
     stream << std::quoted(data.last_name) << " "   // "LastName"
            << std::quoted(data.first_name) << " "  // "FirstName"
@@ -0,0 +1,31 @@
+#ifndef A6_SRC_MAIN_COMMON_READ_HANDLE_H_
+#define A6_SRC_MAIN_COMMON_READ_HANDLE_H_
+
+#include <mutex>
+
+#include "person.h"
+
+namespace s21 {
+
+// Reference to a stored value that keeps the storage locked while it is
+// alive, so the value can be read in place instead of being copied out.
+// An empty handle doesn't hold the lock.
+class ReadHandle {
+ public:
+  ReadHandle(std::unique_lock<std::recursive_mutex> lock, const Person* value)
+      : lock_(std::move(lock)), value_(value) {
+    if (!value_ && lock_.owns_lock()) lock_.unlock();
+  }
+
+  explicit operator bool() const { return value_ != nullptr; }
+  const Person& operator*() const { return *value_; }
+  const Person* operator->() const { return value_; }
+
+ private:
+  std::unique_lock<std::recursive_mutex> lock_;
+  const Person* value_ = nullptr;
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_READ_HANDLE_H_
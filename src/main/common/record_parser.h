@@ -0,0 +1,164 @@
+#ifndef A6_SRC_MAIN_COMMON_RECORD_PARSER_H_
+#define A6_SRC_MAIN_COMMON_RECORD_PARSER_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "person.h"
+
+namespace s21 {
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat info {};
+    if (::fstat(fd, &info) == 0) {
+      size_ = info.st_size;
+      open_ = true;
+      if (size_) {
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+          open_ = false;
+        } else {
+          data_ = static_cast<const char*>(data);
+          ::madvise(data, size_, MADV_SEQUENTIAL);
+        }
+      }
+    }
+
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_) ::munmap(const_cast<char*>(data_), size_);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile(MappedFile&&) = delete;
+  void operator=(const MappedFile&) = delete;
+  void operator=(MappedFile&&) = delete;
+
+  bool IsOpen() const { return open_; }
+  std::string_view Data() const { return {data_, data_ ? size_ : 0}; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool open_ = false;
+};
+
+// Parser of the Upload/Export format
+//   key "LastName" "FirstName" 1999 "City" 21
+// that accepts exactly what `stream >> key >> value` does: quoted fields
+// may be bare words and may contain \" and \\ escapes. Fields are built
+// straight from the input, an escape-free field is a single assign.
+class RecordParser {
+ public:
+  using K = std::string;
+  using V = Person;
+
+  explicit RecordParser(std::string_view text) : text_(text) {}
+
+  // Reads the next record, returns false at the end of the input or at
+  // the first malformed record, like a failed stream extraction.
+  bool Next(K& key, V& value) {
+    if (!SkipSpaces()) return false;
+
+    complete_ = Word(key) && Quoted(value.last_name) &&
+                Quoted(value.first_name) && Word(value.birthday) &&
+                Quoted(value.city) && Word(value.coins);
+    return complete_;
+  }
+
+  // True once the whole input is consumed and its last record was
+  // complete, with every quoted field closed. A chunk cut out of a file
+  // that isn't finished may have been split inside a record.
+  bool Finished() {
+    return complete_ && !unterminated_ && !SkipSpaces();
+  }
+
+  // Calls record(key, value) with rvalues for every record, returns the
+  // number of records read.
+  template <class Record>
+  static int ParseAll(std::string_view text, Record const& record) {
+    RecordParser parser(text);
+    int result = 0;
+    K key;
+    V value;
+    while (parser.Next(key, value)) {
+      record(std::move(key), std::move(value));
+      ++result;
+    }
+    return result;
+  }
+
+ private:
+  std::string_view text_;
+  size_t position_ = 0;
+  bool complete_ = true;
+  bool unterminated_ = false;
+
+  static bool IsSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+           c == '\f';
+  }
+
+  bool SkipSpaces() {
+    while (position_ < text_.size() && IsSpace(text_[position_])) ++position_;
+    return position_ < text_.size();
+  }
+
+  bool Word(std::string& result) {
+    if (!SkipSpaces()) return false;
+
+    size_t begin = position_;
+    while (position_ < text_.size() && !IsSpace(text_[position_])) ++position_;
+    result.assign(text_.data() + begin, position_ - begin);
+    return true;
+  }
+
+  bool Quoted(std::string& result) {
+    if (!SkipSpaces()) return false;
+    if (text_[position_] != '"') return Word(result);
+
+    const char* begin = text_.data() + position_ + 1;
+    const char* end = text_.data() + text_.size();
+    const char* quote =
+        static_cast<const char*>(std::memchr(begin, '"', end - begin));
+    const char* escape = static_cast<const char*>(
+        std::memchr(begin, '\\', (quote ? quote : end) - begin));
+
+    if (quote && !escape) {
+      result.assign(begin, quote);
+      position_ = quote + 1 - text_.data();
+      return true;
+    }
+
+    // Slow path with escapes, an unterminated string runs to the end of
+    // the input just like std::quoted.
+    result.clear();
+    const char* i = begin;
+    for (; i < end && *i != '"'; ++i) {
+      if (*i == '\\' && i + 1 < end) ++i;
+      result.push_back(*i);
+    }
+    unterminated_ = unterminated_ || i == end;
+    position_ = (i < end ? i + 1 : end) - text_.data();
+    return true;
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_RECORD_PARSER_H_
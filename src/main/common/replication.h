@@ -0,0 +1,551 @@
+#ifndef A6_SRC_MAIN_COMMON_REPLICATION_H_
+#define A6_SRC_MAIN_COMMON_REPLICATION_H_
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "op_log.h"
+#include "resp.h"
+#include "server.h"
+
+namespace s21 {
+
+// Log shipping from a leader to followers that run the same program.
+//
+// A follower connects to the server of the leader and sends
+//   SYNC <feed id> <offset>
+// naming the feed and the byte offset in it it has applied up to, "?" and
+// 0 the first time. If the leader still has the stream from there it
+// answers "+CONTINUE" and streams the entries that follow. Otherwise it
+// forks a snapshot of the storage, and answers
+//   +FULLSYNC <feed id> <offset> <entries>\r\n$<size>\r\n<snapshot>
+// followed by the entries appended since the fork. The stream is the
+// entries of the append-only log, and after every round of the server
+// that changed something a heartbeat entry with the number of entries so
+// far and the time. The follower applies the stream a round at a time,
+// at the heartbeats, and answers each of them with
+//   ACK <offset> <entries>
+// so the leader knows how far behind every follower is.
+class Replication {
+ public:
+  static uint64_t NowMs() {
+    return duration_cast<milliseconds>(
+               system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static std::string Heartbeat(uint64_t entries, uint64_t time) {
+    std::string entry(1, LogObserver::kHeartbeat);
+    Snapshot::PutVarint(entry, entries);
+    Snapshot::PutVarint(entry, time);
+    return entry;
+  }
+
+  // True if the input starts with an entry that has fully arrived but
+  // doesn't take, see LogObserver::NextEntry.
+  static bool Damaged(std::string_view input) {
+    uint64_t size = 0;
+    return Snapshot::GetVarint(input, size) &&
+           (!size || input.size() >= size + 4);
+  }
+};
+
+// The leader side: observes the storage and keeps the recent stream in a
+// backlog for followers that reconnect. Entries may come from any thread,
+// the rest is called from the server loop only.
+class ReplicationFeed : public LogObserver {
+ public:
+  // The backlog keeps at least this much of the stream.
+  static constexpr size_t kBacklog = 16 << 20;
+  // A follower that lets this much output pile up is dropped, it comes
+  // back later from the backlog or with a full sync.
+  static constexpr size_t kMaxUnsent = 64 << 20;
+
+  ReplicationFeed() {
+    std::random_device random;
+    char id[17];
+    std::snprintf(id, sizeof(id), "%08x%08x", random(), random());
+    id_ = id;
+  }
+
+  ~ReplicationFeed() {
+    for (auto& [client, follower] : followers_) Abandon(follower);
+  }
+
+  ReplicationFeed(const ReplicationFeed&) = delete;
+  ReplicationFeed(ReplicationFeed&&) = delete;
+  void operator=(const ReplicationFeed&) = delete;
+  void operator=(ReplicationFeed&&) = delete;
+
+  std::string const& Id() const { return id_; }
+
+  // Handles SYNC from a client, the feed must be subscribed to the
+  // storage. The reply goes to the output, or later from Ship when the
+  // snapshot of a full sync is ready. False if the arguments are wrong.
+  bool Attach(int client, std::vector<std::string> const& tokens,
+              KeyValueStorage* storage, std::string& output) {
+    if (tokens.size() != 3 || followers_.count(client)) return false;
+    uint64_t offset = 0;
+    if (!Parse(tokens[2], offset)) return false;
+
+    Follower follower;
+    std::string backlog;
+    {
+      std::scoped_lock<std::mutex> lock(mtx_);
+      if (tokens[1] == id_ && IsBeat(offset) && Tail(offset, backlog)) {
+        follower.acked = offset;
+        follower.acked_entries = EntriesAt(offset);
+        follower.sent = offset + backlog.size();
+      }
+    }
+    if (follower.sent) {
+      output += "+CONTINUE\r\n" + backlog;
+      followers_.emplace(client, follower);
+      return true;
+    }
+
+    // The snapshot shows the storage as of the offset, nothing changes it
+    // between the two.
+    follower.snapshot = (std::filesystem::temp_directory_path() /
+                         ("s21_sync." + std::to_string(::getpid()) + "." +
+                          std::to_string(client) + ".snap"))
+                            .string();
+    storage->Atomically({}, [&] {
+      std::scoped_lock<std::mutex> lock(mtx_);
+      EndRound();
+      follower.sent = follower.acked = end_;
+      follower.acked_entries = entries_;
+      follower.saving = storage->SaveInBackground(follower.snapshot);
+    });
+    if (follower.saving < 0) {
+      Resp::Error(output, "can't save a snapshot");
+      return true;
+    }
+    followers_.emplace(client, follower);
+    return true;
+  }
+
+  // Handles ACK from a follower, false if it isn't one.
+  bool Acknowledge(int client, std::vector<std::string> const& tokens) {
+    auto item = followers_.find(client);
+    uint64_t offset = 0, entries = 0;
+    if (item == followers_.end() || tokens.size() != 3 ||
+        !Parse(tokens[1], offset) || !Parse(tokens[2], entries))
+      return false;
+    item->second.acked = offset;
+    item->second.acked_entries = entries;
+    return true;
+  }
+
+  void Detach(int client) {
+    auto item = followers_.find(client);
+    if (item == followers_.end()) return;
+    Abandon(item->second);
+    followers_.erase(item);
+  }
+
+  // Once a round of the server: ends the round with a heartbeat if it
+  // changed something, sends the finished snapshots and the new part of
+  // the stream to the followers.
+  void Ship(Server& server) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    EndRound();
+    lock.unlock();
+
+    for (auto& [client, follower] : followers_) {
+      if (follower.saving > 0) {
+        auto saved = Snapshot::Poll(follower.saving, false);
+        if (!saved) continue;
+        follower.saving = -1;
+        SendSnapshot(server, client, follower, *saved);
+      }
+
+      std::string data;
+      lock.lock();
+      bool kept = Tail(follower.sent, data);
+      lock.unlock();
+      if (!kept || server.Unsent(client) > kMaxUnsent) {
+        server.Disconnect(client);
+      } else if (!data.empty()) {
+        server.Push(client, data);
+        follower.sent += data.size();
+      }
+    }
+  }
+
+  // One line for the feed and one for every follower.
+  std::vector<std::string> Report() const {
+    std::scoped_lock<std::mutex> lock(mtx_);
+    std::vector<std::string> lines = {
+        "role leader, feed " + id_ + ", " + std::to_string(entries_) +
+        " entries, offset " + std::to_string(end_) + ", " +
+        std::to_string(followers_.size()) + " followers"};
+    uint64_t now = Replication::NowMs();
+    for (auto const& [client, follower] : followers_) {
+      std::string line = "follower " + std::to_string(client) + ": ";
+      if (follower.saving > 0) {
+        line += "full sync";
+      } else {
+        // The oldest round the follower hasn't acknowledged.
+        auto beat = std::upper_bound(beats_.begin(), beats_.end(),
+                                     follower.acked,
+                                     [](uint64_t offset, Beat const& beat) {
+                                       return offset < beat.end;
+                                     });
+        uint64_t since = beat == beats_.end() ? now : beat->time;
+        line += "acked " + std::to_string(follower.acked_entries) +
+                " entries, lag " +
+                std::to_string(entries_ - follower.acked_entries) + " ops " +
+                std::to_string(now - since) + " ms";
+      }
+      lines.push_back(line);
+    }
+    return lines;
+  }
+
+ protected:
+  void Append(std::string const& payload) override {
+    std::scoped_lock<std::mutex> lock(mtx_);
+    Frame(backlog_, payload);
+    end_ = start_ + backlog_.size();
+    ++entries_;
+  }
+
+ private:
+  struct Follower {
+    uint64_t sent = 0;
+    uint64_t acked = 0;
+    uint64_t acked_entries = 0;
+    pid_t saving = -1;  // the child writing the snapshot of a full sync
+    std::string snapshot;
+  };
+
+  // The end of a round in the stream.
+  struct Beat {
+    uint64_t end;
+    uint64_t entries;
+    uint64_t time;
+  };
+
+  std::string id_;
+  std::map<int, Follower> followers_;
+
+  // Guards the fields below.
+  mutable std::mutex mtx_;
+  std::string backlog_;  // the stream from start_ to end_
+  uint64_t start_ = 0;
+  uint64_t end_ = 0;
+  uint64_t entries_ = 0;
+  std::deque<Beat> beats_;
+
+  static bool Parse(std::string const& token, uint64_t& number) {
+    if (token.empty() || token.size() > 19 ||
+        token.find_first_not_of("0123456789") != std::string::npos)
+      return false;
+    number = std::stoull(token);
+    return true;
+  }
+
+  // Called under mtx_. Ends the round if it added entries, and once a
+  // second anyway so that the followers see the link is alive. Old rounds
+  // leave the backlog whole, so followers only resume at round ends.
+  void EndRound() {
+    uint64_t now = Replication::NowMs();
+    if (!beats_.empty() && beats_.back().entries == entries_ &&
+        now < beats_.back().time + 1000)
+      return;
+
+    Frame(backlog_, Replication::Heartbeat(entries_, now));
+    end_ = start_ + backlog_.size();
+    beats_.push_back({end_, entries_, now});
+
+    // The last round ends at end_, so one is always left.
+    if (backlog_.size() <= 2 * kBacklog) return;
+    while (beats_.front().end + kBacklog < end_) beats_.pop_front();
+    backlog_.erase(0, beats_.front().end - start_);
+    start_ = beats_.front().end;
+  }
+
+  // Called under mtx_. The stream from the offset on, false if the
+  // backlog doesn't have it.
+  bool Tail(uint64_t offset, std::string& data) const {
+    if (offset < start_ || offset > end_) return false;
+    data.assign(backlog_, offset - start_, std::string::npos);
+    return true;
+  }
+
+  // Called under mtx_. The round that ends at the offset, if any.
+  std::deque<Beat>::const_iterator FindBeat(uint64_t offset) const {
+    auto beat = std::lower_bound(
+        beats_.begin(), beats_.end(), offset,
+        [](Beat const& beat, uint64_t offset) { return beat.end < offset; });
+    return beat != beats_.end() && beat->end == offset ? beat : beats_.end();
+  }
+
+  bool IsBeat(uint64_t offset) const {
+    return FindBeat(offset) != beats_.end();
+  }
+
+  uint64_t EntriesAt(uint64_t offset) const {
+    auto beat = FindBeat(offset);
+    return beat == beats_.end() ? entries_ : beat->entries;
+  }
+
+  void SendSnapshot(Server& server, int client, Follower& follower,
+                    bool saved) {
+    std::ifstream file(follower.snapshot, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+    std::remove(follower.snapshot.c_str());
+    if (!saved || data.empty()) {
+      std::string error;
+      Resp::Error(error, "can't save a snapshot");
+      server.Push(client, error);
+      server.Disconnect(client);
+      return;
+    }
+
+    std::scoped_lock<std::mutex> lock(mtx_);
+    server.Push(client, "+FULLSYNC " + id_ + " " +
+                            std::to_string(follower.sent) + " " +
+                            std::to_string(EntriesAt(follower.sent)) +
+                            "\r\n$" + std::to_string(data.size()) + "\r\n");
+    server.Push(client, data);
+  }
+
+  static void Abandon(Follower& follower) {
+    if (follower.saving <= 0) return;
+    Snapshot::Poll(follower.saving, true);
+    std::remove(follower.snapshot.c_str());
+  }
+};
+
+// The follower side: a thread that keeps a connection to the leader on
+// 127.0.0.1:port and applies the stream to the storage. A broken link is
+// retried every second and resumes where the follower stopped.
+class Replica {
+ public:
+  struct Status {
+    bool linked = false;
+    uint64_t entries = 0;  // applied
+    uint64_t offset = 0;
+    uint64_t lag_ms = 0;  // from the leader to here, at the last heartbeat
+    uint64_t heartbeat_ms = 0;  // since the last heartbeat
+    int full_syncs = 0;
+  };
+
+  Replica(int port, KeyValueStorage* storage)
+      : port_(port), storage_(storage), thread_([this] { Run(); }) {}
+
+  ~Replica() {
+    {
+      std::scoped_lock<std::mutex> lock(mtx_);
+      stop_ = true;
+      if (fd_ >= 0) ::shutdown(fd_, SHUT_RDWR);
+    }
+    stopped_cv_.notify_all();
+    thread_.join();
+  }
+
+  Replica(const Replica&) = delete;
+  Replica(Replica&&) = delete;
+  void operator=(const Replica&) = delete;
+  void operator=(Replica&&) = delete;
+
+  int Port() const { return port_; }
+
+  Status Report() const {
+    std::scoped_lock<std::mutex> lock(mtx_);
+    Status status = status_;
+    status.heartbeat_ms = heartbeat_ ? Replication::NowMs() - heartbeat_ : 0;
+    return status;
+  }
+
+ private:
+  int port_;
+  KeyValueStorage* storage_;
+  std::string id_ = "?";
+
+  // Guards the fields below.
+  mutable std::mutex mtx_;
+  std::condition_variable stopped_cv_;
+  bool stop_ = false;
+  int fd_ = -1;
+  Status status_;
+  uint64_t heartbeat_ = 0;
+
+  std::thread thread_;
+
+  void Run() {
+    while (true) {
+      Follow();
+      std::unique_lock<std::mutex> lock(mtx_);
+      if (fd_ >= 0) ::close(fd_);
+      fd_ = -1;
+      status_.linked = false;
+      if (stopped_cv_.wait_for(lock, 1s, [&] { return stop_; })) return;
+    }
+  }
+
+  // One connection, until it breaks.
+  void Follow() {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    {
+      std::scoped_lock<std::mutex> lock(mtx_);
+      if (stop_ || fd < 0) {
+        if (fd >= 0) ::close(fd);
+        return;
+      }
+      fd_ = fd;
+    }
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port_);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address),
+                  sizeof(address)) != 0)
+      return;
+    int on = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    std::string request, input;
+    Resp::Command(request, {"SYNC", id_, std::to_string(Offset())});
+    if (!SendAll(fd, request) || !Handshake(fd, input)) return;
+    {
+      std::scoped_lock<std::mutex> lock(mtx_);
+      status_.linked = true;
+    }
+    while (Apply(fd, input) && Receive(fd, input)) continue;
+  }
+
+  uint64_t Offset() const {
+    std::scoped_lock<std::mutex> lock(mtx_);
+    return status_.offset;
+  }
+
+  // Reads the answer to SYNC, and loads the snapshot of a full sync.
+  bool Handshake(int fd, std::string& input) {
+    size_t end = 0;
+    while ((end = input.find("\r\n")) == std::string::npos)
+      if (!Receive(fd, input)) return false;
+    std::string line = input.substr(0, end);
+    input.erase(0, end + 2);
+    if (line == "+CONTINUE") return true;
+
+    char id[64];
+    unsigned long long offset = 0, entries = 0, size = 0;
+    if (std::sscanf(line.c_str(), "+FULLSYNC %63s %llu %llu", id, &offset,
+                    &entries) != 3)
+      return false;
+    while ((end = input.find("\r\n")) == std::string::npos)
+      if (!Receive(fd, input)) return false;
+    if (std::sscanf(input.c_str(), "$%llu", &size) != 1) return false;
+    input.erase(0, end + 2);
+    while (input.size() < size)
+      if (!Receive(fd, input)) return false;
+
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("s21_replica." + std::to_string(::getpid()) + ".snap"))
+                           .string();
+    {
+      std::ofstream file(path, std::ios::binary | std::ios::trunc);
+      file.write(input.data(), size);
+    }
+    input.erase(0, size);
+
+    storage_->MDelete(storage_->Keys());
+    int loaded = 0;
+    bool ok = storage_->Load(path, loaded) == SnapshotStatus::kOk;
+    std::remove(path.c_str());
+    if (!ok) return false;
+
+    id_ = id;
+    std::scoped_lock<std::mutex> lock(mtx_);
+    status_.offset = offset;
+    status_.entries = entries;
+    ++status_.full_syncs;
+    return true;
+  }
+
+  // Applies the whole rounds at the front of the input and acknowledges
+  // them, false if the stream is broken.
+  bool Apply(int fd, std::string& input) {
+    std::string_view rest = input, payload;
+    size_t applied = 0;
+    std::vector<std::string_view> round;
+    while (LogObserver::NextEntry(rest, payload)) {
+      if (payload.front() != LogObserver::kHeartbeat) {
+        round.push_back(payload);
+        continue;
+      }
+
+      payload.remove_prefix(1);
+      uint64_t entries = 0, time = 0;
+      if (!Snapshot::GetVarint(payload, entries) ||
+          !Snapshot::GetVarint(payload, time))
+        return false;
+
+      LogObserver::Replayer replayer(storage_, "", nullptr);
+      for (auto entry : round)
+        if (!replayer.Apply(entry)) return false;
+      replayer.Flush();
+      round.clear();
+
+      uint64_t now = Replication::NowMs();
+      size_t consumed = input.size() - rest.size();
+      std::string ack;
+      {
+        std::scoped_lock<std::mutex> lock(mtx_);
+        status_.offset += consumed - applied;
+        status_.entries = entries;
+        status_.lag_ms = now > time ? now - time : 0;
+        heartbeat_ = now;
+        Resp::Command(ack, {"ACK", std::to_string(status_.offset),
+                            std::to_string(entries)});
+      }
+      applied = consumed;
+      if (!SendAll(fd, ack)) return false;
+    }
+    input.erase(0, applied);
+    return !Replication::Damaged(rest);
+  }
+
+  bool Receive(int fd, std::string& input) {
+    char buffer[64 * 1024];
+    ssize_t size = ::recv(fd, buffer, sizeof(buffer), 0);
+    if (size <= 0) return false;
+    input.append(buffer, size);
+    return true;
+  }
+
+  static bool SendAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+      ssize_t size = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+      if (size <= 0) return false;
+      data.remove_prefix(size);
+    }
+    return true;
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_REPLICATION_H_
@@ -0,0 +1,106 @@
+#ifndef A6_SRC_MAIN_COMMON_REPLY_H_
+#define A6_SRC_MAIN_COMMON_REPLY_H_
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "console.h"
+#include "resp.h"
+
+namespace s21 {
+
+// Where the output of a command goes. The commands write the lines they
+// show on the console, a server turns them into protocol replies.
+class Reply {
+ public:
+  virtual ~Reply() = default;
+
+  virtual void Write(const std::string& text) = 0;
+  virtual void Error(const std::string& message) = 0;
+
+  // The lines that follow are the items of a list, which a server sends
+  // as an array whatever the number of items. The console shows that
+  // there are none.
+  virtual void List(size_t items) {
+    if (!items) WriteLine("> Empty");
+  }
+
+  void WriteLine(const std::string& text) { Write(text + "\n"); }
+};
+
+class ConsoleReply : public Reply {
+ public:
+  void Write(const std::string& text) override { Console::Write(text); }
+  void Error(const std::string& message) override { Console::Error(message); }
+};
+
+// Collects the output of one command and encodes it: an error as an
+// error, "(null)" as a null and a single line as a simple string. A list,
+// like KEYS or FIND, and several lines are an array of bulk strings, no
+// output at all is an empty array. The "> " prompt in front of a line is
+// dropped.
+class RespReply : public Reply {
+ public:
+  void Write(const std::string& text) override {
+    for (size_t begin = 0; begin < text.size();) {
+      size_t end = std::min(text.find('\n', begin), text.size());
+      partial_.append(text, begin, end - begin);
+      if (end < text.size()) EndLine();
+      begin = end + 1;
+    }
+  }
+
+  void Error(const std::string& message) override {
+    lines_.push_back(message);
+    errors_.push_back(lines_.size() - 1);
+  }
+
+  void List(size_t) override { list_ = true; }
+
+  // Appends the reply to the output and starts a new one.
+  void Encode(std::string& output) {
+    if (!partial_.empty()) EndLine();
+
+    if (list_ || lines_.size() != 1) {
+      Resp::Array(output, lines_.size());
+      size_t error = 0;
+      for (size_t i = 0; i < lines_.size(); ++i) {
+        if (error < errors_.size() && errors_[error] == i) {
+          Resp::Error(output, lines_[i]);
+          ++error;
+        } else {
+          Resp::Bulk(output, lines_[i]);
+        }
+      }
+    } else if (errors_.size() == 1) {
+      Resp::Error(output, lines_[0]);
+    } else if (lines_[0] == "(null)") {
+      Resp::Null(output);
+    } else {
+      Resp::Simple(output, lines_[0]);
+    }
+
+    lines_.clear();
+    errors_.clear();
+    list_ = false;
+  }
+
+ private:
+  std::vector<std::string> lines_;
+  std::vector<size_t> errors_;
+  std::string partial_;
+  bool list_ = false;
+
+  void EndLine() {
+    std::string_view line = partial_;
+    if (line.substr(0, 2) == "> ") line.remove_prefix(2);
+    lines_.emplace_back(line);
+    partial_.clear();
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_REPLY_H_
@@ -0,0 +1,191 @@
+#ifndef A6_SRC_MAIN_COMMON_RESP_H_
+#define A6_SRC_MAIN_COMMON_RESP_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace s21 {
+
+// Subset of the Redis serialization protocol the server speaks:
+//   command := "*" count CRLF ("$" size CRLF bytes CRLF)*
+//            | inline words separated by spaces CRLF
+//   reply   := "+" text CRLF | "-" text CRLF | ":" number CRLF
+//            | "$" size CRLF bytes CRLF | "$-1" CRLF
+//            | "*" count CRLF reply*
+class Resp {
+ public:
+  enum class Status { kOk, kIncomplete, kError };
+
+  static constexpr size_t kMaxInline = 64 * 1024;
+  static constexpr int64_t kMaxBulk = 512 << 20;
+  static constexpr int64_t kMaxCount = 1 << 20;
+
+  // Takes one command off the input, nothing is taken unless it is all
+  // there. The words go into the strings already in the command, which
+  // keep their buffers. The command is only whole with kOk.
+  static Status Parse(std::string_view& input,
+                      std::vector<std::string>& command) {
+    if (input.empty()) return Status::kIncomplete;
+    if (input.front() != '*') return ParseInline(input, command);
+
+    std::string_view rest = input.substr(1);
+    int64_t count = 0;
+    Status status = Number(rest, count);
+    if (status != Status::kOk) return status;
+    if (count < 0 || count > kMaxCount) return Status::kError;
+
+    size_t words = 0;
+    for (int64_t i = 0; i < count; ++i) {
+      if (rest.empty()) return Status::kIncomplete;
+      if (rest.front() != '$') return Status::kError;
+      rest.remove_prefix(1);
+
+      int64_t size = 0;
+      status = Number(rest, size);
+      if (status != Status::kOk) return status;
+      if (size < 0 || size > kMaxBulk) return Status::kError;
+      if (rest.size() < static_cast<size_t>(size) + 2)
+        return Status::kIncomplete;
+      if (rest.substr(size, 2) != "\r\n") return Status::kError;
+
+      Assign(command, words++, rest.substr(0, size));
+      rest.remove_prefix(size + 2);
+    }
+
+    command.resize(words);
+    input = rest;
+    return Status::kOk;
+  }
+
+  // Takes one reply off the input without decoding it, for clients that
+  // only wait for the answers.
+  static Status Skip(std::string_view& input, bool& error) {
+    if (input.empty()) return Status::kIncomplete;
+    char type = input.front();
+    std::string_view rest = input.substr(1);
+    error = type == '-';
+
+    if (type == '+' || type == '-' || type == ':') {
+      size_t end = rest.find("\r\n");
+      if (end == std::string_view::npos) return Status::kIncomplete;
+      input = rest.substr(end + 2);
+      return Status::kOk;
+    }
+
+    int64_t size = 0;
+    Status status = Number(rest, size);
+    if (status != Status::kOk) return status;
+
+    if (type == '$') {
+      if (size < 0) {
+        input = rest;
+        return Status::kOk;
+      }
+      if (rest.size() < static_cast<size_t>(size) + 2)
+        return Status::kIncomplete;
+      input = rest.substr(size + 2);
+      return Status::kOk;
+    }
+
+    if (type != '*') return Status::kError;
+    bool item_error = false;
+    for (int64_t i = 0; i < size; ++i) {
+      status = Skip(rest, item_error);
+      if (status != Status::kOk) return status;
+    }
+    input = rest;
+    return Status::kOk;
+  }
+
+  static void Simple(std::string& output, std::string_view text) {
+    output.push_back('+');
+    output.append(text);
+    output.append("\r\n");
+  }
+
+  static void Error(std::string& output, std::string_view message) {
+    output.append("-ERR ");
+    output.append(message);
+    output.append("\r\n");
+  }
+
+  static void Bulk(std::string& output, std::string_view text) {
+    output.push_back('$');
+    output.append(std::to_string(text.size()));
+    output.append("\r\n");
+    output.append(text);
+    output.append("\r\n");
+  }
+
+  static void Null(std::string& output) { output.append("$-1\r\n"); }
+
+  static void Array(std::string& output, size_t count) {
+    output.push_back('*');
+    output.append(std::to_string(count));
+    output.append("\r\n");
+  }
+
+  // A command as a client sends it.
+  static void Command(std::string& output,
+                      std::vector<std::string> const& words) {
+    Array(output, words.size());
+    for (auto const& word : words) Bulk(output, word);
+  }
+
+ private:
+  // Digits up to CRLF.
+  static Status Number(std::string_view& input, int64_t& value) {
+    size_t end = input.find("\r\n");
+    if (end == std::string_view::npos)
+      return input.size() > 20 ? Status::kError : Status::kIncomplete;
+
+    bool negative = end && input.front() == '-';
+    size_t digits = end - negative;
+    if (!digits || digits > 18) return Status::kError;
+    value = 0;
+    for (size_t i = negative; i < end; ++i) {
+      if (input[i] < '0' || input[i] > '9') return Status::kError;
+      value = value * 10 + (input[i] - '0');
+    }
+    if (negative) value = -value;
+
+    input.remove_prefix(end + 2);
+    return Status::kOk;
+  }
+
+  static void Assign(std::vector<std::string>& command, size_t word,
+                     std::string_view text) {
+    if (word < command.size())
+      command[word].assign(text);
+    else
+      command.emplace_back(text);
+  }
+
+  // A line typed by hand, e.g. through telnet.
+  static Status ParseInline(std::string_view& input,
+                            std::vector<std::string>& command) {
+    size_t end = input.find('\n');
+    if (end == std::string_view::npos)
+      return input.size() > kMaxInline ? Status::kError : Status::kIncomplete;
+
+    std::string_view line = input.substr(0, end);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    size_t words = 0;
+    while (!line.empty()) {
+      size_t space = std::min(line.find(' '), line.size());
+      if (space) Assign(command, words++, line.substr(0, space));
+      line.remove_prefix(std::min(space + 1, line.size()));
+    }
+
+    command.resize(words);
+    input.remove_prefix(end + 1);
+    return Status::kOk;
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_RESP_H_
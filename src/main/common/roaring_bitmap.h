@@ -0,0 +1,254 @@
+#ifndef A6_SRC_MAIN_COMMON_ROARING_BITMAP_H_
+#define A6_SRC_MAIN_COMMON_ROARING_BITMAP_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace s21 {
+
+// Compressed set of 32-bit ids in the spirit of Roaring bitmaps: ids are
+// split by their high 16 bits into containers, a container stores the low
+// halves as a sorted array while it's sparse and as a 65536-bit bitset
+// once it holds more than kMaxArray values.
+class RoaringBitmap {
+ public:
+  void Add(uint32_t value) {
+    auto itr = std::lower_bound(keys_.begin(), keys_.end(), High(value));
+    size_t index = std::distance(keys_.begin(), itr);
+
+    if (itr == keys_.end() || *itr != High(value)) {
+      keys_.insert(itr, High(value));
+      containers_.insert(containers_.begin() + index, Container{});
+    }
+
+    containers_[index].Add(Low(value));
+  }
+
+  void Remove(uint32_t value) {
+    auto itr = std::lower_bound(keys_.begin(), keys_.end(), High(value));
+    if (itr == keys_.end() || *itr != High(value)) return;
+
+    size_t index = std::distance(keys_.begin(), itr);
+    containers_[index].Remove(Low(value));
+
+    if (!containers_[index].cardinality) {
+      keys_.erase(itr);
+      containers_.erase(containers_.begin() + index);
+    }
+  }
+
+  bool Contains(uint32_t value) const {
+    auto itr = std::lower_bound(keys_.begin(), keys_.end(), High(value));
+    if (itr == keys_.end() || *itr != High(value)) return false;
+
+    return containers_[std::distance(keys_.begin(), itr)].Contains(Low(value));
+  }
+
+  size_t Cardinality() const {
+    size_t result = 0;
+    for (auto const& i : containers_) result += i.cardinality;
+    return result;
+  }
+
+  bool Empty() const { return keys_.empty(); }
+
+  size_t MemoryUsage() const {
+    size_t result = sizeof(*this) + keys_.capacity() * sizeof(uint16_t);
+    for (auto const& i : containers_)
+      result += sizeof(Container) + i.array.capacity() * sizeof(uint16_t) +
+                i.bitset.capacity() * sizeof(uint64_t);
+    return result;
+  }
+
+  RoaringBitmap& operator&=(const RoaringBitmap& other) {
+    RoaringBitmap result;
+
+    for (size_t i = 0, j = 0; i < keys_.size() && j < other.keys_.size();) {
+      if (keys_[i] < other.keys_[j]) {
+        ++i;
+      } else if (keys_[i] > other.keys_[j]) {
+        ++j;
+      } else {
+        Container container =
+            Container::And(containers_[i], other.containers_[j]);
+        if (container.cardinality) {
+          result.keys_.push_back(keys_[i]);
+          result.containers_.push_back(std::move(container));
+        }
+        ++i, ++j;
+      }
+    }
+
+    return *this = std::move(result);
+  }
+
+  RoaringBitmap& operator|=(const RoaringBitmap& other) {
+    RoaringBitmap result;
+
+    size_t i = 0, j = 0;
+    while (i < keys_.size() || j < other.keys_.size()) {
+      if (j == other.keys_.size() ||
+          (i < keys_.size() && keys_[i] < other.keys_[j])) {
+        result.keys_.push_back(keys_[i]);
+        result.containers_.push_back(std::move(containers_[i++]));
+      } else if (i == keys_.size() || keys_[i] > other.keys_[j]) {
+        result.keys_.push_back(other.keys_[j]);
+        result.containers_.push_back(other.containers_[j++]);
+      } else {
+        result.keys_.push_back(keys_[i]);
+        result.containers_.push_back(
+            Container::Or(containers_[i++], other.containers_[j++]));
+      }
+    }
+
+    return *this = std::move(result);
+  }
+
+  template <class Func>
+  void ForEach(Func const& func) const {
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      uint32_t high = static_cast<uint32_t>(keys_[i]) << 16;
+      containers_[i].ForEach([&](uint16_t low) { func(high | low); });
+    }
+  }
+
+ private:
+  static constexpr uint32_t kMaxArray = 4096;
+  static constexpr size_t kWords = 65536 / 64;
+
+  struct Container {
+    std::vector<uint16_t> array;
+    std::vector<uint64_t> bitset;
+    uint32_t cardinality = 0;
+
+    bool IsBitset() const { return !bitset.empty(); }
+
+    bool Contains(uint16_t value) const {
+      if (IsBitset()) return bitset[value / 64] >> (value % 64) & 1;
+      return std::binary_search(array.begin(), array.end(), value);
+    }
+
+    void Add(uint16_t value) {
+      if (IsBitset()) {
+        uint64_t mask = uint64_t{1} << (value % 64);
+        if (bitset[value / 64] & mask) return;
+        bitset[value / 64] |= mask;
+      } else {
+        auto itr = std::lower_bound(array.begin(), array.end(), value);
+        if (itr != array.end() && *itr == value) return;
+        array.insert(itr, value);
+      }
+
+      if (++cardinality > kMaxArray && !IsBitset()) ToBitset();
+    }
+
+    void Remove(uint16_t value) {
+      if (IsBitset()) {
+        uint64_t mask = uint64_t{1} << (value % 64);
+        if (!(bitset[value / 64] & mask)) return;
+        bitset[value / 64] &= ~mask;
+      } else {
+        auto itr = std::lower_bound(array.begin(), array.end(), value);
+        if (itr == array.end() || *itr != value) return;
+        array.erase(itr);
+      }
+
+      if (--cardinality <= kMaxArray && IsBitset()) ToArray();
+    }
+
+    template <class Func>
+    void ForEach(Func const& func) const {
+      if (!IsBitset()) {
+        for (uint16_t i : array) func(i);
+        return;
+      }
+
+      for (size_t i = 0; i < kWords; ++i)
+        for (uint64_t word = bitset[i]; word; word &= word - 1)
+          func(static_cast<uint16_t>(i * 64 + __builtin_ctzll(word)));
+    }
+
+    void ToBitset() {
+      bitset.assign(kWords, 0);
+      for (uint16_t i : array) bitset[i / 64] |= uint64_t{1} << (i % 64);
+      array = {};
+    }
+
+    void ToArray() {
+      std::vector<uint16_t> values;
+      values.reserve(cardinality);
+      ForEach([&](uint16_t i) { values.push_back(i); });
+      array = std::move(values);
+      bitset = {};
+    }
+
+    static Container And(const Container& left, const Container& right) {
+      Container result;
+
+      if (left.IsBitset() && right.IsBitset()) {
+        result.bitset.resize(kWords);
+        for (size_t i = 0; i < kWords; ++i) {
+          result.bitset[i] = left.bitset[i] & right.bitset[i];
+          result.cardinality += __builtin_popcountll(result.bitset[i]);
+        }
+        if (result.cardinality <= kMaxArray) result.ToArray();
+
+      } else if (left.IsBitset() || right.IsBitset()) {
+        const Container& sparse = left.IsBitset() ? right : left;
+        const Container& dense = left.IsBitset() ? left : right;
+        for (uint16_t i : sparse.array)
+          if (dense.Contains(i)) result.array.push_back(i);
+        result.cardinality = result.array.size();
+
+      } else {
+        std::set_intersection(left.array.begin(), left.array.end(),
+                              right.array.begin(), right.array.end(),
+                              std::back_inserter(result.array));
+        result.cardinality = result.array.size();
+      }
+
+      return result;
+    }
+
+    static Container Or(const Container& left, const Container& right) {
+      Container result;
+
+      if (left.IsBitset() || right.IsBitset()) {
+        result.bitset.assign(kWords, 0);
+        for (const Container* i : {&left, &right}) {
+          if (i->IsBitset()) {
+            for (size_t j = 0; j < kWords; ++j)
+              result.bitset[j] |= i->bitset[j];
+          } else {
+            for (uint16_t j : i->array)
+              result.bitset[j / 64] |= uint64_t{1} << (j % 64);
+          }
+        }
+        for (uint64_t word : result.bitset)
+          result.cardinality += __builtin_popcountll(word);
+        if (result.cardinality <= kMaxArray) result.ToArray();
+
+      } else {
+        std::set_union(left.array.begin(), left.array.end(),
+                       right.array.begin(), right.array.end(),
+                       std::back_inserter(result.array));
+        result.cardinality = result.array.size();
+        if (result.cardinality > kMaxArray) result.ToBitset();
+      }
+
+      return result;
+    }
+  };
+
+  std::vector<uint16_t> keys_;
+  std::vector<Container> containers_;
+
+  static uint16_t High(uint32_t value) { return value >> 16; }
+  static uint16_t Low(uint32_t value) { return value & 0xFFFF; }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_ROARING_BITMAP_H_
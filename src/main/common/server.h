@@ -0,0 +1,482 @@
+#ifndef A6_SRC_MAIN_COMMON_SERVER_H_
+#define A6_SRC_MAIN_COMMON_SERVER_H_
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "io_ring.h"
+#include "resp.h"
+
+namespace s21 {
+
+// Single threaded server on non-blocking sockets and epoll, or on an
+// io_uring where it is the chosen backend. Every round reads what the
+// ready clients sent and runs their complete commands, calls `batch`
+// once, and only then sends the replies, so a log commit in `batch`
+// covers the commands of all the clients of the round. A round ends at
+// least every 100 ms, even with nothing to read.
+class Server {
+ public:
+  using Command = std::vector<std::string>;
+
+  // Runs the commands a client has pipelined, in order, and appends their
+  // replies to the output, false closes the connection once the replies
+  // are sent.
+  using Handler = std::function<bool(
+      int client, std::vector<Command> const& commands, std::string& output)>;
+  using Closed = std::function<void(int client)>;
+  using Batch = std::function<void()>;
+
+  Server(Handler handler, Closed closed, Batch batch)
+      : handler_(std::move(handler)),
+        closed_(std::move(closed)),
+        batch_(std::move(batch)),
+        epoll_(::epoll_create1(EPOLL_CLOEXEC)) {}
+
+  ~Server() {
+    for (auto& [fd, client] : clients_) ::close(fd);
+    for (int fd : listeners_) ::close(fd);
+    if (!unix_path_.empty()) ::unlink(unix_path_.c_str());
+    if (epoll_ >= 0) ::close(epoll_);
+  }
+
+  Server(const Server&) = delete;
+  Server(Server&&) = delete;
+  void operator=(const Server&) = delete;
+  void operator=(Server&&) = delete;
+
+  // Listens on 127.0.0.1.
+  bool ListenTcp(int port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return Listen(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  }
+
+  bool ListenUnix(const std::string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    ::unlink(path.c_str());
+    if (!Listen(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+      return false;
+    unix_path_ = path;
+    return true;
+  }
+
+  // Serves until Stop, SIGINT or SIGTERM.
+  void Run() {
+    struct sigaction action {};
+    action.sa_handler = [](int) { Stopped() = true; };
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    if (CurrentIoBackend() == IoBackend::kUring)
+      RunRing();
+    else
+      RunEpoll();
+  }
+
+  void Stop() { Stopped() = true; }
+
+  // Adds data to the output of a client outside of its commands, from
+  // `batch`. False if the client is gone or closing.
+  bool Push(int client, std::string_view data) {
+    auto item = clients_.find(client);
+    if (item == clients_.end() || item->second.closing) return false;
+    item->second.output.append(data);
+    waiting_.push_back(client);
+    return true;
+  }
+
+  // Bytes of output the client hasn't taken yet.
+  size_t Unsent(int client) const {
+    auto item = clients_.find(client);
+    if (item == clients_.end()) return 0;
+    Client const& state = item->second;
+    return state.output.size() + state.sending.size() - state.sent;
+  }
+
+  // Closes the connection at the end of the round.
+  void Disconnect(int client) {
+    auto item = clients_.find(client);
+    if (item == clients_.end() || item->second.closing) return;
+    item->second.closing = true;
+    closing_.push_back(client);
+  }
+
+ private:
+  struct Client {
+    int fd;
+    std::string input;
+    std::string output;
+    size_t sent = 0;
+    bool writable = true;  // false while EPOLLOUT is armed
+    bool closing = false;
+
+    // With io_uring the output moves to `sending` while a send is in
+    // flight, and the recv lands in `buffer`. The id tells a reused fd
+    // from the one a late completion was meant for.
+    uint32_t id = 0;
+    std::unique_ptr<char[]> buffer;
+    std::string sending;
+    bool receiving = false;
+    bool transmitting = false;
+  };
+
+  // What a completion on the ring is for, in the low byte of its tag.
+  enum Op : uint8_t { kAccepted, kReceived, kSent, kCancelled };
+
+  static constexpr unsigned kRingEntries = 1024;
+  static constexpr size_t kRecvSize = 16 * 1024;
+
+  Handler handler_;
+  Closed closed_;
+  Batch batch_;
+  int epoll_;
+  std::vector<int> listeners_;
+  std::string unix_path_;
+  std::unordered_map<int, Client> clients_;
+  std::vector<int> waiting_;
+  std::vector<int> closing_;
+  std::vector<Command> commands_;
+  std::vector<Command> spare_;  // commands of earlier rounds, to reuse
+  IoRing* ring_ = nullptr;
+  std::vector<int> retiring_;
+  uint32_t last_id_ = 0;
+
+  static std::atomic_bool& Stopped() {
+    static std::atomic_bool stopped = false;
+    return stopped;
+  }
+
+  bool IsListener(int fd) const {
+    for (int listener : listeners_)
+      if (listener == fd) return true;
+    return false;
+  }
+
+  bool Listen(int fd, sockaddr* address, socklen_t size) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (::bind(fd, address, size) != 0 || ::listen(fd, SOMAXCONN) != 0 ||
+        ::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) != 0) {
+      ::close(fd);
+      return false;
+    }
+    listeners_.push_back(fd);
+    return true;
+  }
+
+  void Accept(int listener) {
+    while (true) {
+      int fd = ::accept4(listener, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) return;
+
+      int on = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) != 0) {
+        ::close(fd);
+        continue;
+      }
+      clients_.emplace(fd, Client{fd});
+    }
+  }
+
+  void RunEpoll() {
+    std::vector<epoll_event> events(256);
+    while (!Stopped()) {
+      // The timeout only bounds how late a signal is noticed.
+      int ready = ::epoll_wait(epoll_, events.data(), events.size(), 100);
+      if (ready < 0 && errno != EINTR) break;
+
+      for (int i = 0; i < ready; ++i) {
+        int fd = events[i].data.fd;
+        if (IsListener(fd)) {
+          Accept(fd);
+          continue;
+        }
+
+        auto client = clients_.find(fd);
+        if (client == clients_.end()) continue;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+          Receive(client->second);
+        if (events[i].events & EPOLLOUT) Send(client->second);
+      }
+
+      batch_();
+      for (int fd : waiting_) {
+        auto client = clients_.find(fd);
+        if (client != clients_.end()) Send(client->second);
+      }
+      waiting_.clear();
+
+      for (int fd : closing_) Close(fd);
+      closing_.clear();
+    }
+  }
+
+  void Receive(Client& client) {
+    if (client.closing) return;
+    char buffer[64 * 1024];
+    bool hangup = false;
+    while (true) {
+      ssize_t size = ::read(client.fd, buffer, sizeof(buffer));
+      if (size > 0) {
+        client.input.append(buffer, size);
+        continue;
+      }
+      hangup = size == 0 || (errno != EAGAIN && errno != EINTR);
+      if (size == 0 || errno != EINTR) break;
+    }
+    Process(client, hangup);
+  }
+
+  // Keeps the vectors of the last commands, and their buffers, for the
+  // next ones.
+  void Recycle() {
+    for (auto& command : commands_) spare_.push_back(std::move(command));
+    commands_.clear();
+  }
+
+  // Runs the complete commands of the input.
+  void Process(Client& client, bool hangup) {
+    // Every complete command in the buffer goes to the handler at once,
+    // their replies leave in a single send.
+    std::string_view input = client.input;
+    Resp::Status status = Resp::Status::kOk;
+    Recycle();
+    while (status == Resp::Status::kOk) {
+      if (spare_.empty()) {
+        commands_.emplace_back();
+      } else {
+        commands_.push_back(std::move(spare_.back()));
+        spare_.pop_back();
+      }
+      status = Resp::Parse(input, commands_.back());
+      if (status != Resp::Status::kOk || commands_.back().empty()) {
+        spare_.push_back(std::move(commands_.back()));
+        commands_.pop_back();
+      }
+    }
+    client.input.erase(0, client.input.size() - input.size());
+
+    bool open =
+        commands_.empty() || handler_(client.fd, commands_, client.output);
+    if (open && status == Resp::Status::kError)
+      Resp::Error(client.output, "protocol error");
+    if (!open || hangup || status == Resp::Status::kError) {
+      client.closing = true;
+      closing_.push_back(client.fd);
+    }
+
+    if (!client.output.empty()) waiting_.push_back(client.fd);
+  }
+
+  void Send(Client& client) {
+    while (client.sent < client.output.size()) {
+      ssize_t size =
+          ::send(client.fd, client.output.data() + client.sent,
+                 client.output.size() - client.sent, MSG_NOSIGNAL);
+      if (size < 0 && errno == EINTR) continue;
+      if (size < 0) {
+        if (errno == EAGAIN) Watch(client, false);
+        else client.output.clear(), client.sent = 0;
+        return;
+      }
+      client.sent += size;
+    }
+
+    client.output.clear();
+    client.sent = 0;
+    Watch(client, true);
+  }
+
+  // Arms EPOLLOUT while the socket can't take the rest of the output.
+  void Watch(Client& client, bool writable) {
+    if (client.writable == writable) return;
+    client.writable = writable;
+    epoll_event event{};
+    event.events = writable ? EPOLLIN : EPOLLIN | EPOLLOUT;
+    event.data.fd = client.fd;
+    ::epoll_ctl(epoll_, EPOLL_CTL_MOD, client.fd, &event);
+  }
+
+  // A closing client still gets the replies that fit into its socket.
+  void Close(int fd) {
+    auto client = clients_.find(fd);
+    if (client == clients_.end()) return;
+    if (!client->second.output.empty()) Send(client->second);
+
+    closed_(fd);
+    ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    clients_.erase(client);
+  }
+
+  // The same rounds on io_uring: accepts, receives and sends stay queued
+  // on the ring, and one system call a round submits the new ones and
+  // waits for completions.
+  void RunRing() {
+    IoRing ring(kRingEntries);
+    ring_ = &ring;
+    // The ring only waits for accepts on a blocking socket, a non-blocking
+    // one completes them with EAGAIN.
+    for (int fd : listeners_) {
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+      ring.Accept(fd, Tag(kAccepted, fd, 0));
+    }
+
+    while (!Stopped()) {
+      if (!ring.Submit(1, 100)) break;
+      ring.Reap([&](uint64_t tag, int result) { Complete(tag, result); });
+
+      batch_();
+      for (int fd : waiting_) {
+        auto client = clients_.find(fd);
+        if (client != clients_.end()) Transmit(client->second);
+      }
+      waiting_.clear();
+
+      for (int fd : closing_) Retire(fd);
+      closing_.clear();
+      // A retired client is closed once nothing of it is in flight.
+      auto idle = [&](int fd) {
+        auto client = clients_.find(fd);
+        if (client == clients_.end()) return true;
+        if (client->second.receiving || client->second.transmitting)
+          return false;
+        ::close(fd);
+        clients_.erase(client);
+        return true;
+      };
+      retiring_.erase(std::remove_if(retiring_.begin(), retiring_.end(), idle),
+                      retiring_.end());
+    }
+    ring_ = nullptr;
+  }
+
+  static uint64_t Tag(Op op, int fd, uint32_t id) {
+    return uint64_t{id} << 32 | uint64_t{static_cast<uint32_t>(fd)} << 8 | op;
+  }
+
+  void Complete(uint64_t tag, int result) {
+    auto op = static_cast<Op>(tag & 0xff);
+    int fd = static_cast<int>(tag >> 8 & 0xffffff);
+    if (op == kAccepted) {
+      if (result >= 0) Adopt(result);
+      if (!Stopped()) ring_->Accept(fd, tag);
+      return;
+    }
+
+    auto item = clients_.find(fd);
+    if (op == kCancelled || item == clients_.end() ||
+        item->second.id != tag >> 32)
+      return;
+    Client& client = item->second;
+
+    if (op == kReceived) {
+      client.receiving = false;
+      if (client.closing) return;
+      if (result == -EAGAIN || result == -EINTR) {
+        Arm(client);
+      } else if (result > 0) {
+        client.input.append(client.buffer.get(), result);
+        Process(client, false);
+        if (!client.closing) Arm(client);
+      } else {
+        Process(client, true);
+      }
+      return;
+    }
+
+    client.transmitting = false;
+    if (result < 0) {
+      client.sending.clear();
+      client.output.clear();
+      client.sent = 0;
+      return;
+    }
+    client.sent += result;
+    Transmit(client);
+  }
+
+  void Adopt(int fd) {
+    int on = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    Client& client = clients_.emplace(fd, Client{fd}).first->second;
+    client.id = ++last_id_;
+    client.buffer = std::make_unique<char[]>(kRecvSize);
+    Arm(client);
+  }
+
+  void Arm(Client& client) {
+    client.receiving = ring_->Recv(client.fd, client.buffer.get(), kRecvSize,
+                                   Tag(kReceived, client.fd, client.id));
+  }
+
+  // Sends the rest of `sending`, or the output piled up meanwhile.
+  void Transmit(Client& client) {
+    if (client.transmitting) return;
+    if (client.sent == client.sending.size()) {
+      client.sending.clear();
+      client.sent = 0;
+      if (client.output.empty()) return;
+      client.sending.swap(client.output);
+    }
+    client.transmitting = ring_->Send(
+        client.fd, client.sending.data() + client.sent,
+        client.sending.size() - client.sent, Tag(kSent, client.fd, client.id));
+  }
+
+  // The session ends at once, the replies still go out before the socket
+  // is closed.
+  void Retire(int fd) {
+    auto item = clients_.find(fd);
+    if (item == clients_.end()) return;
+    Client& client = item->second;
+    closed_(fd);
+    if (client.receiving)
+      ring_->Cancel(Tag(kReceived, fd, client.id), Tag(kCancelled, fd, 0));
+    Transmit(client);
+    retiring_.push_back(fd);
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_SERVER_H_
@@ -0,0 +1,422 @@
+#ifndef A6_SRC_MAIN_COMMON_SNAPSHOT_H_
+#define A6_SRC_MAIN_COMMON_SNAPSHOT_H_
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "io_ring.h"
+#include "parallel_loader.h"
+#include "timer.h"
+
+namespace s21 {
+
+enum class SnapshotStatus {
+  kOk,
+  kNotOpen,    // the file can't be opened or written
+  kBadFormat,  // not a snapshot or an unknown version
+  kCorrupted   // checksum mismatch or truncated file
+};
+
+// Time a Load spent in each of its phases.
+struct LoadTimings {
+  nanoseconds read{0};    // mapping the file and verifying the checksums
+  nanoseconds parse{0};   // decoding the records
+  nanoseconds insert{0};  // building the storage
+};
+
+// Binary snapshot of a storage:
+//   file   := "S21SNAP" version:u8 block* varint(0) varint(records)
+//   block  := varint(raw size) varint(stored size) codec:u8 crc32:u32le
+//             stored bytes
+//   record := string(key) string(field)x5 varint(deadline)
+//   string := varint(size) bytes
+// Deadlines are Unix time in milliseconds, 0 for keys without TTL. Blocks
+// are checksummed separately and may be LZ compressed, so they are
+// verified and decoded in parallel on load.
+class Snapshot {
+ public:
+  using K = std::string;
+  using V = Person;
+
+  // Record with a TTL, the lifetime is in seconds from the moment it was
+  // read.
+  struct Expiring {
+    K key;
+    V value;
+    int lifetime;
+  };
+
+  class Writer;
+
+  // TTL deadlines of the keys that have one.
+  using Deadlines = std::map<K, uint64_t>;
+
+  static constexpr std::string_view kMagic = "S21SNAP";
+  static constexpr uint8_t kVersion = 1;
+  static constexpr size_t kBlockSize = 256 * 1024;
+
+  // Unix time in milliseconds when a task scheduled for `time` runs.
+  static uint64_t ToDeadline(Timestamp time) {
+    auto left = duration_cast<milliseconds>(time - Clock::now());
+    auto now = duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch());
+    return std::max<int64_t>((now + left).count(), 1);
+  }
+
+  // Runs body in a forked child that keeps seeing the memory as it was at
+  // the fork while the parent goes on, copy-on-write makes it cheap. Only
+  // the calling thread exists in the child, so the body must not take any
+  // lock another thread might have held. Returns the child pid or -1.
+  template <class Body>
+  static pid_t Fork(Body const& body) {
+    pid_t pid = ::fork();
+    if (pid == 0) ::_exit(body() ? 0 : 1);
+    return pid;
+  }
+
+  // Result of a forked child, nothing while it is still running.
+  static std::optional<bool> Poll(pid_t pid, bool wait) {
+    int status = 0;
+    pid_t result = ::waitpid(pid, &status, wait ? 0 : WNOHANG);
+    if (result == 0) return std::nullopt;
+    return result == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+
+  // Decodes the whole file before returning, so a damaged snapshot loads
+  // nothing. Records whose deadline has passed are dropped.
+  static SnapshotStatus Read(const std::string& filename, unsigned threads,
+                             ParallelLoader::Chunks& chunks,
+                             std::vector<Expiring>& expiring,
+                             LoadTimings* timings = nullptr) {
+    Timer timer;
+    MappedFile file(filename);
+    if (!file.IsOpen()) return SnapshotStatus::kNotOpen;
+
+    std::string_view text = file.Data();
+    if (text.size() <= kMagic.size() ||
+        text.substr(0, kMagic.size()) != kMagic ||
+        static_cast<uint8_t>(text[kMagic.size()]) != kVersion)
+      return SnapshotStatus::kBadFormat;
+
+    std::vector<Block> blocks;
+    uint64_t records = 0;
+    if (!Split(text.substr(kMagic.size() + 1), blocks, records))
+      return SnapshotStatus::kCorrupted;
+
+    // Checksums go first, they pull the whole file in from the disk.
+    std::vector<char> valid(blocks.size());
+    ParallelLoader::Run(blocks.size(), threads, [&](size_t i) {
+      valid[i] = Crc32(blocks[i].data) == blocks[i].crc;
+    });
+    if (std::count(valid.begin(), valid.end(), 0))
+      return SnapshotStatus::kCorrupted;
+    if (timings) timings->read = timer.Finish();
+
+    timer.Start();
+    auto now = duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch());
+    chunks.assign(blocks.size(), {});
+    std::vector<std::vector<Expiring>> expiring_chunks(blocks.size());
+    std::vector<uint64_t> counts(blocks.size());
+
+    ParallelLoader::Run(blocks.size(), threads, [&](size_t i) {
+      valid[i] = Decode(blocks[i], now.count(), chunks[i], expiring_chunks[i],
+                        counts[i]);
+    });
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      if (!valid[i]) return SnapshotStatus::kCorrupted;
+      total += counts[i];
+    }
+    if (total != records) return SnapshotStatus::kCorrupted;
+    if (timings) timings->parse = timer.Finish();
+
+    for (auto& part : expiring_chunks)
+      for (auto& record : part) expiring.push_back(std::move(record));
+    return SnapshotStatus::kOk;
+  }
+
+  static uint32_t Crc32(std::string_view data) {
+    static const std::array<uint32_t, 256> table = [] {
+      std::array<uint32_t, 256> result{};
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+          crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320u : 0);
+        result[i] = crc;
+      }
+      return result;
+    }();
+
+    uint32_t crc = ~0u;
+    for (unsigned char c : data) crc = table[(crc ^ c) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+  }
+
+  // LZ77 with varint lengths: a block is a sequence of
+  //   varint(literals) literals varint(match - 4) varint(offset)
+  // that ends with the last run of literals.
+  static std::string Compress(std::string_view input) {
+    std::string output;
+    std::vector<uint32_t> table(1 << 14);
+    size_t anchor = 0;
+
+    for (size_t i = 0; i + 4 <= input.size();) {
+      uint32_t word = Load32(input.data() + i);
+      uint32_t& slot = table[(word * 2654435761u) >> 18];
+      size_t candidate = slot;
+      slot = i + 1;
+
+      if (!candidate-- || i - candidate > 0xFFFF ||
+          Load32(input.data() + candidate) != word) {
+        ++i;
+        continue;
+      }
+
+      size_t length = 4;
+      while (i + length < input.size() &&
+             input[candidate + length] == input[i + length])
+        ++length;
+
+      PutVarint(output, i - anchor);
+      output.append(input.data() + anchor, i - anchor);
+      PutVarint(output, length - 4);
+      PutVarint(output, i - candidate);
+      i += length;
+      anchor = i;
+    }
+
+    PutVarint(output, input.size() - anchor);
+    output.append(input.data() + anchor, input.size() - anchor);
+    return output;
+  }
+
+  static bool Decompress(std::string_view input, size_t size,
+                         std::string& output) {
+    output.clear();
+    output.reserve(size);
+
+    while (true) {
+      uint64_t literals = 0;
+      if (!GetVarint(input, literals) || literals > input.size() ||
+          output.size() + literals > size)
+        return false;
+      output.append(input.data(), literals);
+      input.remove_prefix(literals);
+      if (output.size() == size) return input.empty();
+
+      uint64_t length = 0, offset = 0;
+      if (!GetVarint(input, length) || !GetVarint(input, offset) ||
+          !offset || offset > output.size() ||
+          output.size() + length + 4 > size)
+        return false;
+
+      // Byte by byte, the match may overlap the bytes it produces.
+      for (size_t from = output.size() - offset, i = 0; i < length + 4; ++i)
+        output.push_back(output[from + i]);
+    }
+  }
+
+  static void PutVarint(std::string& output, uint64_t value) {
+    for (; value >= 0x80; value >>= 7) output.push_back(value | 0x80);
+    output.push_back(value);
+  }
+
+  static bool GetVarint(std::string_view& input, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && !input.empty(); shift += 7) {
+      uint8_t byte = input.front();
+      input.remove_prefix(1);
+      value |= uint64_t{byte & 0x7Fu} << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return false;
+  }
+
+  static void PutString(std::string& output, std::string const& value) {
+    PutVarint(output, value.size());
+    output.append(value);
+  }
+
+  static bool GetString(std::string_view& input, std::string& result) {
+    uint64_t size = 0;
+    if (!GetVarint(input, size) || size > input.size()) return false;
+    result.assign(input.data(), size);
+    input.remove_prefix(size);
+    return true;
+  }
+
+  static void PutValue(std::string& output, V const& value) {
+    PutString(output, value.last_name);
+    PutString(output, value.first_name);
+    PutString(output, value.birthday);
+    PutString(output, value.city);
+    PutString(output, value.coins);
+  }
+
+  static bool GetValue(std::string_view& input, V& value) {
+    return GetString(input, value.last_name) &&
+           GetString(input, value.first_name) &&
+           GetString(input, value.birthday) && GetString(input, value.city) &&
+           GetString(input, value.coins);
+  }
+
+ private:
+  enum Codec : uint8_t { kRaw, kLz };
+
+  struct Block {
+    uint64_t size;
+    uint8_t codec;
+    uint32_t crc;
+    std::string_view data;
+  };
+
+  static uint32_t Load32(const char* data) {
+    uint32_t result;
+    std::memcpy(&result, data, sizeof(result));
+    return result;
+  }
+
+  // Only reads the block headers, the payloads are checked by Decode.
+  static bool Split(std::string_view input, std::vector<Block>& blocks,
+                    uint64_t& records) {
+    while (true) {
+      Block block{};
+      uint64_t stored = 0;
+      if (!GetVarint(input, block.size)) return false;
+      if (!block.size) return GetVarint(input, records) && input.empty();
+
+      if (!GetVarint(input, stored) || input.size() < stored + 5) return false;
+      block.codec = input[0];
+      for (int i = 0; i < 4; ++i)
+        block.crc |= uint32_t{static_cast<uint8_t>(input[1 + i])} << (8 * i);
+      block.data = input.substr(5, stored);
+      input.remove_prefix(5 + stored);
+      blocks.push_back(block);
+    }
+  }
+
+  // The checksum is already verified.
+  static bool Decode(Block const& block, int64_t now,
+                     std::vector<ParallelLoader::Record>& records,
+                     std::vector<Expiring>& expiring, uint64_t& count) {
+    std::string buffer;
+    std::string_view input = block.data;
+    if (block.codec == kLz) {
+      if (!Decompress(block.data, block.size, buffer)) return false;
+      input = buffer;
+    } else if (block.codec != kRaw || block.data.size() != block.size) {
+      return false;
+    }
+
+    K key;
+    V value;
+    uint64_t deadline = 0;
+    for (count = 0; !input.empty(); ++count) {
+      if (!GetString(input, key) || !GetValue(input, value) ||
+          !GetVarint(input, deadline))
+        return false;
+
+      if (!deadline) {
+        records.emplace_back(std::move(key), std::move(value));
+      } else if (static_cast<int64_t>(deadline) > now) {
+        int lifetime = (deadline - now + 999) / 1000;
+        expiring.push_back({std::move(key), std::move(value), lifetime});
+      }
+    }
+    return true;
+  }
+};
+
+// Streams records into blocks of about kBlockSize bytes. On io_uring a
+// block is written while the next one is being filled.
+class Snapshot::Writer {
+ public:
+  Writer(const std::string& filename, bool compress)
+      : fd_(::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644)),
+        output_(fd_, CurrentIoBackend()),
+        compress_(compress) {
+    std::string header(kMagic);
+    header.push_back(kVersion);
+    output_.Write(std::move(header));
+  }
+
+  ~Writer() {
+    output_.Flush(false);
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  Writer(const Writer&) = delete;
+  Writer(Writer&&) = delete;
+  void operator=(const Writer&) = delete;
+  void operator=(Writer&&) = delete;
+
+  bool IsOpen() const { return fd_ >= 0; }
+  int Count() const { return count_; }
+
+  void Add(const K& key, const V& value, uint64_t deadline) {
+    PutString(block_, key);
+    PutValue(block_, value);
+    PutVarint(block_, deadline);
+    ++count_;
+
+    if (block_.size() >= kBlockSize) Flush();
+  }
+
+  // Writes the last block and the end marker, returns false if any write
+  // failed.
+  bool Finish() {
+    Flush();
+    std::string end;
+    PutVarint(end, 0);
+    PutVarint(end, count_);
+    output_.Write(std::move(end));
+    return output_.Flush(false);
+  }
+
+ private:
+  int fd_;
+  FileOutput output_;
+  bool compress_;
+  std::string block_;
+  int count_ = 0;
+
+  void Flush() {
+    if (block_.empty()) return;
+
+    std::string compressed;
+    if (compress_) compressed = Compress(block_);
+    bool use_lz = compress_ && compressed.size() < block_.size();
+    std::string_view data = use_lz ? compressed : block_;
+
+    // The header and the block leave in one write.
+    std::string chunk;
+    chunk.reserve(data.size() + 16);
+    PutVarint(chunk, block_.size());
+    PutVarint(chunk, data.size());
+    chunk.push_back(use_lz ? kLz : kRaw);
+    uint32_t crc = Crc32(data);
+    for (int i = 0; i < 4; ++i) chunk.push_back(crc >> (8 * i));
+    chunk.append(data);
+
+    output_.Write(std::move(chunk));
+    block_.clear();
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_SNAPSHOT_H_
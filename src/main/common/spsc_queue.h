@@ -0,0 +1,92 @@
+#ifndef A6_SRC_MAIN_COMMON_SPSC_QUEUE_H_
+#define A6_SRC_MAIN_COMMON_SPSC_QUEUE_H_
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+namespace s21 {
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. The indexes only grow, the slot is the index modulo
+// the capacity, and each side owns one of them on its own cache line.
+template <class T, size_t kCapacity>
+class SpscQueue {
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "the capacity must be a power of two");
+
+ public:
+  // Producer side, false when the queue is full.
+  bool Push(T item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == kCapacity)
+      return false;
+    slots_[tail & (kCapacity - 1)] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side, false when the queue is empty.
+  bool Pop(T& item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+    item = std::move(slots_[head & (kCapacity - 1)]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool Empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  alignas(64) std::atomic_size_t head_ = 0;
+  alignas(64) std::atomic_size_t tail_ = 0;
+  alignas(64) std::array<T, kCapacity> slots_{};
+};
+
+// Lets one thread sleep until a condition other threads make true. The
+// waiter spins for a while when there are cores to spare, then blocks.
+// Ring must follow the store that makes the condition true, it only takes
+// the mutex when the waiter is asleep.
+class Doorbell {
+ public:
+  template <class Ready>
+  void Wait(Ready const& ready) {
+    for (int i = 0; i < Spins(); ++i)
+      if (ready()) return;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!ready()) wakeup_.wait(lock);
+    sleeping_.store(false, std::memory_order_relaxed);
+  }
+
+  void Ring() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!sleeping_.load(std::memory_order_relaxed)) return;
+    std::scoped_lock<std::mutex> lock(mutex_);
+    wakeup_.notify_one();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::atomic_bool sleeping_ = false;
+
+  // Spinning on a single core only keeps the other side from running.
+  static int Spins() {
+    static const int spins =
+        std::thread::hardware_concurrency() > 1 ? 2000 : 0;
+    return spins;
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_SPSC_QUEUE_H_
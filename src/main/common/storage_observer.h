@@ -0,0 +1,86 @@
+#ifndef A6_SRC_MAIN_COMMON_STORAGE_OBSERVER_H_
+#define A6_SRC_MAIN_COMMON_STORAGE_OBSERVER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "person.h"
+
+namespace s21 {
+
+// Receives every mutation of a storage. Callbacks are invoked by the
+// engine under its lock, in the order the mutations are applied, so they
+// must be cheap and must not block. The values are the stored ones.
+class StorageObserver {
+ public:
+  using K = std::string;
+  using V = Person;
+
+  virtual ~StorageObserver() = default;
+
+  virtual void OnInsert(const K& key, const V& value) {}
+  virtual void OnBeforeUpdate(const K& key, const V& value) {}
+  virtual void OnAfterUpdate(const K& key, const V& value) {}
+  virtual void OnErase(const K& key, const V& value) {}
+  // The TTL of the key ran out, an erase for those that don't care why.
+  virtual void OnExpire(const K& key, const V& value) { OnErase(key, value); }
+  virtual void OnRename(const K& from, const K& to) {}
+  // A TTL was set, the deadline is Unix time in milliseconds.
+  virtual void OnExpireAt(const K& key, uint64_t deadline) {}
+};
+
+class StorageObservers : public StorageObserver {
+ public:
+  StorageObservers(std::initializer_list<StorageObserver*> observers)
+      : observers_(observers) {}
+
+  void Add(StorageObserver* observer) {
+    if (std::find(observers_.begin(), observers_.end(), observer) ==
+        observers_.end())
+      observers_.push_back(observer);
+  }
+
+  void Remove(StorageObserver* observer) {
+    observers_.erase(
+        std::remove(observers_.begin(), observers_.end(), observer),
+        observers_.end());
+  }
+
+  void OnInsert(const K& key, const V& value) override {
+    for (auto* i : observers_) i->OnInsert(key, value);
+  }
+
+  void OnBeforeUpdate(const K& key, const V& value) override {
+    for (auto* i : observers_) i->OnBeforeUpdate(key, value);
+  }
+
+  void OnAfterUpdate(const K& key, const V& value) override {
+    for (auto* i : observers_) i->OnAfterUpdate(key, value);
+  }
+
+  void OnErase(const K& key, const V& value) override {
+    for (auto* i : observers_) i->OnErase(key, value);
+  }
+
+  void OnExpire(const K& key, const V& value) override {
+    for (auto* i : observers_) i->OnExpire(key, value);
+  }
+
+  void OnRename(const K& from, const K& to) override {
+    for (auto* i : observers_) i->OnRename(from, to);
+  }
+
+  void OnExpireAt(const K& key, uint64_t deadline) override {
+    for (auto* i : observers_) i->OnExpireAt(key, deadline);
+  }
+
+ private:
+  std::vector<StorageObserver*> observers_;
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_STORAGE_OBSERVER_H_
@@ -0,0 +1,55 @@
+#ifndef A6_SRC_MAIN_COMMON_TOKENIZER_H_
+#define A6_SRC_MAIN_COMMON_TOKENIZER_H_
+
+#include <algorithm>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace s21 {
+
+// Splits lines into views of the tokens in place. The line and the views
+// keep their buffers from one line to the next, so a steady stream of
+// commands allocates nothing.
+class Tokenizer {
+ public:
+  // Takes the next line of the input, false once the input has ended.
+  bool Read(std::istream& input) {
+    if (!std::getline(input, line_)) {
+      tokens_.clear();
+      return false;
+    }
+    Split(line_, tokens_);
+    return true;
+  }
+
+  // Valid until the next Read.
+  std::vector<std::string_view> const& Tokens() const { return tokens_; }
+
+  // Copies the tokens into the strings, which keep their buffers.
+  void CopyTo(std::vector<std::string>& tokens) const {
+    tokens.resize(tokens_.size());
+    for (size_t i = 0; i < tokens_.size(); ++i) tokens[i] = tokens_[i];
+  }
+
+  // Splits on every space, like the console always has: two spaces make
+  // an empty token, one at the end makes none.
+  static void Split(std::string_view line,
+                    std::vector<std::string_view>& tokens) {
+    tokens.clear();
+    while (!line.empty()) {
+      size_t space = std::min(line.find(' '), line.size());
+      tokens.push_back(line.substr(0, space));
+      line.remove_prefix(std::min(space + 1, line.size()));
+    }
+  }
+
+ private:
+  std::string line_;
+  std::vector<std::string_view> tokens_;
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_TOKENIZER_H_
@@ -0,0 +1,69 @@
+#ifndef A6_SRC_MAIN_COMMON_WATCH_TABLE_H_
+#define A6_SRC_MAIN_COMMON_WATCH_TABLE_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "storage_observer.h"
+
+namespace s21 {
+
+// Key and the version it had when it was watched.
+using WatchedKeys = std::vector<std::pair<std::string, uint64_t>>;
+
+// Version counters of the watched keys. Only keys with at least one
+// watcher have a counter, so writes to the rest of the storage pay a
+// single failed hash lookup. Every mutation of a watched key, including
+// its expiration, bumps the version.
+class WatchTable : public StorageObserver {
+ public:
+  uint64_t Watch(const K& key) {
+    Entry& entry = entries_[key];
+    ++entry.watchers;
+    return entry.version;
+  }
+
+  void Unwatch(const K& key) {
+    auto itr = entries_.find(key);
+    if (itr != entries_.end() && !--itr->second.watchers) entries_.erase(itr);
+  }
+
+  bool Unchanged(const WatchedKeys& watched) const {
+    for (auto const& [key, version] : watched) {
+      auto itr = entries_.find(key);
+      if (itr == entries_.end() || itr->second.version != version)
+        return false;
+    }
+    return true;
+  }
+
+  void OnInsert(const K& key, const V& value) override { Bump(key); }
+  void OnAfterUpdate(const K& key, const V& value) override { Bump(key); }
+  void OnErase(const K& key, const V& value) override { Bump(key); }
+
+  void OnRename(const K& from, const K& to) override {
+    Bump(from);
+    Bump(to);
+  }
+
+ private:
+  struct Entry {
+    uint64_t version = 0;
+    size_t watchers = 0;
+  };
+
+  std::unordered_map<K, Entry> entries_;
+
+  void Bump(const K& key) {
+    if (entries_.empty()) return;
+
+    auto itr = entries_.find(key);
+    if (itr != entries_.end()) ++itr->second.version;
+  }
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_COMMON_WATCH_TABLE_H_
@@ -1,62 +1,42 @@
 #include "hash_table.h"
 
+#include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <utility>
+
+#include "record_parser.h"
 
 namespace s21 {
 
 HashTable::HashTable(size_t capacity) : capacity_(capacity), data_(capacity) {}
 
 bool HashTable::Set(const K& key, const V& value, int lifetime) {
-  std::scoped_lock<std::recursive_mutex> lock(mtx_);
-  if (Exists(key)) return false;
-
-  if (lifetime > -1) {
-    size_t id = pool_.DelayTask(std::chrono::seconds(lifetime),
-                                [&, key] { Delete(key); });
-    deletion_queue_.emplace(key, id);
-  }
-
-  data_.at(CalcIndex(key)).push_back(Node{key, value, lifetime});
+  return Set(K(key), V(value), lifetime);
+}
 
-  return true;
+bool HashTable::Set(K&& key, V&& value, int lifetime) {
+  size_t index = CalcIndex(key);
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Insert(index, std::move(key), std::move(value), lifetime);
 }
 
 HashTable::V HashTable::Get(const K& key) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
-  for (Node node : data_.at(CalcIndex(key)))
-    if (node.key == key) return node.value;
-
-  return V{};
+  const V* value = Lookup(key);
+  return value ? *value : V{};
 }
 
 bool HashTable::Exists(const K& key) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
-  for (Node node : data_.at(CalcIndex(key)))
-    if (node.key == key) return true;
-
-  return false;
+  return Lookup(key) != nullptr;
 }
 
 bool HashTable::Delete(const K& key) {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
-
-  size_t index = CalcIndex(key);
-  for (Node node : data_.at(index)) {
-    if (node.key == key) {
-      auto item = deletion_queue_.find(key);
-      if (item != deletion_queue_.end()) {
-        pool_.StopTask(item->second);
-        deletion_queue_.erase(item);
-      }
-
-      data_.at(index).remove(node);
-      return true;
-    }
-  }
-  return false;
+  return Erase(CalcIndex(key), key);
 }
 
 bool HashTable::Update(const K& key, const V& value) {
@@ -64,7 +44,9 @@ bool HashTable::Update(const K& key, const V& value) {
 
   for (Node& node : data_.at(CalcIndex(key))) {
     if (node.key == key) {
+      observers_.OnBeforeUpdate(key, node.value);
       node.value = value;
+      observers_.OnAfterUpdate(key, node.value);
       return true;
     }
   }
@@ -75,27 +57,34 @@ std::vector<HashTable::K> HashTable::Keys() const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
   std::vector<K> result;
-  for (std::list<Node> nodes : data_) {
-    for (Node node : nodes) {
+  result.reserve(size_);
+  for (const std::list<Node>& nodes : data_) {
+    for (const Node& node : nodes) {
       result.push_back(node.key);
     }
   }
   return result;
 }
 
+// Relinks the list node into the bucket of the new key, the value and the
+// expiration timer stay where they are.
 bool HashTable::Rename(const K& from, const K& to) {
-  if (Exists(to) && Exists(from) && from == to) return true;
-  if (Exists(to)) return false;
-
+  size_t from_index = CalcIndex(from);
+  size_t to_index = CalcIndex(to);
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
-  for (Node& node : data_.at(CalcIndex(from))) {
-    if (node.key == from) {
-      Set(to, node.value, Ttl(node.key));
-      return Delete(from);
-    }
-  }
-  return false;
+  auto& nodes = data_[from_index];
+  auto node = std::find_if(nodes.begin(), nodes.end(),
+                           [&](const Node& i) { return i.key == from; });
+  if (node == nodes.end()) return false;
+  if (from == to) return true;
+  if (Lookup(to_index, to)) return false;
+
+  node->key = to;
+  data_[to_index].splice(data_[to_index].end(), nodes, node);
+  RenameExpiration(from, to);
+  observers_.OnRename(from, to);
+  return true;
 }
 
 int HashTable::Ttl(const K& key) const {
@@ -103,7 +92,7 @@ int HashTable::Ttl(const K& key) const {
 
   auto item = deletion_queue_.find(key);
   if (item != deletion_queue_.end())
-    return pool_.GetRemainTime(item->second).count();
+    return pool_.GetRemainTime(item->second.task_id).count();
 
   return -1;
 }
@@ -112,8 +101,11 @@ std::vector<HashTable::K> HashTable::Find(const V& value) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
   std::vector<K> result;
-  for (std::list<Node> nodes : data_) {
-    for (Node node : nodes) {
+  auto lookup = [&](const K& key) { return Lookup(key); };
+  if (index_.Find(value, lookup, result)) return result;
+
+  for (const std::list<Node>& nodes : data_) {
+    for (const Node& node : nodes) {
       if (node.value == value) {
         result.push_back(node.key);
       }
@@ -122,31 +114,149 @@ std::vector<HashTable::K> HashTable::Find(const V& value) const {
   return result;
 }
 
+size_t HashTable::Count(const V& value) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+
+  size_t result = 0;
+  auto lookup = [&](const K& key) { return Lookup(key); };
+  if (index_.Count(value, lookup, result)) return result;
+
+  for (const std::list<Node>& nodes : data_)
+    for (const Node& node : nodes)
+      if (node.value == value) ++result;
+
+  return result;
+}
+
 std::vector<HashTable::V> HashTable::ShowAll() const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
   std::vector<V> result;
-  for (std::list<Node> nodes : data_) {
-    for (Node node : nodes) {
+  result.reserve(size_);
+  for (const std::list<Node>& nodes : data_) {
+    for (const Node& node : nodes) {
       result.push_back(node.value);
     }
   }
   return result;
 }
 
-int HashTable::Upload(const std::string& filename) {
-  std::ifstream stream(filename);
-  if (stream.is_open() == false) return 0;
+GroupedStats HashTable::Aggregate(const V& filter, GroupBy group_by) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
-  int number_of_lines = 0;
-  K key;
-  V value;
-  while (stream >> key >> value) {
-    Set(key, value);
-    ++number_of_lines;
+  Aggregator aggregator(filter, group_by);
+  for (const std::list<Node>& nodes : data_)
+    for (const Node& node : nodes) aggregator.Add(node.value);
+
+  return aggregator.Result();
+}
+
+bool HashTable::Visit(const K& key,
+                      const std::function<void(const V&)>& visitor) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+
+  const V* value = Lookup(key);
+  if (value) visitor(*value);
+  return value != nullptr;
+}
+
+ReadHandle HashTable::Read(const K& key) const {
+  std::unique_lock<std::recursive_mutex> lock(mtx_);
+  const V* value = Lookup(key);
+  return ReadHandle(std::move(lock), value);
+}
+
+void HashTable::ForEach(const Visitor& visitor) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+
+  for (const std::list<Node>& nodes : data_)
+    for (const Node& node : nodes) visitor(node.key, node.value);
+}
+
+CoinsStatus HashTable::IncrementBy(const K& key, long long delta,
+                                   long long& balance) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Coins::IncrementBy(key, Lookup(key), delta, observers_, balance);
+}
+
+CoinsStatus HashTable::Transfer(const K& from, const K& to, long long amount) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Coins::Transfer(from, Lookup(from), to, Lookup(to), amount,
+                         observers_);
+}
+
+int HashTable::MSet(const std::vector<std::pair<K, V>>& items) {
+  std::vector<size_t> indexes;
+  indexes.reserve(items.size());
+  for (auto const& [key, value] : items) indexes.push_back(CalcIndex(key));
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Prefetch(indexes);
+
+  int result = 0;
+  for (size_t i = 0; i < items.size(); ++i)
+    result += Insert(indexes[i], K(items[i].first), V(items[i].second), -1);
+
+  return result;
+}
+
+std::vector<HashTable::V> HashTable::MGet(const std::vector<K>& keys) const {
+  std::vector<size_t> indexes;
+  indexes.reserve(keys.size());
+  for (auto const& key : keys) indexes.push_back(CalcIndex(key));
+
+  std::vector<V> result;
+  result.reserve(keys.size());
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Prefetch(indexes);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const V* value = Lookup(indexes[i], keys[i]);
+    result.push_back(value ? *value : V{});
   }
 
-  return number_of_lines;
+  return result;
+}
+
+std::vector<bool> HashTable::MExists(const std::vector<K>& keys) const {
+  std::vector<size_t> indexes;
+  indexes.reserve(keys.size());
+  for (auto const& key : keys) indexes.push_back(CalcIndex(key));
+
+  std::vector<bool> result;
+  result.reserve(keys.size());
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Prefetch(indexes);
+
+  for (size_t i = 0; i < keys.size(); ++i)
+    result.push_back(Lookup(indexes[i], keys[i]) != nullptr);
+
+  return result;
+}
+
+int HashTable::MDelete(const std::vector<K>& keys) {
+  std::vector<size_t> indexes;
+  indexes.reserve(keys.size());
+  for (auto const& key : keys) indexes.push_back(CalcIndex(key));
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Prefetch(indexes);
+
+  int result = 0;
+  for (size_t i = 0; i < keys.size(); ++i) result += Erase(indexes[i], keys[i]);
+
+  return result;
+}
+
+int HashTable::Upload(const std::string& filename, unsigned threads) {
+  threads = ParallelLoader::Threads(threads);
+  ParallelLoader::Chunks chunks;
+  if (!ParallelLoader::Read(filename, threads, chunks)) return 0;
+
+  InsertChunks(chunks, threads);
+  return ParallelLoader::Count(chunks);
 }
 
 int HashTable::Export(const std::string& filename) const {
@@ -156,8 +266,8 @@ int HashTable::Export(const std::string& filename) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
   int number_of_lines = 0;
-  for (std::list<Node> nodes : data_) {
-    for (Node node : nodes) {
+  for (const std::list<Node>& nodes : data_) {
+    for (const Node& node : nodes) {
       stream << node.key << " " << node.value << std::endl;
       ++number_of_lines;
     }
@@ -166,6 +276,290 @@ int HashTable::Export(const std::string& filename) const {
   return number_of_lines;
 }
 
+int HashTable::ExportShards(const std::string& manifest,
+                            unsigned shards) const {
+  shards = ParallelLoader::Threads(shards);
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+
+  // Every shard takes a range of buckets.
+  return ExportWriter::Shards(manifest, shards, [&](size_t shard,
+                                                    ExportWriter& writer) {
+    size_t end = data_.size() * (shard + 1) / shards;
+    for (size_t i = data_.size() * shard / shards; i < end; ++i) {
+      for (const Node& node : data_[i]) writer.Add(node.key, node.value);
+      writer.Spill();
+    }
+  });
+}
+
+ExportStats HashTable::ExportInChunks(const std::string& filename,
+                                      size_t chunk) const {
+  ExportStats stats;
+  ExportWriter writer(filename);
+  if (writer.IsOpen() == false) return stats;
+  chunk = std::max<size_t>(chunk, 1);
+
+  // Buckets never move, so the next chunk starts from the next bucket.
+  for (size_t bucket = 0; bucket < data_.size(); ++stats.chunks) {
+    {
+      std::scoped_lock<std::recursive_mutex> lock(mtx_);
+      Timer timer;
+      for (size_t taken = 0; bucket < data_.size() && taken < chunk; ++bucket)
+        for (const Node& node : data_[bucket]) {
+          writer.Add(node.key, node.value);
+          ++taken;
+        }
+      stats.max_lock_hold = std::max(stats.max_lock_hold, timer.Finish());
+    }
+    writer.Spill();
+  }
+
+  if (writer.Finish()) stats.lines = writer.Count();
+  return stats;
+}
+
+SnapshotStatus HashTable::Save(const std::string& filename, int& saved,
+                               bool compress) const {
+  Snapshot::Writer writer(filename, compress);
+  if (writer.IsOpen() == false) return SnapshotStatus::kNotOpen;
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Dump(writer, Deadlines());
+  saved = writer.Count();
+  return writer.Finish() ? SnapshotStatus::kOk : SnapshotStatus::kNotOpen;
+}
+
+pid_t HashTable::SaveInBackground(const std::string& filename,
+                                  bool compress) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  auto deadlines = Deadlines();
+
+  return Snapshot::Fork([&] {
+    Snapshot::Writer writer(filename, compress);
+    if (!writer.IsOpen()) return false;
+    Dump(writer, deadlines);
+    return writer.Finish();
+  });
+}
+
+SnapshotStatus HashTable::Load(const std::string& filename, int& loaded,
+                               unsigned threads,
+                               LoadTimings* timings) {
+  threads = ParallelLoader::Threads(threads);
+  ParallelLoader::Chunks chunks;
+  std::vector<Snapshot::Expiring> expiring;
+  auto status = Snapshot::Read(filename, threads, chunks, expiring, timings);
+  if (status != SnapshotStatus::kOk) return status;
+
+  Timer timer;
+  InsertChunks(chunks, threads);
+  for (auto& [key, value, lifetime] : expiring)
+    Set(std::move(key), std::move(value), lifetime);
+  if (timings) timings->insert = timer.Finish();
+
+  loaded = ParallelLoader::Count(chunks) + expiring.size();
+  return SnapshotStatus::kOk;
+}
+
+uint64_t HashTable::Watch(const K& key) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return watches_.Watch(key);
+}
+
+void HashTable::Unwatch(const K& key) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  watches_.Unwatch(key);
+}
+
+bool HashTable::Atomically(const WatchedKeys& watched,
+                          const std::function<void()>& body) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (!watches_.Unchanged(watched)) return false;
+
+  body();
+  return true;
+}
+
+void HashTable::Subscribe(StorageObserver* observer) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  observers_.Add(observer);
+}
+
+void HashTable::Unsubscribe(StorageObserver* observer) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  observers_.Remove(observer);
+}
+
+void HashTable::CreateView(GroupBy group_by) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (!views_.Contains(group_by))
+    views_.Create(group_by, Aggregate({"-", "-", "-", "-", "-"}, group_by));
+}
+
+GroupedTotals HashTable::ReadView(GroupBy group_by) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return views_.Read(group_by);
+}
+
+void HashTable::CreateIndex() {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (index_.Enabled()) return;
+
+  index_.Enable();
+  for (const std::list<Node>& nodes : data_)
+    for (const Node& node : nodes) index_.OnInsert(node.key, node.value);
+}
+
+size_t HashTable::IndexMemoryUsage() const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return index_.Enabled() ? index_.MemoryUsage() : 0;
+}
+
+const HashTable::V* HashTable::Lookup(const K& key) const {
+  return Lookup(CalcIndex(key), key);
+}
+
+HashTable::V* HashTable::Lookup(const K& key) {
+  return const_cast<V*>(std::as_const(*this).Lookup(key));
+}
+
+const HashTable::V* HashTable::Lookup(size_t index, const K& key) const {
+  for (const Node& node : data_[index])
+    if (node.key == key) return &node.value;
+
+  return nullptr;
+}
+
+// Every thread owns a range of buckets and walks all records in file
+// order, so a repeated key meets its first occurrence in its bucket.
+void HashTable::InsertChunks(ParallelLoader::Chunks& chunks,
+                             unsigned threads) {
+  std::vector<std::vector<size_t>> indexes(chunks.size());
+  ParallelLoader::Run(chunks.size(), threads, [&](size_t i) {
+    for (auto const& record : chunks[i])
+      indexes[i].push_back(CalcIndex(record.first));
+  });
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+
+  std::vector<std::vector<const Node*>> inserted(threads);
+  ParallelLoader::Run(threads, threads, [&](size_t thread) {
+    size_t first = capacity_ * thread / threads;
+    size_t last = capacity_ * (thread + 1) / threads;
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      for (size_t j = 0; j < chunks[i].size(); ++j) {
+        size_t index = indexes[i][j];
+        auto& [key, value] = chunks[i][j];
+        if (index < first || index >= last || Lookup(index, key)) continue;
+
+        data_[index].push_back(Node{std::move(key), std::move(value), -1});
+        inserted[thread].push_back(&data_[index].back());
+      }
+    }
+  });
+
+  for (auto const& nodes : inserted) {
+    for (const Node* node : nodes) observers_.OnInsert(node->key, node->value);
+    size_ += nodes.size();
+  }
+}
+
+bool HashTable::Insert(size_t index, K&& key, V&& value, int lifetime) {
+  auto& nodes = data_[index];
+  for (const Node& node : nodes)
+    if (node.key == key) return false;
+
+  nodes.push_back(Node{std::move(key), std::move(value), lifetime});
+  const Node& node = nodes.back();
+
+  observers_.OnInsert(node.key, node.value);
+  if (lifetime > -1) ScheduleExpiration(node.key, lifetime);
+  ++size_;
+
+  return true;
+}
+
+bool HashTable::Erase(size_t index, const K& key, bool expired) {
+  auto& nodes = data_[index];
+  auto node = std::find_if(nodes.begin(), nodes.end(),
+                           [&](const Node& i) { return i.key == key; });
+  if (node == nodes.end()) return false;
+
+  CancelExpiration(key);
+  if (expired)
+    observers_.OnExpire(key, node->value);
+  else
+    observers_.OnErase(key, node->value);
+  nodes.erase(node);
+  --size_;
+  return true;
+}
+
+void HashTable::ScheduleExpiration(const K& key, int lifetime) {
+  auto holder = std::make_shared<K>(key);
+  size_t id = pool_.DelayTask(std::chrono::seconds(lifetime), [&, holder] {
+    std::scoped_lock<std::recursive_mutex> lock(mtx_);
+    Erase(CalcIndex(*holder), *holder, true);
+  });
+  deletion_queue_.emplace(key, Expiration{id, holder});
+  observers_.OnExpireAt(key, Deadline(key));
+}
+
+// Unix time in milliseconds when the key expires, 0 without TTL.
+uint64_t HashTable::Deadline(const K& key) const {
+  auto item = deletion_queue_.find(key);
+  if (item == deletion_queue_.end()) return 0;
+  return Snapshot::ToDeadline(pool_.GetDeleteTime(item->second.task_id));
+}
+
+Snapshot::Deadlines HashTable::Deadlines() const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Snapshot::Deadlines result;
+  for (auto const& [key, expiration] : deletion_queue_)
+    result.emplace_hint(result.end(), key, Deadline(key));
+  return result;
+}
+
+// Writes the records without locking anything, a forked child calls it
+// too.
+void HashTable::Dump(Snapshot::Writer& writer,
+                     Snapshot::Deadlines const& deadlines) const {
+  for (const std::list<Node>& nodes : data_) {
+    for (const Node& node : nodes) {
+      auto deadline = deadlines.find(node.key);
+      writer.Add(node.key, node.value,
+                 deadline == deadlines.end() ? 0 : deadline->second);
+    }
+  }
+}
+
+void HashTable::CancelExpiration(const K& key) {
+  auto item = deletion_queue_.find(key);
+  if (item == deletion_queue_.end()) return;
+
+  pool_.StopTask(item->second.task_id);
+  deletion_queue_.erase(item);
+}
+
+void HashTable::RenameExpiration(const K& from, const K& to) {
+  auto item = deletion_queue_.extract(from);
+  if (!item) return;
+
+  item.key() = to;
+  *item.mapped().key = to;
+  deletion_queue_.insert(std::move(item));
+}
+
+// Batches first resolve every bucket, then touch the buckets and their
+// first nodes ahead of the probes so that the cache misses overlap.
+void HashTable::Prefetch(const std::vector<size_t>& indexes) const {
+  for (size_t i : indexes) __builtin_prefetch(&data_[i]);
+
+  for (size_t i : indexes)
+    if (!data_[i].empty()) __builtin_prefetch(&data_[i].front());
+}
+
 size_t HashTable::CalcHashCode(const K& key) const {
   size_t result = 0;
   size_t len = key.length();
@@ -5,6 +5,7 @@
 #include <map>
 
 #include "async_pool.h"
+#include "expiration.h"
 #include "key_value_storage.h"
 
 namespace s21 {
@@ -19,6 +20,7 @@ class HashTable : public KeyValueStorage {
   void operator=(HashTable&&) = delete;
 
   bool Set(const K& key, const V& value, int lifetime = -1) override;
+  bool Set(K&& key, V&& value, int lifetime = -1) override;
   [[nodiscard]] V Get(const K& key) const override;
   [[nodiscard]] bool Exists(const K& key) const override;
   bool Delete(const K& key) override;
@@ -27,9 +29,50 @@ class HashTable : public KeyValueStorage {
   bool Rename(const K& from, const K& to) override;
   [[nodiscard]] int Ttl(const K& key) const override;
   [[nodiscard]] std::vector<K> Find(const V& value) const override;
+  [[nodiscard]] size_t Count(const V& value) const override;
   [[nodiscard]] std::vector<V> ShowAll() const override;
-  int Upload(const std::string& filename) override;
+  [[nodiscard]] GroupedStats Aggregate(const V& filter,
+                                       GroupBy group_by) const override;
+  bool Visit(const K& key,
+             const std::function<void(const V&)>& visitor) const override;
+  [[nodiscard]] ReadHandle Read(const K& key) const override;
+  void ForEach(const Visitor& visitor) const override;
+  CoinsStatus IncrementBy(const K& key, long long delta,
+                          long long& balance) override;
+  CoinsStatus Transfer(const K& from, const K& to, long long amount) override;
+  int MSet(const std::vector<std::pair<K, V>>& items) override;
+  [[nodiscard]] std::vector<V> MGet(const std::vector<K>& keys) const override;
+  [[nodiscard]] std::vector<bool> MExists(
+      const std::vector<K>& keys) const override;
+  int MDelete(const std::vector<K>& keys) override;
+  int Upload(const std::string& filename, unsigned threads = 0) override;
   int Export(const std::string& filename) const override;
+  int ExportShards(const std::string& manifest,
+                   unsigned shards = 0) const override;
+  ExportStats ExportInChunks(const std::string& filename,
+                             size_t chunk = 1024) const override;
+  SnapshotStatus Save(const std::string& filename, int& saved,
+                      bool compress = false) const override;
+  SnapshotStatus Load(const std::string& filename, int& loaded,
+                      unsigned threads = 0,
+                      LoadTimings* timings = nullptr) override;
+  pid_t SaveInBackground(const std::string& filename,
+                         bool compress = false) const override;
+  [[nodiscard]] Snapshot::Deadlines Deadlines() const override;
+  void Dump(Snapshot::Writer& writer,
+            Snapshot::Deadlines const& deadlines) const override;
+
+  uint64_t Watch(const K& key) override;
+  void Unwatch(const K& key) override;
+  bool Atomically(const WatchedKeys& watched,
+                  const std::function<void()>& body) override;
+
+  void Subscribe(StorageObserver* observer) override;
+  void Unsubscribe(StorageObserver* observer) override;
+  void CreateView(GroupBy group_by) override;
+  [[nodiscard]] GroupedTotals ReadView(GroupBy group_by) const override;
+  void CreateIndex() override;
+  [[nodiscard]] size_t IndexMemoryUsage() const override;
 
  private:
   struct Node {
@@ -41,11 +84,27 @@ class HashTable : public KeyValueStorage {
   };
 
   size_t capacity_ = 0;
+  size_t size_ = 0;
   std::vector<std::list<Node>> data_;
-  std::map<K, size_t> deletion_queue_;
+  std::map<K, Expiration> deletion_queue_;
+  MaterializedViews views_;
+  BitmapIndex index_;
+  WatchTable watches_;
+  StorageObservers observers_{&views_, &index_, &watches_};
   AsyncPool pool_;
   mutable std::recursive_mutex mtx_;
 
+  const V* Lookup(const K& key) const;
+  V* Lookup(const K& key);
+  const V* Lookup(size_t index, const K& key) const;
+  void InsertChunks(ParallelLoader::Chunks& chunks, unsigned threads);
+  uint64_t Deadline(const K& key) const;
+  bool Insert(size_t index, K&& key, V&& value, int lifetime);
+  bool Erase(size_t index, const K& key, bool expired = false);
+  void ScheduleExpiration(const K& key, int lifetime);
+  void CancelExpiration(const K& key);
+  void RenameExpiration(const K& from, const K& to);
+  void Prefetch(const std::vector<size_t>& indexes) const;
   size_t CalcHashCode(const K& key) const;
   size_t CalcIndex(const K& key) const;
 };
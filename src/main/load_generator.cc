@@ -0,0 +1,275 @@
+//////////////////////////////////////////
+//   load generator for the server mode  //
+//////////////////////////////////////////
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "console.h"
+#include "resp.h"
+#include "timer.h"
+
+using namespace s21;
+
+struct Options {
+  int port = 6379;
+  std::string unix_socket;
+  int clients = 4;
+  int requests = 100000;
+  int keys = 10000;
+  int writes = 20;  // percent of INCRBY among the requests
+  int pipeline = 1;  // deepest pipeline, depths 1, 2, 4... up to it
+  int pid = 0;       // of the server, for its CPU time per request
+};
+
+// A blocking client that sends a pipeline of commands and waits for all
+// of their replies.
+class Client {
+ public:
+  explicit Client(const Options& options) {
+    if (options.unix_socket.empty()) {
+      fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in address{};
+      address.sin_family = AF_INET;
+      address.sin_port = htons(options.port);
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      Connect(reinterpret_cast<sockaddr*>(&address), sizeof(address));
+      int on = 1;
+      ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    } else {
+      fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      sockaddr_un address{};
+      address.sun_family = AF_UNIX;
+      std::strncpy(address.sun_path, options.unix_socket.c_str(),
+                   sizeof(address.sun_path) - 1);
+      Connect(reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    }
+  }
+
+  ~Client() {
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  Client(const Client&) = delete;
+  void operator=(const Client&) = delete;
+
+  bool IsOpen() const { return fd_ >= 0; }
+
+  // Sends the commands in one write and reads up to their replies.
+  bool Call(std::vector<std::vector<std::string>> const& commands) {
+    output_.clear();
+    for (auto const& command : commands) Resp::Command(output_, command);
+    for (size_t sent = 0; sent < output_.size();) {
+      ssize_t size = ::send(fd_, output_.data() + sent,
+                            output_.size() - sent, MSG_NOSIGNAL);
+      if (size <= 0) return false;
+      sent += size;
+    }
+
+    std::string_view input = input_;
+    for (size_t replies = 0; replies < commands.size();) {
+      bool error = false;
+      Resp::Status status = Resp::Skip(input, error);
+      if (status == Resp::Status::kError) return false;
+      if (status == Resp::Status::kOk) {
+        ++replies;
+        continue;
+      }
+
+      size_t parsed = input_.size() - input.size();
+      input_.erase(0, parsed);
+      char buffer[64 * 1024];
+      ssize_t size = ::read(fd_, buffer, sizeof(buffer));
+      if (size <= 0) return false;
+      input_.append(buffer, size);
+      input = input_;
+    }
+    input_.erase(0, input_.size() - input.size());
+    return true;
+  }
+
+ private:
+  int fd_ = -1;
+  std::string input_;
+  std::string output_;
+
+  void Connect(sockaddr* address, socklen_t size) {
+    if (fd_ >= 0 && ::connect(fd_, address, size) != 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+};
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string option = argv[i], value = argv[i + 1];
+    bool number = !value.empty() && value.size() < 10 &&
+                  std::all_of(value.begin(), value.end(), ::isdigit);
+    if (option == "--unixsocket") {
+      options.unix_socket = value;
+    } else if (option == "--port" && number) {
+      options.port = std::stoi(value);
+    } else if (option == "--clients" && number && std::stoi(value) > 0) {
+      options.clients = std::stoi(value);
+    } else if (option == "--requests" && number) {
+      options.requests = std::stoi(value);
+    } else if (option == "--keys" && number && std::stoi(value) > 0) {
+      options.keys = std::stoi(value);
+    } else if (option == "--writes" && number && std::stoi(value) <= 100) {
+      options.writes = std::stoi(value);
+    } else if (option == "--pipeline" && number && std::stoi(value) > 0) {
+      options.pipeline = std::stoi(value);
+    } else if (option == "--pid" && number) {
+      options.pid = std::stoi(value);
+    } else {
+      Console::Error("unknown option " + option + " " + value);
+      return false;
+    }
+  }
+
+  if (argc % 2 == 0) {
+    Console::Error("option without value");
+    return false;
+  }
+  return true;
+}
+
+// User and system CPU time the process has used so far, from the 14th and
+// 15th fields of /proc/<pid>/stat.
+microseconds CpuTime(int pid) {
+  std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+  std::string text;
+  std::getline(file, text);
+  size_t name_end = text.rfind(')');
+  if (name_end == std::string::npos) return microseconds(0);
+
+  std::istringstream fields(text.substr(name_end + 1));
+  std::string skipped;
+  for (int field = 3; field < 14; ++field) fields >> skipped;
+  long long user = 0, system = 0;
+  fields >> user >> system;
+  return microseconds((user + system) * 1000000 / ::sysconf(_SC_CLK_TCK));
+}
+
+struct Result {
+  size_t requests = 0;
+  nanoseconds elapsed{0};
+  microseconds cpu{0};  // of the server
+  std::vector<nanoseconds> latencies;  // of the whole pipeline, sorted
+  int failed = 0;
+};
+
+// Every client sends its share of the requests, `depth` at a time.
+Result Run(const Options& options, int depth) {
+  std::vector<std::vector<nanoseconds>> latencies(options.clients);
+  std::vector<bool> failed(options.clients, true);
+  microseconds cpu = options.pid ? CpuTime(options.pid) : microseconds(0);
+  Timer timer;
+  std::vector<std::thread> threads;
+  for (int c = 0; c < options.clients; ++c) {
+    threads.emplace_back([&, c] {
+      Client client(options);
+      if (!client.IsOpen()) return;
+
+      std::mt19937 random(c);
+      std::uniform_int_distribution<int> key(0, options.keys - 1);
+      std::uniform_int_distribution<int> percent(0, 99);
+      std::vector<std::vector<std::string>> batch(depth);
+      int batches = options.requests / options.clients / depth;
+      latencies[c].reserve(batches);
+      for (int i = 0; i < batches; ++i) {
+        for (auto& command : batch) {
+          std::string name = "key" + std::to_string(key(random));
+          if (percent(random) < options.writes)
+            command = {"INCRBY", name, "1"};
+          else
+            command = {"GET", name};
+        }
+        Timer latency;
+        if (!client.Call(batch)) return;
+        latencies[c].push_back(latency.Finish());
+      }
+      failed[c] = false;
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  Result result;
+  result.elapsed = timer.Finish();
+  if (options.pid) result.cpu = CpuTime(options.pid) - cpu;
+  for (int c = 0; c < options.clients; ++c) {
+    result.latencies.insert(result.latencies.end(), latencies[c].begin(),
+                            latencies[c].end());
+    result.failed += failed[c];
+  }
+  result.requests = result.latencies.size() * depth;
+  std::sort(result.latencies.begin(), result.latencies.end());
+  return result;
+}
+
+// Usage: load_generator.out [--port n | --unixsocket path] [--clients n]
+//   [--requests n] [--keys n] [--writes percent] [--pipeline n] [--pid n]
+// Fills the store with the keys, then every client sends GET and INCRBY
+// requests on random keys. With --pipeline the run is repeated for the
+// pipeline depths 1, 2, 4... up to n, latency is that of a whole
+// pipeline. With the pid of the server its CPU time per request is
+// shown too.
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) return 1;
+
+  {
+    Client client(options);
+    if (!client.IsOpen()) {
+      Console::Error("can't connect");
+      return 1;
+    }
+    std::vector<std::vector<std::string>> batch;
+    for (int i = 0; i < options.keys; ++i) {
+      batch.push_back({"SET", "key" + std::to_string(i), "Иванов", "Иван",
+                       "2000", "Москва", "100"});
+      if (batch.size() == 100 || i + 1 == options.keys) {
+        client.Call(batch);
+        batch.clear();
+      }
+    }
+  }
+
+  auto us = [](nanoseconds time) {
+    return duration_cast<microseconds>(time).count();
+  };
+  std::printf("%8s %12s %12s %12s %12s %12s\n", "depth", "ops/sec",
+              "p50[us]", "p99[us]", "max[us]", "cpu[us/op]");
+  for (int depth = 1; depth <= options.pipeline; depth *= 2) {
+    Result result = Run(options, depth);
+    if (result.failed) {
+      Console::Error(std::to_string(result.failed) + " clients failed");
+      return 1;
+    }
+    if (result.latencies.empty()) continue;
+
+    auto const& latencies = result.latencies;
+    double seconds = us(result.elapsed) / 1e6;
+    std::printf("%8d %12ld %12ld %12ld %12ld %12.2f\n", depth,
+                static_cast<long>(result.requests / seconds),
+                static_cast<long>(us(latencies[latencies.size() / 2])),
+                static_cast<long>(us(latencies[latencies.size() * 99 / 100])),
+                static_cast<long>(us(latencies.back())),
+                static_cast<double>(result.cpu.count()) / result.requests);
+  }
+  return 0;
+}
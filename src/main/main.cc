@@ -1,7 +1,8 @@
 #include "program.h"
 
-int main() {
+int main(int argc, char** argv) {
   s21::Program app;
+  if (!app.Configure(argc, argv)) return 1;
 
   return app.Exec();
 }
@@ -1,61 +1,339 @@
 #include "program.h"
 
+#include <unistd.h>
+
 #include "bp-tree/b_plus_tree.h"
 #include "console.h"
 #include "hashtable/hash_table.h"
 #include "rb-tree/self_balancing_binary_search_tree.h"
+#include "server.h"
+#include "sharded/sharded_storage.h"
+#include "timer.h"
 
 namespace s21 {
 
+bool Program::Configure(int argc, char** argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string option = argv[i], value = argv[i + 1];
+    bool number = !value.empty() && value.size() < 10 && IsNumber(value);
+    if (option == "--appendonly") {
+      append_file_ = value;
+    } else if (option == "--appendfsync" && value == "always") {
+      append_fsync_ = FsyncPolicy::kAlways;
+    } else if (option == "--appendfsync" && value == "everysec") {
+      append_fsync_ = FsyncPolicy::kEverySec;
+    } else if (option == "--appendfsync" && value == "no") {
+      append_fsync_ = FsyncPolicy::kNo;
+    } else if (option == "--index" && (value == "on" || value == "off")) {
+      index_on_start_ = value == "on";
+    } else if (option == "--mode" && (value == "1" || value == "2" ||
+                                      value == "3")) {
+      mode_ = std::stoi(value);
+    } else if (option == "--capacity" && number) {
+      capacity_ = std::stoi(value);
+    } else if (option == "--shards" && number) {
+      shards_ = std::stoi(value);
+    } else if (option == "--port" && number && std::stoi(value) < 65536) {
+      port_ = std::stoi(value);
+    } else if (option == "--unixsocket" && !value.empty()) {
+      unix_socket_ = value;
+    } else if (option == "--follow" && number && std::stoi(value) > 0 &&
+               std::stoi(value) < 65536) {
+      follow_ = std::stoi(value);
+    } else if (option == "--io" && (value == "posix" || value == "uring")) {
+      ChosenIoBackend() = value == "uring" ? IoBackend::kUring
+                                           : IoBackend::kPosix;
+    } else {
+      Console::Error("unknown option " + option + " " + value);
+      return false;
+    }
+  }
+
+  if (argc % 2 == 0) {
+    Console::Error("option without value");
+    return false;
+  }
+  // The state of a follower is that of its leader.
+  if (follow_ && !append_file_.empty()) {
+    Console::Error("a follower keeps no log");
+    return false;
+  }
+  return true;
+}
+
+// Commands piped in rather than typed, like a replayed trace, run as a
+// script: plain buffered output and the rate of the commands at the end.
 int Program::Exec() {
-  int mode = Console::ReadInt(
-      "Enter mode: [1 - HashTable, 2 - B+ Tree, 3 - RB Tree]\n> ");
+  bool script = !port_ && unix_socket_.empty() && !::isatty(STDIN_FILENO);
+  if (script) Console::UsePlainOutput();
 
+  int mode = mode_;
+  if (!mode)
+    mode = Console::ReadInt(
+        "Enter mode: [1 - HashTable, 2 - B+ Tree, 3 - RB Tree]\n> ");
+
+  ShardedStorage::Factory make;
   if (mode == 1) {
-    int capacity = Console::ReadInt("Enter HashTable capacity:\n> ");
-    storage_ = new HashTable(capacity < 1 ? 1 : capacity);
+    int capacity = capacity_;
+    if (!capacity) capacity = Console::ReadInt("Enter HashTable capacity:\n> ");
+    // The capacity is that of the whole storage.
+    if (shards_ >= 0) capacity /= ParallelLoader::Threads(shards_);
+    make = [capacity] { return new HashTable(capacity < 1 ? 1 : capacity); };
   } else if (mode == 2) {
-    storage_ = new BPlusTree();
+    make = [] { return new BPlusTree(); };
   } else {
-    storage_ = new SelfBalancingBinarySearchTree();
+    make = [] { return new SelfBalancingBinarySearchTree(); };
   }
+  storage_ = shards_ < 0 ? make() : new ShardedStorage(shards_, make);
 
-  Console::WriteLine("> Ready to use");
+  if (ChosenIoBackend() != CurrentIoBackend())
+    Console::Error("io_uring is not available, using epoll and write");
 
-  while (true) {
-    std::vector<std::string> tokens = Console::ReadTokens("> ");
-    std::string command = ToUpper(tokens[0]);
+  if (!append_file_.empty()) StartRecovery();
+  if (follow_) replica_ = std::make_unique<Replica>(follow_, storage_);
+  if (port_ || !unix_socket_.empty()) return Serve();
+  // The read-only window of a recovery is for the clients of a server, a
+  // replayed trace would lose its first writes to it.
+  if (script && recovery_.joinable()) recovery_.join();
+  if (!script) Console::WriteLine("> Ready to use");
 
-    if (command == "Q" || command == "QUIT") {
-      break;
-    } else if (command == "SET") {
+  Timer timer;
+  size_t commands = 0;
+  std::vector<std::string> tokens;
+  while (Console::ReadTokens("> ", tokens)) {
+    commands += !tokens.empty();
+    if (!Dispatch(tokens)) break;
+    CommitLog();
+  }
+
+  if (script) {
+    auto elapsed = duration_cast<microseconds>(timer.Finish()).count();
+    Console::Note("> " + std::to_string(commands) + " commands in " +
+                  std::to_string(elapsed / 1000) + " ms, " +
+                  std::to_string(elapsed ? commands * 1000000 / elapsed : 0) +
+                  " ops/sec");
+  }
+  return 0;
+}
+
+// Runs one command of the current session, false once it asks to quit.
+bool Program::Dispatch(const std::vector<std::string>& tokens) {
+  if (tokens.empty()) return true;
+  CommandId command = CommandTable::Find(tokens[0]);
+
+  if (command == CommandId::kQuit) {
+    return false;
+  } else if (recovering_ && CommandTable::IsWrite(command)) {
+    reply_->Error("recovery is running, the store is read-only");
+  } else if (log_failed_ && CommandTable::IsWrite(command)) {
+    reply_->Error("the log can't be recovered, the store is read-only");
+  } else if (replica_ && CommandTable::IsWrite(command)) {
+    reply_->Error("a follower is read-only");
+  } else if (command == CommandId::kWatch) {
+    ProceedWatch(tokens);
+  } else if (command == CommandId::kUnwatch) {
+    ProceedUnwatch(tokens);
+  } else if (command == CommandId::kMulti) {
+    ProceedMulti(tokens);
+  } else if (command == CommandId::kExec) {
+    ProceedExec(tokens);
+  } else if (command == CommandId::kDiscard) {
+    ProceedDiscard(tokens);
+  } else if (session_->in_multi) {
+    session_->queued.push_back(tokens);
+    reply_->WriteLine("> QUEUED");
+  } else {
+    Execute(command, tokens);
+  }
+  return true;
+}
+
+// Serves the commands of the clients on the sockets instead of the
+// console. Every client is a session with its own MULTI and WATCH state.
+// The log is committed once per round of the event loop, before the
+// replies of the round are sent and before the round is shipped to the
+// followers. The change events of the round go to the subscribers after
+// that.
+int Program::Serve() {
+  RespReply reply;
+  reply_ = &reply;
+
+  Server server(
+      [&](int client, const std::vector<Server::Command>& commands,
+          std::string& output) {
+        session_ = &sessions_[client];
+        bool open = true;
+        for (size_t i = 0; open && i < commands.size(); ++i) {
+          if (size_t gets = ProceedGets(commands, i, output)) {
+            i += gets - 1;
+            continue;
+          }
+          CommandId command = CommandTable::Find(commands[i][0]);
+          if (command == CommandId::kSync) {
+            ProceedSync(client, commands[i], output);
+            continue;
+          } else if (command == CommandId::kAck) {
+            // A follower expects no reply.
+            if (feed_) feed_->Acknowledge(client, commands[i]);
+            continue;
+          } else if (command == CommandId::kShutdown) {
+            server.Stop();
+            reply.WriteLine("> OK");
+          } else {
+            open = Dispatch(commands[i]);
+            if (!open) reply.WriteLine("> OK");
+          }
+          reply.Encode(output);
+        }
+        session_ = &console_;
+        return open;
+      },
+      [&](int client) {
+        session_ = &sessions_[client];
+        EndTransaction();
+        session_ = &console_;
+        sessions_.erase(client);
+        if (feed_) feed_->Detach(client);
+      },
+      [&] {
+        CommitLog();
+        if (feed_) feed_->Ship(server);
+        if (changes_) PublishChanges(server);
+      });
+
+  bool listening = true;
+  if (port_ && !server.ListenTcp(port_)) {
+    Console::Error("can't listen on port " + std::to_string(port_));
+    listening = false;
+  }
+  if (!unix_socket_.empty() && !server.ListenUnix(unix_socket_)) {
+    Console::Error("can't listen on " + unix_socket_);
+    listening = false;
+  }
+
+  if (listening) {
+    Console::WriteLine("> Ready to accept connections");
+    server.Run();
+  }
+
+  if (feed_) {
+    storage_->Unsubscribe(feed_.get());
+    feed_.reset();
+  }
+  if (changes_) {
+    storage_->Unsubscribe(changes_.get());
+    for (auto& [client, session] : sessions_) session.changes.reset();
+    changes_.reset();
+  }
+  reply_ = &console_reply_;
+  return listening ? 0 : 1;
+}
+
+void Program::Execute(CommandId command,
+                      const std::vector<std::string>& tokens) {
+  switch (command) {
+    case CommandId::kSet:
       ProceedSet(tokens);
-    } else if (command == "GET") {
+      break;
+    case CommandId::kGet:
       ProceedGet(tokens);
-    } else if (command == "EXISTS") {
+      break;
+    case CommandId::kExists:
       ProceedExists(tokens);
-    } else if (command == "DEL") {
+      break;
+    case CommandId::kDel:
       ProceedDel(tokens);
-    } else if (command == "UPDATE") {
+      break;
+    case CommandId::kUpdate:
       ProceedUpdate(tokens);
-    } else if (command == "KEYS") {
+      break;
+    case CommandId::kMSet:
+      ProceedMSet(tokens);
+      break;
+    case CommandId::kMGet:
+      ProceedMGet(tokens);
+      break;
+    case CommandId::kMExists:
+      ProceedMExists(tokens);
+      break;
+    case CommandId::kMDel:
+      ProceedMDel(tokens);
+      break;
+    case CommandId::kIncrBy:
+      ProceedIncrBy(tokens, 1);
+      break;
+    case CommandId::kDecrBy:
+      ProceedIncrBy(tokens, -1);
+      break;
+    case CommandId::kTransfer:
+      ProceedTransfer(tokens);
+      break;
+    case CommandId::kKeys:
       ProceedKeys(tokens);
-    } else if (command == "RENAME") {
+      break;
+    case CommandId::kRename:
       ProceedRename(tokens);
-    } else if (command == "TTL") {
+      break;
+    case CommandId::kTtl:
       ProceedTtl(tokens);
-    } else if (command == "FIND") {
+      break;
+    case CommandId::kFind:
       ProceedFind(tokens);
-    } else if (command == "SHOWALL") {
+      break;
+    case CommandId::kCount:
+      ProceedCount(tokens);
+      break;
+    case CommandId::kIndex:
+      ProceedIndex(tokens);
+      break;
+    case CommandId::kShowAll:
       ProceedShowAll(tokens);
-    } else if (command == "UPLOAD") {
+      break;
+    case CommandId::kAggregate:
+      ProceedAggregate(tokens);
+      break;
+    case CommandId::kView:
+      ProceedView(tokens);
+      break;
+    case CommandId::kUpload:
       ProceedUpload(tokens);
-    } else if (command == "EXPORT") {
+      break;
+    case CommandId::kExport:
       ProceedExport(tokens);
-    }
+      break;
+    case CommandId::kSave:
+      ProceedSave(tokens);
+      break;
+    case CommandId::kLoad:
+      ProceedLoad(tokens);
+      break;
+    case CommandId::kBackgroundSave:
+      ProceedBackgroundSave(tokens);
+      break;
+    case CommandId::kLastSave:
+      ProceedLastSave(tokens);
+      break;
+    case CommandId::kRewriteLog:
+      ProceedRewriteLog(tokens);
+      break;
+    case CommandId::kCheckpoint:
+      ProceedCheckpoint(tokens);
+      break;
+    case CommandId::kRole:
+      ProceedRole(tokens);
+      break;
+    case CommandId::kSubscribe:
+      ProceedSubscribe(tokens);
+      break;
+    case CommandId::kUnsubscribe:
+      ProceedUnsubscribe(tokens);
+      break;
+    case CommandId::kPing:
+      reply_->WriteLine("> PONG");
+      break;
+    default:
+      reply_->Error("unknown command " + tokens[0]);
   }
-
-  return 0;
 }
 
 std::string Program::ToUpper(std::string s) {
@@ -68,76 +346,210 @@ bool Program::IsNumber(std::string s) {
   return std::all_of(s.begin(), s.end(), ::isdigit);
 }
 
+bool Program::ParseAmount(const std::string& token, long long& amount) {
+  return !token.empty() && IsNumber(token) && V::ParseNumber(token, amount);
+}
+
+void Program::ReportCoinsError(CoinsStatus status) {
+  if (status == CoinsStatus::kNotFound)
+    reply_->Error("key not found");
+  else if (status == CoinsStatus::kNotNumber)
+    reply_->Error("coins is not a number");
+  else if (status == CoinsStatus::kOverflow)
+    reply_->Error("coins overflow");
+  else if (status == CoinsStatus::kOverdraft)
+    reply_->Error("insufficient coins");
+}
+
+// Replays the log written by the previous runs before logging new
+// mutations to it.
+void Program::StartRecovery() {
+  recovering_ = true;
+  Console::WriteLine("> Recovering from " + append_file_);
+  recovery_ = std::thread([this] { Recover(); });
+}
+
+// Runs next to the console, which only lets read commands through until
+// recovering_ is cleared. Reads see the keys loaded so far.
+void Program::Recover() {
+  LoadTimings timings;
+  Timer timer;
+  int replayed = OpLog::Replay(append_file_, storage_, &timings);
+  nanoseconds replay =
+      timer.Finish() - timings.read - timings.parse - timings.insert;
+
+  timer.Start();
+  if (index_on_start_) storage_->CreateIndex();
+  nanoseconds index = timer.Finish();
+
+  // Writes nothing could log would be lost, the store stays read-only.
+  if (replayed < 0) {
+    log_failed_ = true;
+    Console::Error("can't recover from " + append_file_);
+  } else {
+    oplog_ = std::make_unique<OpLog>(append_file_, append_fsync_);
+    if (oplog_->IsOpen()) {
+      storage_->Subscribe(oplog_.get());
+    } else {
+      oplog_.reset();
+      log_failed_ = true;
+      Console::Error("can't open file");
+    }
+
+    auto ms = [](nanoseconds time) {
+      return std::to_string(duration_cast<milliseconds>(time).count());
+    };
+    Console::WriteLine(
+        "> Recovered " + std::to_string(replayed) + " entries in " +
+        ms(timings.read + timings.parse + timings.insert + replay + index) +
+        " ms: read " + ms(timings.read) + ", parse " + ms(timings.parse) +
+        ", insert " + ms(timings.insert) + ", replay " + ms(replay) +
+        ", index " + ms(index));
+  }
+  recovering_ = false;
+}
+
+void Program::CommitLog() {
+  if (recovering_ || !oplog_) return;
+
+  if (oplog_->Policy() == FsyncPolicy::kAlways) oplog_->Commit();
+  if (oplog_->NeedsRewrite()) oplog_->Rewrite(storage_);
+}
+
+// Makes the client a follower, see ReplicationFeed. The feed starts with
+// the first follower, which gets a full sync.
+void Program::ProceedSync(int client, const std::vector<std::string>& tokens,
+                          std::string& output) {
+  if (replica_) {
+    Resp::Error(output, "a follower can't lead");
+    return;
+  }
+  if (!feed_) {
+    feed_ = std::make_unique<ReplicationFeed>();
+    storage_->Subscribe(feed_.get());
+  }
+  if (!feed_->Attach(client, tokens, storage_, output))
+    Resp::Error(output, "invalid input");
+}
+
+void Program::ReportSnapshotError(SnapshotStatus status) {
+  if (status == SnapshotStatus::kNotOpen)
+    reply_->Error("can't open file");
+  else if (status == SnapshotStatus::kBadFormat)
+    reply_->Error("not a snapshot");
+  else if (status == SnapshotStatus::kCorrupted)
+    reply_->Error("snapshot is corrupted");
+}
+
+bool Program::ParseGroupBy(const std::string& token, GroupBy& group_by) {
+  std::string group = ToUpper(token);
+  if (group == "CITY") {
+    group_by = GroupBy::kCity;
+  } else if (group == "YEAR") {
+    group_by = GroupBy::kBirthday;
+  } else if (group == "-") {
+    group_by = GroupBy::kNone;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 void Program::ProceedSet(const std::vector<std::string>& tokens) {
   if (tokens.size() < 7) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
   V value{tokens[2], tokens[3], tokens[4], tokens[5], tokens[6]};
 
   if (!IsNumber(value.birthday) || !IsNumber(value.coins)) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
   bool status = false;
   if (tokens.size() == 9 && ToUpper(tokens[7]) == "EX") {
     if (!IsNumber(tokens[8]))
-      Console::Error("invalid input");
+      reply_->Error("invalid input");
     else
-      status = storage_->Set(tokens[1], value, stoi(tokens[8]));
+      status = storage_->Set(std::string(tokens[1]), std::move(value),
+                              stoi(tokens[8]));
   } else {
-    status = storage_->Set(tokens[1], value);
+    status = storage_->Set(std::string(tokens[1]), std::move(value));
   }
 
   if (status == 1)
-    Console::WriteLine("> OK");
+    reply_->WriteLine("> OK");
   else
-    Console::Error("key exists");
+    reply_->Error("key exists");
 }
 
 void Program::ProceedGet(const std::vector<std::string>& tokens) {
   if (tokens.size() != 2) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
-  V value = storage_->Get(tokens[1]);
+  std::string line = "> (null)";
+  storage_->Visit(tokens[1],
+                  [&](const V& value) { line = "> " + FormatValue(value); });
+  reply_->WriteLine(line);
+}
 
-  if (!value.birthday.empty()) {
-    std::stringstream stream;
-    stream << "> " << value.last_name << " " << value.first_name << " "
-           << value.birthday << " " << value.city << " " << value.coins;
-    Console::WriteLine(stream.str());
-  } else {
-    Console::WriteLine("> (null)");
+// A run of pipelined GETs is looked up by one MGet, under a single lock,
+// instead of one lookup per command, and the replies go straight to the
+// output. Returns the number of commands answered, 0 unless the run has
+// at least two GETs.
+size_t Program::ProceedGets(
+    const std::vector<std::vector<std::string>>& commands, size_t from,
+    std::string& output) {
+  std::vector<std::string> keys;
+  for (size_t i = from; i < commands.size(); ++i) {
+    if (commands[i].size() != 2 ||
+        CommandTable::Find(commands[i][0]) != CommandId::kGet)
+      break;
+    keys.push_back(commands[i][1]);
+  }
+  if (keys.size() < 2 || session_->in_multi) return 0;
+
+  for (auto const& value : storage_->MGet(keys)) {
+    if (value.birthday.empty())
+      Resp::Null(output);
+    else
+      Resp::Simple(output, FormatValue(value));
   }
+  return keys.size();
+}
+
+std::string Program::FormatValue(const V& value) {
+  return value.last_name + " " + value.first_name + " " + value.birthday +
+         " " + value.city + " " + value.coins;
 }
 
 void Program::ProceedExists(const std::vector<std::string>& tokens) {
   if (tokens.size() != 2) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
   std::string result = storage_->Exists(tokens[1]) ? "true" : "false";
-  Console::WriteLine("> " + result);
+  reply_->WriteLine("> " + result);
 }
 
 void Program::ProceedDel(const std::vector<std::string>& tokens) {
   if (tokens.size() != 2) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
   std::string result = storage_->Delete(tokens[1]) ? "true" : "false";
-  Console::WriteLine("> " + result);
+  reply_->WriteLine("> " + result);
 }
 
 void Program::ProceedUpdate(const std::vector<std::string>& tokens) {
   if (tokens.size() != 7) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
@@ -145,92 +557,580 @@ void Program::ProceedUpdate(const std::vector<std::string>& tokens) {
 
   if (!(IsNumber(value.birthday) || value.birthday == "-") ||
       !(IsNumber(value.coins) || value.coins == "-")) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (storage_->Update(tokens[1], value))
+    reply_->WriteLine("> OK");
+  else
+    reply_->Error("key not found");
+}
+
+void Program::ProceedMSet(const std::vector<std::string>& tokens) {
+  if (tokens.size() < 7 || (tokens.size() - 1) % 6) {
+    reply_->Error("invalid input");
     return;
   }
 
-  if (storage_->Update(tokens[1], value)) {
-    Console::WriteLine("> OK");
+  std::vector<std::pair<std::string, V>> items;
+  for (size_t i = 1; i < tokens.size(); i += 6) {
+    V value{tokens[i + 1], tokens[i + 2], tokens[i + 3], tokens[i + 4],
+            tokens[i + 5]};
+
+    if (!IsNumber(value.birthday) || !IsNumber(value.coins)) {
+      reply_->Error("invalid input");
+      return;
+    }
+
+    items.emplace_back(tokens[i], std::move(value));
   }
+
+  reply_->WriteLine("> OK " + std::to_string(storage_->MSet(items)));
+}
+
+void Program::ProceedMGet(const std::vector<std::string>& tokens) {
+  if (tokens.size() < 2) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  auto values = storage_->MGet({tokens.begin() + 1, tokens.end()});
+  reply_->List(values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    std::stringstream stream;
+    stream << i + 1 << ") ";
+    if (!values[i].birthday.empty()) {
+      stream << values[i].last_name << " " << values[i].first_name << " "
+             << values[i].birthday << " " << values[i].city << " "
+             << values[i].coins;
+    } else {
+      stream << "(null)";
+    }
+    reply_->WriteLine(stream.str());
+  }
+}
+
+void Program::ProceedMExists(const std::vector<std::string>& tokens) {
+  if (tokens.size() < 2) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  auto exists = storage_->MExists({tokens.begin() + 1, tokens.end()});
+  reply_->List(exists.size());
+  for (size_t i = 0; i < exists.size(); ++i)
+    reply_->WriteLine(std::to_string(i + 1) + ") " +
+                      (exists[i] ? "true" : "false"));
+}
+
+void Program::ProceedMDel(const std::vector<std::string>& tokens) {
+  if (tokens.size() < 2) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  int deleted = storage_->MDelete({tokens.begin() + 1, tokens.end()});
+  reply_->WriteLine("> " + std::to_string(deleted));
 }
 
 void Program::ProceedKeys(const std::vector<std::string>& tokens) {
   auto keys = storage_->Keys();
-  if (keys.empty()) {
-    Console::WriteLine("> Empty");
+  reply_->List(keys.size());
+  for (int i = 0; i < keys.size(); ++i)
+    reply_->WriteLine(std::to_string(i + 1) + ") " + keys[i]);
+}
+
+void Program::ProceedIncrBy(const std::vector<std::string>& tokens,
+                            int sign) {
+  long long amount = 0, balance = 0;
+  if (tokens.size() != 3 || !ParseAmount(tokens[2], amount)) {
+    reply_->Error("invalid input");
     return;
   }
 
-  for (int i = 0; i < keys.size(); ++i)
-    Console::WriteLine(std::to_string(i + 1) + ") " + keys[i]);
+  CoinsStatus status = storage_->IncrementBy(tokens[1], sign * amount, balance);
+  if (status == CoinsStatus::kOk)
+    reply_->WriteLine("> " + std::to_string(balance));
+  else
+    ReportCoinsError(status);
+}
+
+void Program::ProceedTransfer(const std::vector<std::string>& tokens) {
+  long long amount = 0;
+  if (tokens.size() != 4 || !ParseAmount(tokens[3], amount)) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  CoinsStatus status = storage_->Transfer(tokens[1], tokens[2], amount);
+  if (status == CoinsStatus::kOk)
+    reply_->WriteLine("> OK");
+  else
+    ReportCoinsError(status);
 }
 
 void Program::ProceedRename(const std::vector<std::string>& tokens) {
   if (tokens.size() != 3) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
-  if (storage_->Rename(tokens[1], tokens[2])) {
-    Console::WriteLine("> OK");
-  }
+  if (storage_->Rename(tokens[1], tokens[2]))
+    reply_->WriteLine("> OK");
+  else if (!storage_->Exists(tokens[1]))
+    reply_->Error("key not found");
+  else
+    reply_->Error("key exists");
 }
 
 void Program::ProceedTtl(const std::vector<std::string>& tokens) {
   if (tokens.size() != 2) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
   if (storage_->Exists(tokens[1])) {
     int lifetime = storage_->Ttl(tokens[1]);
-    Console::WriteLine(
+    reply_->WriteLine(
         "> " + (lifetime > -1 ? std::to_string(lifetime) : "unlimited"));
   } else {
-    Console::WriteLine("> (null)");
+    reply_->WriteLine("> (null)");
   }
 }
 
 void Program::ProceedFind(const std::vector<std::string>& tokens) {
   if (tokens.size() != 6) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
   V value{tokens[1], tokens[2], tokens[3], tokens[4], tokens[5]};
   auto keys = storage_->Find(value);
+  reply_->List(keys.size());
   for (int i = 0; i < keys.size(); ++i)
-    Console::WriteLine(std::to_string(i + 1) + ") " + keys[i]);
+    reply_->WriteLine(std::to_string(i + 1) + ") " + keys[i]);
 }
 
+void Program::ProceedCount(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 6) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  V value{tokens[1], tokens[2], tokens[3], tokens[4], tokens[5]};
+  reply_->WriteLine("> " + std::to_string(storage_->Count(value)));
+}
+
+void Program::ProceedIndex(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  storage_->CreateIndex();
+  reply_->WriteLine("> OK " + std::to_string(storage_->IndexMemoryUsage()));
+}
+
+// The header is the first item of the list.
 void Program::ProceedShowAll(const std::vector<std::string>& tokens) {
-  Console::WriteLine("> # | Фамилия | Имя | Год | Город | Количество коинов |");
-  auto values = storage_->ShowAll();
-  for (int i = 0; i < values.size(); ++i) {
+  std::stringstream stream;
+  size_t i = 0;
+  storage_->ForEach([&](const std::string&, const V& value) {
+    stream << ++i << ") " << value << "\n";
+  });
+  reply_->List(i + 1);
+  reply_->WriteLine("> # | Фамилия | Имя | Год | Город | Количество коинов |");
+  reply_->Write(stream.str());
+}
+
+void Program::ProceedAggregate(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1 && tokens.size() != 2 && tokens.size() != 7) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  GroupBy group_by = GroupBy::kNone;
+  if (tokens.size() > 1 && !ParseGroupBy(tokens[1], group_by)) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  V filter = tokens.size() == 7
+                 ? V{tokens[2], tokens[3], tokens[4], tokens[5], tokens[6]}
+                 : V{"-", "-", "-", "-", "-"};
+
+  auto stats = storage_->Aggregate(filter, group_by);
+  reply_->List(stats.size());
+
+  int i = 0;
+  for (auto const& [group, row] : stats) {
+    std::stringstream stream;
+    stream << ++i << ") " << (group.empty() ? "(all)" : group)
+           << " COUNT " << row.count << " SUM " << row.sum << " MIN "
+           << row.min << " MAX " << row.max;
+    reply_->WriteLine(stream.str());
+  }
+}
+
+void Program::ProceedView(const std::vector<std::string>& tokens) {
+  GroupBy group_by = GroupBy::kNone;
+  if (tokens.size() != 2 || !ParseGroupBy(tokens[1], group_by)) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  storage_->CreateView(group_by);
+  auto totals = storage_->ReadView(group_by);
+  reply_->List(totals.size());
+
+  int i = 0;
+  for (auto const& [group, row] : totals) {
     std::stringstream stream;
-    stream << i + 1 << ") " << values[i];
-    Console::WriteLine(stream.str());
+    stream << ++i << ") " << (group.empty() ? "(all)" : group)
+           << " COUNT " << row.count << " SUM " << row.sum;
+    reply_->WriteLine(stream.str());
   }
 }
 
 void Program::ProceedUpload(const std::vector<std::string>& tokens) {
   if (tokens.size() != 2) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
     return;
   }
 
   int number_of_lines = storage_->Upload(tokens[1]);
-  Console::WriteLine("> OK " + std::to_string(number_of_lines));
+  reply_->WriteLine("> OK " + std::to_string(number_of_lines));
 }
 
 void Program::ProceedExport(const std::vector<std::string>& tokens) {
+  bool chunked = tokens.size() == 3 && ToUpper(tokens[2]) == "CHUNKED";
+  bool sharded = tokens.size() == 4 && ToUpper(tokens[2]) == "SHARDS" &&
+                 IsNumber(tokens[3]) && tokens[3].size() < 4;
+  if (tokens.size() != 2 && !chunked && !sharded) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (sharded) {
+    unsigned shards = ParallelLoader::Threads(std::stoi(tokens[3]));
+    int number_of_lines = storage_->ExportShards(tokens[1], shards);
+    reply_->WriteLine("> OK " + std::to_string(number_of_lines) + " in " +
+                       std::to_string(shards) + " shards");
+    return;
+  }
+
+  if (!chunked) {
+    int number_of_lines = storage_->Export(tokens[1]);
+    reply_->WriteLine("> OK " + std::to_string(number_of_lines));
+    return;
+  }
+
+  ExportStats stats = storage_->ExportInChunks(tokens[1]);
+  auto hold = duration_cast<microseconds>(stats.max_lock_hold);
+  reply_->WriteLine("> OK " + std::to_string(stats.lines) + " in " +
+                     std::to_string(stats.chunks) + " chunks, max lock hold " +
+                     std::to_string(hold.count()) + " us");
+}
+
+void Program::ProceedSave(const std::vector<std::string>& tokens) {
+  bool compress = tokens.size() == 3 && ToUpper(tokens[2]) == "COMPRESS";
+  if (tokens.size() != 2 && !compress) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  int saved = 0;
+  SnapshotStatus status = storage_->Save(tokens[1], saved, compress);
+  if (status == SnapshotStatus::kOk)
+    reply_->WriteLine("> OK " + std::to_string(saved));
+  else
+    ReportSnapshotError(status);
+}
+
+void Program::ProceedLoad(const std::vector<std::string>& tokens) {
   if (tokens.size() != 2) {
-    Console::Error("invalid input");
+    reply_->Error("invalid input");
+    return;
+  }
+
+  int loaded = 0;
+  SnapshotStatus status = storage_->Load(tokens[1], loaded);
+  if (status == SnapshotStatus::kOk)
+    reply_->WriteLine("> OK " + std::to_string(loaded));
+  else
+    ReportSnapshotError(status);
+}
+
+void Program::ProceedBackgroundSave(const std::vector<std::string>& tokens) {
+  bool compress = tokens.size() == 3 && ToUpper(tokens[2]) == "COMPRESS";
+  if (tokens.size() != 2 && !compress) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (bgsave_pid_ > 0 && !Snapshot::Poll(bgsave_pid_, false)) {
+    reply_->Error("background save is already running");
+    return;
+  }
+
+  Timer timer;
+  bgsave_pid_ = storage_->SaveInBackground(tokens[1], compress);
+  if (bgsave_pid_ < 0) {
+    reply_->Error("can't fork");
+    return;
+  }
+
+  last_save_ = tokens[1];
+  auto forked = duration_cast<microseconds>(timer.Finish());
+  reply_->WriteLine("> Background saving started, fork took " +
+                     std::to_string(forked.count()) + " us");
+}
+
+void Program::ProceedLastSave(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (bgsave_pid_ <= 0) {
+    reply_->WriteLine("> (null)");
+    return;
+  }
+
+  std::optional<bool> done = Snapshot::Poll(bgsave_pid_, false);
+  if (!done) {
+    reply_->WriteLine("> in progress " + last_save_);
+    return;
+  }
+
+  bgsave_pid_ = -1;
+  if (*done)
+    reply_->WriteLine("> OK " + last_save_);
+  else
+    reply_->Error("background save failed");
+}
+
+void Program::ProceedRewriteLog(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (!oplog_)
+    reply_->Error("log is off");
+  else if (!oplog_->Rewrite(storage_))
+    reply_->Error("rewrite is already running");
+  else
+    reply_->WriteLine("> OK");
+}
+
+void Program::ProceedCheckpoint(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (!oplog_)
+    reply_->Error("log is off");
+  else if (!oplog_->Checkpoint(storage_))
+    reply_->Error("rewrite is already running");
+  else
+    reply_->WriteLine("> OK");
+}
+
+void Program::ProceedWatch(const std::vector<std::string>& tokens) {
+  if (tokens.size() < 2) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (session_->in_multi) {
+    reply_->Error("WATCH inside MULTI is not allowed");
+    return;
+  }
+
+  for (size_t i = 1; i < tokens.size(); ++i)
+    session_->watched.emplace_back(tokens[i], storage_->Watch(tokens[i]));
+  reply_->WriteLine("> OK");
+}
+
+void Program::ProceedUnwatch(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  for (auto const& [key, version] : session_->watched) storage_->Unwatch(key);
+  session_->watched.clear();
+  reply_->WriteLine("> OK");
+}
+
+void Program::ProceedMulti(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (session_->in_multi) {
+    reply_->Error("MULTI calls can not be nested");
+    return;
+  }
+
+  session_->in_multi = true;
+  reply_->WriteLine("> OK");
+}
+
+// Runs the queued commands under the storage lock, so no other client can
+// interleave with them. Nothing runs if a watched key has changed.
+void Program::ProceedExec(const std::vector<std::string>& tokens) {
+  if (!session_->in_multi) {
+    reply_->Error("EXEC without MULTI");
+    return;
+  }
+
+  bool committed = storage_->Atomically(session_->watched, [&] {
+    reply_->List(session_->queued.size());
+    for (auto const& command : session_->queued)
+      Execute(CommandTable::Find(command[0]), command);
+  });
+  if (!committed) reply_->WriteLine("> (null)");
+
+  EndTransaction();
+}
+
+void Program::ProceedDiscard(const std::vector<std::string>& tokens) {
+  if (!session_->in_multi) {
+    reply_->Error("DISCARD without MULTI");
     return;
   }
 
-  int number_of_lines = storage_->Export(tokens[1]);
-  Console::WriteLine("> OK " + std::to_string(number_of_lines));
+  EndTransaction();
+  reply_->WriteLine("> OK");
+}
+
+void Program::EndTransaction() {
+  for (auto const& [key, version] : session_->watched) storage_->Unwatch(key);
+  session_->watched.clear();
+  session_->queued.clear();
+  session_->in_multi = false;
+}
+
+void Program::ProceedRole(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  if (replica_) {
+    Replica::Status status = replica_->Report();
+    reply_->WriteLine(
+        "> role follower of 127.0.0.1:" + std::to_string(replica_->Port()) +
+        ", link " + (status.linked ? "up" : "down") + ", " +
+        std::to_string(status.entries) + " entries, offset " +
+        std::to_string(status.offset) + ", lag " +
+        std::to_string(status.lag_ms) + " ms, heartbeat " +
+        std::to_string(status.heartbeat_ms) + " ms ago, " +
+        std::to_string(status.full_syncs) + " full syncs");
+  } else if (feed_) {
+    for (auto const& line : feed_->Report()) reply_->WriteLine("> " + line);
+  } else {
+    reply_->WriteLine("> role leader, no followers");
+  }
+}
+
+// SUBSCRIBE [set|update|del|rename|expire|expired...], every kind of event
+// without arguments. A client that falls so far behind that the ring
+// overwrites its events is disconnected with an error.
+void Program::ProceedSubscribe(const std::vector<std::string>& tokens) {
+  if (session_ == &console_) {
+    reply_->Error("SUBSCRIBE needs the server mode");
+    return;
+  }
+
+  unsigned events = tokens.size() == 1 ? (1u << ChangeEvent::kLost) - 1 : 0;
+  for (size_t i = 1; i < tokens.size(); ++i) {
+    int type = ChangeEvent::kSet;
+    while (type < ChangeEvent::kLost &&
+           tokens[i] != ChangeEvent::Name(ChangeEvent::Type(type)))
+      ++type;
+    if (type == ChangeEvent::kLost) {
+      reply_->Error("unknown event " + tokens[i]);
+      return;
+    }
+    events |= 1u << type;
+  }
+
+  if (!changes_) {
+    changes_ = std::make_unique<ChangeBus>();
+    storage_->Subscribe(changes_.get());
+  }
+  if (!session_->changes)
+    session_->changes = std::make_unique<ChangeBus::Reader>(*changes_);
+  session_->events = events;
+  reply_->WriteLine("> OK");
+}
+
+void Program::ProceedUnsubscribe(const std::vector<std::string>& tokens) {
+  if (tokens.size() != 1) {
+    reply_->Error("invalid input");
+    return;
+  }
+
+  session_->changes.reset();
+  session_->events = 0;
+  reply_->WriteLine("> OK");
+}
+
+// Sends every subscriber the events since the last round. A subscriber
+// that doesn't read its socket gets no more until it does, the ring keeps
+// them for it meanwhile.
+void Program::PublishChanges(Server& server) {
+  std::string output;
+  for (auto& [client, session] : sessions_) {
+    if (!session.changes || server.Unsent(client) > kMaxUnsentChanges)
+      continue;
+
+    bool lost = false;
+    output.clear();
+    session.changes->Read(
+        [&](ChangeEvent const& event) {
+          if (event.type == ChangeEvent::kLost)
+            lost = true;
+          else if (!lost && session.events >> event.type & 1)
+            FormatChange(event, output);
+        },
+        4096);
+    if (lost) {
+      Resp::Error(output, "subscriber fell behind, events were lost");
+      session.changes.reset();
+      server.Push(client, output);
+      server.Disconnect(client);
+    } else if (!output.empty()) {
+      server.Push(client, output);
+    }
+  }
+}
+
+// An event as an array of the event name and the key, followed by the
+// fields of the value, the new name or the deadline.
+void Program::FormatChange(const ChangeEvent& event, std::string& output) {
+  switch (event.type) {
+    case ChangeEvent::kRename:
+      Resp::Command(output, {ChangeEvent::Name(event.type), event.key,
+                             event.to});
+      break;
+    case ChangeEvent::kExpire:
+      Resp::Command(output, {ChangeEvent::Name(event.type), event.key,
+                             std::to_string(event.deadline)});
+      break;
+    default:
+      Resp::Command(output,
+                    {ChangeEvent::Name(event.type), event.key,
+                     event.value.last_name, event.value.first_name,
+                     event.value.birthday, event.value.city,
+                     event.value.coins});
+  }
 }
 
 }  // namespace s21
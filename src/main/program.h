@@ -1,17 +1,34 @@
 #ifndef A6_SRC_MAIN_PROGRAM_H_
 #define A6_SRC_MAIN_PROGRAM_H_
 
+#include <atomic>
+#include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "change_bus.h"
+#include "command_table.h"
 #include "key_value_storage.h"
+#include "op_log.h"
+#include "replication.h"
+#include "reply.h"
 
 namespace s21 {
 
+class Server;
+
 class Program {
  public:
   Program() = default;
   ~Program() {
+    if (recovery_.joinable()) recovery_.join();
+    if (bgsave_pid_ > 0) Snapshot::Poll(bgsave_pid_, true);
+    replica_.reset();
+    // An expiry may still fire until the storage is gone.
+    if (storage_ && oplog_) storage_->Unsubscribe(oplog_.get());
+    oplog_.reset();
     delete storage_;
     storage_ = nullptr;
   }
@@ -20,28 +37,121 @@ class Program {
   void operator=(const Program&) = delete;
   void operator=(Program&&) = delete;
 
+  // Reads the command line options:
+  //   --appendonly <file>              log mutations to the file
+  //   --appendfsync always|everysec|no  when the log is synced
+  //   --index on|off                    build the index after recovery
+  //   --mode 1|2|3                      storage, skips the prompt
+  //   --capacity <n>                    HashTable capacity
+  //   --shards <n>                      n engines on their own threads,
+  //                                     0 is one per core
+  //   --port <n>                        serve on 127.0.0.1:<n>
+  //   --unixsocket <path>               serve on a Unix socket
+  //   --io posix|uring                  socket, log and snapshot I/O
+  //   --follow <port>                   replicate the leader serving on
+  //                                     127.0.0.1:<port>, read-only
+  bool Configure(int argc, char** argv);
   int Exec();
 
  private:
   using V = KeyValueStorage::V;
 
+  // Transaction state of the console or of a client, and the change
+  // events a client subscribed to.
+  struct Session {
+    bool in_multi = false;
+    std::vector<std::vector<std::string>> queued;
+    WatchedKeys watched;
+    std::unique_ptr<ChangeBus::Reader> changes;
+    unsigned events = 0;  // a bit per ChangeEvent::Type
+  };
+
+  // Output a subscriber may leave unread before its events wait.
+  static constexpr size_t kMaxUnsentChanges = 1 << 20;
+
   KeyValueStorage* storage_ = nullptr;
+  std::string append_file_;
+  FsyncPolicy append_fsync_ = FsyncPolicy::kEverySec;
+  std::unique_ptr<OpLog> oplog_;
+  bool index_on_start_ = false;
+  std::thread recovery_;
+  std::atomic_bool recovering_ = false;
+  std::atomic_bool log_failed_ = false;  // writes would not be logged
+  pid_t bgsave_pid_ = -1;
+  std::string last_save_;
+  int mode_ = 0;
+  int capacity_ = 0;
+  int shards_ = -1;  // not sharded
+  int port_ = 0;
+  std::string unix_socket_;
+  int follow_ = 0;
+  std::unique_ptr<Replica> replica_;
+  std::unique_ptr<ReplicationFeed> feed_;  // once a follower shows up
+  std::unique_ptr<ChangeBus> changes_;      // once a client subscribes
+  ConsoleReply console_reply_;
+  Reply* reply_ = &console_reply_;
+  Session console_;
+  Session* session_ = &console_;
+  std::map<int, Session> sessions_;
+
+  bool Dispatch(const std::vector<std::string>& tokens);
+  int Serve();
+  void Execute(CommandId command, const std::vector<std::string>& tokens);
+  void EndTransaction();
+  void StartRecovery();
+  void Recover();
+  void CommitLog();
+  void ProceedSync(int client, const std::vector<std::string>& tokens,
+                   std::string& output);
+  void PublishChanges(Server& server);
+  void FormatChange(const ChangeEvent& event, std::string& output);
 
   std::string ToUpper(std::string s);
   bool IsNumber(std::string s);
+  bool ParseAmount(const std::string& token, long long& amount);
+  void ReportCoinsError(CoinsStatus status);
+  void ReportSnapshotError(SnapshotStatus status);
+  bool ParseGroupBy(const std::string& token, GroupBy& group_by);
+  std::string FormatValue(const V& value);
 
   void ProceedSet(const std::vector<std::string>& tokens);
   void ProceedGet(const std::vector<std::string>& tokens);
+  size_t ProceedGets(const std::vector<std::vector<std::string>>& commands,
+                     size_t from, std::string& output);
   void ProceedExists(const std::vector<std::string>& tokens);
   void ProceedDel(const std::vector<std::string>& tokens);
   void ProceedUpdate(const std::vector<std::string>& tokens);
+  void ProceedMSet(const std::vector<std::string>& tokens);
+  void ProceedMGet(const std::vector<std::string>& tokens);
+  void ProceedMExists(const std::vector<std::string>& tokens);
+  void ProceedMDel(const std::vector<std::string>& tokens);
+  void ProceedIncrBy(const std::vector<std::string>& tokens, int sign);
+  void ProceedTransfer(const std::vector<std::string>& tokens);
   void ProceedKeys(const std::vector<std::string>& tokens);
   void ProceedRename(const std::vector<std::string>& tokens);
   void ProceedTtl(const std::vector<std::string>& tokens);
   void ProceedFind(const std::vector<std::string>& tokens);
+  void ProceedCount(const std::vector<std::string>& tokens);
+  void ProceedIndex(const std::vector<std::string>& tokens);
   void ProceedShowAll(const std::vector<std::string>& tokens);
+  void ProceedAggregate(const std::vector<std::string>& tokens);
+  void ProceedView(const std::vector<std::string>& tokens);
   void ProceedUpload(const std::vector<std::string>& tokens);
   void ProceedExport(const std::vector<std::string>& tokens);
+  void ProceedSave(const std::vector<std::string>& tokens);
+  void ProceedLoad(const std::vector<std::string>& tokens);
+  void ProceedBackgroundSave(const std::vector<std::string>& tokens);
+  void ProceedLastSave(const std::vector<std::string>& tokens);
+  void ProceedRewriteLog(const std::vector<std::string>& tokens);
+  void ProceedCheckpoint(const std::vector<std::string>& tokens);
+  void ProceedWatch(const std::vector<std::string>& tokens);
+  void ProceedUnwatch(const std::vector<std::string>& tokens);
+  void ProceedMulti(const std::vector<std::string>& tokens);
+  void ProceedExec(const std::vector<std::string>& tokens);
+  void ProceedDiscard(const std::vector<std::string>& tokens);
+  void ProceedRole(const std::vector<std::string>& tokens);
+  void ProceedSubscribe(const std::vector<std::string>& tokens);
+  void ProceedUnsubscribe(const std::vector<std::string>& tokens);
 };
 
 }  // namespace s21
@@ -1,26 +1,41 @@
 #include "self_balancing_binary_search_tree.h"
 
+#include <algorithm>
 #include <fstream>
+#include <numeric>
+#include <utility>
+
+#include "record_parser.h"
 
 namespace s21 {
 
+namespace {
+
+// Positions of the keys in ascending order, equal keys keep their order.
+template <class GetKey>
+std::vector<size_t> SortedOrder(size_t size, GetKey const &get_key) {
+  std::vector<size_t> order(size);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right) {
+    return get_key(left) < get_key(right);
+  });
+  return order;
+}
+
+}  // namespace
+
 bool SelfBalancingBinarySearchTree::Set(K const &key, const V &value,
                                         int lifetime) {
-  bool res = false;
-  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Set(K(key), V(value), lifetime);
+}
 
-  if (!root_) {
-    root_ = std::make_shared<Node>(key, value, nullptr, NodeColor::kBlack);
-    res = true;
-  } else {
-    res = Insert(root_, key, value);
-  }
+bool SelfBalancingBinarySearchTree::Set(K &&key, V &&value, int lifetime) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Node *node = Link(std::move(key), std::move(value));
 
-  if (res && lifetime > -1) {
-    size_t id = pool_.DelayTask(std::chrono::seconds(lifetime),
-                                [&, key] { Delete(key); });
-    delay_deletions_.emplace(key, id);
-  }
+  bool res = node != nullptr;
+  if (res) observers_.OnInsert(node->key, node->value);
+  if (res && lifetime > -1) ScheduleExpiration(node->key, lifetime);
 
   ++size_;
   return res;
@@ -30,29 +45,32 @@ SelfBalancingBinarySearchTree::V SelfBalancingBinarySearchTree::Get(
     K const &key) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
 
-  NodePtr node = GetNode(root_, key);
-  if (node) return node->value;
+  const V *value = Lookup(key);
+  if (value) return *value;
 
   return {};
 }
 
 bool SelfBalancingBinarySearchTree::Exists(K const &key) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
-  return GetNode(root_, key) != nullptr;
+  return Lookup(key) != nullptr;
 }
 
 bool SelfBalancingBinarySearchTree::Delete(K const &key) {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Erase(key, false);
+}
 
-  auto itr = delay_deletions_.find(key);
-  if (itr != delay_deletions_.end()) {
-    pool_.StopTask(itr->second);
-    delay_deletions_.erase(itr);
-  }
+bool SelfBalancingBinarySearchTree::Erase(K const &key, bool expired) {
+  CancelExpiration(key);
 
   NodePtr node = GetNode(root_, key);
   if (!node) return false;
 
+  if (expired)
+    observers_.OnExpire(key, node->value);
+  else
+    observers_.OnErase(key, node->value);
   DeleteNode(node);
 
   --size_;
@@ -65,7 +83,9 @@ bool SelfBalancingBinarySearchTree::Update(K const &key, V const &value) {
 
   NodePtr node = GetNode(root_, key);
   if (node) {
+    observers_.OnBeforeUpdate(key, node->value);
     node->value = value;
+    observers_.OnAfterUpdate(key, node->value);
     return true;
   }
   return false;
@@ -83,22 +103,30 @@ SelfBalancingBinarySearchTree::Keys() const {
   return res;
 }
 
+// The node has to move to the position of the new key, and the deletion
+// swaps payloads between nodes, so the value is moved out and relinked
+// under the new key. It's never copied and the expiration timer is kept.
 bool SelfBalancingBinarySearchTree::Rename(K const &from, K const &to) {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
   NodePtr node = GetNode(root_, from);
   if (!node) return false;
   if (from == to) return true;
+  if (Lookup(to)) return false;
 
-  bool res = Set(to, node->value, Ttl(from));
-  if (res) Delete(from);
-  return res;
+  V value = std::move(node->value);
+  DeleteNode(node);
+  Link(K(to), std::move(value));
+
+  RenameExpiration(from, to);
+  observers_.OnRename(from, to);
+  return true;
 }
 
 int SelfBalancingBinarySearchTree::Ttl(K const &key) const {
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
   auto itr = delay_deletions_.find(key);
   if (itr != delay_deletions_.end())
-    return pool_.GetRemainTime(itr->second).count();
+    return pool_.GetRemainTime(itr->second.task_id).count();
 
   return -1;
 }
@@ -109,12 +137,28 @@ SelfBalancingBinarySearchTree::Find(const V &value) const {
   res.reserve(size_);
 
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  auto lookup = [&](K const &key) { return Lookup(key); };
+  if (index_.Find(value, lookup, res)) return res;
+
   for (NodePtr node = NextNode(); node; node = NextNode(node))
     if (node->value == value) res.push_back(node->key);
 
   return res;
 }
 
+size_t SelfBalancingBinarySearchTree::Count(const V &value) const {
+  size_t res = 0;
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  auto lookup = [&](K const &key) { return Lookup(key); };
+  if (index_.Count(value, lookup, res)) return res;
+
+  for (NodePtr node = NextNode(); node; node = NextNode(node))
+    if (node->value == value) ++res;
+
+  return res;
+}
+
 std::vector<SelfBalancingBinarySearchTree::V>
 SelfBalancingBinarySearchTree::ShowAll() const {
   std::vector<V> res;
@@ -127,24 +171,116 @@ SelfBalancingBinarySearchTree::ShowAll() const {
   return res;
 }
 
-int SelfBalancingBinarySearchTree::Upload(const std::string &filename) {
-  std::ifstream stream(filename);
-  if (stream.is_open() == false) {
-    return 0;
-  }
+GroupedStats SelfBalancingBinarySearchTree::Aggregate(const V &filter,
+                                                      GroupBy group_by) const {
+  Aggregator aggregator(filter, group_by);
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  for (NodePtr node = NextNode(); node; node = NextNode(node))
+    aggregator.Add(node->value);
+
+  return aggregator.Result();
+}
+
+bool SelfBalancingBinarySearchTree::Visit(
+    K const &key, const std::function<void(const V &)> &visitor) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  const V *value = Lookup(key);
+  if (value) visitor(*value);
+  return value != nullptr;
+}
+
+ReadHandle SelfBalancingBinarySearchTree::Read(K const &key) const {
+  std::unique_lock<std::recursive_mutex> lock(mtx_);
+  const V *value = Lookup(key);
+  return ReadHandle(std::move(lock), value);
+}
+
+void SelfBalancingBinarySearchTree::ForEach(const Visitor &visitor) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  for (NodePtr node = NextNode(); node; node = NextNode(node))
+    visitor(node->key, node->value);
+}
+
+CoinsStatus SelfBalancingBinarySearchTree::IncrementBy(K const &key,
+                                                       long long delta,
+                                                       long long &balance) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Coins::IncrementBy(key, Lookup(key), delta, observers_, balance);
+}
+
+CoinsStatus SelfBalancingBinarySearchTree::Transfer(K const &from,
+                                                    K const &to,
+                                                    long long amount) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return Coins::Transfer(from, Lookup(from), to, Lookup(to), amount,
+                         observers_);
+}
+
+int SelfBalancingBinarySearchTree::MSet(
+    const std::vector<std::pair<K, V>> &items) {
+  auto order = SortedOrder(
+      items.size(), [&](size_t i) -> K const & { return items[i].first; });
 
   int res = 0;
-  K key;
-  V value;
   std::scoped_lock<std::recursive_mutex> lock(mtx_);
-  while (stream >> key >> value) {
-    Set(key, value);
-    ++res;
-  }
+  for (size_t i : order) res += Set(items[i].first, items[i].second);
 
   return res;
 }
 
+std::vector<SelfBalancingBinarySearchTree::V>
+SelfBalancingBinarySearchTree::MGet(const std::vector<K> &keys) const {
+  auto order =
+      SortedOrder(keys.size(), [&](size_t i) -> K const & { return keys[i]; });
+  std::vector<const V *> values(keys.size(), nullptr);
+  std::vector<V> res;
+  res.reserve(keys.size());
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  LookupSorted(root_.get(), keys, order.data(), order.data() + order.size(),
+               values);
+  for (auto const *i : values) res.push_back(i ? *i : V{});
+
+  return res;
+}
+
+std::vector<bool> SelfBalancingBinarySearchTree::MExists(
+    const std::vector<K> &keys) const {
+  auto order =
+      SortedOrder(keys.size(), [&](size_t i) -> K const & { return keys[i]; });
+  std::vector<const V *> values(keys.size(), nullptr);
+  std::vector<bool> res(keys.size());
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  LookupSorted(root_.get(), keys, order.data(), order.data() + order.size(),
+               values);
+  for (size_t i = 0; i < values.size(); ++i) res[i] = values[i] != nullptr;
+
+  return res;
+}
+
+int SelfBalancingBinarySearchTree::MDelete(const std::vector<K> &keys) {
+  auto order =
+      SortedOrder(keys.size(), [&](size_t i) -> K const & { return keys[i]; });
+
+  int res = 0;
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  for (size_t i : order) res += Delete(keys[i]);
+
+  return res;
+}
+
+int SelfBalancingBinarySearchTree::Upload(const std::string &filename,
+                                          unsigned threads) {
+  threads = ParallelLoader::Threads(threads);
+  ParallelLoader::Chunks chunks;
+  if (!ParallelLoader::Read(filename, threads, chunks)) return 0;
+
+  InsertChunks(chunks, threads);
+  return ParallelLoader::Count(chunks);
+}
+
 int SelfBalancingBinarySearchTree::Export(const std::string &filename) const {
   std::ofstream file(filename);
   if (!file.is_open()) {
@@ -159,8 +295,239 @@ int SelfBalancingBinarySearchTree::Export(const std::string &filename) const {
   return res;
 }
 
+int SelfBalancingBinarySearchTree::ExportShards(const std::string &manifest,
+                                                unsigned shards) const {
+  shards = ParallelLoader::Threads(shards);
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+
+  // Every shard takes an equal key range of the in-order sequence.
+  std::vector<const Node *> nodes;
+  for (NodePtr node = NextNode(); node; node = NextNode(node))
+    nodes.push_back(node.get());
+
+  return ExportWriter::Shards(manifest, shards, [&](size_t shard,
+                                                    ExportWriter &writer) {
+    size_t end = nodes.size() * (shard + 1) / shards;
+    for (size_t i = nodes.size() * shard / shards; i < end; ++i) {
+      writer.Add(nodes[i]->key, nodes[i]->value);
+      writer.Spill();
+    }
+  });
+}
+
+ExportStats SelfBalancingBinarySearchTree::ExportInChunks(
+    const std::string &filename, size_t chunk) const {
+  ExportStats stats;
+  ExportWriter writer(filename);
+  if (writer.IsOpen() == false) return stats;
+  chunk = std::max<size_t>(chunk, 1);
+
+  // Rotations reshape the tree between the chunks, so the next chunk
+  // starts from the key after the last one written.
+  std::optional<K> last;
+  for (bool done = false; !done; ++stats.chunks) {
+    {
+      std::scoped_lock<std::recursive_mutex> lock(mtx_);
+      Timer timer;
+      NodePtr node = last ? UpperBound(*last) : NextNode();
+      NodePtr tail;
+      for (size_t taken = 0; node && taken < chunk; ++taken) {
+        writer.Add(node->key, node->value);
+        tail = node;
+        node = NextNode(node);
+      }
+
+      done = node == nullptr;
+      if (tail) last = tail->key;
+      stats.max_lock_hold = std::max(stats.max_lock_hold, timer.Finish());
+    }
+    writer.Spill();
+  }
+
+  if (writer.Finish()) stats.lines = writer.Count();
+  return stats;
+}
+
+SnapshotStatus SelfBalancingBinarySearchTree::Save(const std::string &filename,
+                                                   int &saved,
+                                                   bool compress) const {
+  Snapshot::Writer writer(filename, compress);
+  if (!writer.IsOpen()) {
+    return SnapshotStatus::kNotOpen;
+  }
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Dump(writer, Deadlines());
+  saved = writer.Count();
+  return writer.Finish() ? SnapshotStatus::kOk : SnapshotStatus::kNotOpen;
+}
+
+pid_t SelfBalancingBinarySearchTree::SaveInBackground(
+    const std::string &filename, bool compress) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  auto deadlines = Deadlines();
+
+  return Snapshot::Fork([&] {
+    Snapshot::Writer writer(filename, compress);
+    if (!writer.IsOpen()) return false;
+    Dump(writer, deadlines);
+    return writer.Finish();
+  });
+}
+
+SnapshotStatus SelfBalancingBinarySearchTree::Load(const std::string &filename,
+                                                   int &loaded,
+                                                   unsigned threads,
+                                                   LoadTimings *timings) {
+  threads = ParallelLoader::Threads(threads);
+  ParallelLoader::Chunks chunks;
+  std::vector<Snapshot::Expiring> expiring;
+  auto status = Snapshot::Read(filename, threads, chunks, expiring, timings);
+  if (status != SnapshotStatus::kOk) {
+    return status;
+  }
+
+  Timer timer;
+  InsertChunks(chunks, threads);
+  for (auto &[key, value, lifetime] : expiring)
+    Set(std::move(key), std::move(value), lifetime);
+  if (timings) timings->insert = timer.Finish();
+
+  loaded = ParallelLoader::Count(chunks) + expiring.size();
+  return SnapshotStatus::kOk;
+}
+
+// Sorted records go to an empty tree as a balanced build and through Set
+// otherwise, a repeated key keeps its first value either way.
+void SelfBalancingBinarySearchTree::InsertChunks(ParallelLoader::Chunks &chunks,
+                                                 unsigned threads) {
+  auto records = ParallelLoader::SortedUnique(chunks, threads);
+
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (root_) {
+    for (auto *record : records)
+      Set(std::move(record->first), std::move(record->second));
+  } else {
+    // Levels above floor(log2(n + 1)) are full, only the last one may not.
+    size_t red_depth = 0;
+    while ((size_t{2} << red_depth) <= records.size() + 1) ++red_depth;
+
+    root_ = Build(records, 0, records.size(), nullptr, 0, red_depth);
+    size_ = records.size();
+  }
+}
+
+uint64_t SelfBalancingBinarySearchTree::Watch(K const &key) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return watches_.Watch(key);
+}
+
+void SelfBalancingBinarySearchTree::Unwatch(K const &key) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  watches_.Unwatch(key);
+}
+
+bool SelfBalancingBinarySearchTree::Atomically(
+    const WatchedKeys &watched, const std::function<void()> &body) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (!watches_.Unchanged(watched)) return false;
+
+  body();
+  return true;
+}
+
+void SelfBalancingBinarySearchTree::Subscribe(StorageObserver *observer) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  observers_.Add(observer);
+}
+
+void SelfBalancingBinarySearchTree::Unsubscribe(StorageObserver *observer) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  observers_.Remove(observer);
+}
+
+void SelfBalancingBinarySearchTree::CreateView(GroupBy group_by) {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (!views_.Contains(group_by))
+    views_.Create(group_by, Aggregate({"-", "-", "-", "-", "-"}, group_by));
+}
+
+GroupedTotals SelfBalancingBinarySearchTree::ReadView(GroupBy group_by) const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return views_.Read(group_by);
+}
+
+void SelfBalancingBinarySearchTree::CreateIndex() {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  if (index_.Enabled()) return;
+
+  index_.Enable();
+  for (NodePtr node = NextNode(); node; node = NextNode(node))
+    index_.OnInsert(node->key, node->value);
+}
+
+size_t SelfBalancingBinarySearchTree::IndexMemoryUsage() const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  return index_.Enabled() ? index_.MemoryUsage() : 0;
+}
+
 // ========================= PRIVATE ============================
 
+void SelfBalancingBinarySearchTree::ScheduleExpiration(K const &key,
+                                                       int lifetime) {
+  auto holder = std::make_shared<K>(key);
+  size_t id = pool_.DelayTask(std::chrono::seconds(lifetime), [&, holder] {
+    std::scoped_lock<std::recursive_mutex> lock(mtx_);
+    Erase(*holder, true);
+  });
+  delay_deletions_.emplace(key, Expiration{id, holder});
+  observers_.OnExpireAt(key, Deadline(key));
+}
+
+// Unix time in milliseconds when the key expires, 0 without TTL.
+uint64_t SelfBalancingBinarySearchTree::Deadline(K const &key) const {
+  auto itr = delay_deletions_.find(key);
+  if (itr == delay_deletions_.end()) return 0;
+  return Snapshot::ToDeadline(pool_.GetDeleteTime(itr->second.task_id));
+}
+
+Snapshot::Deadlines SelfBalancingBinarySearchTree::Deadlines() const {
+  std::scoped_lock<std::recursive_mutex> lock(mtx_);
+  Snapshot::Deadlines result;
+  for (auto const &[key, expiration] : delay_deletions_)
+    result.emplace_hint(result.end(), key, Deadline(key));
+  return result;
+}
+
+// Writes the records without locking anything, a forked child calls it
+// too.
+void SelfBalancingBinarySearchTree::Dump(
+    Snapshot::Writer &writer, Snapshot::Deadlines const &deadlines) const {
+  for (NodePtr node = NextNode(); node; node = NextNode(node)) {
+    auto deadline = deadlines.find(node->key);
+    writer.Add(node->key, node->value,
+               deadline == deadlines.end() ? 0 : deadline->second);
+  }
+}
+
+void SelfBalancingBinarySearchTree::CancelExpiration(K const &key) {
+  auto itr = delay_deletions_.find(key);
+  if (itr == delay_deletions_.end()) return;
+
+  pool_.StopTask(itr->second.task_id);
+  delay_deletions_.erase(itr);
+}
+
+void SelfBalancingBinarySearchTree::RenameExpiration(K const &from,
+                                                     K const &to) {
+  auto item = delay_deletions_.extract(from);
+  if (!item) return;
+
+  item.key() = to;
+  *item.mapped().key = to;
+  delay_deletions_.insert(std::move(item));
+}
+
 void SelfBalancingBinarySearchTree::DeleteNode(NodePtr node) {
   if (!node) return;
 
@@ -236,30 +603,95 @@ SelfBalancingBinarySearchTree::GetNode(NodePtr node, K const &key) const {
   }
 }
 
-bool SelfBalancingBinarySearchTree::Insert(NodePtr node, K const &key,
-                                           const V &value) {
+const SelfBalancingBinarySearchTree::V *SelfBalancingBinarySearchTree::Lookup(
+    K const &key) const {
+  Node *node = root_.get();
+  while (node && node->key != key)
+    node = (key < node->key ? node->left : node->right).get();
+  return node ? &node->value : nullptr;
+}
+
+SelfBalancingBinarySearchTree::V *SelfBalancingBinarySearchTree::Lookup(
+    K const &key) {
+  return const_cast<V *>(std::as_const(*this).Lookup(key));
+}
+
+// Resolves a sorted batch of keys in one descent: the slice of keys is
+// split around every visited node, so a shared path is walked once.
+void SelfBalancingBinarySearchTree::LookupSorted(
+    Node *node, std::vector<K> const &keys, size_t *first, size_t *last,
+    std::vector<const V *> &values) const {
+  if (!node || first == last) return;
+
+  size_t *lower = std::partition_point(
+      first, last, [&](size_t i) { return keys[i] < node->key; });
+  size_t *upper = std::partition_point(
+      lower, last, [&](size_t i) { return keys[i] == node->key; });
+
+  for (size_t *i = lower; i != upper; ++i) values[*i] = &node->value;
+
+  LookupSorted(node->left.get(), keys, first, lower, values);
+  LookupSorted(node->right.get(), keys, upper, last, values);
+}
+
+SelfBalancingBinarySearchTree::Node *SelfBalancingBinarySearchTree::Link(
+    K &&key, V &&value) {
+  if (root_) return Insert(root_, std::move(key), std::move(value));
+
+  root_ = std::make_shared<Node>(std::move(key), std::move(value), nullptr,
+                                 NodeColor::kBlack);
+  return root_.get();
+}
+
+// Builds a balanced subtree of sorted unique records around the middle
+// one. Only the nodes of an incomplete last level are red, so every path
+// has the same number of black nodes.
+SelfBalancingBinarySearchTree::NodePtr SelfBalancingBinarySearchTree::Build(
+    std::vector<std::pair<K, V> *> const &records, size_t first, size_t last,
+    NodePtr const &parent, size_t depth, size_t red_depth) {
+  if (first == last) return nullptr;
+
+  size_t middle = first + (last - first) / 2;
+  NodeColor color = depth == red_depth ? NodeColor::kRed : NodeColor::kBlack;
+  auto node = std::make_shared<Node>(std::move(records[middle]->first),
+                                     std::move(records[middle]->second),
+                                     parent, color);
+  observers_.OnInsert(node->key, node->value);
+
+  node->left = Build(records, first, middle, node, depth + 1, red_depth);
+  node->right = Build(records, middle + 1, last, node, depth + 1, red_depth);
+  return node;
+}
+
+// Returns the inserted node or nullptr if the key already exists.
+SelfBalancingBinarySearchTree::Node *SelfBalancingBinarySearchTree::Insert(
+    NodePtr node, K &&key, V &&value) {
   if (key < node->key) {
     if (node->left) {
-      return Insert(node->left, key, value);
+      return Insert(node->left, std::move(key), std::move(value));
 
     } else {
-      node->left = std::make_shared<Node>(key, value, node);
+      node->left = std::make_shared<Node>(std::move(key), std::move(value),
+                                          node);
+      Node *result = node->left.get();
       InsertionCheck(node->left);
-      return true;
+      return result;
     }
 
   } else if (key > node->key) {
     if (node->right) {
-      return Insert(node->right, key, value);
+      return Insert(node->right, std::move(key), std::move(value));
 
     } else {
-      node->right = std::make_shared<Node>(key, value, node);
+      node->right = std::make_shared<Node>(std::move(key), std::move(value),
+                                           node);
+      Node *result = node->right.get();
       InsertionCheck(node->right);
-      return true;
+      return result;
     }
 
   } else {
-    return false;
+    return nullptr;
   }
 }
 
@@ -340,6 +772,21 @@ void SelfBalancingBinarySearchTree::Recolor(NodePtr node) const {
       (node->IsRed() || node == root_) ? NodeColor::kBlack : NodeColor::kRed;
 }
 
+// First node with a key greater than the given one.
+SelfBalancingBinarySearchTree::NodePtr
+SelfBalancingBinarySearchTree::UpperBound(K const &key) const {
+  NodePtr result;
+  for (NodePtr node = root_; node;) {
+    if (key < node->key) {
+      result = node;
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return result;
+}
+
 SelfBalancingBinarySearchTree::NodePtr SelfBalancingBinarySearchTree::NextNode(
     NodePtr node) const {
   auto min_node = [&](NodePtr node) -> NodePtr {
@@ -367,12 +814,12 @@ SelfBalancingBinarySearchTree::NodePtr SelfBalancingBinarySearchTree::NextNode(
   return node;
 }
 
-SelfBalancingBinarySearchTree::Node::Node(K const &key, V const &value,
+SelfBalancingBinarySearchTree::Node::Node(K &&key, V &&value,
                                           NodePtr const &parent,
                                           NodeColor color, NodePtr const &left,
                                           NodePtr const &right)
-    : key(key),
-      value(value),
+    : key(std::move(key)),
+      value(std::move(value)),
       parent(parent),
       color(color),
       left(left),
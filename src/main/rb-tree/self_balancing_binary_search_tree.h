@@ -9,6 +9,7 @@
 #include <memory>
 
 #include "async_pool.h"
+#include "expiration.h"
 #include "key_value_storage.h"
 
 namespace s21 {
@@ -16,11 +17,41 @@ namespace s21 {
 class SelfBalancingBinarySearchTree : public KeyValueStorage {
  public:
   bool Set(K const& key, const V& value, int lifetime = -1) override;
+  bool Set(K&& key, V&& value, int lifetime = -1) override;
   [[nodiscard]] std::vector<K> Find(const V& value) const override;
+  [[nodiscard]] size_t Count(const V& value) const override;
   [[nodiscard]] bool Exists(K const& key) const override;
-  int Upload(const std::string& filename) override;
+  bool Visit(const K& key,
+             const std::function<void(const V&)>& visitor) const override;
+  [[nodiscard]] ReadHandle Read(const K& key) const override;
+  void ForEach(const Visitor& visitor) const override;
+  CoinsStatus IncrementBy(const K& key, long long delta,
+                          long long& balance) override;
+  CoinsStatus Transfer(const K& from, const K& to, long long amount) override;
+  int MSet(const std::vector<std::pair<K, V>>& items) override;
+  [[nodiscard]] std::vector<V> MGet(const std::vector<K>& keys) const override;
+  [[nodiscard]] std::vector<bool> MExists(
+      const std::vector<K>& keys) const override;
+  int MDelete(const std::vector<K>& keys) override;
+  int Upload(const std::string& filename, unsigned threads = 0) override;
   int Export(const std::string& filename) const override;
+  int ExportShards(const std::string& manifest,
+                   unsigned shards = 0) const override;
+  ExportStats ExportInChunks(const std::string& filename,
+                             size_t chunk = 1024) const override;
+  SnapshotStatus Save(const std::string& filename, int& saved,
+                      bool compress = false) const override;
+  SnapshotStatus Load(const std::string& filename, int& loaded,
+                      unsigned threads = 0,
+                      LoadTimings* timings = nullptr) override;
+  pid_t SaveInBackground(const std::string& filename,
+                         bool compress = false) const override;
+  [[nodiscard]] Snapshot::Deadlines Deadlines() const override;
+  void Dump(Snapshot::Writer& writer,
+            Snapshot::Deadlines const& deadlines) const override;
   [[nodiscard]] std::vector<V> ShowAll() const override;
+  [[nodiscard]] GroupedStats Aggregate(const V& filter,
+                                       GroupBy group_by) const override;
   [[nodiscard]] std::vector<K> Keys() const override;
   bool Rename(K const& from, K const& to) override;
   [[nodiscard]] int Ttl(K const& key) const override;
@@ -28,6 +59,18 @@ class SelfBalancingBinarySearchTree : public KeyValueStorage {
   [[nodiscard]] V Get(K const& key) const override;
   bool Delete(K const& key) override;
 
+  uint64_t Watch(const K& key) override;
+  void Unwatch(const K& key) override;
+  bool Atomically(const WatchedKeys& watched,
+                  const std::function<void()>& body) override;
+
+  void Subscribe(StorageObserver* observer) override;
+  void Unsubscribe(StorageObserver* observer) override;
+  void CreateView(GroupBy group_by) override;
+  [[nodiscard]] GroupedTotals ReadView(GroupBy group_by) const override;
+  void CreateIndex() override;
+  [[nodiscard]] size_t IndexMemoryUsage() const override;
+
  private:
   enum class NodeColor { kRed, kBlack };
   struct Node;
@@ -35,20 +78,39 @@ class SelfBalancingBinarySearchTree : public KeyValueStorage {
   using NodePtr = std::shared_ptr<Node>;
 
   size_t size_ = 0;
+  MaterializedViews views_;
+  BitmapIndex index_;
+  WatchTable watches_;
+  StorageObservers observers_{&views_, &index_, &watches_};
   AsyncPool pool_;
   NodePtr root_ = nullptr;
   mutable std::recursive_mutex mtx_;
-  std::map<K, size_t> delay_deletions_;
+  std::map<K, Expiration> delay_deletions_;
 
-  bool Insert(NodePtr node, K const& key, const V& value);
+  void InsertChunks(ParallelLoader::Chunks& chunks, unsigned threads);
+  uint64_t Deadline(const K& key) const;
+  Node* Link(K&& key, V&& value);
+  Node* Insert(NodePtr node, K&& key, V&& value);
+  NodePtr Build(std::vector<std::pair<K, V>*> const& records, size_t first,
+                size_t last, NodePtr const& parent, size_t depth,
+                size_t red_depth);
   NodePtr GetNode(NodePtr node, K const& key) const;
+  const V* Lookup(K const& key) const;
+  V* Lookup(K const& key);
+  void LookupSorted(Node* node, std::vector<K> const& keys, size_t* first,
+                    size_t* last, std::vector<const V*>& values) const;
   NodePtr NextNode(NodePtr node = nullptr) const;
+  NodePtr UpperBound(K const& key) const;
   void Rotation(NodePtr node, bool right);
   void InsertionCheck(NodePtr node);
   void CheckRotation(NodePtr node);
   void DeleteNode(NodePtr node);
   void Recolor(NodePtr node) const;
   void DeletionCheck(NodePtr node);
+  bool Erase(K const& key, bool expired);
+  void ScheduleExpiration(K const& key, int lifetime);
+  void CancelExpiration(K const& key);
+  void RenameExpiration(K const& from, K const& to);
 };
 
 struct SelfBalancingBinarySearchTree::Node
@@ -60,7 +122,7 @@ struct SelfBalancingBinarySearchTree::Node
   NodePtr left;
   NodePtr right;
 
-  Node(K const& key, V const& value, NodePtr const& parent = nullptr,
+  Node(K&& key, V&& value, NodePtr const& parent = nullptr,
        NodeColor color = NodeColor::kRed, NodePtr const& left = nullptr,
        NodePtr const& right = nullptr);
 
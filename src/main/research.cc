@@ -2,15 +2,39 @@
 //         created by pintoved          //
 //////////////////////////////////////////
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <optional>
 #include <random>
+#include <thread>
 
 #include "b_plus_tree.h"
 #include "console.h"
 #include "hash_table.h"
+#include "op_log.h"
 #include "self_balancing_binary_search_tree.h"
+#include "sharded_storage.h"
 
 using namespace s21;
 
+// Counts every heap allocation of the process, see CountAllocations.
+std::atomic_size_t allocations = 0;
+
+void* operator new(size_t size) {
+  ++allocations;
+  if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
 std::vector<std::string> first_names = {
     "Иван",  "Андрей",  "Яков",      "Юрий",   "Татьяна",
     "Мария", "Авдотья", "Елизавета", "Виктор", "Поликарп"};
@@ -37,14 +61,18 @@ Type Random(Type from, Type to) {
   return uniform_dist(rd);
 }
 
+Person RandomPerson() {
+  return {first_names.at(Random(0, 9)),  //
+          last_names.at(Random(0, 9)),   //
+          birth_days.at(Random(0, 9)),   //
+          cities.at(Random(0, 9)),       //
+          coins.at(Random(0, 9))};
+}
+
 void Generate(SelfBalancingBinarySearchTree& rb_tree, HashTable& hash_table,
               BPlusTree& b_tree, int count) {
   for (int i = 0; i < count; i++) {
-    Person data = {first_names.at(Random(0, 9)),  //
-                   last_names.at(Random(0, 9)),   //
-                   birth_days.at(Random(0, 9)),   //
-                   cities.at(Random(0, 9)),       //
-                   coins.at(Random(0, 9))};
+    Person data = RandomPerson();
     rb_tree.Set("key" + std::to_string(i), data, -1);
     hash_table.Set("key" + std::to_string(i), data, -1);
     b_tree.Set("key" + std::to_string(i), data, -1);
@@ -67,6 +95,322 @@ nanoseconds Research(int count, Func func, Args... args) {
   return count ? res / count : 0s;
 }
 
+// Average time of one Set, Update and Delete over `num` fresh keys.
+template <class Storage>
+nanoseconds ResearchWrites(Storage& storage, int num, bool with_views) {
+  if (with_views) {
+    storage.CreateView(GroupBy::kCity);
+    storage.CreateView(GroupBy::kBirthday);
+  }
+
+  std::vector<std::string> keys;
+  std::vector<Person> values;
+  for (int i = 0; i < num; i++) {
+    keys.push_back("key" + std::to_string(i));
+    values.push_back(RandomPerson());
+  }
+
+  Timer timer;
+  for (int i = 0; i < num; i++) storage.Set(keys[i], values[i], -1);
+  for (int i = 0; i < num; i++) storage.Update(keys[i], values[num - i - 1]);
+  for (int i = 0; i < num; i++) storage.Delete(keys[i]);
+
+  return num ? timer.Finish() / (3 * num) : 0s;
+}
+
+// Transfers per second between `accounts` funded keys, made by `threads`
+// concurrent clients.
+template <class Storage>
+size_t TransfersPerSecond(Storage& storage, int threads, int accounts) {
+  for (int i = 0; i < accounts; i++)
+    storage.Set("account" + std::to_string(i),
+                {"Account", "Holder", "2000", "Москва", "1000000000"}, -1);
+
+  constexpr int kTransfers = 20000;
+  Timer timer;
+  std::vector<std::thread> clients;
+  for (int t = 0; t < threads; t++) {
+    clients.emplace_back([&, t] {
+      std::mt19937 random(t);
+      std::uniform_int_distribution<int> account(0, accounts - 1);
+      for (int i = 0; i < kTransfers; i++)
+        storage.Transfer("account" + std::to_string(account(random)),
+                         "account" + std::to_string(account(random)), 1);
+    });
+  }
+  for (auto& client : clients) client.join();
+  auto elapsed = duration_cast<microseconds>(timer.Finish()).count();
+
+  for (int i = 0; i < accounts; i++)
+    storage.Delete("account" + std::to_string(i));
+
+  return elapsed ? 1000000ull * threads * kTransfers / elapsed : 0;
+}
+
+// Requests per second of `threads` clients, each making 80% GETs and 20%
+// INCRBYs on random keys out of `keys` funded ones.
+size_t OpsPerSecond(KeyValueStorage& storage, int threads, int keys) {
+  for (int i = 0; i < keys; i++)
+    storage.Set("key" + std::to_string(i),
+                {"Account", "Holder", "2000", "Москва", "1000"}, -1);
+
+  constexpr int kRequests = 50000;
+  Timer timer;
+  std::vector<std::thread> clients;
+  for (int t = 0; t < threads; t++) {
+    clients.emplace_back([&, t] {
+      std::mt19937 random(t);
+      std::uniform_int_distribution<int> key(0, keys - 1);
+      long long balance = 0;
+      for (int i = 0; i < kRequests; i++) {
+        std::string name = "key" + std::to_string(key(random));
+        if (i % 5 == 0)
+          storage.IncrementBy(name, 1, balance);
+        else
+          balance += storage.Get(name).coins.size();
+      }
+    });
+  }
+  for (auto& client : clients) client.join();
+  auto elapsed = duration_cast<microseconds>(timer.Finish()).count();
+
+  return elapsed ? 1000000ull * threads * kRequests / elapsed : 0;
+}
+
+// Sets per second of 4 clients with the mutations logged under the given
+// fsync policy, or not logged at all. With kAlways every client waits for
+// its Set to reach the disk, as the console does after every command.
+template <class Storage>
+size_t LoggedWritesPerSecond(Storage& storage,
+                             std::optional<FsyncPolicy> policy) {
+  constexpr int kThreads = 4, kWrites = 2000;
+  std::string filename = "research_log.aof";
+  std::remove(filename.c_str());
+  std::optional<OpLog> log;
+  if (policy) {
+    log.emplace(filename, *policy);
+    storage.Subscribe(&*log);
+  }
+
+  Timer timer;
+  std::vector<std::thread> clients;
+  for (int t = 0; t < kThreads; t++) {
+    clients.emplace_back([&, t] {
+      for (int i = 0; i < kWrites; i++) {
+        storage.Set("logged" + std::to_string(t * kWrites + i), {}, -1);
+        if (policy == FsyncPolicy::kAlways) log->Commit();
+      }
+    });
+  }
+  for (auto& client : clients) client.join();
+  auto elapsed = duration_cast<microseconds>(timer.Finish()).count();
+
+  if (log) storage.Unsubscribe(&*log);
+  for (int i = 0; i < kThreads * kWrites; i++)
+    storage.Delete("logged" + std::to_string(i));
+  log.reset();
+  std::remove(filename.c_str());
+
+  return elapsed ? 1000000ull * kThreads * kWrites / elapsed : 0;
+}
+
+struct TransactionStats {
+  size_t per_second = 0;
+  double abort_rate = 0;
+};
+
+// Optimistic read-modify-write transactions: each client watches two
+// random accounts, reads their balances and moves a coin between them in
+// a MULTI/EXEC style block, which aborts if another client got there
+// first. Fewer accounts mean more contention.
+template <class Storage>
+TransactionStats Transactions(Storage& storage, int threads, int accounts) {
+  for (int i = 0; i < accounts; i++)
+    storage.Set("account" + std::to_string(i),
+                {"Account", "Holder", "2000", "Москва", "1000000000"}, -1);
+
+  constexpr int kTransactions = 10000;
+  std::atomic_size_t commits = 0, aborts = 0;
+  Timer timer;
+  std::vector<std::thread> clients;
+  for (int t = 0; t < threads; t++) {
+    clients.emplace_back([&, t] {
+      std::mt19937 random(t);
+      std::uniform_int_distribution<int> account(0, accounts - 1);
+      for (int i = 0; i < kTransactions; i++) {
+        std::string from = "account" + std::to_string(account(random));
+        std::string to = "account" + std::to_string(account(random));
+        if (from == to) continue;
+
+        WatchedKeys watched = {{from, storage.Watch(from)},
+                               {to, storage.Watch(to)}};
+
+        long long debit = std::stoll(storage.Get(from).coins) - 1;
+        long long credit = std::stoll(storage.Get(to).coins) + 1;
+        bool committed = storage.Atomically(watched, [&] {
+          storage.Update(from, {"-", "-", "-", "-", std::to_string(debit)});
+          storage.Update(to, {"-", "-", "-", "-", std::to_string(credit)});
+        });
+        ++(committed ? commits : aborts);
+
+        for (auto const& [key, version] : watched) storage.Unwatch(key);
+      }
+    });
+  }
+  for (auto& client : clients) client.join();
+  auto elapsed = duration_cast<microseconds>(timer.Finish()).count();
+
+  for (int i = 0; i < accounts; i++)
+    storage.Delete("account" + std::to_string(i));
+
+  size_t total = std::max<size_t>(commits + aborts, 1);
+  return {elapsed ? 1000000ull * commits / elapsed : 0,
+          100.0 * aborts / total};
+}
+
+// Load throughput of a fresh storage in MB/s, either through Upload on the
+// given number of threads or through the `stream >> key >> value` loop it
+// used before.
+template <class Storage>
+double LoadThroughput(Storage& storage, std::string const& filename,
+                      bool with_stream, unsigned threads = 0) {
+  std::ifstream file(filename, std::ios::ate);
+  double megabytes = file.tellg() / 1e6;
+  file.seekg(0);
+
+  Timer timer;
+  if (with_stream) {
+    std::string key;
+    Person value;
+    while (file >> key >> value) storage.Set(std::move(key), std::move(value));
+  } else {
+    storage.Upload(filename, threads);
+  }
+  double seconds = duration_cast<microseconds>(timer.Finish()).count() / 1e6;
+
+  return seconds > 0 ? megabytes / seconds : 0;
+}
+
+// Load throughput of a binary snapshot into a fresh storage in MB/s.
+template <class Storage>
+double SnapshotThroughput(Storage& storage, std::string const& filename) {
+  std::ifstream file(filename, std::ios::ate | std::ios::binary);
+  double megabytes = file.tellg() / 1e6;
+
+  Timer timer;
+  int loaded = 0;
+  storage.Load(filename, loaded);
+  double seconds = duration_cast<microseconds>(timer.Finish()).count() / 1e6;
+
+  return seconds > 0 ? megabytes / seconds : 0;
+}
+
+enum class SaveMode { kNone, kForeground, kBackground };
+
+struct SaveLatency {
+  long long snapshot_ms = 0;
+  long long p99_us = 0;
+  long long max_us = 0;
+};
+
+// Latency of the Updates a client makes while the storage is saved on
+// another thread, by Save or by a forked SaveInBackground, or while nothing
+// is saved at all.
+template <class Storage>
+SaveLatency WriteLatencyDuringSave(Storage& storage,
+                                   std::string const& filename,
+                                   SaveMode mode) {
+  constexpr int kKeys = 1000, kMinWrites = 20000;
+  for (int i = 0; i < kKeys; i++)
+    storage.Set("latency" + std::to_string(i), {}, -1);
+
+  SaveLatency result;
+  std::atomic_bool saving = mode != SaveMode::kNone;
+  std::thread saver([&] {
+    if (mode == SaveMode::kNone) return;
+    Timer timer;
+    int saved = 0;
+    if (mode == SaveMode::kForeground)
+      storage.Save(filename, saved);
+    else
+      Snapshot::Poll(storage.SaveInBackground(filename), true);
+    result.snapshot_ms =
+        duration_cast<milliseconds>(timer.Finish()).count();
+    saving = false;
+  });
+
+  std::vector<long long> latencies;
+  Person value = {"-", "-", "-", "-", "1"};
+  for (int i = 0; saving || i < kMinWrites; i++) {
+    Timer timer;
+    storage.Update("latency" + std::to_string(i % kKeys), value);
+    latencies.push_back(duration_cast<microseconds>(timer.Finish()).count());
+  }
+  saver.join();
+
+  for (int i = 0; i < kKeys; i++)
+    storage.Delete("latency" + std::to_string(i));
+  std::remove(filename.c_str());
+
+  std::sort(latencies.begin(), latencies.end());
+  result.p99_us = latencies[latencies.size() * 99 / 100];
+  result.max_us = latencies.back();
+  return result;
+}
+
+struct RecoveryTimes {
+  nanoseconds full_log{0};
+  nanoseconds checkpoint{0};
+  LoadTimings phases;
+};
+
+// Restart time of a store of `num` records by replaying a log of their
+// Sets, and by loading a checkpoint and replaying a tail of 1000 Updates
+// after it. `make` builds an empty storage.
+template <class Make>
+RecoveryTimes Recovery(Make make, int num) {
+  std::string filename = "research_recovery.aof";
+  std::remove(filename.c_str());
+  RecoveryTimes result;
+
+  auto storage = make();
+  OpLog log(filename, FsyncPolicy::kNo);
+  storage->Subscribe(&log);
+  for (int i = 0; i < num; i++)
+    storage->Set("key" + std::to_string(i),
+                 {"Иванов", "Иван", "2000", "Москва", std::to_string(i)});
+  log.Commit();
+
+  auto replayed = make();
+  Timer timer;
+  OpLog::Replay(filename, replayed.get());
+  result.full_log = timer.Finish();
+
+  log.Checkpoint(storage.get());
+  log.WaitRewrite();
+  for (int i = 0; i < 1000; i++)
+    storage->Update("key" + std::to_string(i), {"-", "-", "-", "-", "0"});
+  log.Commit();
+  storage->Unsubscribe(&log);
+
+  auto recovered = make();
+  timer.Start();
+  OpLog::Replay(filename, recovered.get(), &result.phases);
+  result.checkpoint = timer.Finish();
+
+  std::remove(filename.c_str());
+  for (auto const& entry : std::filesystem::directory_iterator("."))
+    if (entry.path().extension() == ".snap") std::filesystem::remove(entry);
+  return result;
+}
+
+template <class Func>
+size_t CountAllocations(Func func) {
+  size_t before = allocations;
+  func();
+  return allocations - before;
+}
+
 // ChoseFunc
 
 void PrintTableString(std::string const& name,        //
@@ -148,5 +492,379 @@ int main() {
                    std::to_string(h_time),   //
                    std::to_string(b_time));
 
+  rb_time = Research(count, [&]() {
+              rb_tree.Aggregate({"-", "-", "-", "-", "-"}, GroupBy::kCity);
+            }).count();
+  h_time = Research(count, [&]() {
+             hash_table.Aggregate({"-", "-", "-", "-", "-"}, GroupBy::kCity);
+           }).count();
+  b_time = Research(count, [&]() {
+             b_tree.Aggregate({"-", "-", "-", "-", "-"}, GroupBy::kCity);
+           }).count();
+
+  PrintTableString("Aggregate",              //
+                   std::to_string(rb_time),  //
+                   std::to_string(h_time),   //
+                   std::to_string(b_time));
+
+  auto research_all = [&](std::string const& name, auto func) {
+    PrintTableString(name,  //
+                     std::to_string(Research(count, [&] { func(rb_tree); })
+                                        .count()),
+                     std::to_string(Research(count, [&] { func(hash_table); })
+                                        .count()),
+                     std::to_string(Research(count, [&] { func(b_tree); })
+                                        .count()));
+  };
+
+  std::string get_key = "key" + std::to_string(num / 2);
+  auto visit = [&](auto& i) {
+    i.Visit(get_key, [](Person const& value) { (void)value.coins.size(); });
+  };
+  auto read = [&](auto& i) { (void)i.Read(get_key)->coins.size(); };
+  auto for_each = [&](auto& i) {
+    size_t size = 0;
+    i.ForEach([&](std::string const&, Person const& value) {
+      size += value.city.size();
+    });
+  };
+
+  research_all("Visit", visit);
+  research_all("Read", read);
+
+  auto allocations_of = [&](std::string const& name, auto func) {
+    PrintTableString(name,  //
+                     std::to_string(CountAllocations([&] { func(rb_tree); })),
+                     std::to_string(
+                         CountAllocations([&] { func(hash_table); })),
+                     std::to_string(CountAllocations([&] { func(b_tree); })));
+  };
+
+  allocations_of("Get[allocs]", [&](auto& i) { i.Get(get_key); });
+  allocations_of("Visit[allocs]", visit);
+  allocations_of("Read[allocs]", read);
+  allocations_of("ShowAll[allocs]", [&](auto& i) { i.ShowAll(); });
+  allocations_of("ForEach[allocs]", for_each);
+
+  // Heap allocations per Set of a new record: copying the key and the
+  // value, moving them in, and building the value from its fields.
+  std::vector<std::pair<std::string, Person>> records;
+  for (int i = 0; i < 100; i++)
+    records.emplace_back("record" + std::to_string(i), RandomPerson());
+
+  auto allocations_per_set = [&](std::string const& name, auto set) {
+    auto per_set = [&](auto& storage) {
+      auto copies = records;
+      size_t result = CountAllocations([&] {
+        for (auto& [key, value] : copies) set(storage, key, value);
+      });
+      for (auto const& [key, value] : records) storage.Delete(key);
+      return std::to_string(static_cast<double>(result) / records.size());
+    };
+    PrintTableString(name, per_set(rb_tree), per_set(hash_table),
+                     per_set(b_tree));
+  };
+
+  allocations_per_set("Set[allocs]", [](auto& i, auto& key, auto& value) {
+    i.Set(key, value, -1);
+  });
+  allocations_per_set("Set&&[allocs]", [](auto& i, auto& key, auto& value) {
+    i.Set(std::move(key), std::move(value), -1);
+  });
+  allocations_per_set("Emplace[allocs]", [](auto& i, auto& key, auto& value) {
+    i.Emplace(std::move(key), value.last_name.c_str(),
+              value.first_name.c_str(), value.birthday.c_str(),
+              value.city.c_str(), value.coins.c_str());
+  });
+
+  // Per-key cost of a batch against the same keys one by one.
+  std::vector<std::string> batch_keys;
+  std::vector<std::pair<std::string, Person>> batch_items;
+  for (int i = 0; i < std::min(num, 1000); i++) {
+    batch_keys.push_back("key" + std::to_string(Random(0, num - 1)));
+    batch_items.emplace_back("batch" + std::to_string(i), RandomPerson());
+  }
+  size_t batch = std::max<size_t>(batch_keys.size(), 1);
+
+  auto research_per_key = [&](std::string const& name, auto func) {
+    auto per_key = [&](auto& storage) {
+      return std::to_string(
+          Research(count, [&] { func(storage); }).count() / batch);
+    };
+    PrintTableString(name, per_key(rb_tree), per_key(hash_table),
+                     per_key(b_tree));
+  };
+
+  research_per_key("Get/key", [&](auto& i) {
+    for (auto const& key : batch_keys) i.Get(key);
+  });
+  research_per_key("MGet/key", [&](auto& i) { i.MGet(batch_keys); });
+  research_per_key("Exists/key", [&](auto& i) {
+    for (auto const& key : batch_keys) i.Exists(key);
+  });
+  research_per_key("MExists/key", [&](auto& i) { i.MExists(batch_keys); });
+  research_per_key("Set+Del/key", [&](auto& i) {
+    for (auto const& [key, value] : batch_items) i.Set(key, value, -1);
+    for (auto const& [key, value] : batch_items) i.Delete(key);
+  });
+  research_per_key("MSet+MDel/key", [&](auto& i) {
+    std::vector<std::string> keys;
+    for (auto const& [key, value] : batch_items) keys.push_back(key);
+    i.MSet(batch_items);
+    i.MDelete(keys);
+  });
+
+  // RENAME back and forth, with and without a pending expiration.
+  auto rename = [&](std::string const& key) {
+    return [&, key](auto& i) {
+      i.Rename(key, "renamed");
+      i.Rename("renamed", key);
+    };
+  };
+
+  research_all("Rename", rename("key0"));
+  rb_tree.Set("expiring", RandomPerson(), 3600);
+  hash_table.Set("expiring", RandomPerson(), 3600);
+  b_tree.Set("expiring", RandomPerson(), 3600);
+  research_all("Rename+TTL", rename("expiring"));
+
+  research_all("IncrBy", [&](auto& i) {
+    long long balance = 0;
+    i.IncrementBy("expiring", 1, balance);
+  });
+  research_all("Transfer", [&](auto& i) {
+    i.Transfer("expiring", "key0", 0);
+  });
+  for (int threads : {1, 4}) {
+    auto transfers = [&](auto& i) {
+      return std::to_string(TransfersPerSecond(i, threads, 1000));
+    };
+    PrintTableString("Transfer/s x" + std::to_string(threads),
+                     transfers(rb_tree), transfers(hash_table),
+                     transfers(b_tree));
+  }
+
+  std::pair<std::string, std::optional<FsyncPolicy>> policies[] = {
+      {"Log off[op/s]", std::nullopt},
+      {"Log always[op/s]", FsyncPolicy::kAlways},
+      {"Log 1s[op/s]", FsyncPolicy::kEverySec},
+      {"Log no[op/s]", FsyncPolicy::kNo}};
+  for (auto const& [name, policy] : policies) {
+    PrintTableString(name,
+                     std::to_string(LoggedWritesPerSecond(rb_tree, policy)),
+                     std::to_string(LoggedWritesPerSecond(hash_table, policy)),
+                     std::to_string(LoggedWritesPerSecond(b_tree, policy)));
+  }
+
+  for (int accounts : {10, 10000}) {
+    std::string suffix = accounts == 10 ? " hot" : " cold";
+    TransactionStats stats[3] = {Transactions(rb_tree, 4, accounts),
+                                 Transactions(hash_table, 4, accounts),
+                                 Transactions(b_tree, 4, accounts)};
+    PrintTableString("Tx/s x4" + suffix, std::to_string(stats[0].per_second),
+                     std::to_string(stats[1].per_second),
+                     std::to_string(stats[2].per_second));
+    PrintTableString("Abort% x4" + suffix, std::to_string(stats[0].abort_rate),
+                     std::to_string(stats[1].abort_rate),
+                     std::to_string(stats[2].abort_rate));
+  }
+
+  Person multi_filter = {"-", "-", "1996..1999", "Москва|Рим", "-"};
+  Person count_filter = {"-", "-", "2000", "Киев", "-"};
+
+  research_all("FindMulti", [&](auto& i) { i.Find(multi_filter); });
+  research_all("Count", [&](auto& i) { i.Count(count_filter); });
+
+  rb_tree.CreateIndex();
+  hash_table.CreateIndex();
+  b_tree.CreateIndex();
+
+  research_all("Find+Index", [&](auto& i) {
+    i.Find({"-", "-", "1996", "-", "-"});
+  });
+  research_all("FindMulti+Index", [&](auto& i) { i.Find(multi_filter); });
+  research_all("Count+Index", [&](auto& i) { i.Count(count_filter); });
+
+  PrintTableString("IndexMemory[B]",                               //
+                   std::to_string(rb_tree.IndexMemoryUsage()),     //
+                   std::to_string(hash_table.IndexMemoryUsage()),  //
+                   std::to_string(b_tree.IndexMemoryUsage()));
+
+  for (bool with_views : {false, true}) {
+    SelfBalancingBinarySearchTree rb_writes;
+    HashTable h_writes(num);
+    BPlusTree b_writes;
+
+    rb_time = ResearchWrites(rb_writes, num, with_views).count();
+    h_time = ResearchWrites(h_writes, num, with_views).count();
+    b_time = ResearchWrites(b_writes, num, with_views).count();
+
+    PrintTableString(with_views ? "Writes+Views" : "Writes",  //
+                     std::to_string(rb_time),                 //
+                     std::to_string(h_time),                  //
+                     std::to_string(b_time));
+  }
+
+  std::string upload_file = "research_upload.txt";
+  b_tree.Export(upload_file);
+  for (unsigned threads : {1, 2, 4, 8, 16}) {
+    SelfBalancingBinarySearchTree rb_load;
+    HashTable h_load(num);
+    BPlusTree b_load;
+
+    PrintTableString(
+        "Upload x" + std::to_string(threads) + "[MB/s]",
+        std::to_string(LoadThroughput(rb_load, upload_file, false, threads)),
+        std::to_string(LoadThroughput(h_load, upload_file, false, threads)),
+        std::to_string(LoadThroughput(b_load, upload_file, false, threads)));
+  }
+  {
+    SelfBalancingBinarySearchTree rb_load;
+    HashTable h_load(num);
+    BPlusTree b_load;
+
+    PrintTableString("istream[MB/s]",
+                     std::to_string(LoadThroughput(rb_load, upload_file, true)),
+                     std::to_string(LoadThroughput(h_load, upload_file, true)),
+                     std::to_string(LoadThroughput(b_load, upload_file, true)));
+  }
+  std::remove(upload_file.c_str());
+
+  std::string export_file = "research_export.txt";
+  {
+    // The plain Export holds the lock for all of its time.
+    auto plain = [&](auto& storage) {
+      Timer timer;
+      storage.Export(export_file);
+      return std::to_string(
+          duration_cast<milliseconds>(timer.Finish()).count());
+    };
+    PrintTableString("Export[ms]", plain(rb_tree), plain(hash_table),
+                     plain(b_tree));
+
+    ExportStats stats[3];
+    auto chunked = [&](auto& storage, ExportStats& result) {
+      Timer timer;
+      result = storage.ExportInChunks(export_file);
+      return std::to_string(
+          duration_cast<milliseconds>(timer.Finish()).count());
+    };
+    auto hold = [&](ExportStats const& result) {
+      return std::to_string(
+          duration_cast<microseconds>(result.max_lock_hold).count());
+    };
+    PrintTableString("Chunked[ms]", chunked(rb_tree, stats[0]),
+                     chunked(hash_table, stats[1]), chunked(b_tree, stats[2]));
+    PrintTableString("max hold[us]", hold(stats[0]), hold(stats[1]),
+                     hold(stats[2]));
+  }
+  for (unsigned threads : {1, 2, 4, 8}) {
+    auto sharded = [&](auto& storage) {
+      Timer timer;
+      storage.ExportShards(export_file, threads);
+      return std::to_string(
+          duration_cast<milliseconds>(timer.Finish()).count());
+    };
+    PrintTableString("Export x" + std::to_string(threads) + "[ms]",
+                     sharded(rb_tree), sharded(hash_table), sharded(b_tree));
+  }
+  {
+    // The manifest left by the last run lists 8 shards.
+    auto upload = [&](auto&& storage) {
+      Timer timer;
+      storage.Upload(export_file, 8);
+      return std::to_string(
+          duration_cast<milliseconds>(timer.Finish()).count());
+    };
+    PrintTableString("Upload x8[ms]", upload(SelfBalancingBinarySearchTree()),
+                     upload(HashTable(num)), upload(BPlusTree()));
+  }
+  std::remove(export_file.c_str());
+  for (int i = 0; i < 8; i++)
+    std::remove((export_file + "." + std::to_string(i)).c_str());
+
+  {
+    using RbTree = SelfBalancingBinarySearchTree;
+    RecoveryTimes times[3] = {
+        Recovery([] { return std::make_unique<RbTree>(); }, num),
+        Recovery([&] { return std::make_unique<HashTable>(num); }, num),
+        Recovery([] { return std::make_unique<BPlusTree>(); }, num)};
+    auto row = [&](std::string const& name, auto time) {
+      PrintTableString(
+          name, std::to_string(duration_cast<milliseconds>(time(0)).count()),
+          std::to_string(duration_cast<milliseconds>(time(1)).count()),
+          std::to_string(duration_cast<milliseconds>(time(2)).count()));
+    };
+    row("Replay log[ms]", [&](int i) { return times[i].full_log; });
+    row("Checkpoint[ms]", [&](int i) { return times[i].checkpoint; });
+    row("  read[ms]", [&](int i) { return times[i].phases.read; });
+    row("  parse[ms]", [&](int i) { return times[i].phases.parse; });
+    row("  insert[ms]", [&](int i) { return times[i].phases.insert; });
+  }
+
+  std::string snapshot_file = "research_snapshot.bin";
+  for (bool compress : {false, true}) {
+    int saved = 0;
+    auto save = [&](auto& storage) {
+      Timer timer;
+      storage.Save(snapshot_file, saved, compress);
+      return std::to_string(
+          duration_cast<milliseconds>(timer.Finish()).count());
+    };
+    PrintTableString(compress ? "Save+LZ[ms]" : "Save[ms]", save(rb_tree),
+                     save(hash_table), save(b_tree));
+
+    SelfBalancingBinarySearchTree rb_load;
+    HashTable h_load(num);
+    BPlusTree b_load;
+    PrintTableString(compress ? "Load+LZ[MB/s]" : "Load[MB/s]",
+                     std::to_string(SnapshotThroughput(rb_load, snapshot_file)),
+                     std::to_string(SnapshotThroughput(h_load, snapshot_file)),
+                     std::to_string(SnapshotThroughput(b_load, snapshot_file)));
+  }
+  std::remove(snapshot_file.c_str());
+
+  for (SaveMode mode :
+       {SaveMode::kNone, SaveMode::kForeground, SaveMode::kBackground}) {
+    std::string name = mode == SaveMode::kNone         ? "idle"
+                       : mode == SaveMode::kForeground ? "SAVE"
+                                                       : "BGSAVE";
+    SaveLatency stats[3] = {
+        WriteLatencyDuringSave(rb_tree, snapshot_file, mode),
+        WriteLatencyDuringSave(hash_table, snapshot_file, mode),
+        WriteLatencyDuringSave(b_tree, snapshot_file, mode)};
+    if (mode != SaveMode::kNone)
+      PrintTableString(name + "[ms]", std::to_string(stats[0].snapshot_ms),
+                       std::to_string(stats[1].snapshot_ms),
+                       std::to_string(stats[2].snapshot_ms));
+    PrintTableString("p99 " + name + "[us]", std::to_string(stats[0].p99_us),
+                     std::to_string(stats[1].p99_us),
+                     std::to_string(stats[2].p99_us));
+    PrintTableString("max " + name + "[us]", std::to_string(stats[0].max_us),
+                     std::to_string(stats[1].max_us),
+                     std::to_string(stats[2].max_us));
+  }
+
+  // Shared-nothing shards against one engine under its lock, with as
+  // many clients as shards.
+  for (int shards : {1, 2, 4, 8}) {
+    auto locked = [&](auto&& storage) {
+      return std::to_string(OpsPerSecond(storage, shards, num));
+    };
+    PrintTableString("locked x" + std::to_string(shards) + "[op/s]",
+                     locked(SelfBalancingBinarySearchTree()),
+                     locked(HashTable(num)), locked(BPlusTree()));
+
+    auto sharded = [&](ShardedStorage::Factory const& make) {
+      ShardedStorage storage(shards, make);
+      return std::to_string(OpsPerSecond(storage, shards, num));
+    };
+    PrintTableString(
+        std::to_string(shards) + " shards[op/s]",
+        sharded([] { return new SelfBalancingBinarySearchTree(); }),
+        sharded([&] { return new HashTable(std::max(1, num / shards)); }),
+        sharded([] { return new BPlusTree(); }));
+  }
+
   return 0;
 }
@@ -0,0 +1,848 @@
+#include "sharded_storage.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <list>
+#include <numeric>
+#include <optional>
+#include <utility>
+
+#include "timer.h"
+
+namespace s21 {
+
+namespace {
+
+uint64_t Bit(size_t shard) { return uint64_t{1} << shard; }
+
+template <class T>
+std::vector<T> Concat(std::vector<std::vector<T>>& parts) {
+  size_t size = 0;
+  for (auto const& part : parts) size += part.size();
+
+  std::vector<T> result;
+  result.reserve(size);
+  for (auto& part : parts)
+    std::move(part.begin(), part.end(), std::back_inserter(result));
+  return result;
+}
+
+}  // namespace
+
+// The port a thread uses to call one storage, and the shards it parked.
+struct ShardedStorage::Binding {
+  Ports* owner;
+  std::weak_ptr<Ports> ports;
+  size_t port;
+  uint64_t held = 0;
+};
+
+// Ports a thread has taken, given back when the thread exits. A list, so
+// that a binding stays put while the thread calls another storage from
+// inside a parked section.
+class ShardedStorage::Bindings {
+ public:
+  Bindings() = default;
+  ~Bindings() {
+    for (auto& binding : bindings_) {
+      auto ports = binding.ports.lock();
+      if (!ports) continue;
+      std::scoped_lock<std::mutex> lock(ports->mutex);
+      ports->free.push_back(binding.port);
+    }
+  }
+
+  Bindings(const Bindings&) = delete;
+  void operator=(const Bindings&) = delete;
+
+  Binding& Find(std::shared_ptr<Ports> const& ports) {
+    for (auto& binding : bindings_)
+      if (binding.owner == ports.get() && !binding.ports.expired())
+        return binding;
+
+    bindings_.remove_if(
+        [](Binding const& binding) { return binding.ports.expired(); });
+    bindings_.push_back(Binding{ports.get(), ports, Acquire(*ports)});
+    return bindings_.back();
+  }
+
+ private:
+  std::list<Binding> bindings_;
+
+  // Waits for a thread to exit when all the ports are taken.
+  static size_t Acquire(Ports& ports) {
+    while (true) {
+      {
+        std::scoped_lock<std::mutex> lock(ports.mutex);
+        if (!ports.free.empty()) {
+          size_t port = ports.free.back();
+          ports.free.pop_back();
+          return port;
+        }
+        size_t used = ports.used.load(std::memory_order_relaxed);
+        if (used < kMaxPorts) {
+          ports.ports[used] = std::make_unique<Port>(ports.shards);
+          ports.used.store(used + 1, std::memory_order_release);
+          return used;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+};
+
+// Runs f(engine) on the worker of the shard and returns what it returned,
+// or right here if this thread has the shard parked.
+template <class F>
+auto ShardedStorage::On(size_t shard, F const& f) const {
+  using R = decltype(f(*engines_[shard]));
+  Binding& binding = Bind();
+  if (binding.held & Bit(shard)) return f(*engines_[shard]);
+
+  struct Call {
+    F const* f;
+    std::optional<R> result;
+  } call{&f, std::nullopt};
+  Task task;
+  task.run = [](void* context, KeyValueStorage& engine) {
+    auto& call = *static_cast<Call*>(context);
+    call.result.emplace((*call.f)(engine));
+  };
+  task.context = &call;
+  Post(binding, shard, task);
+  ports_->ports[binding.port]->doorbell.Wait(
+      [&] { return task.done.load(std::memory_order_acquire); });
+  return std::move(*call.result);
+}
+
+// Runs f(shard, engine) for every shard in the mask, all at once.
+template <class F>
+void ShardedStorage::RunEach(F const& f, uint64_t shards) const {
+  struct Call {
+    F const* f;
+    size_t shard;
+  };
+  Binding& binding = Bind();
+  Port& port = *ports_->ports[binding.port];
+  shards &= All();
+  uint64_t posted = shards & ~binding.held;
+
+  Call calls[kMaxShards];
+  Task tasks[kMaxShards];
+  for (size_t i = 0; i < Shards(); ++i) {
+    if (!(posted & Bit(i))) continue;
+    calls[i] = Call{&f, i};
+    tasks[i].run = [](void* context, KeyValueStorage& engine) {
+      auto& call = *static_cast<Call*>(context);
+      (*call.f)(call.shard, engine);
+    };
+    tasks[i].context = &calls[i];
+    Post(binding, i, tasks[i]);
+  }
+
+  // Parked shards run here while the workers of the others are busy.
+  for (size_t i = 0; i < Shards(); ++i)
+    if (shards & binding.held & Bit(i)) f(i, *engines_[i]);
+
+  port.doorbell.Wait([&] {
+    for (size_t i = 0; i < Shards(); ++i)
+      if ((posted & Bit(i)) &&
+          !tasks[i].done.load(std::memory_order_acquire))
+        return false;
+    return true;
+  });
+}
+
+// Parks the workers of the shards, in index order, and runs f() on this
+// thread, which meanwhile calls their engines directly. Shards the thread
+// has already parked stay parked until the outer call is over.
+template <class F>
+auto ShardedStorage::Exclusive(uint64_t shards, F const& f) const {
+  struct Park {
+    Doorbell* shard;
+    Doorbell* caller;
+    std::atomic_bool parked = false;
+    std::atomic_bool released = false;
+  };
+  Binding& binding = Bind();
+  Port& port = *ports_->ports[binding.port];
+  uint64_t parking = shards & All() & ~binding.held;
+
+  Park parks[kMaxShards];
+  Task tasks[kMaxShards];
+  for (size_t i = 0; i < Shards(); ++i) {
+    if (!(parking & Bit(i))) continue;
+    parks[i].shard = doorbells_[i].get();
+    parks[i].caller = &port.doorbell;
+    tasks[i].run = [](void* context, KeyValueStorage&) {
+      auto& park = *static_cast<Park*>(context);
+      park.parked.store(true, std::memory_order_release);
+      park.caller->Ring();
+      park.shard->Wait(
+          [&] { return park.released.load(std::memory_order_acquire); });
+    };
+    tasks[i].context = &parks[i];
+    Post(binding, i, tasks[i]);
+    port.doorbell.Wait(
+        [&] { return parks[i].parked.load(std::memory_order_acquire); });
+  }
+  binding.held |= parking;
+
+  auto unpark = [&] {
+    binding.held &= ~parking;
+    for (size_t i = 0; i < Shards(); ++i) {
+      if (!(parking & Bit(i))) continue;
+      parks[i].released.store(true, std::memory_order_release);
+      doorbells_[i]->Ring();
+    }
+    port.doorbell.Wait([&] {
+      for (size_t i = 0; i < Shards(); ++i)
+        if ((parking & Bit(i)) &&
+            !tasks[i].done.load(std::memory_order_acquire))
+          return false;
+      return true;
+    });
+  };
+  struct Release {
+    decltype(unpark)& run;
+    ~Release() { run(); }
+  } release{unpark};
+
+  return f();
+}
+
+// Runs f() with the engines from `shard` on locked, e.g. so that the
+// background expiry of no shard changes anything during a fork.
+template <class F>
+void ShardedStorage::LockAll(size_t shard, F const& f) const {
+  if (shard == Shards()) return f();
+  engines_[shard]->Atomically({}, [&] { LockAll(shard + 1, f); });
+}
+
+uint64_t ShardedStorage::All() const {
+  return Shards() == kMaxShards ? ~uint64_t{0} : Bit(Shards()) - 1;
+}
+
+// The indexes of the items of every shard, in order, and the mask of the
+// shards that got any.
+template <class KeyOf>
+std::vector<std::vector<size_t>> ShardedStorage::Split(size_t count,
+                                                       KeyOf const& key_of,
+                                                       uint64_t& shards) const {
+  std::vector<std::vector<size_t>> result(Shards());
+  shards = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t shard = ShardOf(key_of(i));
+    result[shard].push_back(i);
+    shards |= Bit(shard);
+  }
+  return result;
+}
+
+ShardedStorage::ShardedStorage(unsigned shards, Factory const& make)
+    : ports_(std::make_shared<Ports>()) {
+  size_t count = std::min<size_t>(ParallelLoader::Threads(shards), kMaxShards);
+  ports_->shards = count;
+  ports_->ports.resize(kMaxPorts);
+  for (size_t i = 0; i < count; ++i) {
+    relays_.push_back(std::make_unique<Relay>(subscribers_));
+    engines_.emplace_back(make());
+    engines_.back()->Subscribe(relays_.back().get());
+    doorbells_.push_back(std::make_unique<Doorbell>());
+  }
+  for (size_t i = 0; i < count; ++i)
+    workers_.emplace_back(&ShardedStorage::Serve, this, i);
+}
+
+ShardedStorage::~ShardedStorage() {
+  stop_ = true;
+  for (auto& doorbell : doorbells_) doorbell->Ring();
+  for (auto& worker : workers_) worker.join();
+
+  // An engine takes a while to stop its expiry thread, they stop at once.
+  ParallelLoader::Run(engines_.size(), engines_.size(),
+                      [&](size_t i) { engines_[i].reset(); });
+}
+
+size_t ShardedStorage::ShardOf(const K& key) const {
+  // Mixed once more, so that the shards don't follow the buckets of a hash
+  // table engine hashing the same keys.
+  uint64_t hash = std::hash<K>{}(key) * 0x9E3779B97F4A7C15ull;
+  return (hash >> 32) % engines_.size();
+}
+
+bool ShardedStorage::Set(const K& key, const V& value, int lifetime) {
+  return On(ShardOf(key), [&](KeyValueStorage& engine) {
+    return engine.Set(key, value, lifetime);
+  });
+}
+
+bool ShardedStorage::Set(K&& key, V&& value, int lifetime) {
+  return On(ShardOf(key), [&](KeyValueStorage& engine) {
+    return engine.Set(std::move(key), std::move(value), lifetime);
+  });
+}
+
+ShardedStorage::V ShardedStorage::Get(const K& key) const {
+  return On(ShardOf(key),
+            [&](KeyValueStorage& engine) { return engine.Get(key); });
+}
+
+bool ShardedStorage::Exists(const K& key) const {
+  return On(ShardOf(key),
+            [&](KeyValueStorage& engine) { return engine.Exists(key); });
+}
+
+bool ShardedStorage::Delete(const K& key) {
+  return On(ShardOf(key),
+            [&](KeyValueStorage& engine) { return engine.Delete(key); });
+}
+
+bool ShardedStorage::Update(const K& key, const V& value) {
+  return On(ShardOf(key), [&](KeyValueStorage& engine) {
+    return engine.Update(key, value);
+  });
+}
+
+std::vector<ShardedStorage::K> ShardedStorage::Keys() const {
+  std::vector<std::vector<K>> parts(Shards());
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    parts[shard] = engine.Keys();
+  });
+  return Concat(parts);
+}
+
+// Between shards the record is moved by hand with both shards parked and
+// both engines locked, the subscribers only hear of the rename.
+bool ShardedStorage::Rename(const K& from, const K& to) {
+  size_t source = ShardOf(from), target = ShardOf(to);
+  if (source == target)
+    return On(source, [&](KeyValueStorage& engine) {
+      return engine.Rename(from, to);
+    });
+
+  return Exclusive(Bit(source) | Bit(target), [&] {
+    KeyValueStorage& from_engine = *engines_[source];
+    KeyValueStorage& to_engine = *engines_[target];
+    bool renamed = false;
+    from_engine.Atomically({}, [&] {
+      to_engine.Atomically({}, [&] {
+        if (!from_engine.Exists(from) || to_engine.Exists(to)) return;
+
+        // The TTL is only known to the second, the started one is kept.
+        int ttl = from_engine.Ttl(from);
+        V value = from_engine.Get(from);
+        relays_[source]->muted = relays_[target]->muted = true;
+        from_engine.Delete(from);
+        renamed = to_engine.Set(to, std::move(value), ttl < 0 ? -1 : ttl + 1);
+        relays_[source]->muted = relays_[target]->muted = false;
+        if (renamed) subscribers_.OnRename(from, to);
+      });
+    });
+    return renamed;
+  });
+}
+
+int ShardedStorage::Ttl(const K& key) const {
+  return On(ShardOf(key),
+            [&](KeyValueStorage& engine) { return engine.Ttl(key); });
+}
+
+std::vector<ShardedStorage::K> ShardedStorage::Find(const V& value) const {
+  std::vector<std::vector<K>> parts(Shards());
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    parts[shard] = engine.Find(value);
+  });
+  return Concat(parts);
+}
+
+size_t ShardedStorage::Count(const V& value) const {
+  std::vector<size_t> counts(Shards());
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    counts[shard] = engine.Count(value);
+  });
+  return std::accumulate(counts.begin(), counts.end(), size_t{0});
+}
+
+std::vector<ShardedStorage::V> ShardedStorage::ShowAll() const {
+  std::vector<std::vector<V>> parts(Shards());
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    parts[shard] = engine.ShowAll();
+  });
+  return Concat(parts);
+}
+
+GroupedStats ShardedStorage::Aggregate(const V& filter,
+                                       GroupBy group_by) const {
+  std::vector<GroupedStats> parts(Shards());
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    parts[shard] = engine.Aggregate(filter, group_by);
+  });
+
+  GroupedStats result;
+  for (auto const& part : parts) {
+    for (auto const& [group, stats] : part) {
+      auto [item, added] = result.try_emplace(group, stats);
+      if (added || !stats.count) continue;
+
+      Stats& total = item->second;
+      total.min = total.count ? std::min(total.min, stats.min) : stats.min;
+      total.max = total.count ? std::max(total.max, stats.max) : stats.max;
+      total.sum += stats.sum;
+      total.count += stats.count;
+    }
+  }
+  return result;
+}
+
+bool ShardedStorage::Visit(
+    const K& key, const std::function<void(const V&)>& visitor) const {
+  return On(ShardOf(key), [&](KeyValueStorage& engine) {
+    return engine.Visit(key, visitor);
+  });
+}
+
+ReadHandle ShardedStorage::Read(const K& key) const {
+  size_t shard = ShardOf(key);
+  return Exclusive(Bit(shard), [&] { return engines_[shard]->Read(key); });
+}
+
+// All the shards stand still like a single engine under its lock, so the
+// visitor may read the storage.
+void ShardedStorage::ForEach(const Visitor& visitor) const {
+  Exclusive(All(), [&] {
+    for (auto const& engine : engines_) engine->ForEach(visitor);
+  });
+}
+
+CoinsStatus ShardedStorage::IncrementBy(const K& key, long long delta,
+                                        long long& balance) {
+  return On(ShardOf(key), [&](KeyValueStorage& engine) {
+    return engine.IncrementBy(key, delta, balance);
+  });
+}
+
+// Both balances are checked with both shards parked and both engines
+// locked. Parking doesn't stop the expiry threads of the engines, the
+// locks do, so neither key can expire between the check and the two
+// increments.
+CoinsStatus ShardedStorage::Transfer(const K& from, const K& to,
+                                     long long amount) {
+  size_t source = ShardOf(from), target = ShardOf(to);
+  if (source == target)
+    return On(source, [&](KeyValueStorage& engine) {
+      return engine.Transfer(from, to, amount);
+    });
+
+  return Exclusive(Bit(source) | Bit(target), [&] {
+    KeyValueStorage& from_engine = *engines_[source];
+    KeyValueStorage& to_engine = *engines_[target];
+    CoinsStatus status = CoinsStatus::kNotFound;
+    from_engine.Atomically({}, [&] {
+      to_engine.Atomically({}, [&] {
+        if (!from_engine.Exists(from) || !to_engine.Exists(to)) return;
+        if (amount < 0) {
+          status = CoinsStatus::kOverdraft;
+          return;
+        }
+
+        long long debit = 0, credit = 0;
+        status = Coins::Add(from_engine.Get(from), -amount, debit);
+        if (status == CoinsStatus::kOk)
+          status = Coins::Add(to_engine.Get(to), amount, credit);
+        if (status != CoinsStatus::kOk) return;
+
+        from_engine.IncrementBy(from, -amount, debit);
+        status = to_engine.IncrementBy(to, amount, credit);
+      });
+    });
+    return status;
+  });
+}
+
+int ShardedStorage::MSet(const std::vector<std::pair<K, V>>& items) {
+  uint64_t shards = 0;
+  auto parts = Split(
+      items.size(), [&](size_t i) -> const K& { return items[i].first; },
+      shards);
+
+  std::vector<int> counts(Shards());
+  RunEach(
+      [&](size_t shard, KeyValueStorage& engine) {
+        std::vector<std::pair<K, V>> part;
+        part.reserve(parts[shard].size());
+        for (size_t i : parts[shard]) part.push_back(items[i]);
+        counts[shard] = engine.MSet(part);
+      },
+      shards);
+  return std::accumulate(counts.begin(), counts.end(), 0);
+}
+
+std::vector<ShardedStorage::V> ShardedStorage::MGet(
+    const std::vector<K>& keys) const {
+  uint64_t shards = 0;
+  auto parts = Split(
+      keys.size(), [&](size_t i) -> const K& { return keys[i]; }, shards);
+
+  std::vector<V> result(keys.size());
+  RunEach(
+      [&](size_t shard, KeyValueStorage& engine) {
+        std::vector<K> part;
+        part.reserve(parts[shard].size());
+        for (size_t i : parts[shard]) part.push_back(keys[i]);
+
+        std::vector<V> values = engine.MGet(part);
+        for (size_t i = 0; i < values.size(); ++i)
+          result[parts[shard][i]] = std::move(values[i]);
+      },
+      shards);
+  return result;
+}
+
+std::vector<bool> ShardedStorage::MExists(const std::vector<K>& keys) const {
+  uint64_t shards = 0;
+  auto parts = Split(
+      keys.size(), [&](size_t i) -> const K& { return keys[i]; }, shards);
+
+  // Bits of one vector<bool> can't be written from several threads.
+  std::vector<std::vector<bool>> found(Shards());
+  RunEach(
+      [&](size_t shard, KeyValueStorage& engine) {
+        std::vector<K> part;
+        part.reserve(parts[shard].size());
+        for (size_t i : parts[shard]) part.push_back(keys[i]);
+        found[shard] = engine.MExists(part);
+      },
+      shards);
+
+  std::vector<bool> result(keys.size());
+  for (size_t shard = 0; shard < Shards(); ++shard)
+    for (size_t i = 0; i < found[shard].size(); ++i)
+      result[parts[shard][i]] = found[shard][i];
+  return result;
+}
+
+int ShardedStorage::MDelete(const std::vector<K>& keys) {
+  uint64_t shards = 0;
+  auto parts = Split(
+      keys.size(), [&](size_t i) -> const K& { return keys[i]; }, shards);
+
+  std::vector<int> counts(Shards());
+  RunEach(
+      [&](size_t shard, KeyValueStorage& engine) {
+        std::vector<K> part;
+        part.reserve(parts[shard].size());
+        for (size_t i : parts[shard]) part.push_back(keys[i]);
+        counts[shard] = engine.MDelete(part);
+      },
+      shards);
+  return std::accumulate(counts.begin(), counts.end(), 0);
+}
+
+int ShardedStorage::Upload(const std::string& filename, unsigned threads) {
+  threads = ParallelLoader::Threads(threads);
+  ParallelLoader::Chunks chunks;
+  if (!ParallelLoader::Read(filename, threads, chunks)) return 0;
+
+  InsertChunks(chunks, nullptr, threads);
+  return ParallelLoader::Count(chunks);
+}
+
+// Every worker writes out its own shard in turn.
+int ShardedStorage::Export(const std::string& filename) const {
+  ExportWriter writer(filename);
+  if (writer.IsOpen() == false) return 0;
+
+  for (size_t shard = 0; shard < Shards(); ++shard) {
+    On(shard, [&](KeyValueStorage& engine) {
+      engine.ForEach([&](const K& key, const V& value) {
+        writer.Add(key, value);
+        writer.Spill();
+      });
+      return true;
+    });
+  }
+  return writer.Finish() ? writer.Count() : 0;
+}
+
+int ShardedStorage::ExportShards(const std::string& manifest,
+                                 unsigned shards) const {
+  shards = ParallelLoader::Threads(shards);
+  return ExportWriter::Shards(
+      manifest, shards, [&](size_t file, ExportWriter& writer) {
+        for (size_t shard = file; shard < Shards(); shard += shards) {
+          On(shard, [&](KeyValueStorage& engine) {
+            engine.ForEach([&](const K& key, const V& value) {
+              writer.Add(key, value);
+              writer.Spill();
+            });
+            return true;
+          });
+        }
+      });
+}
+
+// The keys of a shard are taken at once, their values a chunk at a time,
+// so the worker serves other calls in between. Keys deleted meanwhile are
+// skipped.
+ExportStats ShardedStorage::ExportInChunks(const std::string& filename,
+                                           size_t chunk) const {
+  ExportStats stats;
+  ExportWriter writer(filename);
+  if (writer.IsOpen() == false) return stats;
+  chunk = std::max<size_t>(chunk, 1);
+
+  for (size_t shard = 0; shard < Shards(); ++shard) {
+    std::vector<K> keys =
+        On(shard, [](KeyValueStorage& engine) { return engine.Keys(); });
+
+    for (size_t first = 0; first < keys.size(); first += chunk) {
+      size_t last = std::min(keys.size(), first + chunk);
+      On(shard, [&](KeyValueStorage& engine) {
+        Timer timer;
+        for (size_t i = first; i < last; ++i)
+          engine.Visit(keys[i], [&](const V& value) {
+            writer.Add(keys[i], value);
+          });
+        stats.max_lock_hold = std::max(stats.max_lock_hold, timer.Finish());
+        return true;
+      });
+      writer.Spill();
+      ++stats.chunks;
+    }
+  }
+
+  if (writer.Finish()) stats.lines = writer.Count();
+  return stats;
+}
+
+SnapshotStatus ShardedStorage::Save(const std::string& filename, int& saved,
+                                    bool compress) const {
+  Snapshot::Writer writer(filename, compress);
+  if (writer.IsOpen() == false) return SnapshotStatus::kNotOpen;
+
+  return Exclusive(All(), [&] {
+    LockAll(0, [&] {
+      for (auto const& engine : engines_)
+        engine->Dump(writer, engine->Deadlines());
+    });
+    saved = writer.Count();
+    return writer.Finish() ? SnapshotStatus::kOk : SnapshotStatus::kNotOpen;
+  });
+}
+
+SnapshotStatus ShardedStorage::Load(const std::string& filename, int& loaded,
+                                    unsigned threads, LoadTimings* timings) {
+  threads = ParallelLoader::Threads(threads);
+  ParallelLoader::Chunks chunks;
+  std::vector<Snapshot::Expiring> expiring;
+  auto status = Snapshot::Read(filename, threads, chunks, expiring, timings);
+  if (status != SnapshotStatus::kOk) return status;
+
+  Timer timer;
+  InsertChunks(chunks, &expiring, threads);
+  if (timings) timings->insert = timer.Finish();
+
+  loaded = ParallelLoader::Count(chunks) + expiring.size();
+  return SnapshotStatus::kOk;
+}
+
+// All the shards go into one snapshot, so they are forked together.
+pid_t ShardedStorage::SaveInBackground(const std::string& filename,
+                                       bool compress) const {
+  return Exclusive(All(), [&] {
+    pid_t pid = -1;
+    LockAll(0, [&] {
+      std::vector<Snapshot::Deadlines> deadlines;
+      for (auto const& engine : engines_)
+        deadlines.push_back(engine->Deadlines());
+
+      pid = Snapshot::Fork([&] {
+        Snapshot::Writer writer(filename, compress);
+        if (!writer.IsOpen()) return false;
+        for (size_t i = 0; i < engines_.size(); ++i)
+          engines_[i]->Dump(writer, deadlines[i]);
+        return writer.Finish();
+      });
+    });
+    return pid;
+  });
+}
+
+Snapshot::Deadlines ShardedStorage::Deadlines() const {
+  std::vector<Snapshot::Deadlines> parts(Shards());
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    parts[shard] = engine.Deadlines();
+  });
+
+  Snapshot::Deadlines result;
+  for (auto& part : parts) result.merge(part);
+  return result;
+}
+
+void ShardedStorage::Dump(Snapshot::Writer& writer,
+                          Snapshot::Deadlines const& deadlines) const {
+  for (auto const& engine : engines_) engine->Dump(writer, deadlines);
+}
+
+uint64_t ShardedStorage::Watch(const K& key) {
+  return On(ShardOf(key),
+            [&](KeyValueStorage& engine) { return engine.Watch(key); });
+}
+
+void ShardedStorage::Unwatch(const K& key) {
+  RunEach([&](size_t, KeyValueStorage& engine) { engine.Unwatch(key); },
+          Bit(ShardOf(key)));
+}
+
+// Every engine checks its own watched keys, the body runs inside all of
+// their Atomically calls, the last one innermost.
+bool ShardedStorage::Atomically(const WatchedKeys& watched,
+                                const std::function<void()>& body) {
+  std::vector<WatchedKeys> groups(Shards());
+  for (auto const& item : watched) groups[ShardOf(item.first)].push_back(item);
+
+  return Exclusive(All(), [&] {
+    std::function<bool(size_t)> nest = [&](size_t shard) {
+      if (shard == Shards()) {
+        body();
+        return true;
+      }
+      bool done = false;
+      bool unchanged = engines_[shard]->Atomically(
+          groups[shard], [&] { done = nest(shard + 1); });
+      return unchanged && done;
+    };
+    return nest(0);
+  });
+}
+
+void ShardedStorage::Subscribe(StorageObserver* observer) {
+  Exclusive(All(), [&] { LockAll(0, [&] { subscribers_.Add(observer); }); });
+}
+
+void ShardedStorage::Unsubscribe(StorageObserver* observer) {
+  Exclusive(All(), [&] { LockAll(0, [&] { subscribers_.Remove(observer); }); });
+}
+
+void ShardedStorage::CreateView(GroupBy group_by) {
+  RunEach(
+      [&](size_t, KeyValueStorage& engine) { engine.CreateView(group_by); });
+}
+
+GroupedTotals ShardedStorage::ReadView(GroupBy group_by) const {
+  std::vector<GroupedTotals> parts(Shards());
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    parts[shard] = engine.ReadView(group_by);
+  });
+
+  GroupedTotals result;
+  for (auto const& part : parts) {
+    for (auto const& [group, totals] : part) {
+      Totals& total = result[group];
+      total.count += totals.count;
+      total.sum += totals.sum;
+    }
+  }
+  return result;
+}
+
+void ShardedStorage::CreateIndex() {
+  RunEach([](size_t, KeyValueStorage& engine) { engine.CreateIndex(); });
+}
+
+size_t ShardedStorage::IndexMemoryUsage() const {
+  std::vector<size_t> usage(Shards());
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    usage[shard] = engine.IndexMemoryUsage();
+  });
+  return std::accumulate(usage.begin(), usage.end(), size_t{0});
+}
+
+// The worker loop: runs what the callers queued for the shard, then sleeps
+// until one of them rings.
+void ShardedStorage::Serve(size_t shard) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(shard % ParallelLoader::Threads(0), &cpus);
+  ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus);
+
+  KeyValueStorage& engine = *engines_[shard];
+  while (true) {
+    bool served = false;
+    size_t used = ports_->used.load(std::memory_order_acquire);
+    for (size_t i = 0; i < used; ++i) {
+      Task* task = nullptr;
+      while (ports_->ports[i]->queues[shard].Pop(task)) {
+        // The task is gone as soon as it is done.
+        Doorbell* caller = task->caller;
+        task->run(task->context, engine);
+        task->done.store(true, std::memory_order_release);
+        caller->Ring();
+        served = true;
+      }
+    }
+    if (served) continue;
+    if (stop_) return;
+
+    doorbells_[shard]->Wait([&] { return stop_ || Pending(shard); });
+  }
+}
+
+bool ShardedStorage::Pending(size_t shard) const {
+  size_t used = ports_->used.load(std::memory_order_acquire);
+  for (size_t i = 0; i < used; ++i)
+    if (!ports_->ports[i]->queues[shard].Empty()) return true;
+  return false;
+}
+
+ShardedStorage::Binding& ShardedStorage::Bind() const {
+  thread_local Bindings bindings;
+  return bindings.Find(ports_);
+}
+
+void ShardedStorage::Post(Binding& binding, size_t shard, Task& task) const {
+  Port& port = *ports_->ports[binding.port];
+  task.caller = &port.doorbell;
+  // A caller has at most one task in a queue, it only fills up if a
+  // thread exited with one there.
+  while (!port.queues[shard].Push(&task)) std::this_thread::yield();
+  doorbells_[shard]->Ring();
+}
+
+// The shards of the records are found on all the threads, then every
+// worker sets its own records in file order, so the first of equal keys
+// wins like in a single engine.
+void ShardedStorage::InsertChunks(ParallelLoader::Chunks& chunks,
+                                  std::vector<Snapshot::Expiring>* expiring,
+                                  unsigned threads) {
+  std::vector<std::vector<uint8_t>> owners(chunks.size());
+  ParallelLoader::Run(chunks.size(), threads, [&](size_t i) {
+    owners[i].reserve(chunks[i].size());
+    for (auto const& record : chunks[i])
+      owners[i].push_back(ShardOf(record.first));
+  });
+  std::vector<uint8_t> expiring_owners;
+  if (expiring)
+    for (auto const& item : *expiring)
+      expiring_owners.push_back(ShardOf(item.key));
+
+  RunEach([&](size_t shard, KeyValueStorage& engine) {
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      for (size_t j = 0; j < chunks[i].size(); ++j) {
+        if (owners[i][j] != shard) continue;
+        auto& [key, value] = chunks[i][j];
+        engine.Set(std::move(key), std::move(value));
+      }
+    }
+    for (size_t i = 0; i < expiring_owners.size(); ++i) {
+      if (expiring_owners[i] != shard) continue;
+      auto& [key, value, lifetime] = (*expiring)[i];
+      engine.Set(std::move(key), std::move(value), lifetime);
+    }
+  });
+}
+
+}  // namespace s21
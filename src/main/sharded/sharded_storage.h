@@ -0,0 +1,208 @@
+#ifndef A6_SRC_MAIN_SHARDED_SHARDED_STORAGE_H_
+#define A6_SRC_MAIN_SHARDED_SHARDED_STORAGE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "key_value_storage.h"
+#include "spsc_queue.h"
+
+namespace s21 {
+
+// Shared-nothing storage: every shard is an engine of its own that only
+// its worker thread, pinned to a core, touches. A key belongs to the
+// shard its hash picks. Callers don't lock anything, they hand the work
+// to the owning worker through a lock-free SPSC queue and wait for it;
+// every calling thread gets its own queue to each shard.
+//
+// Operations on many keys are split by shard and run on all the involved
+// workers at once. The few that need several shards to stand still, like
+// TRANSFER and RENAME between shards, MULTI/EXEC or a snapshot, park the
+// workers of those shards in index order, so two of them never wait on
+// each other, and then call the engines directly.
+class ShardedStorage : public KeyValueStorage {
+ public:
+  using Factory = std::function<KeyValueStorage*()>;
+
+  static constexpr size_t kMaxShards = 64;
+  // Threads that call the storage at the same time, a thread that exits
+  // gives its queues back.
+  static constexpr size_t kMaxPorts = 256;
+  static constexpr size_t kQueueSize = 16;
+
+  // Makes `shards` engines, 0 means one per core.
+  ShardedStorage(unsigned shards, Factory const& make);
+  ~ShardedStorage();
+  ShardedStorage(const ShardedStorage&) = delete;
+  ShardedStorage(ShardedStorage&&) = delete;
+  void operator=(const ShardedStorage&) = delete;
+  void operator=(ShardedStorage&&) = delete;
+
+  [[nodiscard]] size_t Shards() const { return engines_.size(); }
+  [[nodiscard]] size_t ShardOf(const K& key) const;
+
+  bool Set(const K& key, const V& value, int lifetime = -1) override;
+  bool Set(K&& key, V&& value, int lifetime = -1) override;
+  [[nodiscard]] V Get(const K& key) const override;
+  [[nodiscard]] bool Exists(const K& key) const override;
+  bool Delete(const K& key) override;
+  bool Update(const K& key, const V& value) override;
+  [[nodiscard]] std::vector<K> Keys() const override;
+  bool Rename(const K& from, const K& to) override;
+  [[nodiscard]] int Ttl(const K& key) const override;
+  [[nodiscard]] std::vector<K> Find(const V& value) const override;
+  [[nodiscard]] size_t Count(const V& value) const override;
+  [[nodiscard]] std::vector<V> ShowAll() const override;
+  [[nodiscard]] GroupedStats Aggregate(const V& filter,
+                                       GroupBy group_by) const override;
+  // The visitor runs on the worker of the key, it must not call the
+  // storage.
+  bool Visit(const K& key,
+             const std::function<void(const V&)>& visitor) const override;
+  // Parks the shard of the key and locks its engine, the worker stalls
+  // until the handle is gone, so the holder must not call the storage.
+  [[nodiscard]] ReadHandle Read(const K& key) const override;
+  // Parks every shard at once, the visitor runs on the calling thread.
+  void ForEach(const Visitor& visitor) const override;
+  CoinsStatus IncrementBy(const K& key, long long delta,
+                          long long& balance) override;
+  CoinsStatus Transfer(const K& from, const K& to, long long amount) override;
+  int MSet(const std::vector<std::pair<K, V>>& items) override;
+  [[nodiscard]] std::vector<V> MGet(const std::vector<K>& keys) const override;
+  [[nodiscard]] std::vector<bool> MExists(
+      const std::vector<K>& keys) const override;
+  int MDelete(const std::vector<K>& keys) override;
+  int Upload(const std::string& filename, unsigned threads = 0) override;
+  int Export(const std::string& filename) const override;
+  // File i gets the shards whose index is i modulo the file count.
+  int ExportShards(const std::string& manifest,
+                   unsigned shards = 0) const override;
+  ExportStats ExportInChunks(const std::string& filename,
+                             size_t chunk = 1024) const override;
+  SnapshotStatus Save(const std::string& filename, int& saved,
+                      bool compress = false) const override;
+  SnapshotStatus Load(const std::string& filename, int& loaded,
+                      unsigned threads = 0,
+                      LoadTimings* timings = nullptr) override;
+  pid_t SaveInBackground(const std::string& filename,
+                         bool compress = false) const override;
+  [[nodiscard]] Snapshot::Deadlines Deadlines() const override;
+  void Dump(Snapshot::Writer& writer,
+            Snapshot::Deadlines const& deadlines) const override;
+
+  uint64_t Watch(const K& key) override;
+  void Unwatch(const K& key) override;
+  // Parks every shard, the body runs on the calling thread.
+  bool Atomically(const WatchedKeys& watched,
+                  const std::function<void()>& body) override;
+
+  // The observer is called from the workers of all the shards at once.
+  void Subscribe(StorageObserver* observer) override;
+  void Unsubscribe(StorageObserver* observer) override;
+  void CreateView(GroupBy group_by) override;
+  [[nodiscard]] GroupedTotals ReadView(GroupBy group_by) const override;
+  void CreateIndex() override;
+  [[nodiscard]] size_t IndexMemoryUsage() const override;
+
+ private:
+  // A call waiting for a worker. It lives on the stack of the caller,
+  // which doesn't return before the worker is done with it.
+  struct Task {
+    void (*run)(void* context, KeyValueStorage& engine);
+    void* context;
+    Doorbell* caller;
+    std::atomic_bool done = false;
+  };
+
+  // The queues of one calling thread, one to each shard.
+  struct Port {
+    explicit Port(size_t shards) : queues(shards) {}
+
+    std::vector<SpscQueue<Task*, kQueueSize>> queues;
+    Doorbell doorbell;
+  };
+
+  // Shared with the threads that hold a port, so a thread that outlives
+  // the storage doesn't give its port back to freed memory.
+  struct Ports {
+    size_t shards = 0;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Port>> ports;
+    std::atomic_size_t used = 0;
+    std::vector<size_t> free;
+  };
+
+  // Stands for the subscribers in the engine of one shard, so that a
+  // record moved between two engines is reported as a rename.
+  class Relay : public StorageObserver {
+   public:
+    explicit Relay(StorageObserver& subscribers) : subscribers_(subscribers) {}
+
+    bool muted = false;
+
+    void OnInsert(const K& key, const V& value) override {
+      if (!muted) subscribers_.OnInsert(key, value);
+    }
+    void OnBeforeUpdate(const K& key, const V& value) override {
+      if (!muted) subscribers_.OnBeforeUpdate(key, value);
+    }
+    void OnAfterUpdate(const K& key, const V& value) override {
+      if (!muted) subscribers_.OnAfterUpdate(key, value);
+    }
+    void OnErase(const K& key, const V& value) override {
+      if (!muted) subscribers_.OnErase(key, value);
+    }
+    void OnExpire(const K& key, const V& value) override {
+      if (!muted) subscribers_.OnExpire(key, value);
+    }
+    void OnRename(const K& from, const K& to) override {
+      if (!muted) subscribers_.OnRename(from, to);
+    }
+    void OnExpireAt(const K& key, uint64_t deadline) override {
+      if (!muted) subscribers_.OnExpireAt(key, deadline);
+    }
+
+   private:
+    StorageObserver& subscribers_;
+  };
+
+  struct Binding;
+  class Bindings;
+
+  // Changed only with every shard parked and every engine locked.
+  StorageObservers subscribers_{};
+  std::vector<std::unique_ptr<Relay>> relays_;
+  std::vector<std::unique_ptr<KeyValueStorage>> engines_;
+  std::shared_ptr<Ports> ports_;
+  std::vector<std::unique_ptr<Doorbell>> doorbells_;
+  std::vector<std::thread> workers_;
+  std::atomic_bool stop_ = false;
+
+  void Serve(size_t shard);
+  bool Pending(size_t shard) const;
+  Binding& Bind() const;
+  void Post(Binding& binding, size_t shard, Task& task) const;
+
+  template <class F>
+  auto On(size_t shard, F const& f) const;
+  template <class F>
+  void RunEach(F const& f, uint64_t shards = ~0ull) const;
+  template <class F>
+  auto Exclusive(uint64_t shards, F const& f) const;
+  template <class F>
+  void LockAll(size_t shard, F const& f) const;
+
+  uint64_t All() const;
+  template <class KeyOf>
+  std::vector<std::vector<size_t>> Split(size_t count, KeyOf const& key_of,
+                                         uint64_t& shards) const;
+  void InsertChunks(ParallelLoader::Chunks& chunks,
+                    std::vector<Snapshot::Expiring>* expiring,
+                    unsigned threads);
+};
+
+}  // namespace s21
+
+#endif  // A6_SRC_MAIN_SHARDED_SHARDED_STORAGE_H_
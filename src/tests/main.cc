@@ -1,8 +1,29 @@
+#include <fcntl.h>
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <thread>
+
 #include "b_plus_tree.h"
+#include "change_bus.h"
+#include "command_table.h"
 #include "hash_table.h"
+#include "io_ring.h"
+#include "op_log.h"
+#include "parallel_loader.h"
+#include "record_parser.h"
+#include "replication.h"
+#include "reply.h"
+#include "resp.h"
+#include "roaring_bitmap.h"
 #include "self_balancing_binary_search_tree.h"
+#include "sharded_storage.h"
+#include "tokenizer.h"
 
 using namespace s21;
 
@@ -45,6 +66,19 @@ void TestSetIncorrect(KeyValueStorage *storage) {
   ASSERT_EQ(actual, expected);
 }
 
+void TestSetMove(KeyValueStorage *storage) {
+  KeyValueStorage::K key = data[0].first;
+  KeyValueStorage::V value = persons[0];
+
+  ASSERT_TRUE(storage->Set(std::move(key), std::move(value)));
+  ASSERT_TRUE(storage->Emplace(data[1].first, "LastName1", "FirstName1",
+                               "2002", "City1", "1"));
+  ASSERT_FALSE(storage->Emplace(data[1].first, "LastName0", "FirstName0",
+                                "2001", "City0", "0"));
+  ASSERT_EQ(storage->Get(data[0].first), persons[0]);
+  ASSERT_EQ(storage->Get(data[1].first), persons[1]);
+}
+
 void TestGetCorrect(KeyValueStorage *storage) {
   auto expected = persons[0];
   FillStorage(storage);
@@ -60,6 +94,37 @@ void TestGetIncorrect(KeyValueStorage *storage) {
   ASSERT_EQ(actual, expected);
 }
 
+void TestVisit(KeyValueStorage *storage) {
+  FillStorage(storage);
+  KeyValueStorage::V actual;
+  bool found = storage->Visit(data[3].first, [&](auto const &i) { actual = i; });
+
+  ASSERT_TRUE(found);
+  ASSERT_EQ(actual, persons[3]);
+  ASSERT_FALSE(storage->Visit("foo", [&](auto const &) { FAIL(); }));
+}
+
+void TestRead(KeyValueStorage *storage) {
+  FillStorage(storage);
+  {
+    auto handle = storage->Read(data[4].first);
+    ASSERT_TRUE(handle);
+    ASSERT_EQ(handle->city, persons[4].city);
+  }
+  ASSERT_FALSE(storage->Read("foo"));
+}
+
+void TestForEach(KeyValueStorage *storage) {
+  FillStorage(storage);
+  int count = 0;
+  storage->ForEach([&](auto const &key, auto const &value) {
+    ASSERT_EQ(storage->Get(key), value);
+    ++count;
+  });
+
+  ASSERT_EQ(count, 10);
+}
+
 void TestExistsTrue(KeyValueStorage *storage) {
   bool expected = true;
   FillStorage(storage);
@@ -108,6 +173,116 @@ void TestUpdateFalse(KeyValueStorage *storage) {
   ASSERT_EQ(actual, expected);
 }
 
+void TestBatch(KeyValueStorage *storage) {
+  std::vector<std::pair<KeyValueStorage::K, KeyValueStorage::V>> items;
+  for (int i = 0; i < 200; ++i)
+    items.emplace_back("key" + std::to_string(i * 7 % 200), persons[i % 10]);
+  items.emplace_back("key0", persons[9]);
+
+  ASSERT_EQ(storage->MSet(items), 200);
+  ASSERT_EQ(storage->Get("key0"), persons[0]);
+
+  std::vector<KeyValueStorage::K> keys = {"key150", "foo", "key7", "key150"};
+  auto values = storage->MGet(keys);
+  ASSERT_EQ(values.size(), 4);
+  ASSERT_EQ(values[0], storage->Get("key150"));
+  ASSERT_TRUE(values[1].birthday.empty());
+  ASSERT_EQ(values[2], persons[1]);
+  ASSERT_EQ(values[3], values[0]);
+
+  auto exists = storage->MExists(keys);
+  ASSERT_EQ(exists, std::vector<bool>({true, false, true, true}));
+
+  ASSERT_EQ(storage->MDelete(keys), 2);
+  ASSERT_EQ(storage->MExists(keys),
+            std::vector<bool>({false, false, false, false}));
+  ASSERT_EQ(storage->Keys().size(), 198);
+}
+
+void TestIncrementBy(KeyValueStorage *storage) {
+  FillStorage(storage);
+  long long balance = 0;
+
+  ASSERT_EQ(storage->IncrementBy("foo5", 5, balance), CoinsStatus::kOk);
+  ASSERT_EQ(balance, 15);
+  ASSERT_EQ(storage->IncrementBy("foo5", -15, balance), CoinsStatus::kOk);
+  ASSERT_EQ(storage->Get("foo5").coins, "0");
+  ASSERT_EQ(storage->IncrementBy("foo5", -1, balance),
+            CoinsStatus::kOverdraft);
+  ASSERT_EQ(storage->IncrementBy("bar", 1, balance), CoinsStatus::kNotFound);
+
+  storage->Update("foo6", {"-", "-", "-", "-", "abc"});
+  ASSERT_EQ(storage->IncrementBy("foo6", 1, balance), CoinsStatus::kNotNumber);
+}
+
+void TestTransfer(KeyValueStorage *storage) {
+  FillStorage(storage);
+
+  ASSERT_EQ(storage->Transfer("foo9", "foo1", 4), CoinsStatus::kOk);
+  ASSERT_EQ(storage->Get("foo9").coins, "10");
+  ASSERT_EQ(storage->Get("foo1").coins, "5");
+
+  ASSERT_EQ(storage->Transfer("foo1", "foo9", 6), CoinsStatus::kOverdraft);
+  ASSERT_EQ(storage->Transfer("foo1", "bar", 1), CoinsStatus::kNotFound);
+  ASSERT_EQ(storage->Get("foo1").coins, "5");
+  ASSERT_EQ(storage->Get("foo9").coins, "10");
+}
+
+void TestTransferConcurrent(KeyValueStorage *storage) {
+  FillStorage(storage);
+  auto total = [&] {
+    return storage->Aggregate({"-", "-", "-", "-", "-"}, GroupBy::kNone)
+        .begin()
+        ->second.sum;
+  };
+  long long expected = total();
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([storage, t] {
+      for (int i = 0; i < 1000; ++i)
+        storage->Transfer(data[(i + t) % 10].first, data[(i * 7) % 10].first,
+                          i % 3);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  ASSERT_EQ(total(), expected);
+}
+
+void TestWatchCommits(KeyValueStorage *storage) {
+  FillStorage(storage);
+  WatchedKeys watched = {{"foo0", storage->Watch("foo0")},
+                         {"bar", storage->Watch("bar")}};
+  storage->Set("foo1", persons[0]);
+  storage->Update("foo2", persons[0]);
+
+  bool executed = false;
+  ASSERT_TRUE(storage->Atomically(watched, [&] { executed = true; }));
+  ASSERT_TRUE(executed);
+}
+
+void TestWatchAborts(KeyValueStorage *storage) {
+  FillStorage(storage);
+  long long balance = 0;
+  std::vector<std::function<void()>> writes = {
+      [&] { storage->Update("foo0", persons[1]); },
+      [&] { storage->IncrementBy("foo0", 1, balance); },
+      [&] { storage->Rename("foo0", "bar"); },
+      [&] { storage->Set("foo0", persons[0]); },
+      [&] { storage->Delete("foo0"); }};
+
+  for (auto const &write : writes) {
+    WatchedKeys watched = {{"foo0", storage->Watch("foo0")}};
+    write();
+
+    bool executed = false;
+    ASSERT_FALSE(storage->Atomically(watched, [&] { executed = true; }));
+    ASSERT_FALSE(executed);
+    storage->Unwatch("foo0");
+  }
+}
+
 void TestKeys(KeyValueStorage *storage) {
   auto expected = 10;
   FillStorage(storage);
@@ -157,6 +332,28 @@ void TestRenameFalse(KeyValueStorage *storage) {
   TestRenameSameKeysOneDoesnotExist(storage);
 }
 
+void TestRenameRelinks(KeyValueStorage *storage) {
+  FillStorage(storage);
+  for (int i = 0; i < 10; ++i)
+    ASSERT_TRUE(storage->Rename(data[i].first, "bar" + std::to_string(i)));
+
+  ASSERT_EQ(storage->Keys().size(), 10);
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_FALSE(storage->Exists(data[i].first));
+    ASSERT_EQ(storage->Get("bar" + std::to_string(i)), persons[i]);
+  }
+}
+
+void TestRenameKeepsTtl(KeyValueStorage *storage) {
+  storage->Set("foo", persons[0], 1);
+  ASSERT_TRUE(storage->Rename("foo", "bar"));
+  ASSERT_EQ(storage->Ttl("foo"), -1);
+  ASSERT_NE(storage->Ttl("bar"), -1);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  ASSERT_FALSE(storage->Exists("bar"));
+}
+
 void TestTtlCorrect(KeyValueStorage *storage) {
   int expected = 99;
   FillStorage(storage);
@@ -199,6 +396,35 @@ void TestFind(KeyValueStorage *storage) {
   TestFindPartial(storage);
 }
 
+void TestIndexFind(KeyValueStorage *storage) {
+  storage->CreateIndex();
+  FillStorage(storage);
+
+  ASSERT_EQ(storage->Find({"-", "-", "2001|2002", "-", "-"}).size(), 4);
+  ASSERT_EQ(
+      storage->Find({"-", "-", "2001..2003", "City2|City5|City9", "-"}).size(),
+      2);
+  ASSERT_EQ(storage->Count({"-", "FirstName2", "-", "-", "10..13"}), 2);
+  ASSERT_EQ(storage->Count({"-", "-", "-", "-", "1|11"}), 2);
+  ASSERT_GT(storage->IndexMemoryUsage(), 0);
+}
+
+void TestIndexTracksWrites(KeyValueStorage *storage) {
+  FillStorage(storage);
+  storage->CreateIndex();
+  ASSERT_EQ(storage->Count({"-", "-", "2002", "-", "-"}), 2);
+
+  storage->Update(data[1].first, {"-", "-", "2005", "-", "-"});
+  ASSERT_EQ(storage->Count({"-", "-", "2002", "-", "-"}), 1);
+
+  storage->Delete(data[6].first);
+  ASSERT_EQ(storage->Count({"-", "-", "2002", "-", "-"}), 0);
+
+  storage->Rename(data[0].first, "foo");
+  auto actual = storage->Find({"-", "-", "2001", "City0", "-"});
+  ASSERT_EQ(actual, std::vector<KeyValueStorage::K>{"foo"});
+}
+
 void TestShowAll(KeyValueStorage *storage) {
   auto expected = 10;
   FillStorage(storage);
@@ -207,6 +433,76 @@ void TestShowAll(KeyValueStorage *storage) {
   ASSERT_EQ(actual, expected);
 }
 
+void TestAggregateAll(KeyValueStorage *storage) {
+  auto actual = storage->Aggregate({"-", "-", "-", "-", "-"}, GroupBy::kNone);
+
+  ASSERT_EQ(actual.size(), 1);
+  ASSERT_EQ(actual[""].count, 10);
+  ASSERT_EQ(actual[""].sum, 70);
+  ASSERT_EQ(actual[""].min, 0);
+  ASSERT_EQ(actual[""].max, 14);
+}
+
+void TestAggregateGrouped(KeyValueStorage *storage) {
+  auto actual =
+      storage->Aggregate({"-", "-", "-", "-", "-"}, GroupBy::kBirthday);
+
+  ASSERT_EQ(actual.size(), 5);
+  ASSERT_EQ(actual["2001"].count, 2);
+  ASSERT_EQ(actual["2001"].sum, 10);
+  ASSERT_EQ(actual["2001"].min, 0);
+  ASSERT_EQ(actual["2001"].max, 10);
+}
+
+void TestAggregateFiltered(KeyValueStorage *storage) {
+  auto actual =
+      storage->Aggregate({"-", "FirstName1", "-", "-", "-"}, GroupBy::kCity);
+
+  ASSERT_EQ(actual.size(), 3);
+  ASSERT_EQ(actual["City4"].sum, 4);
+  ASSERT_EQ(actual["City7"].max, 12);
+}
+
+void TestAggregate(KeyValueStorage *storage) {
+  FillStorage(storage);
+  TestAggregateAll(storage);
+  TestAggregateGrouped(storage);
+  TestAggregateFiltered(storage);
+}
+
+void TestViewTracksWrites(KeyValueStorage *storage) {
+  storage->CreateView(GroupBy::kBirthday);
+  FillStorage(storage);
+  storage->Update(data[0].first, {"-", "-", "-", "-", "100"});
+  storage->Delete(data[5].first);
+  storage->Rename(data[1].first, "foo");
+  auto actual = storage->ReadView(GroupBy::kBirthday);
+
+  ASSERT_EQ(actual.size(), 5);
+  ASSERT_EQ(actual["2001"].count, 1);
+  ASSERT_EQ(actual["2001"].sum, 100);
+  ASSERT_EQ(actual["2002"].count, 2);
+  ASSERT_EQ(actual["2002"].sum, 12);
+}
+
+void TestViewCreatedOverData(KeyValueStorage *storage) {
+  FillStorage(storage);
+  storage->CreateView(GroupBy::kCity);
+  auto actual = storage->ReadView(GroupBy::kCity);
+
+  ASSERT_EQ(actual.size(), 10);
+  ASSERT_EQ(actual["City9"].sum, 14);
+}
+
+void TestViewExpiration(KeyValueStorage *storage) {
+  storage->CreateView(GroupBy::kNone);
+  storage->Set(data[0].first, persons[4], 1);
+  ASSERT_EQ(storage->ReadView(GroupBy::kNone)[""].sum, 4);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  ASSERT_TRUE(storage->ReadView(GroupBy::kNone).empty());
+}
+
 void TestUpload(KeyValueStorage *storage) {
   int expected = 10;
   int actual = storage->Upload("storage_export.txt");
@@ -214,6 +510,149 @@ void TestUpload(KeyValueStorage *storage) {
   ASSERT_EQ(actual, expected);
 }
 
+void TestUploadParallel(KeyValueStorage *storage) {
+  std::ofstream file("storage_parallel.txt");
+  for (int i = 0; i < 3000; ++i)
+    file << "key" << i * 7 % 1000 << " "
+         << KeyValueStorage::V{"Last", "First", "2000", "City",
+                               std::to_string(i)}
+         << "\n";
+  file.close();
+
+  // Keys repeat three times, the first occurrence must win.
+  auto check = [&] {
+    ASSERT_EQ(storage->Keys().size(), 1000);
+    for (int i = 0; i < 1000; ++i)
+      ASSERT_EQ(storage->Get("key" + std::to_string(i * 7 % 1000)).coins,
+                std::to_string(i));
+  };
+
+  ASSERT_EQ(storage->Upload("storage_parallel.txt", 8), 3000);
+  check();
+
+  for (int i = 0; i < 1000; i += 2)
+    ASSERT_TRUE(storage->Delete("key" + std::to_string(i)));
+  ASSERT_EQ(storage->Upload("storage_parallel.txt", 3), 3000);
+  check();
+
+  std::remove("storage_parallel.txt");
+}
+
+void TestSnapshot(KeyValueStorage *storage) {
+  FillStorage(storage);
+  storage->Set("expiring", persons[1], 100);
+
+  for (bool compress : {false, true}) {
+    int saved = 0, loaded = 0;
+    ASSERT_EQ(storage->Save("storage_snapshot.bin", saved, compress),
+              SnapshotStatus::kOk);
+    ASSERT_EQ(saved, 11);
+
+    for (auto const &key : storage->Keys()) storage->Delete(key);
+    ASSERT_EQ(storage->Load("storage_snapshot.bin", loaded),
+              SnapshotStatus::kOk);
+    ASSERT_EQ(loaded, 11);
+    for (auto const &[key, value] : data)
+      ASSERT_EQ(storage->Get(key).city, value.city);
+    ASSERT_GT(storage->Ttl("expiring"), 90);
+    ASSERT_EQ(storage->Ttl(data[0].first), -1);
+  }
+
+  // A damaged block loads nothing.
+  std::fstream file("storage_snapshot.bin", std::ios::in | std::ios::out);
+  file.seekp(20);
+  file.put('#');
+  file.close();
+
+  int loaded = 0;
+  for (auto const &key : storage->Keys()) storage->Delete(key);
+  ASSERT_EQ(storage->Load("storage_snapshot.bin", loaded),
+            SnapshotStatus::kCorrupted);
+  ASSERT_TRUE(storage->Keys().empty());
+  ASSERT_EQ(storage->Load("storage_missing.bin", loaded),
+            SnapshotStatus::kNotOpen);
+
+  std::remove("storage_snapshot.bin");
+}
+
+void TestBackgroundSave(KeyValueStorage *storage) {
+  FillStorage(storage);
+  storage->Set("expiring", persons[1], 100);
+
+  pid_t pid = storage->SaveInBackground("storage_background.bin");
+  ASSERT_GT(pid, 0);
+
+  // The child keeps the image of the moment it was forked.
+  storage->Delete(data[0].first);
+  storage->Update(data[1].first, persons[2]);
+  storage->Set("late", persons[3]);
+  ASSERT_EQ(Snapshot::Poll(pid, true), true);
+
+  int loaded = 0;
+  for (auto const &key : storage->Keys()) storage->Delete(key);
+  ASSERT_EQ(storage->Load("storage_background.bin", loaded),
+            SnapshotStatus::kOk);
+  ASSERT_EQ(loaded, 11);
+  for (auto const &[key, value] : data)
+    ASSERT_EQ(storage->Get(key).city, value.city);
+  ASSERT_FALSE(storage->Exists("late"));
+  ASSERT_GT(storage->Ttl("expiring"), 90);
+
+  std::remove("storage_background.bin");
+}
+
+void TestOpLog(KeyValueStorage *storage) {
+  std::remove("storage_log.aof");
+  auto expected = [&] {
+    std::vector<std::pair<KeyValueStorage::K, KeyValueStorage::V>> result;
+    storage->ForEach([&](auto const &key, auto const &value) {
+      result.emplace_back(key, value);
+    });
+    std::sort(result.begin(), result.end(), [](auto &left, auto &right) {
+      return left.first < right.first;
+    });
+    return result;
+  };
+  auto replay = [&](int entries) {
+    auto before = expected();
+    for (auto const &key : storage->Keys()) storage->Delete(key);
+    ASSERT_EQ(OpLog::Replay("storage_log.aof", storage), entries);
+
+    auto after = expected();
+    ASSERT_EQ(after.size(), before.size());
+    for (size_t i = 0; i < after.size(); ++i) {
+      ASSERT_EQ(after[i].first, before[i].first);
+      ASSERT_EQ(after[i].second.first_name, before[i].second.first_name);
+      ASSERT_EQ(after[i].second.coins, before[i].second.coins);
+    }
+    ASSERT_GT(storage->Ttl("expiring"), 90);
+  };
+
+  {
+    OpLog log("storage_log.aof", FsyncPolicy::kAlways);
+    storage->Subscribe(&log);
+    FillStorage(storage);
+    storage->Set("expiring", persons[1], 100);
+    storage->Update(data[1].first, {"-", "Renamed", "-", "-", "-"});
+    storage->Rename(data[2].first, "renamed");
+    long long balance = 0;
+    storage->IncrementBy(data[3].first, 5, balance);
+    storage->Delete(data[4].first);
+    log.Commit();
+    storage->Unsubscribe(&log);
+  }
+  replay(16);
+
+  // The rewritten log holds one Set per key and the Expire of the TTL.
+  {
+    OpLog log("storage_log.aof", FsyncPolicy::kNo);
+    ASSERT_TRUE(log.Rewrite(storage));
+  }
+  replay(11);
+
+  std::remove("storage_log.aof");
+}
+
 void TestExport(KeyValueStorage *storage) {
   int expected = 10;
   FillStorage(storage);
@@ -222,6 +661,159 @@ void TestExport(KeyValueStorage *storage) {
   ASSERT_EQ(actual, expected);
 }
 
+void TestExportInChunks(KeyValueStorage *storage) {
+  FillStorage(storage);
+  storage->Set("quoted", {"O\"Brien", "Back\\slash", "2000", "New York", "5"});
+  ASSERT_EQ(storage->Export("storage_plain.txt"), 11);
+
+  ExportStats stats = storage->ExportInChunks("storage_chunks.txt", 3);
+  ASSERT_EQ(stats.lines, 11);
+  ASSERT_GE(stats.chunks, 4);
+  ASSERT_GT(stats.max_lock_hold.count(), 0);
+
+  // Same text as the plain Export, and it uploads back.
+  auto read = [](const char *filename) {
+    std::ifstream file(filename);
+    return std::string(std::istreambuf_iterator<char>(file), {});
+  };
+  ASSERT_EQ(read("storage_chunks.txt"), read("storage_plain.txt"));
+
+  // A chunk of nothing is taken as a chunk of one record.
+  stats = storage->ExportInChunks("storage_chunks.txt", 0);
+  ASSERT_EQ(stats.lines, 11);
+  ASSERT_GE(stats.chunks, 4);
+  ASSERT_EQ(read("storage_chunks.txt"), read("storage_plain.txt"));
+
+  for (auto const &key : storage->Keys()) storage->Delete(key);
+  ASSERT_EQ(storage->Upload("storage_chunks.txt"), 11);
+  ASSERT_EQ(storage->Get("quoted").last_name, "O\"Brien");
+  ASSERT_EQ(storage->Get("quoted").first_name, "Back\\slash");
+
+  std::remove("storage_plain.txt");
+  std::remove("storage_chunks.txt");
+}
+
+void TestExportShards(KeyValueStorage *storage) {
+  FillStorage(storage);
+  for (int i = 0; i < 500; ++i)
+    storage->Set("key" + std::to_string(i), {"L", "F", "2000", "C", "1"});
+  auto before = storage->Keys();
+
+  for (unsigned shards : {1u, 4u, 16u}) {
+    ASSERT_EQ(storage->ExportShards("storage_shards.txt", shards), 510);
+    for (auto const &key : storage->Keys()) storage->Delete(key);
+
+    ASSERT_EQ(storage->Upload("storage_shards.txt", 3), 510);
+    ASSERT_EQ(storage->Keys().size(), before.size());
+    for (auto const &[key, value] : data)
+      ASSERT_EQ(storage->Get(key).city, value.city);
+  }
+
+  // A missing shard loads nothing.
+  std::remove("storage_shards.txt.7");
+  for (auto const &key : storage->Keys()) storage->Delete(key);
+  ASSERT_EQ(storage->Upload("storage_shards.txt"), 0);
+  ASSERT_TRUE(storage->Keys().empty());
+
+  std::remove("storage_shards.txt");
+  for (int i = 0; i < 16; ++i)
+    std::remove(("storage_shards.txt." + std::to_string(i)).c_str());
+}
+
+void TestCheckpoint(KeyValueStorage *storage) {
+  std::remove("storage_checkpoint.aof");
+  auto snapshots = [] {
+    int result = 0;
+    for (auto const &entry : std::filesystem::directory_iterator("."))
+      result += entry.path().extension() == ".snap";
+    return result;
+  };
+
+  FillStorage(storage);
+  storage->Set("expiring", persons[1], 100);
+  {
+    OpLog log("storage_checkpoint.aof", FsyncPolicy::kAlways);
+    storage->Subscribe(&log);
+    ASSERT_TRUE(log.Checkpoint(storage));
+    ASSERT_TRUE(log.WaitRewrite());
+    ASSERT_EQ(snapshots(), 1);
+
+    // The tail after the checkpoint.
+    storage->Delete(data[0].first);
+    storage->Set("late", persons[2]);
+    log.Commit();
+    storage->Unsubscribe(&log);
+  }
+
+  for (auto const &key : storage->Keys()) storage->Delete(key);
+  LoadTimings timings;
+  ASSERT_EQ(OpLog::Replay("storage_checkpoint.aof", storage, &timings), 3);
+  ASSERT_GT(timings.read.count(), 0);
+  ASSERT_GT(timings.insert.count(), 0);
+  ASSERT_FALSE(storage->Exists(data[0].first));
+  ASSERT_TRUE(storage->Exists("late"));
+  ASSERT_EQ(storage->Get(data[1].first).city, data[1].second.city);
+  ASSERT_GT(storage->Ttl("expiring"), 90);
+
+  // Without its snapshot the log fails to replay and stays as it is.
+  std::filesystem::path snapshot;
+  for (auto const &entry : std::filesystem::directory_iterator("."))
+    if (entry.path().extension() == ".snap") snapshot = entry.path();
+  auto size = std::filesystem::file_size("storage_checkpoint.aof");
+  std::filesystem::rename(snapshot, "storage_moved.bin");
+  ASSERT_EQ(OpLog::Replay("storage_checkpoint.aof", storage), -1);
+  ASSERT_EQ(std::filesystem::file_size("storage_checkpoint.aof"), size);
+  std::filesystem::rename("storage_moved.bin", snapshot);
+
+  // A plain rewrite drops the snapshot the log no longer needs.
+  {
+    OpLog log("storage_checkpoint.aof", FsyncPolicy::kNo);
+    ASSERT_TRUE(log.Rewrite(storage));
+    ASSERT_TRUE(log.WaitRewrite());
+  }
+  ASSERT_EQ(snapshots(), 0);
+
+  std::remove("storage_checkpoint.aof");
+}
+
+void TestChanges(KeyValueStorage *storage) {
+  ChangeBus bus;
+  storage->Subscribe(&bus);
+  storage->Set("before", persons[0]);
+
+  ChangeBus::Reader reader(bus);
+  std::vector<ChangeEvent> events;
+  auto collect = [&](ChangeEvent const &event) { events.push_back(event); };
+  storage->Set(data[0].first, persons[0]);
+  storage->Update(data[0].first, persons[1]);
+  storage->Rename(data[0].first, data[1].first);
+  storage->Delete(data[1].first);
+  storage->Set(data[2].first, persons[2], 1);
+  ASSERT_EQ(reader.Read(collect), 6);
+  ASSERT_EQ(reader.Read(collect), 0);
+
+  ASSERT_EQ(events[0].type, ChangeEvent::kSet);
+  ASSERT_EQ(events[0].key, data[0].first);
+  ASSERT_EQ(events[0].value.city, persons[0].city);
+  ASSERT_EQ(events[1].type, ChangeEvent::kUpdate);
+  ASSERT_EQ(events[1].value.city, persons[1].city);
+  ASSERT_EQ(events[2].type, ChangeEvent::kRename);
+  ASSERT_EQ(events[2].to, data[1].first);
+  ASSERT_EQ(events[3].type, ChangeEvent::kDelete);
+  ASSERT_EQ(events[3].key, data[1].first);
+  ASSERT_EQ(events[4].type, ChangeEvent::kSet);
+  ASSERT_EQ(events[5].type, ChangeEvent::kExpire);
+  ASSERT_GT(events[5].deadline, 0);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  events.clear();
+  ASSERT_EQ(reader.Read(collect), 1);
+  ASSERT_EQ(events[0].type, ChangeEvent::kExpired);
+  ASSERT_EQ(events[0].key, data[2].first);
+  ASSERT_EQ(events[0].value.city, persons[2].city);
+  storage->Unsubscribe(&bus);
+}
+
 // ========= B_PLUS_TREE
 
 TEST(B_Plus_Tree, Set_Correct) {
@@ -234,6 +826,11 @@ TEST(B_Plus_Tree, Set_Incorrect) {
   TestSetIncorrect(&storage);
 }
 
+TEST(B_Plus_Tree, Set_Move) {
+  BPlusTree storage;
+  TestSetMove(&storage);
+}
+
 TEST(B_Plus_Tree, Get_Correct) {
   BPlusTree storage;
   TestGetCorrect(&storage);
@@ -244,6 +841,21 @@ TEST(B_Plus_Tree, Get_Incorrect) {
   TestGetIncorrect(&storage);
 }
 
+TEST(B_Plus_Tree, Visit) {
+  BPlusTree storage;
+  TestVisit(&storage);
+}
+
+TEST(B_Plus_Tree, Read) {
+  BPlusTree storage;
+  TestRead(&storage);
+}
+
+TEST(B_Plus_Tree, ForEach) {
+  BPlusTree storage;
+  TestForEach(&storage);
+}
+
 TEST(B_Plus_Tree, Exists_True) {
   BPlusTree storage;
   TestExistsTrue(&storage);
@@ -274,6 +886,36 @@ TEST(B_Plus_Tree, Update_False) {
   TestUpdateFalse(&storage);
 }
 
+TEST(B_Plus_Tree, Batch) {
+  BPlusTree storage;
+  TestBatch(&storage);
+}
+
+TEST(B_Plus_Tree, IncrementBy) {
+  BPlusTree storage;
+  TestIncrementBy(&storage);
+}
+
+TEST(B_Plus_Tree, Transfer) {
+  BPlusTree storage;
+  TestTransfer(&storage);
+}
+
+TEST(B_Plus_Tree, Transfer_Concurrent) {
+  BPlusTree storage;
+  TestTransferConcurrent(&storage);
+}
+
+TEST(B_Plus_Tree, Watch_Commits) {
+  BPlusTree storage;
+  TestWatchCommits(&storage);
+}
+
+TEST(B_Plus_Tree, Watch_Aborts) {
+  BPlusTree storage;
+  TestWatchAborts(&storage);
+}
+
 TEST(B_Plus_Tree, Keys) {
   BPlusTree storage;
   TestKeys(&storage);
@@ -289,6 +931,16 @@ TEST(B_Plus_Tree, Rename_False) {
   TestRenameFalse(&storage);
 }
 
+TEST(B_Plus_Tree, Rename_Relinks) {
+  BPlusTree storage;
+  TestRenameRelinks(&storage);
+}
+
+TEST(B_Plus_Tree, Rename_Keeps_TTL) {
+  BPlusTree storage;
+  TestRenameKeepsTtl(&storage);
+}
+
 TEST(B_Plus_Tree, TTL_Correct) {
   BPlusTree storage;
   TestTtlCorrect(&storage);
@@ -304,21 +956,91 @@ TEST(B_Plus_Tree, Find) {
   TestFind(&storage);
 }
 
+TEST(B_Plus_Tree, Index_Find) {
+  BPlusTree storage;
+  TestIndexFind(&storage);
+}
+
+TEST(B_Plus_Tree, Index_Writes) {
+  BPlusTree storage;
+  TestIndexTracksWrites(&storage);
+}
+
 TEST(B_Plus_Tree, ShowAll) {
   BPlusTree storage;
   TestShowAll(&storage);
 }
 
+TEST(B_Plus_Tree, Aggregate) {
+  BPlusTree storage;
+  TestAggregate(&storage);
+}
+
+TEST(B_Plus_Tree, View_Writes) {
+  BPlusTree storage;
+  TestViewTracksWrites(&storage);
+}
+
+TEST(B_Plus_Tree, View_Existing_Data) {
+  BPlusTree storage;
+  TestViewCreatedOverData(&storage);
+}
+
+TEST(B_Plus_Tree, View_Expiration) {
+  BPlusTree storage;
+  TestViewExpiration(&storage);
+}
+
 TEST(B_Plus_Tree, Export) {
   BPlusTree storage;
   TestExport(&storage);
 }
 
+TEST(B_Plus_Tree, Export_In_Chunks) {
+  BPlusTree storage;
+  TestExportInChunks(&storage);
+}
+
+TEST(B_Plus_Tree, Export_Shards) {
+  BPlusTree storage;
+  TestExportShards(&storage);
+}
+
 TEST(B_Plus_Tree, Upload) {
   BPlusTree storage;
   TestUpload(&storage);
 }
 
+TEST(B_Plus_Tree, Upload_Parallel) {
+  BPlusTree storage;
+  TestUploadParallel(&storage);
+}
+
+TEST(B_Plus_Tree, Snapshot) {
+  BPlusTree storage;
+  TestSnapshot(&storage);
+}
+
+TEST(B_Plus_Tree, Background_Save) {
+  BPlusTree storage;
+  TestBackgroundSave(&storage);
+}
+
+TEST(B_Plus_Tree, Op_Log) {
+  BPlusTree storage;
+  TestOpLog(&storage);
+}
+
+TEST(B_Plus_Tree, Checkpoint) {
+  BPlusTree storage;
+  TestCheckpoint(&storage);
+}
+
+TEST(B_Plus_Tree, Changes) {
+  BPlusTree storage;
+  TestChanges(&storage);
+}
+
 // ========= RED_BLACK_TREE
 
 TEST(Self_Balancing_Binary_Search_Tree, Set_Correct) {
@@ -331,6 +1053,11 @@ TEST(Self_Balancing_Binary_Search_Tree, Set_Incorrect) {
   TestSetIncorrect(&storage);
 }
 
+TEST(Self_Balancing_Binary_Search_Tree, Set_Move) {
+  SelfBalancingBinarySearchTree storage;
+  TestSetMove(&storage);
+}
+
 TEST(Self_Balancing_Binary_Search_Tree, Get_Correct) {
   SelfBalancingBinarySearchTree storage;
   TestGetCorrect(&storage);
@@ -341,6 +1068,21 @@ TEST(Self_Balancing_Binary_Search_Tree, Get_Incorrect) {
   TestGetIncorrect(&storage);
 }
 
+TEST(Self_Balancing_Binary_Search_Tree, Visit) {
+  SelfBalancingBinarySearchTree storage;
+  TestVisit(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Read) {
+  SelfBalancingBinarySearchTree storage;
+  TestRead(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, ForEach) {
+  SelfBalancingBinarySearchTree storage;
+  TestForEach(&storage);
+}
+
 TEST(Self_Balancing_Binary_Search_Tree, Exists_True) {
   SelfBalancingBinarySearchTree storage;
   TestExistsTrue(&storage);
@@ -371,6 +1113,36 @@ TEST(Self_Balancing_Binary_Search_Tree, Update_False) {
   TestUpdateFalse(&storage);
 }
 
+TEST(Self_Balancing_Binary_Search_Tree, Batch) {
+  SelfBalancingBinarySearchTree storage;
+  TestBatch(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, IncrementBy) {
+  SelfBalancingBinarySearchTree storage;
+  TestIncrementBy(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Transfer) {
+  SelfBalancingBinarySearchTree storage;
+  TestTransfer(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Transfer_Concurrent) {
+  SelfBalancingBinarySearchTree storage;
+  TestTransferConcurrent(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Watch_Commits) {
+  SelfBalancingBinarySearchTree storage;
+  TestWatchCommits(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Watch_Aborts) {
+  SelfBalancingBinarySearchTree storage;
+  TestWatchAborts(&storage);
+}
+
 TEST(Self_Balancing_Binary_Search_Tree, Keys) {
   SelfBalancingBinarySearchTree storage;
   TestKeys(&storage);
@@ -386,6 +1158,16 @@ TEST(Self_Balancing_Binary_Search_Tree, Rename_False) {
   TestRenameFalse(&storage);
 }
 
+TEST(Self_Balancing_Binary_Search_Tree, Rename_Relinks) {
+  SelfBalancingBinarySearchTree storage;
+  TestRenameRelinks(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Rename_Keeps_TTL) {
+  SelfBalancingBinarySearchTree storage;
+  TestRenameKeepsTtl(&storage);
+}
+
 TEST(Self_Balancing_Binary_Search_Tree, TTL_Correct) {
   SelfBalancingBinarySearchTree storage;
   TestTtlCorrect(&storage);
@@ -401,21 +1183,91 @@ TEST(Self_Balancing_Binary_Search_Tree, Find) {
   TestFind(&storage);
 }
 
+TEST(Self_Balancing_Binary_Search_Tree, Index_Find) {
+  SelfBalancingBinarySearchTree storage;
+  TestIndexFind(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Index_Writes) {
+  SelfBalancingBinarySearchTree storage;
+  TestIndexTracksWrites(&storage);
+}
+
 TEST(Self_Balancing_Binary_Search_Tree, ShowAll) {
   SelfBalancingBinarySearchTree storage;
   TestShowAll(&storage);
 }
 
+TEST(Self_Balancing_Binary_Search_Tree, Aggregate) {
+  SelfBalancingBinarySearchTree storage;
+  TestAggregate(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, View_Writes) {
+  SelfBalancingBinarySearchTree storage;
+  TestViewTracksWrites(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, View_Existing_Data) {
+  SelfBalancingBinarySearchTree storage;
+  TestViewCreatedOverData(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, View_Expiration) {
+  SelfBalancingBinarySearchTree storage;
+  TestViewExpiration(&storage);
+}
+
 TEST(Self_Balancing_Binary_Search_Tree, Export) {
   SelfBalancingBinarySearchTree storage;
   TestExport(&storage);
 }
 
+TEST(Self_Balancing_Binary_Search_Tree, Export_In_Chunks) {
+  SelfBalancingBinarySearchTree storage;
+  TestExportInChunks(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Export_Shards) {
+  SelfBalancingBinarySearchTree storage;
+  TestExportShards(&storage);
+}
+
 TEST(Self_Balancing_Binary_Search_Tree, Upload) {
   SelfBalancingBinarySearchTree storage;
   TestUpload(&storage);
 }
 
+TEST(Self_Balancing_Binary_Search_Tree, Upload_Parallel) {
+  SelfBalancingBinarySearchTree storage;
+  TestUploadParallel(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Snapshot) {
+  SelfBalancingBinarySearchTree storage;
+  TestSnapshot(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Background_Save) {
+  SelfBalancingBinarySearchTree storage;
+  TestBackgroundSave(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Op_Log) {
+  SelfBalancingBinarySearchTree storage;
+  TestOpLog(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Checkpoint) {
+  SelfBalancingBinarySearchTree storage;
+  TestCheckpoint(&storage);
+}
+
+TEST(Self_Balancing_Binary_Search_Tree, Changes) {
+  SelfBalancingBinarySearchTree storage;
+  TestChanges(&storage);
+}
+
 // ========= HASH_TABLE
 
 TEST(Hash_Table, Set_Correct) {
@@ -428,6 +1280,11 @@ TEST(Hash_Table, Set_Incorrect) {
   TestSetIncorrect(&storage);
 }
 
+TEST(Hash_Table, Set_Move) {
+  HashTable storage(10);
+  TestSetMove(&storage);
+}
+
 TEST(Hash_Table, Get_Correct) {
   HashTable storage(10);
   TestGetCorrect(&storage);
@@ -438,6 +1295,21 @@ TEST(Hash_Table, Get_Incorrect) {
   TestGetIncorrect(&storage);
 }
 
+TEST(Hash_Table, Visit) {
+  HashTable storage(10);
+  TestVisit(&storage);
+}
+
+TEST(Hash_Table, Read) {
+  HashTable storage(10);
+  TestRead(&storage);
+}
+
+TEST(Hash_Table, ForEach) {
+  HashTable storage(10);
+  TestForEach(&storage);
+}
+
 TEST(Hash_Table, Exists_True) {
   HashTable storage(10);
   TestExistsTrue(&storage);
@@ -468,6 +1340,36 @@ TEST(Hash_Table, Update_False) {
   TestUpdateFalse(&storage);
 }
 
+TEST(Hash_Table, Batch) {
+  HashTable storage(10);
+  TestBatch(&storage);
+}
+
+TEST(Hash_Table, IncrementBy) {
+  HashTable storage(10);
+  TestIncrementBy(&storage);
+}
+
+TEST(Hash_Table, Transfer) {
+  HashTable storage(10);
+  TestTransfer(&storage);
+}
+
+TEST(Hash_Table, Transfer_Concurrent) {
+  HashTable storage(10);
+  TestTransferConcurrent(&storage);
+}
+
+TEST(Hash_Table, Watch_Commits) {
+  HashTable storage(10);
+  TestWatchCommits(&storage);
+}
+
+TEST(Hash_Table, Watch_Aborts) {
+  HashTable storage(10);
+  TestWatchAborts(&storage);
+}
+
 TEST(Hash_Table, Keys) {
   HashTable storage(10);
   TestKeys(&storage);
@@ -483,6 +1385,16 @@ TEST(Hash_Table, Rename_False) {
   TestRenameFalse(&storage);
 }
 
+TEST(Hash_Table, Rename_Relinks) {
+  HashTable storage(10);
+  TestRenameRelinks(&storage);
+}
+
+TEST(Hash_Table, Rename_Keeps_TTL) {
+  HashTable storage(10);
+  TestRenameKeepsTtl(&storage);
+}
+
 TEST(Hash_Table, TTL_Correct) {
   HashTable storage(10);
   TestTtlCorrect(&storage);
@@ -498,22 +1410,751 @@ TEST(Hash_Table, Find) {
   TestFind(&storage);
 }
 
+TEST(Hash_Table, Index_Find) {
+  HashTable storage(10);
+  TestIndexFind(&storage);
+}
+
+TEST(Hash_Table, Index_Writes) {
+  HashTable storage(10);
+  TestIndexTracksWrites(&storage);
+}
+
 TEST(Hash_Table, ShowAll) {
   HashTable storage(10);
   TestShowAll(&storage);
 }
 
+TEST(Hash_Table, Aggregate) {
+  HashTable storage(10);
+  TestAggregate(&storage);
+}
+
+TEST(Hash_Table, View_Writes) {
+  HashTable storage(10);
+  TestViewTracksWrites(&storage);
+}
+
+TEST(Hash_Table, View_Existing_Data) {
+  HashTable storage(10);
+  TestViewCreatedOverData(&storage);
+}
+
+TEST(Hash_Table, View_Expiration) {
+  HashTable storage(10);
+  TestViewExpiration(&storage);
+}
+
 TEST(Hash_Table, Export) {
   HashTable storage(10);
   TestExport(&storage);
 }
 
+TEST(Hash_Table, Export_In_Chunks) {
+  HashTable storage(10);
+  TestExportInChunks(&storage);
+}
+
+TEST(Hash_Table, Export_Shards) {
+  HashTable storage(64);
+  TestExportShards(&storage);
+}
+
 TEST(Hash_Table, Upload) {
   HashTable storage(10);
   TestUpload(&storage);
 }
 
+TEST(Hash_Table, Upload_Parallel) {
+  HashTable storage(64);
+  TestUploadParallel(&storage);
+}
+
+TEST(Hash_Table, Snapshot) {
+  HashTable storage(10);
+  TestSnapshot(&storage);
+}
+
+TEST(Hash_Table, Background_Save) {
+  HashTable storage(10);
+  TestBackgroundSave(&storage);
+}
+
+TEST(Hash_Table, Op_Log) {
+  HashTable storage(10);
+  TestOpLog(&storage);
+}
+
+TEST(Hash_Table, Checkpoint) {
+  HashTable storage(10);
+  TestCheckpoint(&storage);
+}
+
+TEST(Hash_Table, Changes) {
+  HashTable storage(10);
+  TestChanges(&storage);
+}
+
+// ========= SHARDED_STORAGE
+
+TEST(Sharded_Storage, Spreads_Keys) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  ASSERT_EQ(storage.Shards(), 4);
+
+  std::vector<int> keys(storage.Shards());
+  for (int i = 0; i < 1000; ++i) ++keys[storage.ShardOf(std::to_string(i))];
+  for (int count : keys) ASSERT_GT(count, 150);
+}
+
+TEST(Sharded_Storage, Across_Shards) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  std::string from = "a", to = "b";
+  while (storage.ShardOf(to) == storage.ShardOf(from)) to += "b";
+  storage.Set(from, persons[9], 100);
+  storage.Set(to, persons[1]);
+
+  ASSERT_EQ(storage.Transfer(from, to, 10), CoinsStatus::kOk);
+  ASSERT_EQ(storage.Transfer(from, to, 1 << 30), CoinsStatus::kOverdraft);
+  ASSERT_FALSE(storage.Rename(from, to));
+  ASSERT_TRUE(storage.Delete(to));
+  ASSERT_TRUE(storage.Rename(from, to));
+  ASSERT_FALSE(storage.Exists(from));
+  ASSERT_GT(storage.Ttl(to), 90);
+  ASSERT_EQ(storage.Get(to).coins, "4");
+}
+
+TEST(Sharded_Storage, Transfer_While_Expiring) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  std::string from = "a", to = "b";
+  while (storage.ShardOf(to) == storage.ShardOf(from)) to += "b";
+  storage.Set(from, {"A", "B", "2000", "C", "1000000"});
+  storage.Set(to, persons[0], 1);
+
+  // Either both increments happen or none, whenever the TTL runs out.
+  long long moved = 0;
+  while (storage.Exists(to) || moved == 0) {
+    CoinsStatus status = storage.Transfer(from, to, 1);
+    if (status == CoinsStatus::kOk) {
+      ++moved;
+    } else {
+      ASSERT_EQ(status, CoinsStatus::kNotFound);
+      break;
+    }
+  }
+  ASSERT_GT(moved, 0);
+  ASSERT_FALSE(storage.Exists(to));
+  ASSERT_EQ(storage.Get(from).coins, std::to_string(1000000 - moved));
+}
+
+TEST(Sharded_Storage, Set_Correct) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestSetCorrect(&storage);
+}
+
+TEST(Sharded_Storage, Set_Incorrect) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestSetIncorrect(&storage);
+}
+
+TEST(Sharded_Storage, Set_Move) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestSetMove(&storage);
+}
+
+TEST(Sharded_Storage, Get_Correct) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestGetCorrect(&storage);
+}
+
+TEST(Sharded_Storage, Get_Incorrect) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestGetIncorrect(&storage);
+}
+
+TEST(Sharded_Storage, Visit) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestVisit(&storage);
+}
+
+TEST(Sharded_Storage, Read) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestRead(&storage);
+}
+
+TEST(Sharded_Storage, ForEach) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestForEach(&storage);
+}
+
+TEST(Sharded_Storage, Exists_True) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestExistsTrue(&storage);
+}
+
+TEST(Sharded_Storage, Exists_False) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestExistsFalse(&storage);
+}
+
+TEST(Sharded_Storage, Delete_True) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestDeleteCorrect(&storage);
+}
+
+TEST(Sharded_Storage, Delete_False) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestDeleteIncorrect(&storage);
+}
+
+TEST(Sharded_Storage, Update_True) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestUpdateTrue(&storage);
+}
+
+TEST(Sharded_Storage, Update_False) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestUpdateFalse(&storage);
+}
+
+TEST(Sharded_Storage, Batch) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestBatch(&storage);
+}
+
+TEST(Sharded_Storage, IncrementBy) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestIncrementBy(&storage);
+}
+
+TEST(Sharded_Storage, Transfer) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestTransfer(&storage);
+}
+
+TEST(Sharded_Storage, Transfer_Concurrent) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestTransferConcurrent(&storage);
+}
+
+TEST(Sharded_Storage, Watch_Commits) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestWatchCommits(&storage);
+}
+
+TEST(Sharded_Storage, Watch_Aborts) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestWatchAborts(&storage);
+}
+
+TEST(Sharded_Storage, Keys) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestKeys(&storage);
+}
+
+TEST(Sharded_Storage, Rename_True) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestRenameTrue(&storage);
+}
+
+TEST(Sharded_Storage, Rename_False) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestRenameFalse(&storage);
+}
+
+TEST(Sharded_Storage, Rename_Relinks) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestRenameRelinks(&storage);
+}
+
+TEST(Sharded_Storage, Rename_Keeps_TTL) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestRenameKeepsTtl(&storage);
+}
+
+TEST(Sharded_Storage, TTL_Correct) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestTtlCorrect(&storage);
+}
+
+TEST(Sharded_Storage, TTL_Incorrect) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestTtlIncorrect(&storage);
+}
+
+TEST(Sharded_Storage, Find) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestFind(&storage);
+}
+
+TEST(Sharded_Storage, Index_Find) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestIndexFind(&storage);
+}
+
+TEST(Sharded_Storage, Index_Writes) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestIndexTracksWrites(&storage);
+}
+
+TEST(Sharded_Storage, ShowAll) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestShowAll(&storage);
+}
+
+TEST(Sharded_Storage, Aggregate) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestAggregate(&storage);
+}
+
+TEST(Sharded_Storage, View_Writes) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestViewTracksWrites(&storage);
+}
+
+TEST(Sharded_Storage, View_Existing_Data) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestViewCreatedOverData(&storage);
+}
+
+TEST(Sharded_Storage, View_Expiration) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestViewExpiration(&storage);
+}
+
+TEST(Sharded_Storage, Export) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestExport(&storage);
+}
+
+TEST(Sharded_Storage, Export_In_Chunks) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestExportInChunks(&storage);
+}
+
+TEST(Sharded_Storage, Export_Shards) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestExportShards(&storage);
+}
+
+TEST(Sharded_Storage, Upload) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestUpload(&storage);
+}
+
+TEST(Sharded_Storage, Upload_Parallel) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestUploadParallel(&storage);
+}
+
+TEST(Sharded_Storage, Snapshot) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestSnapshot(&storage);
+}
+
+TEST(Sharded_Storage, Background_Save) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestBackgroundSave(&storage);
+}
+
+TEST(Sharded_Storage, Op_Log) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestOpLog(&storage);
+}
+
+TEST(Sharded_Storage, Op_Log_Interleaved) {
+  std::remove("storage_log.aof");
+  {
+    // Another shard appends between the Set of a key and its Expire.
+    OpLog log("storage_log.aof", FsyncPolicy::kAlways);
+    auto now = duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch());
+    log.OnInsert("expiring", persons[0]);
+    log.OnInsert("other", persons[1]);
+    log.OnExpireAt("expiring", now.count() + 100000);
+    log.OnInsert("expired", persons[2]);
+    log.OnInsert("another", persons[3]);
+    log.OnExpireAt("expired", now.count() - 1000);
+    log.Commit();
+  }
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  ASSERT_EQ(OpLog::Replay("storage_log.aof", &storage), 6);
+  ASSERT_GT(storage.Ttl("expiring"), 90);
+  ASSERT_EQ(storage.Get("expiring").city, persons[0].city);
+  ASSERT_EQ(storage.Ttl("other"), -1);
+  ASSERT_FALSE(storage.Exists("expired"));
+  ASSERT_TRUE(storage.Exists("another"));
+  std::remove("storage_log.aof");
+}
+
+TEST(Sharded_Storage, Checkpoint) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestCheckpoint(&storage);
+}
+
+TEST(Sharded_Storage, Changes) {
+  ShardedStorage storage(4, [] { return new HashTable(16); });
+  TestChanges(&storage);
+}
+
+// ========= CHANGE_BUS
+
+TEST(Change_Bus, Drops_Slow_Reader) {
+  ChangeBus bus(64);
+  ChangeBus::Reader slow(bus);
+  ChangeBus::Reader fast(bus);
+  std::vector<ChangeEvent> events;
+  auto collect = [&](ChangeEvent const &event) { events.push_back(event); };
+  for (int i = 0; i < 100; ++i) {
+    bus.OnInsert("key" + std::to_string(i), persons[0]);
+    ASSERT_EQ(fast.Read(collect), 1);
+  }
+  ASSERT_EQ(events.back().key, "key99");
+
+  // The writers never waited, the slow reader learns what it missed.
+  events.clear();
+  ASSERT_EQ(slow.Read(collect), 1);
+  ASSERT_EQ(events[0].type, ChangeEvent::kLost);
+  bus.OnErase("key0", persons[0]);
+  ASSERT_EQ(slow.Read(collect), 1);
+  ASSERT_EQ(events[1].type, ChangeEvent::kDelete);
+}
+
+TEST(Change_Bus, Concurrent_Writers) {
+  ChangeBus bus(1 << 12);
+  ChangeBus::Reader reader(bus);
+  std::vector<std::thread> writers;
+  for (int w = 0; w < 4; ++w)
+    writers.emplace_back([&bus, w] {
+      for (int i = 0; i < 100; ++i)
+        bus.OnInsert(std::to_string(w) + "." + std::to_string(i), persons[w]);
+    });
+  for (auto &writer : writers) writer.join();
+
+  std::map<std::string, int> last;
+  size_t count = reader.Read([&](ChangeEvent const &event) {
+    ASSERT_EQ(event.type, ChangeEvent::kSet);
+    std::string writer = event.key.substr(0, event.key.find('.'));
+    int i = std::stoi(event.key.substr(event.key.find('.') + 1));
+    ASSERT_EQ(event.value.city, persons[std::stoi(writer)].city);
+    if (last.count(writer)) {
+      ASSERT_EQ(i, last[writer] + 1);
+    }
+    last[writer] = i;
+  });
+  ASSERT_EQ(count, 400);
+}
+
+// ========= ROARING_BITMAP
+
+TEST(Roaring_Bitmap, Containers) {
+  RoaringBitmap even, odd, all;
+  for (uint32_t i = 0; i < 20000; i += 2) even.Add(i);
+  for (uint32_t i = 1; i < 20000; i += 2) odd.Add(i);
+  for (uint32_t i = 0; i < 3; ++i) all.Add(i << 16);
+
+  all |= even;
+  all |= odd;
+  ASSERT_EQ(all.Cardinality(), 20002);
+  ASSERT_TRUE(all.Contains(2 << 16));
+
+  all &= even;
+  ASSERT_EQ(all.Cardinality(), 10000);
+  ASSERT_FALSE(all.Contains(1));
+
+  for (uint32_t i = 0; i < 20000; i += 4) all.Remove(i);
+  ASSERT_EQ(all.Cardinality(), 5000);
+  ASSERT_TRUE(all.Contains(2));
+  ASSERT_FALSE(all.Contains(4));
+}
+
+// ========= RECORD_PARSER
+
+TEST(Record_Parser, Matches_Stream) {
+  std::string text =
+      "foo \"Last Name\" \"First\" 1999 \"New York\" 21\n"
+      "  bar Bare \"Esc \\\"a\\\\b\\\"\" 2000\t\"Rome\" 5\r\n"
+      "baz \"Truncated\" \"Record\" 2001";
+
+  std::stringstream stream(text);
+  std::vector<std::pair<KeyValueStorage::K, KeyValueStorage::V>> expected;
+  KeyValueStorage::K key;
+  KeyValueStorage::V value;
+  while (stream >> key >> value) expected.emplace_back(key, value);
+
+  std::vector<std::pair<KeyValueStorage::K, KeyValueStorage::V>> actual;
+  int count = RecordParser::ParseAll(text, [&](auto &&key, auto &&value) {
+    actual.emplace_back(key, value);
+  });
+
+  ASSERT_EQ(count, 2);
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < actual.size(); ++i) {
+    ASSERT_EQ(actual[i].first, expected[i].first);
+    ASSERT_EQ(actual[i].second.last_name, expected[i].second.last_name);
+    ASSERT_EQ(actual[i].second.first_name, expected[i].second.first_name);
+    ASSERT_EQ(actual[i].second.city, expected[i].second.city);
+    ASSERT_EQ(actual[i].second.coins, expected[i].second.coins);
+  }
+  ASSERT_EQ(actual[1].second.first_name, "Esc \"a\\b\"");
+}
+
+TEST(Record_Parser, Parallel_Matches_Serial) {
+  std::string text;
+  for (int i = 0; i < 100; ++i)
+    text += "key" + std::to_string(i) + " \"Last\" \"First\" 2000 \"City\" " +
+            std::to_string(i) + "\n";
+
+  auto chunks = ParallelLoader::Parse(text, 4);
+  ASSERT_EQ(chunks.size(), 4);
+  ASSERT_EQ(ParallelLoader::Count(chunks), 100);
+  ASSERT_EQ(chunks[3].back().first, "key99");
+
+  // A quoted field spanning lines may be cut, the text is parsed again.
+  text.insert(text.find('\n', text.size() / 2) + 1,
+              "multi \"" + std::string(80, 'x') +
+                  "\nName\" \"First\" 2000 \"City\" 1\n");
+  int expected = RecordParser::ParseAll(text, [](auto &&, auto &&) {});
+  chunks = ParallelLoader::Parse(text, 4);
+  ASSERT_EQ(chunks.size(), 1);
+  ASSERT_EQ(ParallelLoader::Count(chunks), expected);
+  ASSERT_EQ(expected, 101);
+}
+
+// ========= SNAPSHOT
+
+TEST(Snapshot, Compress_Round_Trip) {
+  std::string text;
+  for (int i = 0; i < 1000; ++i)
+    text += "key" + std::to_string(i % 37) + " aaaaaaaaaaaaaaaa City ";
+  text += "tail";
+
+  std::string compressed = Snapshot::Compress(text), actual;
+  ASSERT_LT(compressed.size(), text.size() / 4);
+  ASSERT_TRUE(Snapshot::Decompress(compressed, text.size(), actual));
+  ASSERT_EQ(actual, text);
+  ASSERT_FALSE(Snapshot::Decompress(compressed, text.size() + 1, actual));
+  ASSERT_EQ(Snapshot::Crc32("123456789"), 0xCBF43926u);
+}
+
+// ========= IO_RING
+
+TEST(Io_Ring, File_Output) {
+  std::string expected;
+  for (IoBackend backend : {IoBackend::kPosix, IoBackend::kUring}) {
+    int fd = ::open("storage_output.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    {
+      FileOutput output(fd, backend);
+      expected.clear();
+      for (size_t i = 0; i < 3 * FileOutput::kDepth; ++i) {
+        std::string chunk(1 << (i + 4), 'a' + i);
+        expected += chunk;
+        output.Write(std::move(chunk));
+        if (i % 5 == 0) {
+          ASSERT_TRUE(output.Flush(i % 2 == 0));
+        }
+      }
+      ASSERT_TRUE(output.Flush(true));
+    }
+    ::close(fd);
+
+    std::ifstream file("storage_output.bin", std::ios::binary);
+    std::string actual((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+    ASSERT_EQ(actual, expected);
+  }
+  std::remove("storage_output.bin");
+}
+
+TEST(Io_Ring, Snapshot_And_Op_Log) {
+  ChosenIoBackend() = IoBackend::kUring;
+  {
+    HashTable storage(10);
+    TestSnapshot(&storage);
+  }
+  {
+    HashTable storage(10);
+    TestOpLog(&storage);
+  }
+  ChosenIoBackend() = IoBackend::kPosix;
+}
+
+// ========= REPLICATION
+
+TEST(Replication, Follows_Leader) {
+  HashTable leader(16);
+  BPlusTree follower;
+  ReplicationFeed feed;
+  leader.Subscribe(&feed);
+  FillStorage(&leader);
+  leader.Set("expiring", persons[1], 100);
+
+  Server server(
+      [&](int client, const std::vector<Server::Command> &commands,
+          std::string &output) {
+        for (auto const &command : commands) {
+          if (command[0] == "SYNC")
+            feed.Attach(client, command, &leader, output);
+          else if (command[0] == "ACK")
+            feed.Acknowledge(client, command);
+        }
+        return true;
+      },
+      [&](int client) { feed.Detach(client); }, [&] { feed.Ship(server); });
+  ASSERT_TRUE(server.ListenTcp(17431));
+  std::thread loop([&] { server.Run(); });
+
+  auto wait_for = [](auto const &done) {
+    for (int i = 0; i < 500 && !done(); ++i)
+      std::this_thread::sleep_for(10ms);
+    return done();
+  };
+  Replica::Status status;
+  {
+    // The existing keys come with a full sync, the later changes with
+    // the stream.
+    Replica replica(17431, &follower);
+    ASSERT_TRUE(wait_for([&] { return replica.Report().full_syncs == 1; }));
+    ASSERT_EQ(follower.Keys().size(), 11);
+    ASSERT_GT(follower.Ttl("expiring"), 90);
+    uint64_t entries = replica.Report().entries;
+
+    long long balance = 0;
+    leader.Update(data[1].first, {"-", "Renamed", "-", "-", "-"});
+    leader.Rename(data[2].first, "renamed");
+    leader.IncrementBy(data[3].first, 5, balance);
+    leader.Delete(data[4].first);
+    ASSERT_TRUE(
+        wait_for([&] { return replica.Report().entries == entries + 4; }));
+    ASSERT_EQ(follower.Get(data[1].first).first_name, "Renamed");
+    ASSERT_TRUE(follower.Exists("renamed"));
+    ASSERT_FALSE(follower.Exists(data[2].first));
+    ASSERT_EQ(follower.Get(data[3].first).coins, "8");
+    ASSERT_FALSE(follower.Exists(data[4].first));
+
+    status = replica.Report();
+    ASSERT_TRUE(status.linked);
+    ASSERT_EQ(status.full_syncs, 1);
+  }
+  server.Stop();
+  loop.join();
+
+  // A follower that comes back at a round it has seen gets the rest of
+  // the stream from the backlog.
+  leader.Delete(data[5].first);
+  std::string output;
+  ASSERT_TRUE(feed.Attach(
+      100, {"SYNC", feed.Id(), std::to_string(status.offset)}, &leader,
+      output));
+  ASSERT_EQ(output.rfind("+CONTINUE\r\n", 0), 0u);
+  ASSERT_GT(output.size(), 11u);
+  leader.Unsubscribe(&feed);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }
+
+// ========= RESP
+
+TEST(Resp, Parse_Pipelined_Commands) {
+  std::string text;
+  Resp::Command(text, {"SET", "a b", "", "x"});
+  text += "GET  key\r\n*2\r\n$3\r\nDEL\r\n$1\r\n";
+  std::string_view input = text;
+  std::vector<std::string> command;
+
+  ASSERT_EQ(Resp::Parse(input, command), Resp::Status::kOk);
+  ASSERT_EQ(command, std::vector<std::string>({"SET", "a b", "", "x"}));
+  ASSERT_EQ(Resp::Parse(input, command), Resp::Status::kOk);
+  ASSERT_EQ(command, std::vector<std::string>({"GET", "key"}));
+
+  // Nothing is taken until the whole command is there.
+  size_t rest = input.size();
+  ASSERT_EQ(Resp::Parse(input, command), Resp::Status::kIncomplete);
+  ASSERT_EQ(input.size(), rest);
+  text += "k\r\n";
+  input = std::string_view(text).substr(text.size() - rest - 3);
+  ASSERT_EQ(Resp::Parse(input, command), Resp::Status::kOk);
+  ASSERT_EQ(command, std::vector<std::string>({"DEL", "k"}));
+  ASSERT_TRUE(input.empty());
+
+  for (std::string bad : {"*1\r\n:1\r\n", "*1\r\n$2\r\nabc\r\n",
+                          "*-5\r\n", "*1x\r\n"}) {
+    input = bad;
+    ASSERT_EQ(Resp::Parse(input, command), Resp::Status::kError);
+  }
+}
+
+TEST(Resp, Encode_Replies) {
+  RespReply reply;
+  std::string output;
+  reply.WriteLine("> OK");
+  reply.Encode(output);
+  reply.WriteLine("> 42");
+  reply.Encode(output);
+  reply.WriteLine("> (null)");
+  reply.Encode(output);
+  reply.Error("key exists");
+  reply.Encode(output);
+  reply.Write("1) foo\n2) bar\n");
+  reply.Error("invalid input");
+  reply.Encode(output);
+  ASSERT_EQ(output,
+            "+OK\r\n+42\r\n$-1\r\n-ERR key exists\r\n"
+            "*3\r\n$6\r\n1) foo\r\n$6\r\n2) bar\r\n-ERR invalid input\r\n");
+
+  // A list is an array whatever its size, and no output is not a success.
+  output.clear();
+  reply.List(0);
+  reply.Encode(output);
+  reply.List(1);
+  reply.WriteLine("1) foo");
+  reply.Encode(output);
+  reply.Encode(output);
+  ASSERT_EQ(output, "*0\r\n*1\r\n$6\r\n1) foo\r\n*0\r\n");
+
+  output = "+OK\r\n+42\r\n$-1\r\n-ERR key exists\r\n*0\r\n"
+           "*3\r\n$6\r\n1) foo\r\n$6\r\n2) bar\r\n-ERR invalid input\r\n";
+  std::string_view input = output;
+  bool error = false;
+  int replies = 0;
+  while (Resp::Skip(input, error) == Resp::Status::kOk) ++replies;
+  ASSERT_EQ(replies, 6);
+  ASSERT_TRUE(input.empty());
+}
+
+// ========= COMMANDS
+
+TEST(Commands, Tokenizer) {
+  std::istringstream input("SET  key x\nGET key \n\nDEL k");
+  Tokenizer tokenizer;
+  std::vector<std::string> tokens;
+  ASSERT_TRUE(tokenizer.Read(input));
+  tokenizer.CopyTo(tokens);
+  ASSERT_EQ(tokens, std::vector<std::string>({"SET", "", "key", "x"}));
+  ASSERT_TRUE(tokenizer.Read(input));
+  tokenizer.CopyTo(tokens);
+  ASSERT_EQ(tokens, std::vector<std::string>({"GET", "key"}));
+  ASSERT_TRUE(tokenizer.Read(input));
+  ASSERT_TRUE(tokenizer.Tokens().empty());
+  ASSERT_TRUE(tokenizer.Read(input));
+  ASSERT_EQ(tokenizer.Tokens().size(), 2);
+  ASSERT_EQ(tokenizer.Tokens()[1], "k");
+  ASSERT_FALSE(tokenizer.Read(input));
+}
+
+TEST(Commands, Table) {
+  ASSERT_EQ(CommandTable::Find("SET"), CommandId::kSet);
+  ASSERT_EQ(CommandTable::Find("set"), CommandId::kSet);
+  ASSERT_EQ(CommandTable::Find("q"), CommandId::kQuit);
+  ASSERT_EQ(CommandTable::Find("Quit"), CommandId::kQuit);
+  ASSERT_EQ(CommandTable::Find("BgRewriteAof"), CommandId::kRewriteLog);
+  ASSERT_EQ(CommandTable::Find("unsubscribe"), CommandId::kUnsubscribe);
+  for (std::string_view name : {"", "SE", "SETS", "GOT", "S\xd0\xb5T", "QQ"})
+    ASSERT_EQ(CommandTable::Find(name), CommandId::kUnknown);
+
+  ASSERT_TRUE(CommandTable::IsWrite(CommandTable::Find("incrby")));
+  ASSERT_FALSE(CommandTable::IsWrite(CommandTable::Find("GET")));
+}